@@ -1,7 +1,12 @@
 #include "advancing_front.h"
 #include <array>
+#include <cmath>
+#include "counting_volume.h"
+#include "tiled_volume.h"
 #include "volume_util.h"
 #include "core/debug/assertion.h"
+#include "core/util/timer.h"
+#include "core/util/worker_pool.h"
 
 
 namespace playchilla {
@@ -10,6 +15,12 @@ static const auto TestDirs = std::array{
 	vec3(-1, 0, 0), vec3(0, -1, 0), vec3(0, 0, -1)
 };
 
+// Surfaces closer than this many edges share a seed, smaller cells find thinner parts but cost more intervals
+static constexpr double SeedCellEdges = 4;
+
+// The node cells are this many edges wide, by the edge length where the nodes are created
+static constexpr double NodeCellEdges = 15;
+
 inline vec3 get_perpendicular(const vec3& dir) {
 	for (const vec3& test : TestDirs) {
 		vec3 p = dir.cross(test);
@@ -35,20 +46,70 @@ inline size_t count_edges_to(const edge* e, const node* n) {
 
 advancing_front::advancing_front(const volume* volume, mesh_builder* mesh_builder, double edge_len, double creation_radius, double error_margin_scale):
 	_volume(volume),
+	_source_volume(volume),
 	_default_edge_length(edge_len),
 	_current_edge_length(edge_len),
 	_creation_radius(creation_radius),
 	_error_margin_scale(error_margin_scale),
-	_surface_memory(15. * edge_len, mesh_builder),
+	_surface_memory(NodeCellEdges * edge_len, mesh_builder),
 	_data(edge_len) {
 	assertion(edge_len > 0, "The edge length should be greater than zero.");
 }
 
+advancing_front::~advancing_front() = default;
+
 advancing_front& advancing_front::ignore_resolution() {
 	_use_resolution = false;
 	return *this;
 }
 
+advancing_front& advancing_front::prioritize_near() {
+	_surface_memory.prioritize_near(_default_edge_length);
+	return *this;
+}
+
+advancing_front& advancing_front::use_gradients() {
+	_normal_method = normal_method::gradient;
+	return *this;
+}
+
+advancing_front& advancing_front::use_surface_projection() {
+	_use_projection = true;
+	return *this;
+}
+
+advancing_front& advancing_front::use_tiles(double tile_size) {
+	// under the counting so that the evaluations of the pruned volumes are counted
+	_clear_approximations();
+	_tiled_volume = std::make_unique<tiled_volume>(_source_volume, tile_size);
+	_volume = _tiled_volume.get();
+	if (_counting_volume) {
+		_counting_volume = std::make_unique<counting_volume>(_volume);
+		_volume = _counting_volume.get();
+	}
+	return *this;
+}
+
+advancing_front& advancing_front::count_evaluations() {
+	if (!_counting_volume) {
+		_clear_approximations();
+		_counting_volume = std::make_unique<counting_volume>(_volume);
+		_volume = _counting_volume.get();
+	}
+	return *this;
+}
+
+advancing_front& advancing_front::use_value_tolerance(double edge_fraction) {
+	_clear_approximations();
+	_value_tolerance = edge_fraction;
+	return *this;
+}
+
+advancing_front& advancing_front::use_workers(size_t worker_count) {
+	_workers = worker_count > 1 ? std::make_unique<worker_pool>(worker_count) : nullptr;
+	return *this;
+}
+
 bool advancing_front::need_seed() const {
 	return _surface_memory.get_front().empty() && _surface_memory.get_node_count() == 0;
 }
@@ -64,6 +125,16 @@ bool advancing_front::try_find_surface(const vec3& search_pos) {
 	return false;
 }
 
+int advancing_front::seed_surfaces(const vec3& generate_pos) {
+	int seeded = 0;
+	for (const vec3& pos : find_surface_components(_volume, aabb(generate_pos, _creation_radius), SeedCellEdges * _default_edge_length)) {
+		if (pos.distance_sqr(generate_pos) <= _creation_radius * _creation_radius && _create_start_edge(pos)) {
+			++seeded;
+		}
+	}
+	return seeded;
+}
+
 double advancing_front::get_edge_length() const {
 	return _default_edge_length;
 }
@@ -73,7 +144,7 @@ double advancing_front::get_creation_radius() const {
 }
 
 const volume* advancing_front::get_volume() const {
-	return _volume;
+	return _source_volume;
 }
 
 surface_memory& advancing_front::get_surface_memory() {
@@ -84,24 +155,48 @@ int advancing_front::get_total_steps() const {
 	return _total_steps;
 }
 
+const step_stats& advancing_front::get_step_stats() const {
+	return _step_stats;
+}
+
 void advancing_front::build_full_surface(const vec3& generate_pos) {
 	step(generate_pos, std::numeric_limits<int>::max());
 }
 
 bool advancing_front::step(const vec3& generate_pos, int n) {
+	return _step(generate_pos, n, 0).edges > 0;
+}
+
+const step_stats& advancing_front::step_within(const vec3& generate_pos, double budget_ms) {
+	assertion(budget_ms > 0, "The step budget should be greater than zero.");
+	return _step(generate_pos, std::numeric_limits<int>::max(), std::max(1ll, static_cast<long long>(budget_ms * 1e6)));
+}
+
+const step_stats& advancing_front::_step(const vec3& generate_pos, int n, long long budget_ns) {
+	const timer t;
+	const uint64_t evaluations_before = _get_evaluations();
+	_step_stats = {};
+	_surface_memory.focus_front(generate_pos, _creation_radius);
 	int step = 0;
-	int progress = 0;
-	edge* stop_edge = nullptr;
+	int max_predictions = n;
 	while (step < n) {
+		long long edge_start_ns = 0;
+		if (budget_ns > 0) {
+			// the budget covers the focus and parking too, only the first pop is made regardless so that a step makes
+			// progress. The estimate is only checked once an edge is made, parking costs far less than an edge
+			edge_start_ns = t.nano_seconds();
+			const double remaining_ns = static_cast<double>(budget_ns - edge_start_ns);
+			if (step > 0 && (remaining_ns <= 0 || (_step_stats.edges > 0 && remaining_ns < _edge_nano_seconds))) {
+				break;
+			}
+			// don't predict more edges than fit in the budget
+			max_predictions = static_cast<int>(std::min(static_cast<double>(n - step), remaining_ns / std::max(1., _edge_nano_seconds)));
+		}
+
 		edge* current_edge = _surface_memory.pop_edge();
 		if (current_edge == nullptr) {
 			break;
 		}
-		if (current_edge == stop_edge) {
-			current_edge->use();
-			_surface_memory.push(stop_edge);
-			break;
-		}
 		if (current_edge->is_used()) {
 			continue;
 		}
@@ -113,30 +208,54 @@ bool advancing_front::step(const vec3& generate_pos, int n) {
 		++_total_steps;
 
 		if (generate_pos.distance_sqr(current_edge->a->get_pos()) >= _creation_radius * _creation_radius) {
-			if (stop_edge == nullptr) {
-				stop_edge = current_edge;
-			}
-			_surface_memory.push(current_edge);
+			// out of reach until generate_pos comes closer
+			_surface_memory.park(current_edge);
+			++_step_stats.parked_edges;
 			continue;
 		}
 
-		++progress;
+		++_step_stats.edges;
 
-		const auto maybe_test_pos = _calc_test_pos_follow(current_edge);
-		if (!maybe_test_pos) {
+		const edge_prediction& prediction = _get_prediction(current_edge, generate_pos, std::max(1, std::min(max_predictions, n - step + 1)));
+		_data = prediction.data;
+		_current_edge_length = prediction.edge_length;
+		if (prediction.test_pos) {
+			const auto& test_pos = *prediction.test_pos;
+			if (edge* common_edge = _get_close_with(current_edge, test_pos)) {
+				_close_triangle(current_edge, common_edge, common_edge->get_other_node(current_edge));
+			}
+			else if (node* neighbor = _find_node(current_edge, test_pos, prediction.has_test_normal ? prediction.test_normal : _calc_normal(test_pos))) {
+				_triangulate(current_edge, neighbor, get_common_edge(current_edge, neighbor));
+			}
+		}
+		else {
 			_surface_memory.notify_follow_surface_fail();
-			continue;
 		}
 
-		const auto& test_pos = *maybe_test_pos;
-		if (edge* common_edge = _get_close_with(current_edge, test_pos)) {
-			_close_triangle(current_edge, common_edge, common_edge->get_other_node(current_edge));
-		}
-		else if (node* neighbor = _find_node(current_edge, test_pos)) {
-			_triangulate(current_edge, neighbor, get_common_edge(current_edge, neighbor));
+		if (budget_ns > 0) {
+			// from the pop of a made edge, so the focus and the parked edges don't count as the time of an edge. Rise fast
+			// and decay slowly, an underestimate is what breaks the budget
+			const auto edge_ns = static_cast<double>(t.nano_seconds() - edge_start_ns);
+			const double rate = edge_ns > _edge_nano_seconds ? 0.5 : 0.05;
+			_edge_nano_seconds += rate * (edge_ns - _edge_nano_seconds);
 		}
 	}
-	return progress > 0;
+	_predictions.clear();
+	_step_stats.evaluations = _get_evaluations() - evaluations_before;
+	_step_stats.nano_seconds = t.nano_seconds();
+	return _step_stats;
+}
+
+uint64_t advancing_front::_get_evaluations() const {
+	if (!_counting_volume) {
+		return 0;
+	}
+	uint64_t evaluations = _counting_volume->get_value_count() + _counting_volume->get_data_count();
+	std::lock_guard lock(_approximations_mutex);
+	for (const auto& a : _approximations) {
+		evaluations += a.counting ? a.counting->get_value_count() : 0;
+	}
+	return evaluations;
 }
 
 void advancing_front::_triangulate(const edge* e, node* neighbor, edge* common_edge) {
@@ -151,7 +270,8 @@ void advancing_front::_triangulate(const edge* e, node* neighbor, edge* common_e
 void advancing_front::_new_triangle(const edge* edge, node* neighbor) {
 	_surface_memory.push(edge->a, neighbor);
 	_surface_memory.push(neighbor, edge->b);
-	_surface_memory.notify_new_triangle(edge->a, neighbor, edge->b, _data);
+	_surface_memory.notify_new_triangle(edge->a, neighbor, edge->b, _get_triangle_data(edge));
+	++_step_stats.triangles;
 }
 
 void advancing_front::_close_triangle(const edge* e, edge* common_edge, node* neighbor) {
@@ -169,7 +289,18 @@ void advancing_front::_close_triangle(const edge* e, edge* common_edge, node* ne
 		_surface_memory.push(flip ? neighbor : other, flip ? other : neighbor);
 	}
 
-	_surface_memory.notify_new_triangle(e->a, neighbor, e->b, _data);
+	_surface_memory.notify_new_triangle(e->a, neighbor, e->b, _get_triangle_data(e));
+	++_step_stats.triangles;
+}
+
+const volume_data& advancing_front::_get_triangle_data(const edge* e) {
+	if (!_use_resolution) {
+		// Nothing before the triangle needs the data, so it is looked up at the edge mid point only for the triangles made
+		const vec3& a = e->a->get_pos();
+		_data = {_default_edge_length};
+		_volume->get_data((e->b->get_pos() - a) * 0.5 + a, _data);
+	}
+	return _data;
 }
 
 bool advancing_front::_is_valid(const edge* edge, const node* neighbor) const {
@@ -185,17 +316,79 @@ bool advancing_front::_is_valid(const vec3& a, const vec3& b, const vec3& c) con
 	return false;
 }
 
-std::optional<vec3> advancing_front::_calc_test_pos_follow(edge* e) {
-	return _calc_test_pos_follow(e->a->get_pos(), e->b->get_pos());
-}
-
-std::optional<vec3> advancing_front::_calc_test_pos_follow(const vec3& a, const vec3& b) {
+std::optional<vec3> advancing_front::_calc_test_pos_follow(const vec3& a, const vec3& b, volume_data& data, double& edge_length) const {
 	const vec3& align = b - a;
 	const vec3& mid_point = align * 0.5 + a;
-	_data = {_default_edge_length};
-	_volume->get_data(mid_point, _data);
-	_current_edge_length = _use_resolution ? _data.edge_len : _default_edge_length;
-	return follow_surface(_volume, mid_point, align.normalize(), _error_margin_scale * _current_edge_length, _current_edge_length);
+	data = {_default_edge_length};
+	edge_length = _default_edge_length;
+	if (_use_resolution) {
+		// the data sets the edge length and is kept for the triangle, so this is the only data lookup of the step. It
+		// isn't get_value_and_data since nothing uses the value at the mid point, follow_surface starts from normal
+		// samples around it
+		_volume->get_data(mid_point, data);
+		edge_length = data.edge_len;
+	}
+	return _follow_surface(mid_point, align.normalize(), edge_length);
+}
+
+std::optional<vec3> advancing_front::_follow_surface(const vec3& start_pos, const vec3& dir, double edge_length) const {
+	const double error_margin = _error_margin_scale * edge_length;
+	if (_use_projection) {
+		if (const auto pos = follow_surface(_get_volume(edge_length), start_pos, dir, edge_length / ProjectionSteps, edge_length, _normal_method, ProjectionTolerance * error_margin)) {
+			return pos;
+		}
+		// the long steps can miss the surface around small features, where the short ones may still find it
+	}
+	return follow_surface(_get_volume(edge_length), start_pos, dir, error_margin, edge_length, _normal_method);
+}
+
+advancing_front::edge_prediction advancing_front::_predict(const edge* e, bool with_test_normal) const {
+	edge_prediction p{e, e->a->get_pos(), e->b->get_pos(), {_default_edge_length}, _default_edge_length, {}, {}, with_test_normal};
+	p.test_pos = _calc_test_pos_follow(p.a, p.b, p.data, p.edge_length);
+	if (with_test_normal && p.test_pos) {
+		p.test_normal = calc_normal(_get_volume(p.edge_length), *p.test_pos, p.edge_length, _normal_method);
+	}
+	return p;
+}
+
+const advancing_front::edge_prediction& advancing_front::_get_prediction(const edge* e, const vec3& generate_pos, int max_predictions) {
+	for (const auto& p : _predictions) {
+		if (p.e == e && p.a == e->a->get_pos() && p.b == e->b->get_pos()) {
+			return p;
+		}
+	}
+
+	_predictions.clear();
+	if (!_workers) {
+		_predictions.push_back(_predict(e, false));
+		return _predictions.back();
+	}
+
+	// Predict the edges that are next in line, they are processed in the same order as without workers so the result
+	// does not depend on the worker count.
+	const size_t max_count = std::min(static_cast<size_t>(max_predictions), 8 * _workers->get_worker_count());
+	const double r2 = _creation_radius * _creation_radius;
+	_prediction_edges.clear();
+	_prediction_edges.push_back(e);
+	_surface_memory.get_front().for_each_in_pop_order([this, e, &generate_pos, r2, max_count](edge_handle handle) {
+		const edge* candidate = _surface_memory.get_edge(handle);
+		if (_prediction_edges.size() < max_count &&
+			candidate != nullptr &&
+			candidate != e &&
+			!candidate->is_used() &&
+			!candidate->a->is_removed() &&
+			!candidate->b->is_removed() &&
+			generate_pos.distance_sqr(candidate->a->get_pos()) < r2) {
+			_prediction_edges.push_back(candidate);
+		}
+		return _prediction_edges.size() < max_count;
+	});
+
+	_predictions.assign(_prediction_edges.size(), {nullptr, {}, {}, {_default_edge_length}, _default_edge_length, {}, {}, false});
+	_workers->for_each_index(_prediction_edges.size(), [this](size_t i) {
+		_predictions[i] = _predict(_prediction_edges[i], true);
+	});
+	return _predictions.front();
 }
 
 bool advancing_front::_create_start_edge(const vec3& start_surface_pos) {
@@ -206,15 +399,15 @@ bool advancing_front::_create_start_edge(const vec3& start_surface_pos) {
 	if (!maybe_normal) {
 		return false;
 	}
-	node* a = _surface_memory.add_node(start_surface_pos, *maybe_normal);
+	node* a = _surface_memory.add_node(start_surface_pos, *maybe_normal, NodeCellEdges * _current_edge_length);
 
 	std::optional<vec3> b_pos;
 	vec3 dir = get_perpendicular(a->normal);
 	assertion(dir.is_valid(), "Didn't find a valid orthogonal vector to normal");
 	for (const auto& test_dir : TestDirs) {
-		b_pos = follow_surface(_volume, a->get_pos(), dir, _error_margin_scale * _current_edge_length, _current_edge_length);
+		b_pos = _follow_surface(a->get_pos(), dir, _current_edge_length);
 		if (b_pos) {
-			if (_calc_test_pos_follow(a->get_pos(), *b_pos)) {
+			if (_calc_test_pos_follow(a->get_pos(), *b_pos, _data, _current_edge_length)) {
 				break;
 			}
 		}
@@ -229,7 +422,7 @@ bool advancing_front::_create_start_edge(const vec3& start_surface_pos) {
 		return false;
 	}
 
-	node* b = _surface_memory.add_node(*b_pos, *_calc_normal(*b_pos));
+	node* b = _surface_memory.add_node(*b_pos, *_calc_normal(*b_pos), NodeCellEdges * _current_edge_length);
 	_surface_memory.push(a, b);
 	return true;
 }
@@ -237,72 +430,65 @@ bool advancing_front::_create_start_edge(const vec3& start_surface_pos) {
 edge* advancing_front::_get_close_with(const edge* e, const vec3& test_pos) const {
 	edge* best = nullptr;
 	double best_alignment = MinAngle;
-	std::vector<edge*> edges;
-	edges.insert(edges.end(), e->a->edges.begin(), e->a->edges.end());
-	edges.insert(edges.end(), e->b->edges.begin(), e->b->edges.end());
 	const double e2 = _current_edge_length * _current_edge_length;
-	for (edge* close_with : edges) {
-		if (close_with == e) {
-			continue;
-		}
+	for (const node* end : {e->a, e->b}) {
+		for (edge* close_with : end->edges) {
+			if (close_with == e) {
+				continue;
+			}
 
-		const node* common = e->get_common_node(close_with);
-		const node* neighbor = close_with->get_other(common);
-		if (neighbor->get_pos().distance_sqr(test_pos) > e2) {
-			continue;
-		}
+			const node* common = e->get_common_node(close_with);
+			const node* neighbor = close_with->get_other(common);
+			if (neighbor->get_pos().distance_sqr(test_pos) > e2) {
+				continue;
+			}
 
-		const vec3& nd = (neighbor->get_pos() - common->get_pos()).normalize();
-		const node* other = e->get_other(common);
-		const vec3& al = (other->get_pos() - common->get_pos()).normalize();
-		const double alignment = al.dot(nd);
-		if (alignment < best_alignment) {
-			// there is a more narrow angle
-			continue;
-		}
+			const vec3& nd = (neighbor->get_pos() - common->get_pos()).normalize();
+			const node* other = e->get_other(common);
+			const vec3& al = (other->get_pos() - common->get_pos()).normalize();
+			const double alignment = al.dot(nd);
+			if (alignment < best_alignment) {
+				// there is a more narrow angle
+				continue;
+			}
 
-		if (!_is_valid(e, neighbor)) {
-			continue;
-		}
+			if (!_is_valid(e, neighbor)) {
+				continue;
+			}
 
-		best = close_with;
-		best_alignment = alignment;
+			best = close_with;
+			best_alignment = alignment;
+		}
 	}
 
 	return best;
 }
 
-node* advancing_front::_find_node(const edge* edge, const vec3& surface_pos) {
+node* advancing_front::_find_node(const edge* edge, const vec3& surface_pos, const std::optional<vec3>& maybe_normal) {
 	node* closest = nullptr;
-	const auto maybe_normal = _calc_normal(surface_pos);
 	if (!maybe_normal) {
 		return nullptr;
 	}
-	double closest_dist_sqr = _current_edge_length * _current_edge_length;
 	bool found_invalid = false;
 	const vec3& normal = *maybe_normal;
-	for (node* n : _surface_memory.get_nodes(surface_pos, _current_edge_length)) {
+	// nearest first, so the validation that calculates normals stops at the closest valid node
+	_surface_memory.get_node_hash().for_each_nearest_within(surface_pos, _current_edge_length, [&](node* n) {
 		assertion(n->is_removed() == false, "Removed in spatial");
 		if (edge->has_node(n)) {
-			continue;
-		}
-
-		const double dist_sqr = surface_pos.distance_sqr(n->get_pos());
-		if (dist_sqr > closest_dist_sqr) {
-			continue;
+			return true;
 		}
 
 		if (normal.dot(n->normal) < 0) {
-			continue;
+			return true;
 		}
 
 		if (!_is_valid(edge, n)) {
 			found_invalid = true;
-			continue;
+			return true;
 		}
 		closest = n;
-		closest_dist_sqr = dist_sqr;
-	}
+		return false;
+	});
 
 	if (closest != nullptr) {
 		return closest;
@@ -316,10 +502,53 @@ node* advancing_front::_find_node(const edge* edge, const vec3& surface_pos) {
 		return nullptr;
 	}
 
-	return _surface_memory.add_node(surface_pos, normal);
+	return _surface_memory.add_node(surface_pos, normal, NodeCellEdges * _current_edge_length);
 }
 
 std::optional<vec3> advancing_front::_calc_normal(const vec3& pos) const {
-	return calc_normal(_volume, pos, _current_edge_length);
+	return calc_normal(_get_volume(_current_edge_length), pos, _current_edge_length, _normal_method);
+}
+
+const volume* advancing_front::_get_volume(double edge_length) const {
+	if (_value_tolerance <= 0) {
+		return _volume;
+	}
+
+	// the tolerance is rounded down to a power of two so that a few approximations serve all the edge lengths
+	const int exponent = std::min(std::ilogb(_value_tolerance * edge_length), MaxApproximationExponent);
+	if (exponent < MinApproximationExponent) {
+		return _volume; // too small to approximate anything away
+	}
+	auto& root = _approximation_roots[static_cast<size_t>(exponent - MinApproximationExponent)];
+	if (const volume* built = root.load(std::memory_order_acquire)) {
+		return built;
+	}
+
+	std::lock_guard lock(_approximations_mutex);
+	if (const volume* built = root.load(std::memory_order_relaxed)) {
+		return built;
+	}
+	auto& a = _approximations.emplace_back();
+	a.root = _source_volume->approximate(std::ldexp(1., exponent), a.owned);
+	if (a.root == _source_volume) {
+		a.root = _volume;
+		root.store(a.root, std::memory_order_release);
+		return a.root;
+	}
+	if (_counting_volume) {
+		auto counting = std::make_unique<counting_volume>(a.root);
+		a.counting = counting.get();
+		a.root = counting.get();
+		a.owned.push_back(std::move(counting));
+	}
+	root.store(a.root, std::memory_order_release);
+	return a.root;
+}
+
+void advancing_front::_clear_approximations() {
+	for (auto& root : _approximation_roots) {
+		root.store(nullptr, std::memory_order_relaxed);
+	}
+	_approximations.clear();
 }
 }
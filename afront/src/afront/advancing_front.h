@@ -1,44 +1,103 @@
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+
 #include "edge.h"
 #include "surface_memory.h"
 #include "volume_data.h"
 #include "volume.h"
+#include "volume_util.h"
 
 namespace playchilla {
+class counting_volume;
+class tiled_volume;
+class worker_pool;
+
+struct step_stats {
+	int edges = 0; // Edges within the creation radius
+	int parked_edges = 0; // Edges outside of the creation radius
+	int triangles = 0;
+	uint64_t evaluations = 0; // Volume values and data, only counted after count_evaluations()
+	long long nano_seconds = 0;
+};
+
 
 class advancing_front {
 public:
 	advancing_front(const volume*, mesh_builder*, double edge_len, double creation_radius, double error_margin_scale = 0.1);
+	advancing_front(const advancing_front&) = delete;
+	advancing_front(advancing_front&&) = delete;
+	advancing_front& operator=(const advancing_front&) = delete;
+	advancing_front& operator=(advancing_front&&) = delete;
+	~advancing_front();
 
 	advancing_front& ignore_resolution();
+	advancing_front& use_workers(size_t worker_count);
+	advancing_front& prioritize_near(); // Process the edges closest to generate_pos first instead of in creation order
+	advancing_front& use_gradients(); // Normals from the gradient of the volume instead of central differences
+	// Follows the surface in a few long steps, each projected onto the surface by root finding instead of stepping past it
+	advancing_front& use_surface_projection();
+	advancing_front& use_tiles(double tile_size); // Evaluates the volume pruned to the tile of each position, not its approximations
+	advancing_front& count_evaluations();
+	// Lets the values be off by a fraction of the edge length, which leaves out the detail the edges can't show
+	advancing_front& use_value_tolerance(double edge_fraction);
 	bool need_seed() const;
 	bool try_find_surface(const vec3& search_pos);
+	int seed_surfaces(const vec3& generate_pos); // Starts fronts on the surfaces within the creation radius without nodes, returns how many
 	
 	double get_edge_length() const;
 	double get_creation_radius() const;
 	const volume* get_volume() const;
 	surface_memory& get_surface_memory();
 	int get_total_steps() const;
+	const step_stats& get_step_stats() const; // Of the last step
 
 	void build_full_surface(const vec3& generate_pos);
 	bool step(const vec3& generate_pos, int n);
 
+	// Steps until the budget is used, stops early if the next edge is expected to go over it but always does one edge
+	const step_stats& step_within(const vec3& generate_pos, double budget_ms);
+
 private:
+	// The surface probing of an edge only depends on the edge end points, so it can be done ahead of time
+	struct edge_prediction {
+		const edge* e;
+		vec3 a;
+		vec3 b;
+		volume_data data;
+		double edge_length;
+		std::optional<vec3> test_pos;
+		std::optional<vec3> test_normal;
+		bool has_test_normal;
+	};
+
+	const step_stats& _step(const vec3& generate_pos, int n, long long budget_ns);
+	uint64_t _get_evaluations() const;
 	void _triangulate(const edge* e, node* neighbor, edge* common_edge);
 	void _new_triangle(const edge* edge, node* neighbor);
 	void _close_triangle(const edge* e, edge* common_edge, node* neighbor);
+	const volume_data& _get_triangle_data(const edge* e); // The data at the mid point of the edge a triangle is made on
 	bool _is_valid(const edge* edge, const node* neighbor) const;
 	bool _is_valid(const vec3& a, const vec3& b, const vec3& c) const;
-	std::optional<vec3> _calc_test_pos_follow(edge*);
-	std::optional<vec3> _calc_test_pos_follow(const vec3& a, const vec3& b);
+	std::optional<vec3> _follow_surface(const vec3& start_pos, const vec3& dir, double edge_length) const;
+	std::optional<vec3> _calc_test_pos_follow(const vec3& a, const vec3& b, volume_data& data, double& edge_length) const;
+	edge_prediction _predict(const edge*, bool with_test_normal) const;
+	const edge_prediction& _get_prediction(const edge*, const vec3& generate_pos, int max_predictions);
 	bool _create_start_edge(const vec3& start_surface_pos);
 	edge* _get_close_with(const edge* e, const vec3& test_pos) const;
-	node* _find_node(const edge* edge, const vec3& surface_pos);
+	node* _find_node(const edge* edge, const vec3& surface_pos, const std::optional<vec3>& maybe_normal);
 	std::optional<vec3> _calc_normal(const vec3& pos) const;
+	const volume* _get_volume(double edge_length) const; // Approximated within the value tolerance of the edge length
+	void _clear_approximations();
 
 	inline static const auto MinAngle = std::cos(deg_to_rad(93));
+	static constexpr double ProjectionSteps = 4;
+	static constexpr double ProjectionTolerance = 0.1; // Of the error margin
 	const volume* _volume;
+	const volume* _source_volume;
 	double _default_edge_length;
 	double _current_edge_length;
 	double _creation_radius;
@@ -48,5 +107,30 @@ private:
 	volume_data _data;
 	int _total_steps = 0;
 	bool _use_resolution = true;
+	normal_method _normal_method = normal_method::central_difference;
+	bool _use_projection = false;
+
+	step_stats _step_stats;
+	double _edge_nano_seconds = 0; // Expected time to process an edge, estimated by step_within
+	std::unique_ptr<tiled_volume> _tiled_volume;
+	std::unique_ptr<counting_volume> _counting_volume;
+
+	// The volume approximated within a power of two tolerance
+	struct approximation {
+		volume_unique_ptrs owned;
+		const volume* root = nullptr;
+		const counting_volume* counting = nullptr;
+	};
+	static constexpr int MinApproximationExponent = -64;
+	static constexpr int MaxApproximationExponent = 63;
+	double _value_tolerance = 0;
+	// The roots by exponent, published when built so that looking one up takes no lock, the mutex only guards building
+	mutable std::array<std::atomic<const volume*>, MaxApproximationExponent - MinApproximationExponent + 1> _approximation_roots{};
+	mutable std::mutex _approximations_mutex;
+	mutable std::vector<approximation> _approximations;
+
+	std::unique_ptr<worker_pool> _workers;
+	std::vector<edge_prediction> _predictions;
+	std::vector<const edge*> _prediction_edges;
 };
 }
@@ -0,0 +1,218 @@
+#include "brick_cache_volume.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "core/debug/assertion.h"
+#include "core/math/math_util.h"
+#include "core/util/hash_util.h"
+
+namespace playchilla {
+namespace {
+int64_t floor_div(int64_t v, int64_t d) {
+	return v >= 0 ? v / d : (v - d + 1) / d;
+}
+}
+
+brick_cache_volume::brick_cache_volume(const volume* source, double spacing, double tolerance, size_t max_bricks) :
+	_source(source),
+	_spacing(spacing),
+	_inv_spacing(1. / spacing),
+	_tolerance(tolerance),
+	_max_bricks(max_bricks) {
+	assertion(spacing > 0, "The spacing must be positive");
+	assertion(max_bricks > 0, "Must be able to hold a brick");
+}
+
+double brick_cache_volume::get_value(double x, double y, double z) const {
+	return _get_value(x, y, z);
+}
+
+void brick_cache_volume::get_values(std::span<const vec3> positions, std::span<double> values) const {
+	for (size_t i = 0; i < positions.size(); ++i) {
+		values[i] = _get_value(positions[i].x, positions[i].y, positions[i].z);
+	}
+}
+
+double brick_cache_volume::get_value_and_gradient(double x, double y, double z, vec3& gradient) const {
+	return _source->get_value_and_gradient(x, y, z, gradient);
+}
+
+interval brick_cache_volume::get_interval(const aabb& box) const {
+	// interpolated values are blends of samples at most a spacing outside of the box
+	return _source->get_interval({box.get_center(), box.get_size() + vec3(2 * _spacing, 2 * _spacing, 2 * _spacing)});
+}
+
+double brick_cache_volume::get_lipschitz(const aabb& box) const {
+	// each axis of the interpolation changes by the difference of two samples a spacing apart
+	return std::sqrt(3.) * _source->get_lipschitz({box.get_center(), box.get_size() + vec3(2 * _spacing, 2 * _spacing, 2 * _spacing)});
+}
+
+void brick_cache_volume::get_data(const vec3& pos, volume_data& data) const {
+	_source->get_data(pos, data);
+}
+
+const volume* brick_cache_volume::get_source() const {
+	return _source;
+}
+
+brick_cache_volume::stats brick_cache_volume::get_stats() const {
+	return {_hits.load(), _fills.load(), _bypasses.load(), _evictions.load()};
+}
+
+double brick_cache_volume::get_hit_rate() const {
+	const auto s = get_stats();
+	const auto queries = s.hits + s.fills + s.bypasses;
+	return queries == 0 ? 0. : static_cast<double>(s.hits) / static_cast<double>(queries);
+}
+
+size_t brick_cache_volume::get_brick_count() const {
+	std::shared_lock lock(_mutex);
+	return _bricks.size();
+}
+
+void brick_cache_volume::clear() {
+	std::lock_guard lock(_mutex);
+	_bricks.clear();
+}
+
+double brick_cache_volume::_get_value(double x, double y, double z) const {
+	const double gx = x * _inv_spacing;
+	const double gy = y * _inv_spacing;
+	const double gz = z * _inv_spacing;
+	const auto cx = floor_to<int64_t>(gx);
+	const auto cy = floor_to<int64_t>(gy);
+	const auto cz = floor_to<int64_t>(gz);
+	const int64_t bx = floor_div(cx, BrickCells);
+	const int64_t by = floor_div(cy, BrickCells);
+	const int64_t bz = floor_div(cz, BrickCells);
+
+	const auto interpolate = [&](const brick& b) {
+		return _interpolate(b,
+			static_cast<int>(cx - bx * BrickCells), static_cast<int>(cy - by * BrickCells), static_cast<int>(cz - bz * BrickCells),
+			gx - static_cast<double>(cx), gy - static_cast<double>(cy), gz - static_cast<double>(cz));
+	};
+
+	std::shared_lock lock(_mutex);
+	if (const brick* b = _find_brick(bx, by, bz)) {
+		if (b->interpolate) {
+			_hits.fetch_add(1, std::memory_order_relaxed);
+			return interpolate(*b);
+		}
+		lock.unlock();
+		_bypasses.fetch_add(1, std::memory_order_relaxed);
+		return _source->get_value(x, y, z);
+	}
+	lock.unlock();
+
+	brick filled;
+	filled.x = bx;
+	filled.y = by;
+	filled.z = bz;
+	_fill(filled);
+	{
+		std::lock_guard store_lock(_mutex);
+		_store(filled);
+	}
+	_fills.fetch_add(1, std::memory_order_relaxed);
+	if (!filled.interpolate) {
+		_bypasses.fetch_add(1, std::memory_order_relaxed);
+		return _source->get_value(x, y, z);
+	}
+	return interpolate(filled);
+}
+
+const brick_cache_volume::brick* brick_cache_volume::_find_brick(int64_t x, int64_t y, int64_t z) const {
+	const auto it = _bricks.find(hash_good(x, y, z));
+	if (it == _bricks.end() || it->second.x != x || it->second.y != y || it->second.z != z) {
+		return nullptr;
+	}
+	// under the shared lock, only written when it changes so hits on the same brick don't write to it
+	const uint64_t use = _use.load(std::memory_order_relaxed);
+	std::atomic_ref last_use(it->second.last_use);
+	if (last_use.load(std::memory_order_relaxed) != use) {
+		last_use.store(use, std::memory_order_relaxed);
+	}
+	return &it->second;
+}
+
+// Replaces a brick with the same hash, which may be the same brick filled by another thread
+void brick_cache_volume::_store(const brick& filled) const {
+	const uint64_t key = hash_good(filled.x, filled.y, filled.z);
+	auto it = _bricks.find(key);
+	if (it == _bricks.end()) {
+		if (_bricks.size() >= _max_bricks) {
+			_evict();
+		}
+		it = _bricks.try_emplace(key).first;
+	}
+	it->second = filled;
+	it->second.last_use = _use.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+void brick_cache_volume::_fill(brick& b) const {
+	// The samples followed by cell centers spread over the brick to estimate the interpolation error with
+	std::array<vec3, BrickSamples * BrickSamples * BrickSamples + CheckCount> positions;
+	const vec3 origin = vec3(static_cast<double>(b.x), static_cast<double>(b.y), static_cast<double>(b.z)) * (BrickCells * _spacing);
+	size_t i = 0;
+	for (int z = 0; z < BrickSamples; ++z) {
+		for (int y = 0; y < BrickSamples; ++y) {
+			for (int x = 0; x < BrickSamples; ++x) {
+				positions[i++] = origin + vec3(x, y, z) * _spacing;
+			}
+		}
+	}
+	const size_t checks = i;
+	for (const double offset : {.5, 1.5}) {
+		for (int z = 0; z < 2; ++z) {
+			for (int y = 0; y < 2; ++y) {
+				for (int x = 0; x < 2; ++x) {
+					positions[i++] = origin + vec3(offset + 2 * x, offset + 2 * y, offset + 2 * z) * _spacing;
+				}
+			}
+		}
+	}
+
+	std::array<double, positions.size()> values;
+	_source->get_values(positions, values);
+	std::copy_n(values.begin(), b.samples.size(), b.samples.begin());
+
+	double max_error = 0;
+	for (size_t c = checks; c < positions.size(); ++c) {
+		const vec3 g = (positions[c] - origin) * _inv_spacing;
+		const int ix = floor_to<int>(g.x);
+		const int iy = floor_to<int>(g.y);
+		const int iz = floor_to<int>(g.z);
+		max_error = std::max(max_error, std::abs(values[c] - _interpolate(b, ix, iy, iz, g.x - ix, g.y - iy, g.z - iz)));
+	}
+	b.interpolate = max_error <= _tolerance;
+}
+
+void brick_cache_volume::_evict() const {
+	// Drops the least recently used quarter at once so that the sorting is shared by many fills
+	std::vector<std::pair<uint64_t, uint64_t>> uses;
+	uses.reserve(_bricks.size());
+	for (const auto& [key, b] : _bricks) {
+		uses.emplace_back(b.last_use, key);
+	}
+	const size_t count = std::max<size_t>(1, uses.size() / 4);
+	std::nth_element(uses.begin(), uses.begin() + static_cast<std::ptrdiff_t>(count - 1), uses.end());
+	for (size_t i = 0; i < count; ++i) {
+		_bricks.erase(uses[i].second);
+	}
+	_evictions.fetch_add(count, std::memory_order_relaxed);
+}
+
+double brick_cache_volume::_interpolate(const brick& b, int ix, int iy, int iz, double fx, double fy, double fz) {
+	constexpr int sy = BrickSamples;
+	constexpr int sz = BrickSamples * BrickSamples;
+	const double* s = &b.samples[static_cast<size_t>(iz * sz + iy * sy + ix)];
+	const double x00 = s[0] + fx * (s[1] - s[0]);
+	const double x10 = s[sy] + fx * (s[sy + 1] - s[sy]);
+	const double x01 = s[sz] + fx * (s[sz + 1] - s[sz]);
+	const double x11 = s[sz + sy] + fx * (s[sz + sy + 1] - s[sz + sy]);
+	const double y0 = x00 + fy * (x10 - x00);
+	const double y1 = x01 + fy * (x11 - x01);
+	return y0 + fz * (y1 - y0);
+}
+}
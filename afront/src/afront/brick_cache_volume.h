@@ -0,0 +1,80 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+
+#include "volume.h"
+
+namespace playchilla {
+/**
+ * Caches the values of another volume in small bricks of samples, a brick is filled the first time a position in it is
+ * queried and then answers by trilinear interpolation. Bricks where the interpolation is further off than the tolerance
+ * at a few check points pass their queries on to the source. When there are more than max bricks the least recently
+ * used ones are dropped, recency is counted in stored bricks. Data and gradients come from the source. Safe to use from
+ * several threads: lookups share the lock and only storing a brick takes it exclusively, the source is evaluated without
+ * it. Two threads can fill the same brick.
+ */
+class brick_cache_volume : public volume {
+public:
+	static constexpr int BrickCells = 4;
+
+	struct stats {
+		uint64_t hits = 0; // Interpolated in a brick that was already filled
+		uint64_t fills = 0; // Filled a brick for the query
+		uint64_t bypasses = 0; // Asked the source since the brick is over the tolerance
+		uint64_t evictions = 0;
+	};
+
+	brick_cache_volume(const volume* source, double spacing, double tolerance, size_t max_bricks = 4096);
+
+	using volume::get_value;
+	using volume::get_value_and_gradient;
+	double get_value(double x, double y, double z) const override;
+	void get_values(std::span<const vec3> positions, std::span<double> values) const override;
+	double get_value_and_gradient(double x, double y, double z, vec3& gradient) const override;
+	interval get_interval(const aabb& box) const override;
+	double get_lipschitz(const aabb& box) const override;
+	void get_data(const vec3& pos, volume_data& data) const override;
+
+	const volume* get_source() const;
+	stats get_stats() const;
+	double get_hit_rate() const; // Hits of all queries
+	size_t get_brick_count() const;
+	void clear();
+
+private:
+	static constexpr int BrickSamples = BrickCells + 1;
+	static constexpr size_t CheckCount = 16;
+
+	struct brick {
+		int64_t x, y, z;
+		uint64_t last_use = 0;
+		bool interpolate = false;
+		std::array<double, BrickSamples * BrickSamples * BrickSamples> samples;
+	};
+
+	double _get_value(double x, double y, double z) const;
+	const brick* _find_brick(int64_t x, int64_t y, int64_t z) const;
+	void _store(const brick&) const;
+	void _fill(brick&) const;
+	void _evict() const;
+	static double _interpolate(const brick&, int ix, int iy, int iz, double fx, double fy, double fz);
+
+	const volume* _source;
+	const double _spacing;
+	const double _inv_spacing;
+	const double _tolerance;
+	const size_t _max_bricks;
+	mutable std::shared_mutex _mutex;
+	mutable std::unordered_map<uint64_t, brick> _bricks;
+	mutable std::atomic<uint64_t> _use = 0;
+	mutable std::atomic<uint64_t> _hits = 0;
+	mutable std::atomic<uint64_t> _fills = 0;
+	mutable std::atomic<uint64_t> _bypasses = 0;
+	mutable std::atomic<uint64_t> _evictions = 0;
+};
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include "volume.h"
+
+namespace playchilla {
+/**
+ * Forwards to another volume and counts the evaluations, safe to use from several threads.
+ */
+class counting_volume : public volume {
+public:
+	counting_volume(const volume* source) : _source(source) {
+	}
+
+	double get_value(double x, double y, double z) const override {
+		_value_count.fetch_add(1, std::memory_order_relaxed);
+		return _source->get_value(x, y, z);
+	}
+
+	void get_values(std::span<const vec3> positions, std::span<double> values) const override {
+		_value_count.fetch_add(positions.size(), std::memory_order_relaxed);
+		_source->get_values(positions, values);
+	}
+
+	double get_value_and_gradient(double x, double y, double z, vec3& gradient) const override {
+		_value_count.fetch_add(1, std::memory_order_relaxed);
+		return _source->get_value_and_gradient(x, y, z, gradient);
+	}
+
+	interval get_interval(const aabb& box) const override {
+		return _source->get_interval(box);
+	}
+
+	double get_lipschitz(const aabb& box) const override {
+		return _source->get_lipschitz(box);
+	}
+
+	void get_data(const vec3& pos, volume_data& data) const override {
+		_data_count.fetch_add(1, std::memory_order_relaxed);
+		_source->get_data(pos, data);
+	}
+
+	double get_value_and_data(const vec3& pos, volume_data& data) const override {
+		_value_count.fetch_add(1, std::memory_order_relaxed);
+		_data_count.fetch_add(1, std::memory_order_relaxed);
+		return _source->get_value_and_data(pos, data);
+	}
+
+	const volume* get_source() const {
+		return _source;
+	}
+
+	uint64_t get_value_count() const {
+		return _value_count.load(std::memory_order_relaxed);
+	}
+
+	uint64_t get_data_count() const {
+		return _data_count.load(std::memory_order_relaxed);
+	}
+
+private:
+	const volume* _source;
+	mutable std::atomic<uint64_t> _value_count = 0;
+	mutable std::atomic<uint64_t> _data_count = 0;
+};
+}
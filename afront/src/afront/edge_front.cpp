@@ -0,0 +1,298 @@
+#include "edge_front.h"
+
+#include <algorithm>
+
+#include "node.h"
+#include "core/debug/assertion.h"
+#include "core/math/math_util.h"
+#include "core/util/hash_util.h"
+
+namespace playchilla {
+edge_front::edge_front(const object_pool<edge>& edges, double cell_size) :
+	_edges(edges),
+	_inv_cell_size(1. / cell_size),
+	_cell_size(cell_size) {
+	assertion(cell_size > 0, "The dormant cell size should be greater than zero");
+}
+
+bool edge_front::empty() const {
+	return size() == 0 && _dormant_count == 0;
+}
+
+size_t edge_front::size() const {
+	return _prioritize ? _heap.size() : _queue.size() - _queue_head;
+}
+
+edge_handle edge_front::front() const {
+	return (*this)[0];
+}
+
+edge_handle edge_front::operator[](size_t i) const {
+	assertion(i < size(), "Front index out of range");
+	return _prioritize ? _heap[i].handle : _queue[_queue_head + i];
+}
+
+size_t edge_front::get_dormant_count() const {
+	return _dormant_count;
+}
+
+size_t edge_front::get_dormant_cell_count() const {
+	return _dormant.size();
+}
+
+bool edge_front::is_prioritized() const {
+	return _prioritize;
+}
+
+size_t edge_front::get_allocated_bytes() const {
+	const size_t cell_count = _dormant.size() + _spare_cells.size();
+	return _queue.capacity() * sizeof(edge_handle) +
+		_heap.capacity() * sizeof(prioritized) +
+		_pop_order.capacity() * sizeof(size_t) +
+		_dormant.bucket_count() * sizeof(void*) +
+		cell_count * (sizeof(void*) + sizeof(dormant_cells::value_type)) +
+		_spare_cells.capacity() * sizeof(dormant_cells::node_type) +
+		_dormant_edges.capacity() * sizeof(dormant_edge);
+}
+
+void edge_front::push(const edge* e) {
+	_activate(_edges.get_handle(e));
+}
+
+edge* edge_front::pop() {
+	if (_prioritize) {
+		while (!_heap.empty()) {
+			std::pop_heap(_heap.begin(), _heap.end());
+			auto* e = _edges.get(_heap.back().handle);
+			_heap.pop_back();
+			if (e != nullptr) {
+				return e;
+			}
+		}
+		return nullptr;
+	}
+
+	while (_queue_head < _queue.size()) {
+		auto* e = _edges.get(_queue[_queue_head++]);
+		if (2 * _queue_head >= _queue.size()) {
+			// moves at most as many handles as have been popped since the last time
+			_queue.erase(_queue.begin(), _queue.begin() + static_cast<std::ptrdiff_t>(_queue_head));
+			_queue_head = 0;
+		}
+		if (e != nullptr) {
+			return e;
+		}
+	}
+	return nullptr;
+}
+
+void edge_front::park(const edge* e) {
+	const vec3& pos = e->a->get_pos();
+	const auto x = floor_to<int64_t>(pos.x * _inv_cell_size);
+	const auto y = floor_to<int64_t>(pos.y * _inv_cell_size);
+	const auto z = floor_to<int64_t>(pos.z * _inv_cell_size);
+	const uint64_t id = hash_good(x, y, z);
+	auto it = _dormant.find(id);
+	if (it == _dormant.end()) {
+		if (_spare_cells.empty()) {
+			it = _dormant.emplace(id, dormant_cell{x, y, z}).first;
+		}
+		else {
+			auto spare = std::move(_spare_cells.back());
+			_spare_cells.pop_back();
+			spare.key() = id;
+			spare.mapped() = {x, y, z};
+			it = _dormant.insert(std::move(spare)).position;
+		}
+	}
+
+	uint32_t i = _free_dormant_edge;
+	if (i == NoEdge) {
+		i = static_cast<uint32_t>(_dormant_edges.size());
+		_dormant_edges.push_back({_edges.get_handle(e), NoEdge});
+	}
+	else {
+		_free_dormant_edge = _dormant_edges[i].next;
+		_dormant_edges[i] = {_edges.get_handle(e), NoEdge};
+	}
+	dormant_cell& cell = it->second;
+	(cell.last == NoEdge ? cell.first : _dormant_edges[cell.last].next) = i;
+	cell.last = i;
+	++_dormant_count;
+}
+
+void edge_front::clear() {
+	_queue.clear();
+	_queue_head = 0;
+	_heap.clear();
+	_dormant.clear();
+	_dormant_edges.clear();
+	_free_dormant_edge = NoEdge;
+	_dormant_count = 0;
+	_deleted_since_drop = 0;
+}
+
+void edge_front::focus(const vec3& center, double radius) {
+	if (center.is_exactly(_center) && radius == _radius) {
+		// edges parked since the last call are outside of this radius
+		return;
+	}
+	_center = center;
+	_radius = radius;
+
+	if (_prioritize && center.distance_sqr(_keyed_center) > _refocus_distance * _refocus_distance) {
+		_refocus(center);
+	}
+
+	if (_dormant.empty()) {
+		return;
+	}
+
+	// visit the cells overlapping the radius, or all dormant cells if there are fewer of them
+	const double radius_sqr = radius * radius;
+	const auto x0 = floor_to<int64_t>((center.x - radius) * _inv_cell_size);
+	const auto y0 = floor_to<int64_t>((center.y - radius) * _inv_cell_size);
+	const auto z0 = floor_to<int64_t>((center.z - radius) * _inv_cell_size);
+	const auto x1 = floor_to<int64_t>((center.x + radius) * _inv_cell_size);
+	const auto y1 = floor_to<int64_t>((center.y + radius) * _inv_cell_size);
+	const auto z1 = floor_to<int64_t>((center.z + radius) * _inv_cell_size);
+	const double overlapping_cells = static_cast<double>(x1 - x0 + 1) * static_cast<double>(y1 - y0 + 1) * static_cast<double>(z1 - z0 + 1);
+	if (overlapping_cells < static_cast<double>(_dormant.size())) {
+		for (int64_t x = x0; x <= x1; ++x) {
+			for (int64_t y = y0; y <= y1; ++y) {
+				for (int64_t z = z0; z <= z1; ++z) {
+					const auto it = _dormant.find(hash_good(x, y, z));
+					if (it != _dormant.end() && _wake(it->second, center, radius_sqr)) {
+						_remove_cell(it);
+					}
+				}
+			}
+		}
+		return;
+	}
+
+	for (auto it = _dormant.begin(); it != _dormant.end();) {
+		it = _wake(it->second, center, radius_sqr) ? _remove_cell(it) : std::next(it);
+	}
+}
+
+void edge_front::prioritize_near(double refocus_distance) {
+	_refocus_distance = refocus_distance;
+	if (_prioritize) {
+		return;
+	}
+	_prioritize = true;
+	for (size_t i = _queue_head; i < _queue.size(); ++i) {
+		_activate(_queue[i]);
+	}
+	_queue.clear();
+	_queue_head = 0;
+}
+
+void edge_front::on_deleted(size_t edge_count) {
+	_deleted_since_drop += edge_count;
+	if (_deleted_since_drop * 2 < _dormant_count) {
+		return;
+	}
+	_drop_dead();
+	_deleted_since_drop = 0;
+}
+
+bool edge_front::prioritized::operator<(const prioritized& rhs) const {
+	// the heap keeps the largest on top, so the closest and then the oldest is the largest
+	if (distance_sqr != rhs.distance_sqr) {
+		return distance_sqr > rhs.distance_sqr;
+	}
+	return order > rhs.order;
+}
+
+void edge_front::_activate(edge_handle handle) {
+	if (!_prioritize) {
+		_queue.push_back(handle);
+		return;
+	}
+	const auto* e = _edges.get(handle);
+	if (e == nullptr) {
+		return;
+	}
+	_heap.push_back({e->a->get_pos().distance_sqr(_keyed_center), _order++, handle});
+	std::push_heap(_heap.begin(), _heap.end());
+}
+
+bool edge_front::_wake(dormant_cell& cell, const vec3& center, double radius_sqr) {
+	const vec3 cell_min = vec3(static_cast<double>(cell.x), static_cast<double>(cell.y), static_cast<double>(cell.z)) * _cell_size;
+	const vec3 closest(
+		std::clamp(center.x, cell_min.x, cell_min.x + _cell_size),
+		std::clamp(center.y, cell_min.y, cell_min.y + _cell_size),
+		std::clamp(center.z, cell_min.z, cell_min.z + _cell_size));
+	if (closest.distance_sqr(center) >= radius_sqr) {
+		return false;
+	}
+
+	return _filter(cell, [this, &center, radius_sqr](edge_handle handle) {
+		const auto* e = _edges.get(handle);
+		if (e == nullptr) {
+			return false;
+		}
+		if (e->a->get_pos().distance_sqr(center) < radius_sqr) {
+			_activate(handle);
+			return false;
+		}
+		return true;
+	});
+}
+
+// Unlinks the edges that are not kept and frees their slots, returns true if the cell is left empty
+template <typename KeepT>
+bool edge_front::_filter(dormant_cell& cell, const KeepT& keep) {
+	uint32_t last = NoEdge;
+	for (uint32_t i = cell.first; i != NoEdge;) {
+		const uint32_t next = _dormant_edges[i].next;
+		if (keep(_dormant_edges[i].handle)) {
+			(last == NoEdge ? cell.first : _dormant_edges[last].next) = i;
+			last = i;
+		}
+		else {
+			_dormant_edges[i].next = _free_dormant_edge;
+			_free_dormant_edge = i;
+			--_dormant_count;
+		}
+		i = next;
+	}
+	if (last == NoEdge) {
+		cell.first = NoEdge;
+	}
+	else {
+		_dormant_edges[last].next = NoEdge;
+	}
+	cell.last = last;
+	return last == NoEdge;
+}
+
+// Keeps the map node of the cell for the next cell to be parked in
+edge_front::dormant_cells::iterator edge_front::_remove_cell(dormant_cells::iterator it) {
+	const auto next = std::next(it);
+	_spare_cells.push_back(_dormant.extract(it));
+	return next;
+}
+
+void edge_front::_refocus(const vec3& center) {
+	_keyed_center = center;
+	std::erase_if(_heap, [this](const prioritized& p) {
+		return !_edges.is_alive(p.handle);
+	});
+	for (auto& p : _heap) {
+		p.distance_sqr = _edges.get(p.handle)->a->get_pos().distance_sqr(center);
+	}
+	std::make_heap(_heap.begin(), _heap.end());
+}
+
+void edge_front::_drop_dead() {
+	for (auto it = _dormant.begin(); it != _dormant.end();) {
+		const bool empty = _filter(it->second, [this](edge_handle handle) {
+			return _edges.is_alive(handle);
+		});
+		it = empty ? _remove_cell(it) : std::next(it);
+	}
+}
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+#include "edge.h"
+#include "core/math/vec3.h"
+#include "core/util/object_pool.h"
+
+namespace playchilla {
+using edge_handle = object_pool<edge>::handle;
+
+/**
+ * The edges left to process. Active edges are handed out first in first out, or closest to the focus first when
+ * prioritized. Dormant edges are parked per cell and stay out of the way until the focus comes close to their cell.
+ * The queue, the dormant edges and the dormant cells reuse what they have allocated, so pushing, parking and waking
+ * edges stop allocating once they have been as many before.
+ */
+class edge_front {
+public:
+	edge_front(const object_pool<edge>& edges, double cell_size);
+
+	bool empty() const; // No active or dormant edges
+	size_t size() const; // Active edges, indexed in pop order unless prioritized, then only the front is next
+	edge_handle front() const;
+	edge_handle operator[](size_t i) const;
+	size_t get_dormant_count() const;
+	size_t get_dormant_cell_count() const;
+	bool is_prioritized() const;
+	size_t get_allocated_bytes() const;
+
+	void push(const edge*);
+	edge* pop();
+	void park(const edge*);
+	void clear();
+
+	// Activates the dormant edges within radius of center and orders the active edges by distance to it if prioritized
+	void focus(const vec3& center, double radius);
+	void prioritize_near(double refocus_distance);
+
+	// Calls back with the active edges in the order they would be popped until the callback returns false
+	template <typename CallbackT>
+	void for_each_in_pop_order(const CallbackT& callback) const {
+		if (!_prioritize) {
+			for (size_t i = _queue_head; i < _queue.size() && callback(_queue[i]); ++i) {
+			}
+			return;
+		}
+		// the next in a heap is the largest of the children of those already visited
+		const auto less = [this](size_t a, size_t b) {
+			return _heap[a] < _heap[b];
+		};
+		_pop_order.clear();
+		if (!_heap.empty()) {
+			_pop_order.push_back(0);
+		}
+		while (!_pop_order.empty()) {
+			std::pop_heap(_pop_order.begin(), _pop_order.end(), less);
+			const size_t i = _pop_order.back();
+			_pop_order.pop_back();
+			if (!callback(_heap[i].handle)) {
+				return;
+			}
+			for (size_t child = 2 * i + 1; child <= 2 * i + 2 && child < _heap.size(); ++child) {
+				_pop_order.push_back(child);
+				std::push_heap(_pop_order.begin(), _pop_order.end(), less);
+			}
+		}
+	}
+
+	// Drops dormant handles of deleted edges once they make up a large part of the dormant set
+	void on_deleted(size_t edge_count);
+
+	template <typename CallbackT>
+	void for_each(const CallbackT& callback) const {
+		for (size_t i = 0; i < size(); ++i) {
+			callback((*this)[i]);
+		}
+		for (const auto& [id, cell] : _dormant) {
+			for (uint32_t i = cell.first; i != NoEdge; i = _dormant_edges[i].next) {
+				callback(_dormant_edges[i].handle);
+			}
+		}
+	}
+
+private:
+	struct prioritized {
+		double distance_sqr;
+		uint64_t order;
+		edge_handle handle;
+
+		bool operator<(const prioritized& rhs) const;
+	};
+
+	static constexpr uint32_t NoEdge = ~uint32_t(0);
+
+	// The dormant edges of a cell are linked in park order through _dormant_edges
+	struct dormant_cell {
+		int64_t x;
+		int64_t y;
+		int64_t z;
+		uint32_t first = NoEdge;
+		uint32_t last = NoEdge;
+	};
+
+	struct dormant_edge {
+		edge_handle handle;
+		uint32_t next;
+	};
+
+	using dormant_cells = std::unordered_map<uint64_t, dormant_cell>;
+
+	void _activate(edge_handle);
+	bool _wake(dormant_cell&, const vec3& center, double radius_sqr);
+	template <typename KeepT>
+	bool _filter(dormant_cell&, const KeepT& keep);
+	dormant_cells::iterator _remove_cell(dormant_cells::iterator);
+	void _refocus(const vec3& center);
+	void _drop_dead();
+
+	const object_pool<edge>& _edges;
+	double _inv_cell_size;
+	double _cell_size;
+
+	std::vector<edge_handle> _queue;
+	size_t _queue_head = 0; // The popped handles before it are dropped once they are half of the queue
+	std::vector<prioritized> _heap;
+	mutable std::vector<size_t> _pop_order; // The heap indices to visit next in for_each_in_pop_order
+	bool _prioritize = false;
+	double _refocus_distance = 0;
+	uint64_t _order = 0;
+
+	dormant_cells _dormant;
+	std::vector<dormant_cells::node_type> _spare_cells;
+	std::vector<dormant_edge> _dormant_edges;
+	uint32_t _free_dormant_edge = NoEdge;
+	size_t _dormant_count = 0;
+	size_t _deleted_since_drop = 0;
+
+	vec3 _center = vec3d::zero;
+	vec3 _keyed_center = vec3d::zero;
+	double _radius = -1;
+};
+}
@@ -1,11 +1,15 @@
 #pragma once
 
-#include <vector>
 #include "core/math/vec3.h"
+#include "core/util/inline_vector.h"
 
 namespace playchilla {
 class edge;
 
+// Nodes of a finished surface have eight edges or less but for a few, those never allocate. Edges are kept as pointers
+// rather than 32-bit pool handles so a node can walk its neighbors without the surface memory that owns the pools.
+using node_edges = inline_vector<edge*, 8>;
+
 class node {
 public:
 	node(const vec3& pos, const vec3& normal);
@@ -24,7 +28,9 @@ public:
 
 	vec3 pos;
 	vec3 normal;
-	std::vector<edge*> edges;
+	node_edges edges;
+	uint32_t visit_mark = 0; // Scratch for walks over the neighbors, owned by surface_memory
+	int8_t hash_level = 0; // The level of the node hash it is in, owned by surface_memory
 
 private:
 	bool _is_removed = false;
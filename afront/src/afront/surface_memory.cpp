@@ -6,7 +6,8 @@
 namespace playchilla {
 surface_memory::surface_memory(double cell_size, mesh_builder* mesh_builder) :
 	_node_hash(cell_size),
-	_mesh_builder(mesh_builder) {
+	_mesh_builder(mesh_builder),
+	_front(_edges, cell_size) {
 }
 
 const node_hash& surface_memory::get_node_hash() const {
@@ -29,17 +30,36 @@ std::vector<node*> surface_memory::get_nodes(const vec3& pos, double radius) con
 	return _node_hash.get_values(pos, radius);
 }
 
-const edge_queue& surface_memory::get_front() const {
-	return _queue;
+const edge_front& surface_memory::get_front() const {
+	return _front;
 }
 
-node* surface_memory::add_node(const vec3& pos, const vec3& normal) {
-	return _node_hash.add(create_node(pos, normal));
+edge* surface_memory::get_edge(edge_handle handle) const {
+	return _edges.get(handle);
+}
+
+size_t surface_memory::get_allocated_bytes() const {
+	size_t adjacency_bytes = 0;
+	_node_hash.for_each_value([&adjacency_bytes](const node* n) {
+		adjacency_bytes += n->edges.get_heap_bytes();
+	});
+	return _nodes.get_allocated_bytes() +
+		_edges.get_allocated_bytes() +
+		adjacency_bytes +
+		_node_hash.get_allocated_bytes() +
+		_front.get_allocated_bytes() +
+		(_removed_nodes.capacity() * sizeof(node_handle)) +
+		(_removed_edges.capacity() * sizeof(edge_handle));
+}
+
+node* surface_memory::add_node(const vec3& pos, const vec3& normal, double cell_size) {
+	node* n = create_node(pos, normal);
+	n->hash_level = static_cast<int8_t>(cell_size > 0 ? _node_hash.get_level(cell_size) : 0);
+	return _node_hash.add(n, n->hash_level);
 }
 
 node* surface_memory::create_node(const vec3& pos, const vec3& normal) {
-	_nodes.push_back(std::make_unique<node>(pos, normal));
-	return _nodes.back().get();
+	return _nodes.create(pos, normal);
 }
 
 edge* surface_memory::push(node* a, node* b) {
@@ -47,18 +67,21 @@ edge* surface_memory::push(node* a, node* b) {
 	assertion(!a->has_edge_to(b), "An edge already has a connection to the other node");
 	assertion(!b->has_edge_to(a), "An edge already has a connection to the other node");
 
-	_edges.push_back(std::make_unique<edge>(a, b));
-	auto* edge = _edges.back().get();
+	auto* edge = _edges.create(a, b);
 	a->edges.push_back(edge);
 	b->edges.push_back(edge);
-	_queue.push_back(edge);
+	_front.push(edge);
 	notify_new_edge(edge);
 	return edge;
 }
 
 void surface_memory::remove_node(node* node) {
 	notify_remove_node(node);
-	_node_hash.remove(node);
+	_node_hash.remove(node, node->hash_level);
+	_removed_nodes.push_back(_nodes.get_handle(node));
+	for (const auto* e : node->edges) {
+		_removed_edges.push_back(_edges.get_handle(e));
+	}
 	node->mark_for_removal();
 }
 
@@ -67,39 +90,71 @@ void surface_memory::push(edge* edge) {
 	assertion(!edge->b->is_removed(), "Adding an edge with removed node");
 	assertion(edge->is_used(), "Adding an unused edge.");
 	edge->reuse();
-	_queue.push_back(edge);
+	_front.push(edge);
 }
 
 edge* surface_memory::pop_edge() {
-	if (_queue.empty()) {
-		return nullptr;
-	}
-	auto* e = _queue.front();
-	_queue.pop_front();
-	return e;
+	return _front.pop();
+}
+
+void surface_memory::park(edge* edge) {
+	assertion(edge->is_used(), "Parking an unused edge.");
+	edge->reuse();
+	_front.park(edge);
+}
+
+void surface_memory::focus_front(const vec3& center, double radius) {
+	_front.focus(center, radius);
+}
+
+void surface_memory::prioritize_near(double refocus_distance) {
+	_front.prioritize_near(refocus_distance);
 }
 
 void surface_memory::delete_removed() {
-	std::erase_if(_queue, [](const edge* e) {
-		return e->a->is_removed() || e->b->is_removed();
-	});
+	// the same edge is tracked once per removed end point, dead handles are skipped
+	size_t deleted_edges = 0;
+	for (const auto handle : _removed_edges) {
+		if (auto* e = _edges.get(handle)) {
+			_edges.destroy(e);
+			++deleted_edges;
+		}
+	}
+	_removed_edges.clear();
 
-	std::erase_if(_edges, [](const std::unique_ptr<edge>& e) {
-		return e->a->is_removed() || e->b->is_removed();
-	});
+	for (const auto handle : _removed_nodes) {
+		if (auto* n = _nodes.get(handle)) {
+			_nodes.destroy(n);
+		}
+	}
+	_removed_nodes.clear();
 
-	std::erase_if(_nodes, [](const std::unique_ptr<node>& n) {
-		return n->is_removed();
-	});
+	// queued handles of deleted edges are skipped when popped, but an empty surface should also have an empty front
+	if (_nodes.size() == 0) {
+		_front.clear();
+	}
+	else {
+		_front.on_deleted(deleted_edges);
+	}
 }
 
 void surface_memory::collapse_node(node* n) {
 	assertion(!n->is_removed(), "Node already removed");
 
+	// mark the neighbors that still have an edge to n, so that a triangle test is a compare instead of a scan
+	if (++_visit_mark == 0) {
+		++_visit_mark;
+	}
+	const uint32_t mark = _visit_mark;
+	for (const edge* e : n->edges) {
+		e->get_other(n)->visit_mark = mark;
+	}
+
 	// update neighbors
 	for (edge* current_edge : n->edges) {
 		current_edge->use();
 		node* other = current_edge->get_other(n);
+		other->visit_mark = 0;
 		auto other_edge_it = other->edges.begin();
 		while (other_edge_it != other->edges.end()) {
 			edge* other_edge = *other_edge_it;
@@ -111,7 +166,7 @@ void surface_memory::collapse_node(node* n) {
 			if (!other_edge->is_used()) {
 				continue;
 			}
-			if (other_edge->get_other(other)->has_edge_to(n)) {
+			if (other_edge->get_other(other)->visit_mark == mark) {
 				push(other_edge);
 			}
 		}
@@ -145,13 +200,18 @@ void surface_memory::collapse_nodes_outside(const vec3& center, double radius) {
 }
 
 void surface_memory::collapse_node_cells_outside(const vec3& center, double radius) {
-	nodes to_collapse;
-	_node_hash.for_each_cell([&to_collapse, center, r2 = radius * radius](const nodes& nodes) {
+	std::vector<const node_hash::cell_values*> cells;
+	_node_hash.for_each_cell([&cells, center, r2 = radius * radius](const node_hash::cell_values& nodes) {
 		if (nodes[0]->pos.distance_sqr(center) > r2) {
-			to_collapse.insert(to_collapse.begin(), nodes.begin(), nodes.end());
+			cells.push_back(&nodes);
 		}
 	});
 
+	// the last found cell is collapsed first, copy the nodes since collapsing modifies the cells
+	nodes to_collapse;
+	for (auto cell = cells.rbegin(); cell != cells.rend(); ++cell) {
+		to_collapse.insert(to_collapse.end(), (*cell)->begin(), (*cell)->end());
+	}
 	for (auto* node : to_collapse) {
 		if (!node->is_removed()) {
 			collapse_node(node);
@@ -184,10 +244,14 @@ void surface_memory::notify_follow_surface_fail() const {
 }
 
 void surface_memory::validate() const {
-	for (const auto* edge : _queue) {
+	_front.for_each([this](edge_handle handle) {
+		const auto* edge = get_edge(handle);
+		if (edge == nullptr) {
+			return;
+		}
 		assertion(!edge->a->is_removed(), "Validation: An edge in the queue has been removed");
 		assertion(!edge->b->is_removed(), "Validation: An edge in the queue has been removed");
-	}
+	});
 
 	size_t twice_edge_count = 0;
 	size_t node_count = 0;
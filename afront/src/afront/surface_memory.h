@@ -1,16 +1,17 @@
 #pragma once
 
 #include <memory>
-#include <queue>
 
+#include "edge.h"
+#include "edge_front.h"
 #include "node.h"
-#include "core/spatial/point_spatial_hash.h"
+#include "core/spatial/multi_level_point_hash.h"
+#include "core/util/object_pool.h"
 
 namespace playchilla {
-using node_hash = point_spatial_hash3<node*>;
-using edge_queue = std::deque<edge*>;
+using node_hash = multi_level_point_hash<node*>;
+using node_handle = object_pool<node>::handle;
 using nodes = std::vector<node*>;
-using edge_collection = std::vector<std::unique_ptr<edge>>;
 
 class surface_memory {
 public:
@@ -21,9 +22,13 @@ public:
 	size_t get_node_count() const;
 	size_t get_edge_count() const;
 	std::vector<node*> get_nodes(const vec3& pos, double radius) const;
-	const edge_queue& get_front() const;
+	const edge_front& get_front() const;
+	edge* get_edge(edge_handle) const;
+	size_t get_allocated_bytes() const; // Nodes, edges, adjacency, node hash and front
 
-	node* add_node(const vec3& pos, const vec3& normal);
+	// The node is indexed in cells of at least the cell size, the cell size of the memory by default. Where the edges are
+	// shorter the cells are too, so queries for near nodes don't scan the many nodes of large cells.
+	node* add_node(const vec3& pos, const vec3& normal, double cell_size = 0);
 	node* create_node(const vec3& pos, const vec3& normal);
 	void remove_node(node*);
 	void collapse_node(node*);
@@ -35,6 +40,12 @@ public:
 	void push(edge*);
 	edge* pop_edge();
 
+	// Parks a used edge until the front is focused within reach of it
+	void park(edge*);
+	void focus_front(const vec3& center, double radius);
+	void prioritize_near(double refocus_distance);
+
+	// Frees what has been removed since the last call, the cost is proportional to the number of removed nodes
 	void delete_removed();
 
 	void notify_new_triangle(const node*, const node*, const node*, const class volume_data&) const;
@@ -45,12 +56,13 @@ public:
 	void validate() const;
 
 private:
-	using node_collection = std::vector<std::unique_ptr<node>>;
-
 	node_hash _node_hash;
 	mesh_builder* _mesh_builder;
-	edge_queue _queue;
-	node_collection _nodes;
-	edge_collection _edges;
+	object_pool<node> _nodes;
+	object_pool<edge> _edges;
+	edge_front _front;
+	std::vector<node_handle> _removed_nodes;
+	std::vector<edge_handle> _removed_edges;
+	uint32_t _visit_mark = 0;
 };
 }
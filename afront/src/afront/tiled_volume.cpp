@@ -0,0 +1,141 @@
+#include "tiled_volume.h"
+
+#include <algorithm>
+#include <atomic>
+
+#include "core/debug/assertion.h"
+#include "core/math/math_util.h"
+#include "core/util/hash_util.h"
+
+namespace playchilla {
+namespace {
+std::atomic<uint64_t> next_id{1};
+}
+
+tiled_volume::tiled_volume(const volume* source, double tile_size, size_t max_tiles) :
+	_id(next_id++),
+	_source(source),
+	_tile_size(tile_size),
+	_inv_tile_size(1. / tile_size),
+	_max_tiles(max_tiles) {
+	assertion(tile_size > 0, "The tile size must be positive");
+	assertion(max_tiles > 0, "Must be able to hold a tile");
+}
+
+double tiled_volume::get_value(double x, double y, double z) const {
+	return _get_tile(x, y, z)->root->get_value(x, y, z);
+}
+
+void tiled_volume::get_values(std::span<const vec3> positions, std::span<double> values) const {
+	// each run of positions in the same tile goes to its volume as one batch
+	size_t begin = 0;
+	while (begin < positions.size()) {
+		const auto tx = _to_tile(positions[begin].x);
+		const auto ty = _to_tile(positions[begin].y);
+		const auto tz = _to_tile(positions[begin].z);
+		size_t end = begin + 1;
+		while (end < positions.size() && _to_tile(positions[end].x) == tx && _to_tile(positions[end].y) == ty &&
+			_to_tile(positions[end].z) == tz) {
+			++end;
+		}
+		_get_tile_at(tx, ty, tz)->root->get_values(positions.subspan(begin, end - begin), values.subspan(begin, end - begin));
+		begin = end;
+	}
+}
+
+double tiled_volume::get_value_and_gradient(double x, double y, double z, vec3& gradient) const {
+	return _get_tile(x, y, z)->root->get_value_and_gradient(x, y, z, gradient);
+}
+
+interval tiled_volume::get_interval(const aabb& box) const {
+	return _source->get_interval(box);
+}
+
+double tiled_volume::get_lipschitz(const aabb& box) const {
+	return _source->get_lipschitz(box);
+}
+
+void tiled_volume::get_data(const vec3& pos, volume_data& data) const {
+	_get_tile(pos.x, pos.y, pos.z)->root->get_data(pos, data);
+}
+
+double tiled_volume::get_value_and_data(const vec3& pos, volume_data& data) const {
+	return _get_tile(pos.x, pos.y, pos.z)->root->get_value_and_data(pos, data);
+}
+
+const volume* tiled_volume::get_source() const {
+	return _source;
+}
+
+double tiled_volume::get_tile_size() const {
+	return _tile_size;
+}
+
+size_t tiled_volume::get_tile_count() const {
+	std::lock_guard lock(_mutex);
+	return _tiles.size();
+}
+
+uint64_t tiled_volume::get_specialize_count() const {
+	std::lock_guard lock(_mutex);
+	return _specialize_count;
+}
+
+int64_t tiled_volume::_to_tile(double v) const {
+	return floor_to<int64_t>(v * _inv_tile_size);
+}
+
+const tiled_volume::tile* tiled_volume::_get_tile(double x, double y, double z) const {
+	return _get_tile_at(_to_tile(x), _to_tile(y), _to_tile(z));
+}
+
+// The tile stays alive while it is the last tile of the thread, even when it is dropped from the tiles meanwhile
+const tiled_volume::tile* tiled_volume::_get_tile_at(int64_t tx, int64_t ty, int64_t tz) const {
+	struct last_tile {
+		uint64_t id = 0;
+		int64_t x, y, z;
+		std::shared_ptr<const tile> t;
+	};
+	thread_local last_tile last;
+	if (last.id == _id && last.x == tx && last.y == ty && last.z == tz) {
+		return last.t.get();
+	}
+
+	const uint64_t key = hash_good(tx, ty, tz);
+	std::lock_guard lock(_mutex);
+	auto it = _tiles.find(key);
+	if (it != _tiles.end() && it->second.x == tx && it->second.y == ty && it->second.z == tz) {
+		it->second.last_use = ++_use;
+		last = {_id, tx, ty, tz, it->second.t};
+		return last.t.get();
+	}
+	if (it == _tiles.end() && _tiles.size() >= _max_tiles) {
+		_evict();
+	}
+
+	// a little larger than the tile so that positions rounded onto its sides are inside
+	const vec3 center = (vec3(static_cast<double>(tx), static_cast<double>(ty), static_cast<double>(tz)) + vec3(.5, .5, .5)) * _tile_size;
+	auto t = std::make_shared<tile>();
+	t->root = _source->specialize(aabb(center, 0.51 * _tile_size), t->owned);
+	++_specialize_count;
+	tile_entry& entry = _tiles[key];
+	entry = {tx, ty, tz, ++_use, std::move(t)};
+	last = {_id, tx, ty, tz, entry.t};
+	return last.t.get();
+}
+
+void tiled_volume::_evict() const {
+	// drops the least recently used half at once so that the sorting is shared by many tiles, the tiles in use are kept
+	// alive by the threads that used them last
+	std::vector<std::pair<uint64_t, uint64_t>> uses;
+	uses.reserve(_tiles.size());
+	for (const auto& [key, entry] : _tiles) {
+		uses.emplace_back(entry.last_use, key);
+	}
+	const size_t count = std::max<size_t>(1, uses.size() / 2);
+	std::nth_element(uses.begin(), uses.begin() + static_cast<std::ptrdiff_t>(count - 1), uses.end());
+	for (size_t i = 0; i < count; ++i) {
+		_tiles.erase(uses[i].second);
+	}
+}
+}
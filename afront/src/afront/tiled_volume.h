@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include "volume.h"
+
+namespace playchilla {
+/**
+ * Evaluates another volume by its specialization for the tile that each position is in, made the first time a
+ * position in the tile is queried. When there are more than max tiles the least recently used ones are dropped.
+ * Safe to use from several threads, each remembers the last tile it used so that runs of positions in the same tile
+ * don't need the lock. The remembered tile is kept alive by the thread, so a tiled volume must not be evaluated from
+ * within the source of another one.
+ */
+class tiled_volume : public volume {
+public:
+	tiled_volume(const volume* source, double tile_size, size_t max_tiles = 4096);
+
+	using volume::get_value;
+	using volume::get_value_and_gradient;
+	double get_value(double x, double y, double z) const override;
+	void get_values(std::span<const vec3> positions, std::span<double> values) const override;
+	double get_value_and_gradient(double x, double y, double z, vec3& gradient) const override;
+	interval get_interval(const aabb& box) const override;
+	double get_lipschitz(const aabb& box) const override;
+	void get_data(const vec3& pos, volume_data& data) const override;
+	double get_value_and_data(const vec3& pos, volume_data& data) const override;
+
+	const volume* get_source() const;
+	double get_tile_size() const;
+	size_t get_tile_count() const;
+	uint64_t get_specialize_count() const; // Tiles made, including the dropped ones
+
+private:
+	struct tile {
+		volume_unique_ptrs owned;
+		const volume* root = nullptr;
+	};
+
+	struct tile_entry {
+		int64_t x, y, z;
+		uint64_t last_use = 0;
+		std::shared_ptr<const tile> t;
+	};
+
+	int64_t _to_tile(double v) const;
+	const tile* _get_tile(double x, double y, double z) const;
+	const tile* _get_tile_at(int64_t tx, int64_t ty, int64_t tz) const;
+	void _evict() const;
+
+	const uint64_t _id; // Tells the last tiles of the threads apart, unlike addresses they are never reused
+	const volume* _source;
+	const double _tile_size;
+	const double _inv_tile_size;
+	const size_t _max_tiles;
+	mutable std::mutex _mutex;
+	mutable std::unordered_map<uint64_t, tile_entry> _tiles;
+	mutable uint64_t _use = 0;
+	mutable uint64_t _specialize_count = 0;
+};
+}
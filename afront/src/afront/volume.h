@@ -1,13 +1,23 @@
 #pragma once
 
+#include <algorithm>
+#include <limits>
 #include <memory>
+#include <span>
+#include <utility>
 #include <vector>
 
+#include "core/math/aabb.h"
+#include "core/math/interval.h"
 #include "core/math/vec3.h"
 
 namespace playchilla {
+class volume;
 class volume_data;
 
+using volume_unique_ptr = std::unique_ptr<volume>;
+using volume_unique_ptrs = std::vector<std::unique_ptr<volume>>;
+
 class volume {
 public:
 	// todo: Minimum normalizable double number
@@ -25,10 +35,115 @@ public:
 		return get_value(pos.x, pos.y, pos.z);
 	}
 
+	double get_value_and_gradient(const vec3& pos, vec3& gradient) const {
+		return get_value_and_gradient(pos.x, pos.y, pos.z, gradient);
+	}
+
 	virtual double get_value(double x, double y, double z) const = 0;
 	virtual void get_data(const vec3& pos, volume_data&) const = 0;
-};
 
-using volume_unique_ptr = std::unique_ptr<volume>;
-using volume_unique_ptrs = std::vector<std::unique_ptr<volume>>;
+	// Evaluates many positions at once, the values are the same as get_value for each of the positions
+	virtual void get_values(std::span<const vec3> positions, std::span<double> values) const {
+		for (size_t i = 0; i < positions.size(); ++i) {
+			values[i] = get_value(positions[i].x, positions[i].y, positions[i].z);
+		}
+	}
+
+	// The value and how it changes with the position, by central differences unless the volume knows the exact one
+	virtual double get_value_and_gradient(double x, double y, double z, vec3& gradient) const {
+		constexpr double h = GradientStep;
+		gradient = {
+			get_value(x + h, y, z) - get_value(x - h, y, z),
+			get_value(x, y + h, z) - get_value(x, y - h, z),
+			get_value(x, y, z + h) - get_value(x, y, z - h)};
+		gradient *= 0.5 / h;
+		return get_value(x, y, z);
+	}
+
+	// The value and the data in one walk, volumes that pick a source by its value give the data of the one they picked
+	virtual double get_value_and_data(const vec3& pos, volume_data& data) const {
+		get_data(pos, data);
+		return get_value(pos.x, pos.y, pos.z);
+	}
+
+	// Contains every value within the box, volumes that can't bound their values give the whole range
+	virtual interval get_interval(const aabb& box) const {
+		return {MIN_VALUE, MAX_VALUE};
+	}
+
+	// No two positions within the box have values further apart than this times their distance, infinite when unknown
+	virtual double get_lipschitz(const aabb& box) const {
+		return std::numeric_limits<double>::infinity();
+	}
+
+	// A volume with the same values and data within the box, without the parts that can't matter there. The volumes it
+	// creates are added to owned, volumes that can't leave anything out are their own specialization.
+	virtual const volume* specialize(const aabb& box, volume_unique_ptrs& owned) const {
+		return this;
+	}
+
+	// A volume with values at most tolerance from these, without the detail that is smaller than that, like the finer
+	// octaves of fbm. The data is the same. The volumes it creates are added to owned, volumes that can't leave
+	// anything out are their own approximation.
+	virtual const volume* approximate(double tolerance, volume_unique_ptrs& owned) const {
+		return this;
+	}
+
+	// The largest distance of a value from 0 anywhere, from the interval of a box that holds everything
+	double get_magnitude() const {
+		const interval all = get_interval(aabb::create_from_min_max(vec3(MIN_VALUE, MIN_VALUE, MIN_VALUE), vec3(MAX_VALUE, MAX_VALUE, MAX_VALUE)));
+		return std::max(-all.lower, all.upper);
+	}
+
+	// Step of the central differences, small compared to the edge lengths of a front
+	static constexpr double GradientStep = 1e-4;
+
+protected:
+	template <typename T, typename... Args>
+	static const T* _own(volume_unique_ptrs& owned, Args&&... args) {
+		auto v = std::make_unique<T>(std::forward<Args>(args)...);
+		const T* ptr = v.get();
+		owned.push_back(std::move(v));
+		return ptr;
+	}
+
+	// Specializes each of the sources, returns false if all of them are their own specialization
+	static bool _specialize(std::span<const volume* const> sources, const aabb& box, volume_unique_ptrs& owned, std::vector<const volume*>& specialized) {
+		bool changed = false;
+		specialized.clear();
+		for (const volume* source : sources) {
+			specialized.push_back(source->specialize(box, owned));
+			changed |= specialized.back() != source;
+		}
+		return changed;
+	}
+
+	// Approximates each of the sources within the tolerance, returns false if all of them are their own approximation
+	static bool _approximate(std::span<const volume* const> sources, double tolerance, volume_unique_ptrs& owned, std::vector<const volume*>& approximated) {
+		bool changed = false;
+		approximated.clear();
+		for (const volume* source : sources) {
+			approximated.push_back(source->approximate(tolerance, owned));
+			changed |= approximated.back() != source;
+		}
+		return changed;
+	}
+
+	// Largest batch the overrides work on, they keep their intermediate values on the stack
+	static constexpr size_t BatchSize = 16;
+
+	// Scratch positions for a batch, not initialized since the overrides write them before reading
+	union batch_positions {
+		batch_positions() {}
+		vec3 data[BatchSize];
+	};
+
+	template <typename CallbackT>
+	static void for_each_batch(std::span<const vec3> positions, std::span<double> values, const CallbackT& callback) {
+		for (size_t i = 0; i < positions.size(); i += BatchSize) {
+			const size_t count = std::min(BatchSize, positions.size() - i);
+			callback(positions.subspan(i, count), values.subspan(i, count));
+		}
+	}
+};
 }
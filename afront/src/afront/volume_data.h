@@ -1,15 +1,68 @@
 #pragma once
 
-#include <any>
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <typeinfo>
+#include <utility>
 
 namespace playchilla {
+/**
+ * The edge length and a custom payload of a position in a volume. The payload is a small trivially copyable value kept in
+ * place, so that the data can be reset and copied on every step without allocations. A type tag is kept with it, get throws
+ * std::bad_cast for another type as the std::any_cast it replaces did.
+ */
 class volume_data {
 public:
+	static constexpr size_t PayloadSize = 16;
+
 	volume_data(double edge_len) : edge_len(edge_len) {
 	}
 
 	double edge_len;
 
-	std::any custom_data;
+	template <typename T>
+	void set(const T& value) {
+		static_assert(std::is_trivially_copyable_v<T> && std::is_trivially_destructible_v<T>, "The payload is copied as bytes");
+		static_assert(sizeof(T) <= PayloadSize && alignof(T) <= alignof(double), "The payload must fit in place");
+		std::construct_at(reinterpret_cast<T*>(_payload.data()), value);
+		_type = _get_type<T>();
+	}
+
+	template <typename T>
+	T& get() {
+		return const_cast<T&>(std::as_const(*this).get<T>());
+	}
+
+	template <typename T>
+	const T& get() const {
+		const T* value = get_if<T>();
+		if (value == nullptr) {
+			throw std::bad_cast();
+		}
+		return *value;
+	}
+
+	template <typename T>
+	const T* get_if() const {
+		return _type == _get_type<T>() ? std::launder(reinterpret_cast<const T*>(_payload.data())) : nullptr;
+	}
+
+	bool has_value() const {
+		return _type != nullptr;
+	}
+
+private:
+	// The address of a variable per type tells the types apart without type info
+	template <typename T>
+	static const void* _get_type() {
+		static constexpr char tag = 0;
+		return &tag;
+	}
+
+	alignas(double) std::array<std::byte, PayloadSize> _payload{};
+	const void* _type = nullptr;
 };
 }
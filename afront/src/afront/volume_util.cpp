@@ -1,5 +1,15 @@
 #include "volume_util.h"
 
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <unordered_map>
+
+#include "core/util/hash_util.h"
+#include "core/util/worker_pool.h"
+
 namespace playchilla {
 bool in_air(double v) {
 	return v < 0;
@@ -70,19 +80,349 @@ std::optional<vec3> find_random_surface_pos(const volume* volume) {
 	return {};
 }
 
-std::optional<vec3> follow_surface(const volume* source, const vec3& start_pos, const vec3& ba_dir, double step_size, double distance) {
+namespace {
+struct surface_cell {
+	int64_t x, y, z;
+	vec3 center;
+	size_t group;
+};
+
+// Splits the cube of cells in eight until single cells, leaving out the parts that the surface can't pass through
+void find_surface_cells(const volume* source, const vec3& origin, double cell_size, int64_t x, int64_t y, int64_t z, int64_t cells, std::vector<surface_cell>& found) {
+	const vec3 min = origin + vec3(static_cast<double>(x), static_cast<double>(y), static_cast<double>(z)) * cell_size;
+	const double size = static_cast<double>(cells) * cell_size;
+	if (!source->get_interval(aabb::create_from_min_max(min, min + vec3(size, size, size))).contains(0.)) {
+		return;
+	}
+	if (cells == 1) {
+		found.push_back({x, y, z, min + vec3(size, size, size) * .5, 0});
+		return;
+	}
+	const int64_t half = cells / 2;
+	for (int64_t i = 0; i < 8; ++i) {
+		find_surface_cells(source, origin, cell_size, x + (i & 1) * half, y + ((i >> 1) & 1) * half, z + ((i >> 2) & 1) * half, half, found);
+	}
+}
+
+// The corners and center of the cell
+std::array<vec3, 9> get_cell_samples(const vec3& center, double cell_size) {
+	std::array<vec3, 9> samples;
+	const double h = cell_size * .5;
+	for (size_t i = 0; i < 8; ++i) {
+		samples[i] = center + vec3(i & 1 ? h : -h, i & 2 ? h : -h, i & 4 ? h : -h);
+	}
+	samples[8] = center;
+	return samples;
+}
+
+bool has_surface(const volume* source, const vec3& center, double cell_size) {
+	std::array<double, 9> values;
+	source->get_values(get_cell_samples(center, cell_size), values);
+	return std::ranges::any_of(values, [](double v) { return in_air(v); }) && std::ranges::any_of(values, [](double v) { return !in_air(v); });
+}
+
+// Bisects between a sample in air and a solid one of a cell that has the surface
+vec3 find_cell_surface(const volume* source, const vec3& center, double cell_size) {
+	const auto samples = get_cell_samples(center, cell_size);
+	std::array<double, 9> values;
+	source->get_values(samples, values);
+	vec3 air_pos = samples[std::ranges::find_if(values, [](double v) { return in_air(v); }) - values.begin()];
+	vec3 solid_pos = samples[std::ranges::find_if(values, [](double v) { return !in_air(v); }) - values.begin()];
+	for (int i = 0; i < 20; ++i) {
+		const vec3 mid = (solid_pos + air_pos) * .5;
+		(in_air(source, mid) ? air_pos : solid_pos) = mid;
+	}
+	return (solid_pos + air_pos) * .5;
+}
+
+size_t find_group(std::vector<surface_cell>& cells, size_t i) {
+	while (cells[i].group != i) {
+		cells[i].group = cells[cells[i].group].group;
+		i = cells[i].group;
+	}
+	return i;
+}
+
+// A crossing between s0 on the start side and s1 past the surface. It is narrowed by secant steps, and a bisection after a
+// step that didn't halve it.
+struct bracket {
+	double s0, v0, s1, v1;
+	double width = 0;
+	bool bisect = false;
+
+	// The distance to evaluate next, NaN when the crossing is within the tolerance
+	double next(double tolerance) {
+		if (!(s1 - s0 > tolerance)) {
+			return std::numeric_limits<double>::quiet_NaN();
+		}
+		width = s1 - s0;
+		double s = bisect ? .5 * (s0 + s1) : s0 + width * v0 / (v0 - v1);
+		if (!(s > s0 && s < s1)) {
+			s = .5 * (s0 + s1);
+			if (!(s > s0 && s < s1)) {
+				return std::numeric_limits<double>::quiet_NaN();
+			}
+		}
+		return s;
+	}
+
+	void update(double s, double v, bool pos_in_air) {
+		if (in_air(v) == pos_in_air) {
+			s0 = s;
+			v0 = v;
+		}
+		else {
+			s1 = s;
+			v1 = v;
+		}
+		bisect = s1 - s0 > .5 * width;
+	}
+};
+
+// Narrows the bracket along dir down to the tolerance
+vec3 refine_crossing(const volume* source, const vec3& pos, const vec3& dir, bool pos_in_air, bracket b, double tolerance) {
+	for (double s = b.next(tolerance); !std::isnan(s); s = b.next(tolerance)) {
+		b.update(s, source->get_value(pos + dir * s), pos_in_air);
+	}
+	return pos + dir * b.s1;
+}
+
+// find_surface along a direction, the start value is evaluated when refining needs it and it isn't known
+std::optional<vec3> find_crossing(const volume* source, const vec3& pos, const vec3& dir, bool pos_in_air, double step_size, double max_distance, double tolerance, double start_value) {
+	// march in growing batches, the surface is often found within the first steps
+	std::array<vec3, 8> test_positions;
+	std::array<double, 8> distances;
+	std::array<double, 8> values;
+	size_t batch_size = 1;
+	double s = step_size;
+	double last_s = 0;
+	double last_value = start_value;
+	while (s <= max_distance) {
+		size_t count = 0;
+		for (; count < batch_size && s <= max_distance; ++count, s += step_size) {
+			test_positions[count] = pos + dir * s;
+			distances[count] = s;
+		}
+		source->get_values(std::span(test_positions).first(count), std::span(values).first(count));
+		for (size_t i = 0; i < count; ++i) {
+			if (pos_in_air != in_air(values[i])) {
+				if (tolerance <= 0) {
+					return test_positions[i];
+				}
+				if (std::isnan(last_value)) {
+					last_value = source->get_value(pos);
+				}
+				return refine_crossing(source, pos, dir, pos_in_air, {last_s, last_value, distances[i], values[i]}, tolerance);
+			}
+			last_s = distances[i];
+			last_value = values[i];
+		}
+		batch_size = std::min(2 * batch_size, test_positions.size());
+	}
+	return {};
+}
+
+/**
+ * Sphere traces a ray one evaluation at a time, so that the evaluations of many rays can be batched. Each step is the
+ * distance to the surface that the value and the Lipschitz bound of the segment of the ray it is in guarantee, times
+ * the over-relaxation. A relaxed step is taken back and retaken without relaxation when its sphere doesn't overlap the one
+ * it came from or it ends past the surface, since it may have passed a thin part.
+ */
+class ray_tracer {
+public:
+	static constexpr double OverRelaxation = 1.5;
+
+	ray_tracer(const volume* source, const ray& r, double tolerance, double step_size) :
+		_source(source),
+		_ray(r),
+		_tolerance(tolerance),
+		_step_size(step_size),
+		_segment_length(std::max(step_size, 2 * tolerance)) {
+		assertion(tolerance > 0, "The tolerance must be positive");
+		assertion(step_size > 0, "The step size must be positive");
+	}
+
+	// The position to evaluate next, none when the trace is done
+	std::optional<vec3> next() const {
+		if (_done) {
+			return {};
+		}
+		return _get_pos(_t);
+	}
+
+	void update(double value) {
+		if (_refining) {
+			_bracket.update(_t, value, true);
+			_refine();
+		}
+		else if (!_started) {
+			_started = true;
+			if (in_air(value)) {
+				_accept(0, value);
+			}
+			else {
+				_finish(0);
+			}
+		}
+		else if (!in_air(value)) {
+			if (_relaxed) {
+				_retake();
+			}
+			else {
+				_bracket = {_s, _v, _t, value};
+				_refining = true;
+				_refine();
+			}
+		}
+		else if (_relaxed && _radius - value / _lipschitz < _t - _s) {
+			_retake();
+		}
+		else {
+			_accept(_t, value);
+		}
+	}
+
+	const std::optional<vec3>& get_hit() const {
+		return _hit;
+	}
+
+private:
+	vec3 _get_pos(double s) const {
+		return _ray.origin + _ray.dir * s;
+	}
+
+	void _accept(double s, double value) {
+		_s = s;
+		_v = value;
+		if (!_relaxed) {
+			_omega = OverRelaxation;
+		}
+		if (s >= _ray.length) {
+			_done = true;
+			return;
+		}
+		if (s >= _segment_end) {
+			_segment_end = std::min(s + _segment_length, _ray.length);
+			const vec3 a = _get_pos(s);
+			const vec3 b = _get_pos(_segment_end);
+			_lipschitz = _source->get_lipschitz(aabb::create_from_min_max(a.get_min(b), a.get_max(b)));
+		}
+		_plan_step();
+	}
+
+	void _retake() {
+		_omega = 1;
+		_plan_step();
+	}
+
+	void _plan_step() {
+		const bool bounded = std::isfinite(_lipschitz);
+		_radius = bounded ? -_v / _lipschitz : 0.;
+		double step = bounded ? _omega * _radius : _step_size;
+		_relaxed = bounded && step > _radius && step > _tolerance;
+		step = std::max(step, _tolerance);
+		if (_s + step >= _segment_end) {
+			// a longer segment where the steps reach past it
+			step = _segment_end - _s;
+			_relaxed = _relaxed && step > _radius;
+			_segment_length *= 2;
+		}
+		else {
+			_segment_length = std::max(2 * _tolerance, 4 * step);
+		}
+		_t = _s + step;
+	}
+
+	void _refine() {
+		const double s = _bracket.next(_tolerance);
+		if (std::isnan(s)) {
+			_finish(_bracket.s1);
+		}
+		else {
+			_t = s;
+		}
+	}
+
+	void _finish(double s) {
+		_hit = _get_pos(s);
+		_done = true;
+	}
+
+	const volume* _source;
+	const ray _ray;
+	const double _tolerance;
+	const double _step_size;
+	double _segment_length;
+	double _segment_end = 0;
+	double _lipschitz = 0;
+	double _omega = OverRelaxation;
+	double _s = 0; // The last accepted distance, in air
+	double _v = 0;
+	double _t = 0; // The distance being evaluated
+	double _radius = 0; // The unrelaxed step from _s
+	bool _relaxed = false;
+	bool _started = false;
+	bool _refining = false;
+	bool _done = false;
+	bracket _bracket{};
+	std::optional<vec3> _hit;
+};
+}
+
+std::vector<vec3> find_surface_components(const volume* source, const aabb& box, double cell_size) {
+	assertion(cell_size > 0, "The cell size must be positive");
+	int64_t cells = 1;
+	while (static_cast<double>(cells) * cell_size < box.get_max_component()) {
+		cells *= 2;
+	}
+	std::vector<surface_cell> found;
+	find_surface_cells(source, box.get_min(), cell_size, 0, 0, 0, cells, found);
+
+	// groups the cells that touch by their sides, edges or corners
+	std::unordered_map<uint64_t, size_t> cell_indices;
+	for (size_t i = 0; i < found.size(); ++i) {
+		found[i].group = i;
+		cell_indices.emplace(hash_good(found[i].x, found[i].y, found[i].z), i);
+	}
+	for (size_t i = 0; i < found.size(); ++i) {
+		for (int64_t n = 0; n < 27; ++n) {
+			const auto it = cell_indices.find(hash_good(found[i].x + n % 3 - 1, found[i].y + n / 3 % 3 - 1, found[i].z + n / 9 - 1));
+			if (it != cell_indices.end()) {
+				found[find_group(found, it->second)].group = find_group(found, i);
+			}
+		}
+	}
+
+	// the nearest cell of each group that the surface passes through, the intervals also let some cells without it in
+	const vec3& center = box.get_center();
+	std::vector<size_t> order(found.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::ranges::sort(order, [&found, &center](size_t a, size_t b) { return found[a].center.distance_sqr(center) < found[b].center.distance_sqr(center); });
+	std::unordered_map<size_t, bool> seeded_groups;
+	std::vector<vec3> components;
+	for (const size_t i : order) {
+		bool& seeded = seeded_groups[find_group(found, i)];
+		if (!seeded && has_surface(source, found[i].center, cell_size)) {
+			components.push_back(find_cell_surface(source, found[i].center, cell_size));
+			seeded = true;
+		}
+	}
+	return components;
+}
+
+std::optional<vec3> follow_surface(const volume* source, const vec3& start_pos, const vec3& ba_dir, double step_size, double distance, normal_method method, double tolerance) {
 	vec3 surface_pos = start_pos;
 	std::optional<vec3> last_pos;
 	const double max_steps = distance / step_size;
 	for (int i = 0; i < max_steps; ++i) {
-		auto maybe_normal = calc_normal(source, surface_pos, distance);
+		auto maybe_normal = calc_normal(source, surface_pos, distance, method);
 		if (!maybe_normal) {
 			break;
 		}
 
 		vec3 dir = ba_dir.cross(*maybe_normal).normalize();
 		vec3 test_pos = surface_pos + dir * step_size;
-		auto maybe_surface_pos = find_surface(source, test_pos, step_size, distance);
+		auto maybe_surface_pos = find_surface(source, test_pos, step_size, distance, method, tolerance);
 		if (!maybe_surface_pos) {
 			break;
 		}
@@ -92,31 +432,93 @@ std::optional<vec3> follow_surface(const volume* source, const vec3& start_pos,
 	return last_pos;
 }
 
-std::optional<vec3> find_surface(const volume* source, const vec3& start_pos, double step_size, double distance) {
-	if (const auto maybe_surface_dir = calc_normal(source, start_pos, distance)) {
+std::optional<vec3> find_surface(const volume* source, const vec3& start_pos, double step_size, double distance, normal_method method, double tolerance) {
+	std::optional<vec3> maybe_surface_dir;
+	double start_value;
+	if (method == normal_method::gradient) {
+		vec3 gradient;
+		start_value = source->get_value_and_gradient(start_pos, gradient);
+		maybe_surface_dir = to_normal(gradient);
+	}
+	else {
+		// the start value is evaluated with the normal samples
+		std::array<vec3, 7> samples;
+		std::array<double, 7> values;
+		get_normal_samples(start_pos, distance, std::span(samples).first<6>());
+		samples[6] = start_pos;
+		source->get_values(samples, values);
+		start_value = values[6];
+		maybe_surface_dir = to_normal(std::span(values).first<6>());
+	}
+	if (maybe_surface_dir) {
 		const vec3& surface_dir = *maybe_surface_dir;
-		const bool air = in_air(source->get_value(start_pos));
-		return find_surface(source, start_pos, air ? -surface_dir : surface_dir, air, step_size, distance);
+		const bool air = in_air(start_value);
+		return find_crossing(source, start_pos, air ? -surface_dir : surface_dir, air, step_size, distance, tolerance, start_value);
 	}
 	return {};
 }
 
-std::optional<vec3> find_surface(const volume* source, const vec3& pos, const vec3& dir, bool pos_in_air, double step_size, double max_distance) {
-	for (double s = step_size; s <= max_distance; s += step_size) {
-		vec3 test_pos = pos + dir * s;
-		if (pos_in_air != in_air(source, test_pos)) {
-			return test_pos;
+std::optional<vec3> find_surface(const volume* source, const vec3& pos, const vec3& dir, bool pos_in_air, double step_size, double max_distance, double tolerance) {
+	return find_crossing(source, pos, dir, pos_in_air, step_size, max_distance, tolerance, std::numeric_limits<double>::quiet_NaN());
+}
+
+std::optional<vec3> trace_surface(const volume* source, const ray& r, double tolerance, double step_size) {
+	ray_tracer tracer(source, r, tolerance, step_size);
+	while (const auto pos = tracer.next()) {
+		tracer.update(source->get_value(*pos));
+	}
+	return tracer.get_hit();
+}
+
+void trace_surfaces(const volume* source, std::span<const ray> rays, std::span<std::optional<vec3>> hits, double tolerance, double step_size, worker_pool* workers) {
+	assertion(rays.size() == hits.size(), "A hit for each ray");
+	constexpr size_t ChunkSize = 64;
+	const auto trace_chunk = [&](size_t chunk) {
+		const size_t begin = chunk * ChunkSize;
+		const size_t count = std::min(ChunkSize, rays.size() - begin);
+		std::vector<ray_tracer> tracers;
+		tracers.reserve(count);
+		for (size_t i = 0; i < count; ++i) {
+			tracers.emplace_back(source, rays[begin + i], tolerance, step_size);
+		}
+		std::array<vec3, ChunkSize> positions;
+		std::array<double, ChunkSize> values;
+		std::array<size_t, ChunkSize> indices;
+		for (;;) {
+			size_t pending = 0;
+			for (size_t i = 0; i < count; ++i) {
+				if (const auto pos = tracers[i].next()) {
+					positions[pending] = *pos;
+					indices[pending++] = i;
+				}
+			}
+			if (pending == 0) {
+				break;
+			}
+			source->get_values(std::span(positions).first(pending), std::span(values).first(pending));
+			for (size_t i = 0; i < pending; ++i) {
+				tracers[indices[i]].update(values[i]);
+			}
+		}
+		for (size_t i = 0; i < count; ++i) {
+			hits[begin + i] = tracers[i].get_hit();
+		}
+	};
+	const size_t chunks = (rays.size() + ChunkSize - 1) / ChunkSize;
+	if (workers) {
+		workers->for_each_index(chunks, trace_chunk);
+	}
+	else {
+		for (size_t chunk = 0; chunk < chunks; ++chunk) {
+			trace_chunk(chunk);
 		}
 	}
-	return {};
 }
 
 bool is_blocked(const volume* source, const vec3& from, const vec3& to, double step_size) {
-	if (!in_air(source, from)) {
-		return true;
-	}
-	const vec3 dir = (to - from);
-	return static_cast<bool>(find_surface(source, from, dir.normalize(), true, step_size, dir.length()));
+	const vec3 dir = to - from;
+	const double length = dir.length();
+	return static_cast<bool>(trace_surface(source, {from, length > 0 ? dir * (1. / length) : dir, length}, step_size, step_size));
 }
 
 std::optional<vec3> find_solid(const volume* source, const vec3& from, double step_size, double distance) {
@@ -140,16 +542,43 @@ std::optional<vec3> calc_surface_dir(const volume* source, const vec3& pos, doub
 	return {};
 }
 
-std::optional<vec3> calc_normal(const volume* source, const vec3& pos, double distance) {
+std::optional<vec3> calc_normal(const volume* source, const vec3& pos, double distance, normal_method method) {
+	if (method == normal_method::gradient) {
+		vec3 gradient;
+		source->get_value_and_gradient(pos, gradient);
+		return to_normal(gradient);
+	}
+	std::array<vec3, 6> samples;
+	std::array<double, 6> values;
+	get_normal_samples(pos, distance, samples);
+	source->get_values(samples, values);
+	return to_normal(values);
+}
+
+void get_normal_samples(const vec3& pos, double distance, std::span<vec3, 6> samples) {
 	const double d = 0.4 * distance;
-	auto normal = vec3(
-		source->get_value(pos.x - d, pos.y, pos.z) - source->get_value(pos.x + d, pos.y, pos.z),
-		source->get_value(pos.x, pos.y - d, pos.z) - source->get_value(pos.x, pos.y + d, pos.z),
-		source->get_value(pos.x, pos.y, pos.z - d) - source->get_value(pos.x, pos.y, pos.z + d));
+	samples[0] = {pos.x - d, pos.y, pos.z};
+	samples[1] = {pos.x + d, pos.y, pos.z};
+	samples[2] = {pos.x, pos.y - d, pos.z};
+	samples[3] = {pos.x, pos.y + d, pos.z};
+	samples[4] = {pos.x, pos.y, pos.z - d};
+	samples[5] = {pos.x, pos.y, pos.z + d};
+}
+
+std::optional<vec3> to_normal(std::span<const double, 6> values) {
+	auto normal = vec3(values[0] - values[1], values[2] - values[3], values[4] - values[5]);
 	if (normal.length_sqr() < EpsilonSqr) {
 		return {};
 	}
 	normal.normalize_self();
 	return normal.length_sqr() < EpsilonSqr ? std::optional<vec3>{} : std::optional<vec3>(normal);
 }
+
+std::optional<vec3> to_normal(const vec3& gradient) {
+	// the values grow into the solid, so the normal is against the gradient
+	if (gradient.length_sqr() < EpsilonSqr) {
+		return {};
+	}
+	return -gradient.normalize();
+}
 }
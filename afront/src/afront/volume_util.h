@@ -1,20 +1,56 @@
 #pragma once
 
 #include <optional>
+#include <span>
+#include <vector>
 #include "volume.h"
 
 namespace playchilla {
+class worker_pool;
+
+// Normals by central differences over a distance, or from the gradient of the volume with a single evaluation
+enum class normal_method {
+	central_difference,
+	gradient,
+};
+
 std::optional<vec3> find_surface_along_ray(const volume*, const vec3& pos, const vec3& dir, double allowed_surface_distance);
 std::optional<vec3> find_random_surface_pos(const volume*);
 
-std::optional<vec3> follow_surface(const volume*, const vec3& start_pos, const vec3& ba_dir, double step_size, double distance);
-std::optional<vec3> find_surface(const volume*, const vec3& start_pos, double step_size, double distance);
-std::optional<vec3> find_surface(const volume*, const vec3& pos, const vec3& dir, bool pos_in_air, double step_size, double max_distance);
+// A surface position for each group of touching cells that the surface may pass through, nearest the center of the box
+// first. The box is split where the interval of the volume holds zero until the cells are no larger than cell_size.
+std::vector<vec3> find_surface_components(const volume*, const aabb& box, double cell_size);
+
+// The surface positions are the first step past the surface, or with a positive tolerance the crossing is bracketed by the
+// steps and narrowed down by secant and bisection steps until the position past it is within the tolerance
+std::optional<vec3> follow_surface(const volume*, const vec3& start_pos, const vec3& ba_dir, double step_size, double distance, normal_method = normal_method::central_difference, double tolerance = 0);
+std::optional<vec3> find_surface(const volume*, const vec3& start_pos, double step_size, double distance, normal_method = normal_method::central_difference, double tolerance = 0);
+std::optional<vec3> find_surface(const volume*, const vec3& pos, const vec3& dir, bool pos_in_air, double step_size, double max_distance, double tolerance = 0);
+
+// A segment from the origin along a unit direction
+struct ray {
+	vec3 origin;
+	vec3 dir;
+	double length = 0;
+};
+
+// The first solid position along the ray, past the surface by no more than the tolerance, or the origin when it is solid.
+// Sphere traces by the Lipschitz bounds of the volume with over-relaxed steps that are taken back when they may have passed
+// the surface, and marches with the step size where the volume has no bound.
+std::optional<vec3> trace_surface(const volume*, const ray&, double tolerance, double step_size);
+// trace_surface for each ray, the rays step together so that their evaluations are batched and chunks of them are traced
+// by the workers
+void trace_surfaces(const volume*, std::span<const ray> rays, std::span<std::optional<vec3>> hits, double tolerance, double step_size, worker_pool* workers = nullptr);
 
 bool is_blocked(const volume*, const vec3& from, const vec3& to, double step_size);
 std::optional<vec3> find_solid(const volume*, const vec3& from, double step_size, double distance);
 std::optional<vec3> find_air(const volume*, const vec3& from, double step_size, double distance);
 
 std::optional<vec3> calc_surface_dir(const volume*, const vec3& pos, double distance);
-std::optional<vec3> calc_normal(const volume*, const vec3& pos, double distance);
+std::optional<vec3> calc_normal(const volume*, const vec3& pos, double distance, normal_method = normal_method::central_difference);
+
+// calc_normal in two parts, for callers that batch the samples with other evaluations
+void get_normal_samples(const vec3& pos, double distance, std::span<vec3, 6> samples);
+std::optional<vec3> to_normal(std::span<const double, 6> values);
+std::optional<vec3> to_normal(const vec3& gradient);
 }
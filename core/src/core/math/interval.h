@@ -0,0 +1,95 @@
+#pragma once
+
+#include <ostream>
+
+#include "math_util.h"
+
+namespace playchilla {
+// The range [lower, upper] of a value, the operations give ranges that contain every possible result
+class interval {
+public:
+	double lower = 0, upper = 0;
+
+	interval() = default;
+
+	interval(double value) : lower(value), upper(value) {
+	}
+
+	interval(double lower, double upper) : lower(lower), upper(upper) {
+	}
+
+	bool contains(double value) const {
+		return lower <= value && value <= upper;
+	}
+
+	double get_width() const {
+		return upper - lower;
+	}
+
+	// The smallest interval containing both
+	interval hull(const interval& b) const {
+		return {min(lower, b.lower), max(upper, b.upper)};
+	}
+
+	interval operator-() const {
+		return {-upper, -lower};
+	}
+
+	interval operator+(const interval& b) const {
+		return {lower + b.lower, upper + b.upper};
+	}
+
+	interval operator-(const interval& b) const {
+		return {lower - b.upper, upper - b.lower};
+	}
+
+	interval operator*(double s) const {
+		return s >= 0 ? interval{lower * s, upper * s} : interval{upper * s, lower * s};
+	}
+
+	interval operator*(const interval& b) const {
+		const double p0 = lower * b.lower;
+		const double p1 = lower * b.upper;
+		const double p2 = upper * b.lower;
+		const double p3 = upper * b.upper;
+		return {min(min(p0, p1), min(p2, p3)), max(max(p0, p1), max(p2, p3))};
+	}
+
+	interval& operator+=(const interval& b) {
+		return *this = *this + b;
+	}
+
+	interval& operator*=(const interval& b) {
+		return *this = *this * b;
+	}
+
+	interval abs() const {
+		if (lower >= 0) {
+			return *this;
+		}
+		if (upper <= 0) {
+			return -*this;
+		}
+		return {0, max(-lower, upper)};
+	}
+};
+
+inline interval min(const interval& a, const interval& b) {
+	return {min(a.lower, b.lower), min(a.upper, b.upper)};
+}
+
+inline interval max(const interval& a, const interval& b) {
+	return {max(a.lower, b.lower), max(a.upper, b.upper)};
+}
+
+// from + a * (to - from) for a within [0, 1], exact since the result is linear in a for the bounds of from and to
+inline interval lerp(const interval& from, const interval& to, const interval& a) {
+	return {
+		min(from.lower + a.lower * (to.lower - from.lower), from.lower + a.upper * (to.lower - from.lower)),
+		max(from.upper + a.lower * (to.upper - from.upper), from.upper + a.upper * (to.upper - from.upper))};
+}
+
+inline std::ostream& operator<<(std::ostream& os, const interval& i) {
+	return os << "[" << i.lower << ", " << i.upper << "]";
+}
+}
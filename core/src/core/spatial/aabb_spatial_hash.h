@@ -1,5 +1,9 @@
 #pragma once
 
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+
 #include "spatial_hash.h"
 #include "core/math/aabb.h"
 
@@ -12,7 +16,6 @@ struct aabb_spatial_hash_value {
 	int64_t cx2 = 0;
 	int64_t cy2 = 0;
 	int64_t cz2 = 0;
-	uint64_t timestamp = 0;
 
 	aabb_spatial_hash_value(const aabb& bb) : bb(bb) {
 	}
@@ -35,7 +38,10 @@ struct aabb_spatial_hash_value {
 	}
 };
 
-
+/**
+ * Boxes in the cells they overlap. Queries write nothing, a box found in several cells is only reported from the first
+ * of its cells within the query, so any number of threads can query at once while no thread changes the hash.
+ */
 class aabb_spatial_hash : public spatial_hash<aabb_spatial_hash_value*> {
 public:
 	aabb_spatial_hash(double cellSize) : spatial_hash(cellSize) {
@@ -125,7 +131,17 @@ public:
 	}
 
 	std::vector<aabb_spatial_hash_value*> get_values(const aabb& bb) const {
-		++_timestamp;
+		std::vector<aabb_spatial_hash_value*> collect;
+		for_each_overlapping(bb, [&collect](aabb_spatial_hash_value* v) {
+			collect.push_back(v);
+			return true;
+		});
+		return collect;
+	}
+
+	// Calls back once with each value overlapping bb until the callback returns false, returns false when it did
+	template <typename CallbackT>
+	bool for_each_overlapping(const aabb& bb, const CallbackT& callback) const {
 		const auto& min = bb.get_min() * _inv_cell_size;
 		const auto& max = bb.get_max() * _inv_cell_size;
 		const auto cx1 = floor_to<int64_t>(min.x);
@@ -135,26 +151,86 @@ public:
 		const auto cy2 = floor_to<int64_t>(max.y);
 		const auto cz2 = floor_to<int64_t>(max.z);
 
-		std::vector<aabb_spatial_hash_value*> collect;
 		for (int64_t cz = cz1; cz <= cz2; ++cz) {
 			for (int64_t cy = cy1; cy <= cy2; ++cy) {
 				for (int64_t cx = cx1; cx <= cx2; ++cx) {
 					for (aabb_spatial_hash_value* v : get_cell_values(cx, cy, cz)) {
-						if (v->timestamp >= _timestamp) {
-							continue;
-						}
-						v->timestamp = _timestamp;
-						if (v->overlaps(bb)) {
-							collect.push_back(v);
+						// the first cell of the value that the query visits
+						const bool first = cx == std::max(cx1, v->cx1) && cy == std::max(cy1, v->cy1) && cz == std::max(cz1, v->cz1);
+						if (first && v->overlaps(bb) && !callback(v)) {
+							return false;
 						}
 					}
 				}
 			}
 		}
-		return collect;
+		return true;
+	}
+};
+
+/**
+ * An aabb_spatial_hash that threads can query while another thread changes it. Queries share a lock and changes take
+ * it alone, boxes are changed through update so that no query sees one halfway. Read the boxes of found values in the
+ * callback of for_each_overlapping, get_values leaves the lock before they are read. New queries wait while a change
+ * waits for the lock, so a steady stream of them doesn't starve it, queries only ever wait for changes.
+ */
+class concurrent_aabb_spatial_hash {
+public:
+	concurrent_aabb_spatial_hash(double cell_size) : _hash(cell_size) {
+	}
+
+	void add(aabb_spatial_hash_value* shv) {
+		const auto lock = _lock();
+		_hash.add(shv);
+	}
+
+	void remove(aabb_spatial_hash_value* shv) {
+		const auto lock = _lock();
+		_hash.remove(shv);
+	}
+
+	void update(aabb_spatial_hash_value* shv, const aabb& bb) {
+		const auto lock = _lock();
+		shv->bb = bb;
+		_hash.update(shv);
+	}
+
+	uint64_t get_value_count() const {
+		const auto lock = _lock_shared();
+		return _hash.get_value_count();
+	}
+
+	std::vector<aabb_spatial_hash_value*> get_values(const aabb& bb) const {
+		const auto lock = _lock_shared();
+		return _hash.get_values(bb);
+	}
+
+	template <typename CallbackT>
+	bool for_each_overlapping(const aabb& bb, const CallbackT& callback) const {
+		const auto lock = _lock_shared();
+		return _hash.for_each_overlapping(bb, callback);
 	}
 
 private:
-	mutable uint64_t _timestamp = 1;
+	std::unique_lock<std::shared_mutex> _lock() {
+		_waiting_changes.fetch_add(1, std::memory_order_acq_rel);
+		std::unique_lock lock(_mutex);
+		_waiting_changes.fetch_sub(1, std::memory_order_acq_rel);
+		_waiting_changes.notify_all();
+		return lock;
+	}
+
+	std::shared_lock<std::shared_mutex> _lock_shared() const {
+		uint32_t waiting = _waiting_changes.load(std::memory_order_acquire);
+		while (waiting > 0) {
+			_waiting_changes.wait(waiting, std::memory_order_acquire);
+			waiting = _waiting_changes.load(std::memory_order_acquire);
+		}
+		return std::shared_lock(_mutex);
+	}
+
+	aabb_spatial_hash _hash;
+	mutable std::shared_mutex _mutex;
+	std::atomic<uint32_t> _waiting_changes = 0; // Changes waiting for the lock, new queries wait until there are none
 };
 }
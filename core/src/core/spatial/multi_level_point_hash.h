@@ -0,0 +1,179 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "point_spatial_hash.h"
+
+namespace playchilla {
+/**
+ * Points in grids whose cell sizes double from one level to the next, level zero has the cell size it was made with.
+ * Each point is kept in the level of the spacing around it, so the cells hold about as many points at every level where
+ * the spacing varies a lot. A query wider than CoarseFactor cells of a level visits it through cells that many times
+ * larger, so that a large query over a fine level visits the points around it rather than many empty cells or every cell
+ * of the level. Those coarse cells are made by the first such query of the level and kept up to date from then on, so the
+ * levels that only get queries of their own size don't add and remove every point twice.
+ */
+template <typename T, typename HashT = fast_cell_hash>
+class multi_level_point_hash {
+public:
+	using level_hash = point_spatial_hash3<T, HashT>;
+	using cell_values = typename level_hash::cell_values;
+
+	static constexpr int MinLevel = -20;
+	static constexpr int MaxLevel = 20;
+	static constexpr double CoarseFactor = 8;
+
+	multi_level_point_hash(double cell_size) : _cell_size(cell_size) {
+	}
+
+	double get_cell_size() const {
+		return _cell_size;
+	}
+
+	// The level of the smallest cells that are at least the size
+	int get_level(double cell_size) const {
+		const double level = std::ceil(std::log2(cell_size / _cell_size) - 1e-9);
+		return static_cast<int>(std::clamp(level, static_cast<double>(MinLevel), static_cast<double>(MaxLevel)));
+	}
+
+	T add(const T& v, int level = 0) {
+		auto it = _levels.find(level);
+		if (it == _levels.end()) {
+			it = _levels.emplace(level, std::ldexp(_cell_size, level)).first;
+		}
+		if (it->second.coarse) {
+			it->second.coarse->add(v);
+		}
+		return it->second.fine.add(v);
+	}
+
+	T remove(const T& v, int level = 0) {
+		const auto it = _levels.find(level);
+		assertion(it != _levels.end(), "Removing from a level without values");
+		if (it->second.coarse) {
+			it->second.coarse->remove(v);
+		}
+		return it->second.fine.remove(v);
+	}
+
+	size_t get_level_count() const {
+		size_t count = 0;
+		for (const auto& [i, l] : _levels) {
+			count += l.fine.get_value_count() > 0;
+		}
+		return count;
+	}
+
+	// The cells of the levels, not counting their coarse cells
+	std::size_t get_cell_count() const {
+		size_t count = 0;
+		for (const auto& [i, l] : _levels) {
+			count += l.fine.get_cell_count();
+		}
+		return count;
+	}
+
+	uint64_t get_value_count() const {
+		uint64_t count = 0;
+		for (const auto& [i, l] : _levels) {
+			count += l.fine.get_value_count();
+		}
+		return count;
+	}
+
+	// An estimate, the per level overhead of the map depends on the standard library
+	size_t get_allocated_bytes() const {
+		size_t bytes = 0;
+		for (const auto& [i, l] : _levels) {
+			bytes += 3 * sizeof(void*) + sizeof(level) + l.fine.get_allocated_bytes();
+			if (l.coarse) {
+				bytes += sizeof(level_hash) + l.coarse->get_allocated_bytes();
+			}
+		}
+		return bytes;
+	}
+
+	bool has_value(const vec3& pos, double r) const {
+		return !for_each_value_within(pos, r, [](const T&) {
+			return false;
+		});
+	}
+
+	std::vector<T> get_values(const vec3& pos, double r) const {
+		std::vector<T> found;
+		for_each_value_within(pos, r, [&found](const T& v) {
+			found.push_back(v);
+			return true;
+		});
+		return found;
+	}
+
+	// Calls back with the values within r until the callback returns false, returns false when it did
+	template<typename CallbackT>
+	bool for_each_value_within(const vec3& pos, double r, const CallbackT& callback) const {
+		for (const auto& [i, l] : _levels) {
+			if (l.fine.get_value_count() == 0) {
+				continue;
+			}
+			const level_hash& hash = 2 * r > CoarseFactor * l.fine.get_cell_size() ? _get_coarse(l) : l.fine;
+			if (!hash.for_each_value_within(pos, r, callback)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// As for_each_value_within but nearest first over all levels
+	template<typename CallbackT>
+	bool for_each_nearest_within(const vec3& pos, double r, const CallbackT& callback) const {
+		nearest_values<T> nearest;
+		for_each_value_within(pos, r, [&nearest, &pos](const T& v) {
+			nearest.add(pos.distance_sqr(get_pos(v)), v);
+			return true;
+		});
+		return nearest.for_each(callback);
+	}
+
+	template<typename CallbackT>
+	void for_each_cell(const CallbackT& cell_callback) const {
+		for (const auto& [i, l] : _levels) {
+			l.fine.for_each_cell(cell_callback);
+		}
+	}
+
+	template <typename CallbackT>
+	void for_each_value(const CallbackT& value_callback) const {
+		for (const auto& [i, l] : _levels) {
+			l.fine.for_each_value(value_callback);
+		}
+	}
+
+private:
+	struct level {
+		level(double cell_size) : fine(cell_size) {
+		}
+
+		level_hash fine;
+		mutable std::unique_ptr<level_hash> coarse;
+		mutable std::once_flag coarse_made; // Queries can make them from several threads
+	};
+
+	static const level_hash& _get_coarse(const level& l) {
+		std::call_once(l.coarse_made, [&l] {
+			l.coarse = std::make_unique<level_hash>(CoarseFactor * l.fine.get_cell_size());
+			l.fine.for_each_value([&l](const T& v) {
+				l.coarse->add(v);
+			});
+		});
+		return *l.coarse;
+	}
+
+	double _cell_size;
+	std::map<int, level> _levels;
+};
+}
@@ -1,22 +1,86 @@
 #pragma once
 
+#include <algorithm>
 #include <optional>
+#include <utility>
+#include <vector>
 
 #include "spatial_hash.h"
 
 namespace playchilla {
+/**
+ * Values with their squared distance to a query, gathered and then sorted once to be visited nearest first. Values at
+ * the same distance keep the order they were added in. The storage is kept per thread and reused, so gathering stops
+ * allocating once it has held as many values, one made while another is in use on the thread gets its own.
+ */
 template <typename T>
-class point_spatial_hash3 : public spatial_hash<T> {
+class nearest_values {
 public:
-	using spatial_hash<T>::spatial_hash;
+	nearest_values() : _values(std::move(_get_spare())) {
+		_values.clear();
+	}
+
+	nearest_values(const nearest_values&) = delete;
+	nearest_values& operator=(const nearest_values&) = delete;
+
+	~nearest_values() {
+		auto& spare = _get_spare();
+		if (_values.capacity() > spare.capacity()) {
+			spare = std::move(_values);
+		}
+	}
+
+	void add(double distance_sqr, const T& value) {
+		_values.push_back({distance_sqr, _values.size(), value});
+	}
+
+	size_t size() const {
+		return _values.size();
+	}
+
+	// Calls back with the values nearest first until the callback returns false, returns false when it did
+	template<typename CallbackT>
+	bool for_each(const CallbackT& callback) {
+		std::sort(_values.begin(), _values.end(), [](const distance_value& a, const distance_value& b) {
+			return a.distance_sqr != b.distance_sqr ? a.distance_sqr < b.distance_sqr : a.order < b.order;
+		});
+		for (const auto& v : _values) {
+			if (!callback(v.value)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+private:
+	struct distance_value {
+		double distance_sqr;
+		size_t order;
+		T value;
+	};
+
+	static std::vector<distance_value>& _get_spare() {
+		thread_local std::vector<distance_value> spare;
+		return spare;
+	}
+
+	std::vector<distance_value> _values;
+};
+
+template <typename T, typename HashT = fast_cell_hash>
+class point_spatial_hash3 : public spatial_hash<T, HashT> {
+	using base = spatial_hash<T, HashT>;
+
+public:
+	using base::base;
 
 	T add(const T& shv) {
-		spatial_hash<T>::add_to_cell(shv, get_pos(shv));
+		base::add_to_cell(shv, get_pos(shv));
 		return shv;
 	}
 
 	T remove(const T& shv) {
-		spatial_hash<T>::remove_from_cell(shv, get_pos(shv));
+		base::remove_from_cell(shv, get_pos(shv));
 		return shv;
 	}
 
@@ -38,8 +102,20 @@ public:
 		return found;
 	}
 
+	// As for_each_value_within but nearest first, so a search for the nearest value that passes a test can stop at it
 	template<typename CallbackT>
-	void for_each_value_within(const vec3& pos, double r, const CallbackT& callback) const {
+	bool for_each_nearest_within(const vec3& pos, double r, const CallbackT& callback) const {
+		nearest_values<T> nearest;
+		for_each_value_within(pos, r, [&nearest, &pos](const T& v) {
+			nearest.add(pos.distance_sqr(get_pos(v)), v);
+			return true;
+		});
+		return nearest.for_each(callback);
+	}
+
+	// Calls back with the values within r until the callback returns false, returns false when it did
+	template<typename CallbackT>
+	bool for_each_value_within(const vec3& pos, double r, const CallbackT& callback) const {
 		const double inv_cell_size = this->_inv_cell_size;
 		const auto cx1 = floor_to<int64_t>((pos.x - r) * inv_cell_size);
 		const auto cy1 = floor_to<int64_t>((pos.y - r) * inv_cell_size);
@@ -49,19 +125,32 @@ public:
 		const auto cz2 = floor_to<int64_t>((pos.z + r) * inv_cell_size);
 
 		const double r2 = r * r;
+		const double query_cells = static_cast<double>(cx2 - cx1 + 1) * static_cast<double>(cy2 - cy1 + 1) * static_cast<double>(cz2 - cz1 + 1);
+		if (query_cells > static_cast<double>(2 * base::get_cell_count())) {
+			// the cells in use are fewer than the ones the query covers
+			bool stopped = false;
+			base::for_each_cell([&](const auto& cell) {
+				for (uint32_t i = 0; i < cell.size() && !stopped; ++i) {
+					stopped = pos.distance_sqr(get_pos(cell[i])) <= r2 && !callback(cell[i]);
+				}
+			});
+			return !stopped;
+		}
+
 		for (int64_t cz = cz1; cz <= cz2; ++cz) {
 			for (int64_t cy = cy1; cy <= cy2; ++cy) {
 				for (int64_t cx = cx1; cx <= cx2; ++cx) {
-					for (const T& v : spatial_hash<T>::get_cell_values(cx, cy, cz)) {
+					for (const T& v : base::get_cell_values(cx, cy, cz)) {
 						if (pos.distance_sqr(get_pos(v)) <= r2) {
 							if (!callback(v)) {
-								return;
+								return false;
 							}
 						}
 					}
 				}
 			}
 		}
+		return true;
 	}
 };
 }
@@ -1,17 +1,39 @@
 #pragma once
 
-#include <unordered_map>
+#include <algorithm>
+#include <utility>
 #include <vector>
 
 #include "core/debug/assertion.h"
 #include "core/math/vec3.h"
 #include "core/util/hash_util.h"
+#include "core/util/inline_vector.h"
 
 namespace playchilla {
+// Cell hashes, the cells are told apart by their coordinates so the hash only spreads them over the table
+struct good_cell_hash {
+	static uint64_t hash(int64_t cx, int64_t cy, int64_t cz) {
+		return hash_good(cx, cy, cz);
+	}
+};
 
-template <typename T>
+struct fast_cell_hash {
+	static uint64_t hash(int64_t cx, int64_t cy, int64_t cz) {
+		return hash_fast(cx, cy, cz);
+	}
+};
+
+/**
+ * Values in the cells of a grid. The cells are kept in a flat table with linear probing and hold their first values in
+ * place. A cell is removed when its last value is, by shifting back the cells after it, so churn leaves no tombstones.
+ * Free slots keep the capacity of the cells they held, so cells that come and go reuse it instead of allocating.
+ * Cell values are valid until the next add or remove.
+ */
+template <typename T, typename HashT = fast_cell_hash, uint32_t InlineSize = 4>
 class spatial_hash {
 public:
+	using cell_values = inline_vector<T, InlineSize>;
+
 	spatial_hash(double cell_size) : _inv_cell_size(1. / cell_size), _cell_size(cell_size) {
 	}
 
@@ -20,13 +42,21 @@ public:
 	}
 
 	std::size_t get_cell_count() const {
-		return _map.size();
+		return _cell_count;
 	}
 
 	uint64_t get_value_count() const {
 		return _value_count;
 	}
 
+	size_t get_allocated_bytes() const {
+		size_t bytes = _cells.capacity() * sizeof(cell);
+		for (const auto& c : _cells) {
+			bytes += c.values.get_heap_bytes();
+		}
+		return bytes;
+	}
+
 	vec3 get_cell_center(const vec3& pos) const {
 		const int64_t x1 = floor_to<int64_t>(pos.x * _inv_cell_size);
 		const int64_t y1 = floor_to<int64_t>(pos.y * _inv_cell_size);
@@ -38,62 +68,64 @@ public:
 	 * Add to cell
 	 */
 	void add_to_cell(const T& shv, const vec3& pos) {
-		_add_to_cell(shv, _hash(pos));
+		_add_to_cell(shv, _to_cell(pos.x), _to_cell(pos.y), _to_cell(pos.z));
 	}
 
 	void add_to_cell(const T& shv, int64_t cx, int64_t cy, int64_t cz) {
-		_add_to_cell(shv, _hash(cx, cy, cz));
+		_add_to_cell(shv, cx, cy, cz);
 	}
 
 	/**
 	 * Remove from cell
 	 */
 	void remove_from_cell(const T& shv, const vec3& pos) {
-		return _remove_from_cell(shv, _hash(pos));
+		_remove_from_cell(shv, _to_cell(pos.x), _to_cell(pos.y), _to_cell(pos.z));
 	}
 
 	void remove_from_cell(const T& shv, int64_t cx, int64_t cy, int64_t cz) {
-		_remove_from_cell(shv, _hash(cx, cy, cz));
+		_remove_from_cell(shv, cx, cy, cz);
 	}
 
 	void remove_cell(int64_t cx, int64_t cy, int64_t cz) {
-		_map.remove(_hash(cx, cy, cz));
+		const size_t i = _find(cx, cy, cz);
+		if (i != NotFound) {
+			_value_count -= _cells[i].values.size();
+			_erase(i);
+		}
 	}
 
 	/**
 	 * Get cell values
 	 */
-	const std::vector<T>& get_cell_values(const vec3& pos) const {
-		return get_cell_values(_hash(pos));
+	const cell_values& get_cell_values(const vec3& pos) const {
+		return get_cell_values(pos.x, pos.y, pos.z);
 	}
 
-	const std::vector<T>& get_cell_values(double x, double y, double z) const {
-		return get_cell_values(_hash(x, y, z));
+	const cell_values& get_cell_values(double x, double y, double z) const {
+		return get_cell_values(_to_cell(x), _to_cell(y), _to_cell(z));
 	}
 
-	const std::vector<T>& get_cell_values(int64_t cx, int64_t cy, int64_t cz) const {
-		return get_cell_values(_hash(cx, cy, cz));
-	}
-
-	const std::vector<T>& get_cell_values(uint64_t cell_id) const {
-		const auto it = _map.find(cell_id);
-		if (it != _map.end()) {
-			return it->second;
+	const cell_values& get_cell_values(int64_t cx, int64_t cy, int64_t cz) const {
+		const size_t i = _find(cx, cy, cz);
+		if (i != NotFound) {
+			return _cells[i].values;
 		}
-		const static std::vector<T> e;
+		const static cell_values e;
 		return e;
 	}
 
 	template<typename CallbackT>
 	void for_each_cell(const CallbackT& cell_callback) const {
-		for (const auto& e : _map) {
-			cell_callback(e.second);
+		for (const auto& c : _cells) {
+			if (!c.values.empty()) {
+				cell_callback(c.values);
+			}
 		}
 	}
 
 	template <typename CallbackT>
 	void for_each_value(const CallbackT& value_callback) const {
-		for_each_cell([&value_callback](const std::vector<T>& cell) {
+		for_each_cell([&value_callback](const cell_values& cell) {
 			for (const auto& value : cell) {
 				value_callback(value);
 			}
@@ -104,52 +136,112 @@ protected:
 	double _inv_cell_size;
 
 private:
-	void _add_to_cell(const T& shv, uint64_t cell_id) {
-		const auto it = _map.find(cell_id);
-		if (it == _map.end()) {
-			_map[cell_id] = {shv};
+	static constexpr size_t NotFound = ~size_t(0);
+	static constexpr size_t MinTableSize = 16;
+
+	struct cell {
+		int64_t x = 0;
+		int64_t y = 0;
+		int64_t z = 0;
+		cell_values values; // Empty for free slots, which keep their capacity
+	};
+
+	int64_t _to_cell(double v) const {
+		return floor_to<int64_t>(v * _inv_cell_size);
+	}
+
+	size_t _get_home(int64_t cx, int64_t cy, int64_t cz) const {
+		return HashT::hash(cx, cy, cz) & (_cells.size() - 1);
+	}
+
+	size_t _find(int64_t cx, int64_t cy, int64_t cz) const {
+		if (_cells.empty()) {
+			return NotFound;
+		}
+		const size_t mask = _cells.size() - 1;
+		for (size_t i = _get_home(cx, cy, cz);; i = (i + 1) & mask) {
+			const cell& c = _cells[i];
+			if (c.values.empty()) {
+				return NotFound;
+			}
+			if (c.x == cx && c.y == cy && c.z == cz) {
+				return i;
+			}
 		}
-		else {
-			it->second.push_back(shv);
+	}
+
+	void _add_to_cell(const T& shv, int64_t cx, int64_t cy, int64_t cz) {
+		// at most half full keeps the probes of missing cells short
+		if (2 * (_cell_count + 1) > _cells.size()) {
+			_grow();
+		}
+		const size_t mask = _cells.size() - 1;
+		for (size_t i = _get_home(cx, cy, cz);; i = (i + 1) & mask) {
+			cell& c = _cells[i];
+			if (c.values.empty()) {
+				c.x = cx;
+				c.y = cy;
+				c.z = cz;
+				++_cell_count;
+			}
+			else if (c.x != cx || c.y != cy || c.z != cz) {
+				continue;
+			}
+			c.values.push_back(shv);
+			break;
 		}
 		++_value_count;
 	}
 
-	void _remove_from_cell(const T& shv, int64_t cell_id) {
-		const auto it = _map.find(cell_id);
-		assertion(it != _map.end(), "Could not find point value std::vector");
-		std::vector<T>& values = it->second;
+	void _remove_from_cell(const T& shv, int64_t cx, int64_t cy, int64_t cz) {
+		const size_t i = _find(cx, cy, cz);
+		assertion(i != NotFound, "Could not find the cell of the value");
+		cell_values& values = _cells[i].values;
 
-		const size_t size_before = values.size();
-		auto value_it = std::find(values.begin(), values.end(), shv);
+		const auto value_it = std::find(values.begin(), values.end(), shv);
 		assertion(value_it != values.end(), "Could not find value in cell");
 		values.erase(value_it);
-		assertion(values.size() == size_before - 1, "Could not delete a point hash value");
 
 		if (values.empty()) {
-			_map.erase(it);
+			_erase(i);
 		}
+		assertion(_value_count > 0, "Removed too many point values");
 		--_value_count;
-		assertion(_value_count >= 0, "Removed too many point values");
-	}
-
-	uint64_t _hash(const vec3& pos) const {
-		return _hash(pos.x, pos.y, pos.z);
 	}
 
-	uint64_t _hash(double x, double y, double z) const {
-		const auto cx = floor_to<uint64_t>(x * _inv_cell_size);
-		const auto cy = floor_to<uint64_t>(y * _inv_cell_size);
-		const auto cz = floor_to<uint64_t>(z * _inv_cell_size);
-		return hash_good(cx, cy, cz);
+	// Frees the slot and moves back the following cells that probed past it, swapping so the free slot keeps its capacity
+	void _erase(size_t i) {
+		--_cell_count;
+		_cells[i].values.clear();
+		const size_t mask = _cells.size() - 1;
+		size_t hole = i;
+		for (size_t j = (i + 1) & mask; !_cells[j].values.empty(); j = (j + 1) & mask) {
+			const size_t home = _get_home(_cells[j].x, _cells[j].y, _cells[j].z);
+			if (((j - home) & mask) >= ((j - hole) & mask)) {
+				std::swap(_cells[hole], _cells[j]);
+				hole = j;
+			}
+		}
 	}
 
-	static uint64_t _hash(int64_t cx, int64_t cy, int64_t cz) {
-		return hash_good(cx, cy, cz);
+	void _grow() {
+		std::vector<cell> old = std::move(_cells);
+		_cells = std::vector<cell>(std::max(MinTableSize, 2 * old.size()));
+		const size_t mask = _cells.size() - 1;
+		for (cell& c : old) {
+			if (!c.values.empty()) {
+				size_t i = _get_home(c.x, c.y, c.z);
+				while (!_cells[i].values.empty()) {
+					i = (i + 1) & mask;
+				}
+				_cells[i] = std::move(c);
+			}
+		}
 	}
 
-	std::unordered_map<uint64_t, std::vector<T>> _map;
+	std::vector<cell> _cells;
 	double _cell_size;
-	int64_t _value_count = 0;
+	size_t _cell_count = 0;
+	uint64_t _value_count = 0;
 };
 }
@@ -16,6 +16,12 @@ inline uint64_t hash_good(uint64_t x, uint64_t y, uint64_t z) {
 	return mix(x ^ mix(y ^ mix(z)));
 }
 
+inline uint64_t hash_fast(uint64_t x, uint64_t y, uint64_t z) {
+	// a multiply per coordinate, the high bits folded into the low ones that hash tables mask
+	const uint64_t h = x * 0x9e3779b97f4a7c15 ^ y * 0xc2b2ae3d27d4eb4f ^ z * 0x165667b19e3779f9;
+	return h ^ (h >> 32);
+}
+
 inline uint64_t hash_double_good(double x, double y, double z) {
 	return hash_good(util::bits_to<uint64_t>(x), util::bits_to<uint64_t>(y), util::bits_to<uint64_t>(z));
 }
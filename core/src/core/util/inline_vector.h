@@ -0,0 +1,191 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include "core/debug/assertion.h"
+
+namespace playchilla {
+/**
+ * A vector that keeps up to InlineSize elements inside the object and only allocates when it grows beyond that.
+ * Limited to trivially copyable elements, erasing keeps the order.
+ */
+template <typename T, uint32_t InlineSize>
+class inline_vector {
+	static_assert(std::is_trivially_copyable_v<T>, "inline_vector only holds trivially copyable elements");
+	static_assert(InlineSize > 0, "inline_vector needs room for at least one inline element");
+
+public:
+	using value_type = T;
+	using iterator = T*;
+	using const_iterator = const T*;
+
+	inline_vector() : _heap(nullptr) {
+	}
+
+	inline_vector(const inline_vector& other) {
+		_append(other.data(), other._size);
+	}
+
+	inline_vector(inline_vector&& other) noexcept {
+		_take(other);
+	}
+
+	inline_vector& operator=(const inline_vector& other) {
+		if (this != &other) {
+			clear();
+			_append(other.data(), other._size);
+		}
+		return *this;
+	}
+
+	inline_vector& operator=(inline_vector&& other) noexcept {
+		if (this != &other) {
+			_release();
+			_take(other);
+		}
+		return *this;
+	}
+
+	~inline_vector() {
+		_release();
+	}
+
+	void push_back(const T& value) {
+		if (_size == _capacity) {
+			_grow(_capacity * 2);
+		}
+		data()[_size++] = value;
+	}
+
+	void pop_back() {
+		assertion(_size > 0, "Popping an empty inline_vector");
+		--_size;
+	}
+
+	iterator erase(const_iterator it) {
+		T* pos = const_cast<T*>(it);
+		assertion(pos >= begin() && pos < end(), "Erasing outside of inline_vector");
+		std::memmove(pos, pos + 1, (end() - pos - 1) * sizeof(T));
+		--_size;
+		return pos;
+	}
+
+	void clear() {
+		_size = 0;
+	}
+
+	void reserve(uint32_t capacity) {
+		if (capacity > _capacity) {
+			_grow(capacity);
+		}
+	}
+
+	bool empty() const {
+		return _size == 0;
+	}
+
+	uint32_t size() const {
+		return _size;
+	}
+
+	uint32_t capacity() const {
+		return _capacity;
+	}
+
+	bool is_inline() const {
+		return _capacity == InlineSize;
+	}
+
+	// Bytes allocated outside of the object itself
+	size_t get_heap_bytes() const {
+		return is_inline() ? 0 : _capacity * sizeof(T);
+	}
+
+	T* data() {
+		return is_inline() ? _inline : _heap;
+	}
+
+	const T* data() const {
+		return is_inline() ? _inline : _heap;
+	}
+
+	T& operator[](uint32_t i) {
+		assertion(i < _size, "inline_vector index out of range");
+		return data()[i];
+	}
+
+	const T& operator[](uint32_t i) const {
+		assertion(i < _size, "inline_vector index out of range");
+		return data()[i];
+	}
+
+	T& back() {
+		return (*this)[_size - 1];
+	}
+
+	const T& back() const {
+		return (*this)[_size - 1];
+	}
+
+	iterator begin() {
+		return data();
+	}
+
+	iterator end() {
+		return data() + _size;
+	}
+
+	const_iterator begin() const {
+		return data();
+	}
+
+	const_iterator end() const {
+		return data() + _size;
+	}
+
+private:
+	void _grow(uint32_t capacity) {
+		T* heap = new T[capacity];
+		std::copy_n(data(), _size, heap);
+		_release();
+		_heap = heap;
+		_capacity = capacity;
+	}
+
+	void _append(const T* values, uint32_t count) {
+		reserve(count);
+		std::copy_n(values, count, data());
+		_size = count;
+	}
+
+	void _take(inline_vector& other) {
+		if (other.is_inline()) {
+			std::copy_n(other._inline, other._size, _inline);
+		}
+		else {
+			_heap = other._heap;
+			_capacity = other._capacity;
+			other._capacity = InlineSize;
+		}
+		_size = other._size;
+		other._size = 0;
+	}
+
+	void _release() {
+		if (!is_inline()) {
+			delete[] _heap;
+			_capacity = InlineSize;
+		}
+	}
+
+	union {
+		T _inline[InlineSize];
+		T* _heap;
+	};
+	uint32_t _size = 0;
+	uint32_t _capacity = InlineSize;
+};
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "core/debug/assertion.h"
+
+namespace playchilla {
+/**
+ * Refers to an object in an object_pool, it stops resolving when the object is destroyed even if the slot is reused.
+ */
+template <typename T>
+struct pool_handle {
+	uint32_t index = 0;
+	uint32_t generation = 0;
+
+	bool operator==(const pool_handle&) const = default;
+};
+
+/**
+ * Allocates objects in fixed size slabs and recycles the slots of destroyed objects through a free list.
+ * Objects never move, so pointers are valid until the object is destroyed.
+ */
+template <typename T, uint32_t SlabSize = 1024>
+class object_pool {
+public:
+	using handle = pool_handle<T>;
+
+	object_pool() = default;
+	object_pool(const object_pool&) = delete;
+	object_pool(object_pool&&) = delete;
+	object_pool& operator=(const object_pool&) = delete;
+	object_pool& operator=(object_pool&&) = delete;
+
+	~object_pool() {
+		for (auto& slab : _slabs) {
+			for (uint32_t i = 0; i < SlabSize; ++i) {
+				if (slab[i].alive) {
+					slab[i].get()->~T();
+				}
+			}
+		}
+	}
+
+	template <typename... Args>
+	T* create(Args&&... args) {
+		slot& s = _acquire_slot();
+		T* object = new(s.storage) T(std::forward<Args>(args)...);
+		s.alive = true;
+		++_size;
+		return object;
+	}
+
+	void destroy(T* object) {
+		slot& s = _get_slot(object);
+		assertion(s.alive, "Destroying a dead pool object");
+		object->~T();
+		s.alive = false;
+		++s.generation;
+		_free.push_back(s.index);
+		--_size;
+	}
+
+	handle get_handle(const T* object) const {
+		const slot& s = _get_slot(object);
+		return {s.index, s.generation};
+	}
+
+	T* get(handle h) const {
+		if (h.index >= capacity()) {
+			return nullptr;
+		}
+		slot& s = _slot(h.index);
+		return s.alive && s.generation == h.generation ? s.get() : nullptr;
+	}
+
+	bool is_alive(handle h) const {
+		return get(h) != nullptr;
+	}
+
+	size_t size() const {
+		return _size;
+	}
+
+	size_t capacity() const {
+		return _slabs.size() * SlabSize;
+	}
+
+	size_t get_allocated_bytes() const {
+		return _slabs.size() * SlabSize * sizeof(slot) + _free.capacity() * sizeof(uint32_t);
+	}
+
+private:
+	struct slot {
+		alignas(T) unsigned char storage[sizeof(T)];
+		uint32_t index = 0;
+		uint32_t generation = 1;
+		bool alive = false;
+
+		T* get() {
+			return std::launder(reinterpret_cast<T*>(storage));
+		}
+	};
+
+	slot& _acquire_slot() {
+		if (_free.empty()) {
+			const auto first_index = static_cast<uint32_t>(capacity());
+			_slabs.push_back(std::make_unique<slot[]>(SlabSize));
+			auto& slab = _slabs.back();
+			// hand out the lowest index first
+			for (uint32_t i = SlabSize; i-- > 0;) {
+				slab[i].index = first_index + i;
+				_free.push_back(first_index + i);
+			}
+		}
+		const uint32_t index = _free.back();
+		_free.pop_back();
+		return _slot(index);
+	}
+
+	slot& _slot(uint32_t index) const {
+		return _slabs[index / SlabSize][index % SlabSize];
+	}
+
+	static slot& _get_slot(const T* object) {
+		// storage is the first member of a slot
+		return *reinterpret_cast<slot*>(const_cast<T*>(object));
+	}
+
+	std::vector<std::unique_ptr<slot[]>> _slabs;
+	std::vector<uint32_t> _free;
+	size_t _size = 0;
+};
+}
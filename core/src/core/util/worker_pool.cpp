@@ -0,0 +1,81 @@
+#include "worker_pool.h"
+#include "core/debug/assertion.h"
+
+namespace playchilla {
+worker_pool::worker_pool(size_t worker_count) {
+	assertion(worker_count > 0, "A worker pool needs at least one worker");
+	for (size_t i = 1; i < worker_count; ++i) {
+		_threads.emplace_back([this] { _work(); });
+	}
+}
+
+worker_pool::~worker_pool() {
+	{
+		std::lock_guard lock(_mutex);
+		_stop = true;
+	}
+	_job_started.notify_all();
+	for (auto& thread : _threads) {
+		thread.join();
+	}
+}
+
+size_t worker_pool::get_worker_count() const {
+	return _threads.size() + 1;
+}
+
+void worker_pool::_run(size_t count, job_function job, const void* context) {
+	{
+		std::lock_guard lock(_mutex);
+		_job = job;
+		_job_context = context;
+		_job_count = count;
+		_next_index = 0;
+		_done_count = 0;
+		++_generation;
+	}
+	_job_started.notify_all();
+
+	_work_on_current_job();
+
+	// the job context lives on the callers stack, wait for every worker to let go of it
+	std::unique_lock lock(_mutex);
+	_job_done.wait(lock, [this] {
+		return _done_count == _job_count && _active_workers == 0;
+	});
+	_job = nullptr;
+	_job_context = nullptr;
+}
+
+void worker_pool::_work() {
+	uint64_t seen_generation = 0;
+	while (true) {
+		{
+			std::unique_lock lock(_mutex);
+			_job_started.wait(lock, [this, seen_generation] {
+				return _stop || (_job != nullptr && _generation != seen_generation);
+			});
+			if (_stop) {
+				return;
+			}
+			seen_generation = _generation;
+			++_active_workers;
+		}
+
+		_work_on_current_job();
+
+		{
+			std::lock_guard lock(_mutex);
+			--_active_workers;
+		}
+		_job_done.notify_one();
+	}
+}
+
+void worker_pool::_work_on_current_job() {
+	for (size_t i = _next_index++; i < _job_count; i = _next_index++) {
+		_job(_job_context, i);
+		++_done_count;
+	}
+}
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace playchilla {
+/**
+ * A fixed set of threads that runs indexed jobs, the calling thread takes part in the work.
+ * A pool of one worker runs everything on the calling thread.
+ */
+class worker_pool {
+public:
+	worker_pool(size_t worker_count);
+	worker_pool(const worker_pool&) = delete;
+	worker_pool(worker_pool&&) = delete;
+	worker_pool& operator=(const worker_pool&) = delete;
+	worker_pool& operator=(worker_pool&&) = delete;
+	~worker_pool();
+
+	size_t get_worker_count() const;
+
+	/**
+	 * Calls callback(i) for every i in [0, count) and returns when all calls are done.
+	 */
+	template <typename CallbackT>
+	void for_each_index(size_t count, const CallbackT& callback) {
+		if (count == 0) {
+			return;
+		}
+		if (_threads.empty() || count == 1) {
+			for (size_t i = 0; i < count; ++i) {
+				callback(i);
+			}
+			return;
+		}
+		_run(count, [](const void* context, size_t i) {
+			(*static_cast<const CallbackT*>(context))(i);
+		}, &callback);
+	}
+
+private:
+	using job_function = void (*)(const void*, size_t);
+
+	void _run(size_t count, job_function job, const void* context);
+	void _work();
+	void _work_on_current_job();
+
+	std::vector<std::thread> _threads;
+	std::mutex _mutex;
+	std::condition_variable _job_started;
+	std::condition_variable _job_done;
+	job_function _job = nullptr;
+	const void* _job_context = nullptr;
+	size_t _job_count = 0;
+	std::atomic<size_t> _next_index = 0;
+	std::atomic<size_t> _done_count = 0;
+	uint64_t _generation = 0;
+	size_t _active_workers = 0;
+	bool _stop = false;
+};
+}
@@ -10,6 +10,7 @@ public:
 		_view([this] { return &_vbo; }, shader_type::line_shader, GL_LINES),
 		_advancing_front(volume, &_mesh_builder, edge_len, 100., 0.05),
 		_update_around(update_around) {
+		_advancing_front.prioritize_near();
 	}
 
 	void on_tick(const tick_data&) {
@@ -20,7 +21,7 @@ public:
 			_try_setup_surface_position(local_update_pos);
 		}
 
-		_advancing_front.step(local_update_pos, 100);
+		_advancing_front.step_within(local_update_pos, 2.);
 
 		if (_vbo.is_ready_to_upload()) return;
 
@@ -46,14 +47,7 @@ private:
 		if (distance >= creation_radius) {
 			return false;
 		}
-
-		if (!around_position.is_near({0, 0, 0})) {
-			if (_advancing_front.try_find_surface(around_position)) {
-				return true;
-			}
-		}
-
-		return _advancing_front.try_find_surface({0.1, 0.2, -0.05});
+		return _advancing_front.seed_surfaces(around_position) > 0;
 	}
 
 	line_mesh_builder _mesh_builder;
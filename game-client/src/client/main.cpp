@@ -16,6 +16,7 @@
 
 #include "entity.h"
 #include "example_models.h"
+#include "generated/planet.h"
 
 namespace {
 playchilla::keyboard_input& get_keyboard_input() {
@@ -70,7 +71,7 @@ void start_demo(GLFWwindow* window) {
 	                           ),
 	                           &camera_transform);
 
-	surface_entity noisy_terrain(create_planet(csg, 100), &camera_transform, 2.0);
+	surface_entity noisy_terrain(csg.create<generated::planet>(create_planet(csg, 100)), &camera_transform, 2.0);
 
 	cube.get_view()->get_transform().set_pos({-60, 0, 0});
 	sphere_cube.get_view()->get_transform().set_pos({60, 0, 0});
@@ -124,7 +124,7 @@ public:
 	}
 
 	void on_add_triangle(const node* a, const node* b, const node* c, const volume_data& data) override {
-		const auto& game_data = std::any_cast<const game_volume_data&>(data.custom_data);
+		const auto& game_data = data.get<game_volume_data>();
 		const auto color = game_data.mat->diffuse_color;
 		const vec3 normal = (b->pos - a->pos).cross(c->pos - a->pos).normalize();
 		assertion(normal.is_valid(), "Adding invalid normal from triangle");
@@ -181,7 +181,7 @@ private:
 class static_mesh_builder : public mesh_builder, public dynamic_vertex_buffer {
 public:
 	void on_add_triangle(const node* a, const node* b, const node* c, const volume_data& data) override {
-		const auto& game_data = std::any_cast<const game_volume_data&>(data.custom_data);
+		const auto& game_data = data.get<game_volume_data>();
 		const auto color = game_data.mat->diffuse_color;
 		const vec3 normal = (b->pos - a->pos).cross(c->pos - a->pos).normalize();
 
@@ -0,0 +1,221 @@
+#include "noise.h"
+
+#include <algorithm>
+#include <iterator>
+#include <limits>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define NOISE_AVX2 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define NOISE_TARGET_AVX2
+#else
+#define NOISE_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace playchilla {
+#ifdef NOISE_AVX2
+namespace {
+bool detect_avx2() {
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) {
+		return false;
+	}
+	__cpuid(info, 1);
+	const bool os_saves_ymm = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6;
+	__cpuidex(info, 7, 0);
+	return os_saves_ymm && (info[1] & (1 << 5)) != 0;
+#else
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+
+NOISE_TARGET_AVX2 __m256d lerp(__m256d from, __m256d to, __m256d a) {
+	return _mm256_add_pd(from, _mm256_mul_pd(a, _mm256_sub_pd(to, from)));
+}
+
+NOISE_TARGET_AVX2 __m256d quintic(__m256d t) {
+	const __m256d poly = _mm256_add_pd(_mm256_mul_pd(t, _mm256_sub_pd(_mm256_mul_pd(t, _mm256_set1_pd(6.)), _mm256_set1_pd(15.))), _mm256_set1_pd(10.));
+	return _mm256_mul_pd(_mm256_mul_pd(_mm256_mul_pd(t, t), t), poly);
+}
+
+// The gradient of each of the four cells dotted with the offsets, in the same order of operations as the scalar code
+NOISE_TARGET_AVX2 __m256d gradient(__m128i cx, __m128i cy, __m128i cz, __m256d dx, __m256d dy, __m256d dz) {
+	__m128i i = _mm_xor_si128(_mm_xor_si128(cx, cy), cz);
+	i = _mm_xor_si128(i, _mm_srli_epi32(i, 8));
+	i = _mm_slli_epi32(_mm_and_si128(i, _mm_set1_epi32(0xff)), 2);
+	alignas(16) int32_t index[4];
+	_mm_store_si128(reinterpret_cast<__m128i*>(index), i);
+
+	// each table entry is x, y, z, 0 so one row per cell is loaded and transposed into x, y and z columns
+	const __m256d r0 = _mm256_loadu_pd(&tables::random_vectors_3d[index[0]]);
+	const __m256d r1 = _mm256_loadu_pd(&tables::random_vectors_3d[index[1]]);
+	const __m256d r2 = _mm256_loadu_pd(&tables::random_vectors_3d[index[2]]);
+	const __m256d r3 = _mm256_loadu_pd(&tables::random_vectors_3d[index[3]]);
+	const __m256d xz01 = _mm256_unpacklo_pd(r0, r1);
+	const __m256d yw01 = _mm256_unpackhi_pd(r0, r1);
+	const __m256d xz23 = _mm256_unpacklo_pd(r2, r3);
+	const __m256d yw23 = _mm256_unpackhi_pd(r2, r3);
+	const __m256d gx = _mm256_permute2f128_pd(xz01, xz23, 0x20);
+	const __m256d gy = _mm256_permute2f128_pd(yw01, yw23, 0x20);
+	const __m256d gz = _mm256_permute2f128_pd(xz01, xz23, 0x31);
+	return _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, gx), _mm256_mul_pd(dy, gy)), _mm256_mul_pd(dz, gz));
+}
+
+NOISE_TARGET_AVX2 bool fits_int32(__m256d v) {
+	const __m256d in_range = _mm256_and_pd(
+		_mm256_cmp_pd(v, _mm256_set1_pd(-2147483648.), _CMP_GE_OQ),
+		_mm256_cmp_pd(v, _mm256_set1_pd(2147483647.), _CMP_LE_OQ));
+	return _mm256_movemask_pd(in_range) == 0xf;
+}
+
+// Returns false without writing the values if a cell doesn't fit in 32 bits. Otherwise the 32 bit cell hashes have the
+// same low bits as the 64 bit ones in get_value, and only the low 16 bits are used for the table index.
+NOISE_TARGET_AVX2 bool get_values4(int32_t seed_add, const vec3* p, double* values) {
+	const __m256d x = _mm256_set_pd(p[3].x, p[2].x, p[1].x, p[0].x);
+	const __m256d y = _mm256_set_pd(p[3].y, p[2].y, p[1].y, p[0].y);
+	const __m256d z = _mm256_set_pd(p[3].z, p[2].z, p[1].z, p[0].z);
+	const __m256d fx = _mm256_floor_pd(x);
+	const __m256d fy = _mm256_floor_pd(y);
+	const __m256d fz = _mm256_floor_pd(z);
+	if (!fits_int32(fx) || !fits_int32(fy) || !fits_int32(fz)) {
+		return false;
+	}
+
+	const __m256d one = _mm256_set1_pd(1.);
+	const __m256d dx0 = _mm256_sub_pd(x, fx);
+	const __m256d dy0 = _mm256_sub_pd(y, fy);
+	const __m256d dz0 = _mm256_sub_pd(z, fz);
+	const __m256d xs = quintic(dx0);
+	const __m256d ys = quintic(dy0);
+	const __m256d zs = quintic(dz0);
+	const __m256d dx1 = _mm256_sub_pd(dx0, one);
+	const __m256d dy1 = _mm256_sub_pd(dy0, one);
+	const __m256d dz1 = _mm256_sub_pd(dz0, one);
+
+	const __m128i cx0 = _mm_mullo_epi32(_mm256_cvttpd_epi32(fx), _mm_set1_epi32(1619));
+	const __m128i cy0 = _mm_mullo_epi32(_mm256_cvttpd_epi32(fy), _mm_set1_epi32(31337));
+	const __m128i cz0 = _mm_add_epi32(_mm_mullo_epi32(_mm256_cvttpd_epi32(fz), _mm_set1_epi32(6971)), _mm_set1_epi32(seed_add));
+	const __m128i cx1 = _mm_add_epi32(cx0, _mm_set1_epi32(1619));
+	const __m128i cy1 = _mm_add_epi32(cy0, _mm_set1_epi32(31337));
+	const __m128i cz1 = _mm_add_epi32(cz0, _mm_set1_epi32(6971));
+
+	const __m256d n00 = lerp(gradient(cx0, cy0, cz0, dx0, dy0, dz0), gradient(cx1, cy0, cz0, dx1, dy0, dz0), xs);
+	const __m256d n10 = lerp(gradient(cx0, cy1, cz0, dx0, dy1, dz0), gradient(cx1, cy1, cz0, dx1, dy1, dz0), xs);
+	const __m256d n01 = lerp(gradient(cx0, cy0, cz1, dx0, dy0, dz1), gradient(cx1, cy0, cz1, dx1, dy0, dz1), xs);
+	const __m256d n11 = lerp(gradient(cx0, cy1, cz1, dx0, dy1, dz1), gradient(cx1, cy1, cz1, dx1, dy1, dz1), xs);
+	const __m256d yf0 = lerp(n00, n10, ys);
+	const __m256d yf1 = lerp(n01, n11, ys);
+	_mm256_storeu_pd(values, _mm256_mul_pd(_mm256_set1_pd(1.3), lerp(yf0, yf1, zs)));
+	return true;
+}
+}
+#endif
+
+bool gradient_noise::has_simd() {
+#ifdef NOISE_AVX2
+	static const bool has_avx2 = detect_avx2();
+	return has_avx2;
+#else
+	return false;
+#endif
+}
+
+void gradient_noise::get_values(std::span<const vec3> positions, std::span<double> values) const {
+	size_t i = 0;
+#ifdef NOISE_AVX2
+	if (has_simd()) {
+		const auto seed_add = static_cast<int32_t>(static_cast<uint32_t>(_seed_add));
+		for (; i + 4 <= positions.size(); i += 4) {
+			if (!get_values4(seed_add, &positions[i], &values[i])) {
+				for (size_t k = i; k < i + 4; ++k) {
+					values[k] = get_value(positions[k].x, positions[k].y, positions[k].z);
+				}
+			}
+		}
+	}
+#endif
+	for (; i < positions.size(); ++i) {
+		values[i] = get_value(positions[i].x, positions[i].y, positions[i].z);
+	}
+}
+
+interval gradient_noise::get_interval(const vec3& min, const vec3& max) const {
+	// the cells that a box wider than a cell covers whole bound it about as loosely as the bounds do
+	if (!(max.x - min.x < 1. && max.y - min.y < 1. && max.z - min.z < 1.)) {
+		return get_bounds();
+	}
+	const auto x0 = floor_to<int64_t>(min.x);
+	const auto y0 = floor_to<int64_t>(min.y);
+	const auto z0 = floor_to<int64_t>(min.z);
+	const auto x1 = floor_to<int64_t>(max.x);
+	const auto y1 = floor_to<int64_t>(max.y);
+	const auto z1 = floor_to<int64_t>(max.z);
+	interval result{std::numeric_limits<double>::max(), std::numeric_limits<double>::lowest()};
+	for (int64_t cz = z0; cz <= z1; ++cz) {
+		for (int64_t cy = y0; cy <= y1; ++cy) {
+			for (int64_t cx = x0; cx <= x1; ++cx) {
+				const interval dx{std::max(min.x - cx, 0.), std::min(max.x - cx, 1.)};
+				const interval dy{std::max(min.y - cy, 0.), std::min(max.y - cy, 1.)};
+				const interval dz{std::max(min.z - cz, 0.), std::min(max.z - cz, 1.)};
+				result = result.hull(_get_cell_interval(cx, cy, cz, dx, dy, dz));
+			}
+		}
+	}
+	return result;
+}
+
+interval gradient_noise::get_bounds() {
+	// the corners are dot products with offsets no longer than sqrt(3), and the lerps stay within the corners
+	static const double bound = [] {
+		double max_length_sqr = 0;
+		for (size_t i = 0; i < std::size(tables::random_vectors_3d); i += 4) {
+			const double* v = &tables::random_vectors_3d[i];
+			max_length_sqr = std::max(max_length_sqr, v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+		}
+		return 1.3 * std::sqrt(3. * max_length_sqr);
+	}();
+	return {-bound, bound};
+}
+
+double gradient_noise::get_lipschitz() {
+	// along each axis the lerps of the corner vectors plus the quintic slope, at most 30 / 16, times the difference of two
+	// corners, each no larger than the vector length times sqrt(3)
+	static const double bound = [] {
+		double max_length_sqr = 0;
+		for (size_t i = 0; i < std::size(tables::random_vectors_3d); i += 4) {
+			const double* v = &tables::random_vectors_3d[i];
+			max_length_sqr = std::max(max_length_sqr, v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+		}
+		const double length = std::sqrt(max_length_sqr);
+		return 1.3 * std::sqrt(3.) * (length + 30. / 16. * 2. * std::sqrt(3.) * length);
+	}();
+	return bound;
+}
+
+interval gradient_noise::_get_cell_interval(int64_t cx, int64_t cy, int64_t cz, const interval& dx0, const interval& dy0, const interval& dz0) const {
+	// the quintic is increasing within the cell
+	const interval xs{_quintic(dx0.lower), _quintic(dx0.upper)};
+	const interval ys{_quintic(dy0.lower), _quintic(dy0.upper)};
+	const interval zs{_quintic(dz0.lower), _quintic(dz0.upper)};
+	const interval dx1 = dx0 - 1.;
+	const interval dy1 = dy0 - 1.;
+	const interval dz1 = dz0 - 1.;
+	const int64_t cx0 = cx * 1619ll;
+	const int64_t cy0 = cy * 31337ll;
+	const int64_t cz0 = cz * 6971ll + static_cast<int64_t>(_seed_add);
+	const int64_t cx1 = cx0 + 1619ll;
+	const int64_t cy1 = cy0 + 31337ll;
+	const int64_t cz1 = cz0 + 6971ll;
+
+	const interval n00 = lerp(_n(cx0, cy0, cz0, dx0, dy0, dz0), _n(cx1, cy0, cz0, dx1, dy0, dz0), xs);
+	const interval n10 = lerp(_n(cx0, cy1, cz0, dx0, dy1, dz0), _n(cx1, cy1, cz0, dx1, dy1, dz0), xs);
+	const interval n01 = lerp(_n(cx0, cy0, cz1, dx0, dy0, dz1), _n(cx1, cy0, cz1, dx1, dy0, dz1), xs);
+	const interval n11 = lerp(_n(cx0, cy1, cz1, dx0, dy1, dz1), _n(cx1, cy1, cz1, dx1, dy1, dz1), xs);
+	return lerp(lerp(n00, n10, ys), lerp(n01, n11, ys), zs) * 1.3;
+}
+}
@@ -1,12 +1,20 @@
 #pragma once
 
+#include <span>
+
 #include "tables.h"
+#include "core/math/interval.h"
 #include "core/math/math_util.h"
+#include "core/math/vec3.h"
 
 namespace playchilla {
 class gradient_noise {
 public:
-	gradient_noise(uint64_t seed) : _seed_add(1013 * seed) {
+	gradient_noise(uint64_t seed) : _seed(seed), _seed_add(1013 * seed) {
+	}
+
+	uint64_t get_seed() const {
+		return _seed;
 	}
 
 	double get_value(const double x, const double y, const double z) const {
@@ -39,13 +47,93 @@ public:
 		return 1.3 * _lerp(yf0, yf1, zs);
 	}
 
+	// The value is the same as get_value, the gradient is the exact derivative of it
+	double get_value_and_gradient(const double x, const double y, const double z, vec3& gradient) const {
+		auto cx0 = floor_to<int64_t>(x);
+		auto cy0 = floor_to<int64_t>(y);
+		auto cz0 = floor_to<int64_t>(z);
+		const double dx0 = x - cx0;
+		const double dy0 = y - cy0;
+		const double dz0 = z - cz0;
+		const double xs = _quintic(dx0);
+		const double ys = _quintic(dy0);
+		const double zs = _quintic(dz0);
+		const double dxs = _quintic_derivative(dx0);
+		const double dys = _quintic_derivative(dy0);
+		const double dzs = _quintic_derivative(dz0);
+
+		const double dx1 = dx0 - 1.;
+		const double dy1 = dy0 - 1.;
+		const double dz1 = dz0 - 1.;
+		cx0 *= 1619ll;
+		cy0 *= 31337ll;
+		cz0 = cz0 * 6971ll + _seed_add;
+		const int64_t cx1 = cx0 + 1619ll;
+		const int64_t cy1 = cy0 + 31337ll;
+		const int64_t cz1 = cz0 + 6971ll;
+
+		// the corner values are dot products with the corner vectors, which are their gradients
+		vec3 g00, g10, g01, g11;
+		const double n00 = _lerp_x(cx0, cx1, cy0, cz0, dx0, dx1, dy0, dz0, xs, dxs, g00);
+		const double n10 = _lerp_x(cx0, cx1, cy1, cz0, dx0, dx1, dy1, dz0, xs, dxs, g10);
+		const double n01 = _lerp_x(cx0, cx1, cy0, cz1, dx0, dx1, dy0, dz1, xs, dxs, g01);
+		const double n11 = _lerp_x(cx0, cx1, cy1, cz1, dx0, dx1, dy1, dz1, xs, dxs, g11);
+		vec3 gy0 = g00 + (g10 - g00) * ys;
+		vec3 gy1 = g01 + (g11 - g01) * ys;
+		gy0.y += (n10 - n00) * dys;
+		gy1.y += (n11 - n01) * dys;
+		const double yf0 = _lerp(n00, n10, ys);
+		const double yf1 = _lerp(n01, n11, ys);
+		gradient = gy0 + (gy1 - gy0) * zs;
+		gradient.z += (yf1 - yf0) * dzs;
+		gradient *= 1.3;
+		return 1.3 * _lerp(yf0, yf1, zs);
+	}
+
+	// The values are bit-identical to get_value, four points at a time with AVX2 when the cpu has it
+	void get_values(std::span<const vec3> positions, std::span<double> values) const;
+	static bool has_simd();
+
+	// Contains every value within the box, from the corner vectors of the cells it covers
+	interval get_interval(const vec3& min, const vec3& max) const;
+
+	// Contains every value of any noise
+	static interval get_bounds();
+
+	// No two positions of any noise have values further apart than this times their distance
+	static double get_lipschitz();
+
 private:
 	static double _n(const int64_t cx, const int64_t cy, const int64_t cz, const double dx, const double dy, const double dz) {
+		const double* v = _random_vector(cx, cy, cz);
+		return dx * v[0] + dy * v[1] + dz * v[2];
+	}
+
+	static interval _n(const int64_t cx, const int64_t cy, const int64_t cz, const interval& dx, const interval& dy, const interval& dz) {
+		const double* v = _random_vector(cx, cy, cz);
+		return dx * v[0] + dy * v[1] + dz * v[2];
+	}
+
+	// The values of the cell at cx, cy, cz for the offsets within it
+	interval _get_cell_interval(int64_t cx, int64_t cy, int64_t cz, const interval& dx0, const interval& dy0, const interval& dz0) const;
+
+	static const double* _random_vector(const int64_t cx, const int64_t cy, const int64_t cz) {
 		int64_t i = cx ^ cy ^ cz;
 		i ^= (i >> 8);
 		i &= 0xff;
 		i *= 4;
-		return dx * tables::random_vectors_3d[i] + dy * tables::random_vectors_3d[i + 1] + dz * tables::random_vectors_3d[i + 2];
+		return &tables::random_vectors_3d[i];
+	}
+
+	// The value of two corners along x blended by xs, with the gradient of it
+	static double _lerp_x(int64_t cx0, int64_t cx1, int64_t cy, int64_t cz, double dx0, double dx1, double dy, double dz, double xs, double dxs, vec3& gradient) {
+		const double* v0 = _random_vector(cx0, cy, cz);
+		const double* v1 = _random_vector(cx1, cy, cz);
+		const double n0 = dx0 * v0[0] + dy * v0[1] + dz * v0[2];
+		const double n1 = dx1 * v1[0] + dy * v1[1] + dz * v1[2];
+		gradient = {v0[0] + (v1[0] - v0[0]) * xs, v0[1] + (v1[1] - v0[1]) * xs, v0[2] + (v1[2] - v0[2]) * xs};
+		gradient.x += (n1 - n0) * dxs;
+		return _lerp(n0, n1, xs);
 	}
 
 	static double _lerp(double from, double to, double a) {
@@ -56,6 +144,11 @@ private:
 		return t * t * t * (t * (t * 6. - 15.) + 10.);
 	}
 
+	static double _quintic_derivative(double t) {
+		return 30. * t * t * (t * (t - 2.) + 1.);
+	}
+
+	uint64_t _seed;
 	uint64_t _seed_add;
 };
 }
@@ -0,0 +1,618 @@
+#include "compiled_volume.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "csg.h"
+#include "volume_optimizer.h"
+
+namespace playchilla::volumes {
+namespace {
+const constant* as_constant(const volume* v) {
+	return dynamic_cast<const constant*>(v);
+}
+
+const volume* skip_data(const volume* v) {
+	while (const auto* data = dynamic_cast<const data_volume*>(v)) {
+		v = data->get_source();
+	}
+	return v;
+}
+}
+
+compiled_volume::compiled_volume(const volume* source) : _source(source) {
+	// values of volumes with several users are often only used again in another branch, so the first pass finds the
+	// ones used again and the second only keeps those
+	_count_uses(source);
+	for (const bool keep_all : {true, false}) {
+		_instructions.clear();
+		_shared_values.clear();
+		_top = _pinned_top = _register_count = 0;
+		_call_count = _candidates = 0;
+		_keep_all = keep_all;
+		const uint16_t pos = _allocate(3);
+		_result = _allocate(1);
+		_compile(source, pos, _result);
+	}
+	_uses.clear();
+	_shared_values.clear();
+	_reused.clear();
+}
+
+const volume* compiled_volume::get_source() const {
+	return _source;
+}
+
+size_t compiled_volume::get_instruction_count() const {
+	return _instructions.size();
+}
+
+size_t compiled_volume::get_register_count() const {
+	return _register_count;
+}
+
+size_t compiled_volume::get_call_count() const {
+	return _call_count;
+}
+
+double compiled_volume::get_value(double x, double y, double z) const {
+	const vec3 pos(x, y, z);
+	double value;
+	if (_register_count > StackRegisterValues / BatchSize) {
+		get_values(std::span(&pos, 1), std::span(&value, 1));
+		return value;
+	}
+	std::array<double, StackRegisterValues / BatchSize> registers;
+	_run<1>(std::span(&pos, 1), std::span(&value, 1), registers);
+	return value;
+}
+
+void compiled_volume::get_values(std::span<const vec3> positions, std::span<double> values) const {
+	std::array<double, StackRegisterValues> stack_registers;
+	std::vector<double> heap_registers;
+	std::span<double> registers = stack_registers;
+	size_t lanes = std::min(BatchSize, StackRegisterValues / _register_count);
+	if (lanes == 0) {
+		// only very large trees need more registers than fit on the stack
+		lanes = BatchSize;
+		heap_registers.resize(lanes * _register_count);
+		registers = heap_registers;
+	}
+	for (size_t i = 0; i < positions.size(); i += lanes) {
+		const size_t count = std::min(lanes, positions.size() - i);
+		_run<0>(positions.subspan(i, count), values.subspan(i, count), registers);
+	}
+}
+
+double compiled_volume::get_value_and_gradient(double x, double y, double z, vec3& gradient) const {
+	return _source->get_value_and_gradient(x, y, z, gradient);
+}
+
+interval compiled_volume::get_interval(const aabb& box) const {
+	return _source->get_interval(box);
+}
+
+double compiled_volume::get_lipschitz(const aabb& box) const {
+	return _source->get_lipschitz(box);
+}
+
+const volume* compiled_volume::approximate(double tolerance, volume_unique_ptrs& owned) const {
+	const volume* source = _source->approximate(tolerance, owned);
+	return source == _source ? this : _own<compiled_volume>(owned, source);
+}
+
+void compiled_volume::get_data(const vec3& pos, volume_data& data) const {
+	_source->get_data(pos, data);
+}
+
+void compiled_volume::_count_uses(const volume* v) {
+	if (_uses[skip_data(v)]++ == 0) {
+		for (const auto* child : volume_optimizer::get_children(skip_data(v))) {
+			_count_uses(child);
+		}
+	}
+}
+
+void compiled_volume::_compile(const volume* v, uint16_t pos, uint16_t dst) {
+	v = skip_data(v);
+
+	// a volume with several users keeps its value in a register for the later uses at the same position
+	bool shared = _uses[v] > 1 && !as_constant(v);
+	size_t candidate = 0;
+	if (shared) {
+		if (const auto it = _shared_values.find({v, pos}); it != _shared_values.end()) {
+			_reused[it->second.candidate] = true;
+			_emit(opcode::copy, dst, it->second.reg);
+			return;
+		}
+		candidate = _candidates++;
+		if (_keep_all) {
+			_reused.push_back(false);
+		}
+		shared = _keep_all || _reused[candidate];
+	}
+
+	// the registers allocated by v are free to reuse once its value is in dst
+	const uint16_t top = _top;
+	const uint16_t target = shared ? _allocate(1) : dst;
+	if (!_try_compile_leaf(v, pos, target) && !_try_compile_combiner(v, pos, target) && !_try_compile_transform(v, pos, target)) {
+		_emit(opcode::call, target, pos).source = v;
+		++_call_count;
+	}
+	if (shared) {
+		_emit(opcode::copy, dst, target);
+		_shared_values[{v, pos}] = {target, candidate};
+		_pinned_top = std::max<uint16_t>(_pinned_top, target + 1);
+	}
+	_top = std::max(top, _pinned_top);
+}
+
+void compiled_volume::_compile_branch(const volume* v, uint16_t pos, uint16_t dst) {
+	// a branch only runs for some of the positions, so values from it can't be used after it and values from before
+	// it may be in other registers when the branch runs on its positions gathered
+	auto shared_values = std::exchange(_shared_values, {});
+	const uint16_t pinned_top = _pinned_top;
+	_compile(v, pos, dst);
+	_shared_values = std::move(shared_values);
+	_pinned_top = pinned_top;
+}
+
+bool compiled_volume::_try_compile_leaf(const volume* v, uint16_t pos, uint16_t dst) {
+	if (const auto* c = as_constant(v)) {
+		_emit(opcode::constant, dst).imm[0] = c->get_constant();
+		return true;
+	}
+	if (const auto* s = dynamic_cast<const sphere*>(v)) {
+		_emit(opcode::sphere, dst, pos).imm[0] = s->get_radius();
+		return true;
+	}
+	if (const auto* c = dynamic_cast<const cube*>(v)) {
+		const vec3& half_extents = c->get_half_extents();
+		_emit(opcode::cube, dst, pos).imm = {half_extents.x, half_extents.y, half_extents.z};
+		return true;
+	}
+	if (const auto* n = dynamic_cast<const noise*>(v)) {
+		auto& i = _emit(opcode::noise, dst, pos);
+		i.noise = &n->get_noise();
+		i.imm[0] = n->get_frequency();
+		return true;
+	}
+	if (const auto* n = dynamic_cast<const noise2d*>(v)) {
+		auto& i = _emit(opcode::noise2d, dst, pos);
+		i.noise = &n->get_noise();
+		i.imm = {n->get_radius(), n->get_frequency(), 0.};
+		return true;
+	}
+	return false;
+}
+
+bool compiled_volume::_try_compile_combiner(const volume* v, uint16_t pos, uint16_t dst) {
+	// the values are combined in the same order as the volumes do, starting from the same initial value
+	if (const auto* n = dynamic_cast<const negate_value*>(v)) {
+		_compile(n->get_source(), pos, dst);
+		_emit(opcode::negate, dst, dst);
+		return true;
+	}
+	if (const auto* r = dynamic_cast<const to_range*>(v)) {
+		_compile(r->get_source(), pos, dst);
+		_emit(opcode::to_range, dst, dst).imm = {r->get_from(), r->get_to() - r->get_from(), 0.};
+		return true;
+	}
+	if (const auto* add = dynamic_cast<const add_value*>(v)) {
+		// the first source goes straight to dst, so a chain of volumes doesn't need a register per link
+		const auto& sources = add->get_sources();
+		_compile(sources[0], pos, dst);
+		_emit(opcode::add_imm, dst, dst).imm[0] = 0.; // the sum starts from 0, which turns -0 into 0
+		const uint16_t term = _allocate(1);
+		for (size_t i = 1; i < sources.size(); ++i) {
+			if (const auto* c = as_constant(sources[i])) {
+				_emit(opcode::add_imm, dst, dst).imm[0] = c->get_constant();
+				continue;
+			}
+			_compile(sources[i], pos, term);
+			_emit(opcode::add, dst, dst, term);
+		}
+		return true;
+	}
+	if (const auto* mul = dynamic_cast<const mul_value*>(v)) {
+		const auto& sources = mul->get_sources();
+		if (sources.empty()) {
+			_emit(opcode::constant, dst).imm[0] = 1.;
+			return true;
+		}
+		_compile(sources[0], pos, dst); // the product starts from 1, and 1 * v is v
+		const uint16_t factor = _allocate(1);
+		for (size_t i = 1; i < sources.size(); ++i) {
+			if (const auto* c = as_constant(sources[i])) {
+				_emit(opcode::mul_imm, dst, dst).imm[0] = c->get_constant();
+				continue;
+			}
+			_compile(sources[i], pos, factor);
+			_emit(opcode::mul, dst, dst, factor);
+		}
+		return true;
+	}
+	if (const auto* u = dynamic_cast<const union_volume*>(v)) {
+		const auto& sources = u->get_sources();
+		if (sources.empty()) {
+			_emit(opcode::constant, dst).imm[0] = u->get_min_value();
+			return true;
+		}
+		_compile(sources[0], pos, dst);
+		_emit(opcode::max_imm, dst, dst).imm[0] = u->get_min_value();
+		const uint16_t source = _allocate(1);
+		for (size_t i = 1; i < sources.size(); ++i) {
+			_compile(sources[i], pos, source);
+			_emit(opcode::max, dst, dst, source);
+		}
+		return true;
+	}
+	if (const auto* d = dynamic_cast<const difference*>(v)) {
+		_compile(d->get_source(), pos, dst);
+		const uint16_t rhs = _allocate(1);
+		for (const auto* s : d->get_differences()) {
+			_compile(s, pos, rhs);
+			_emit(opcode::min_negated, dst, dst, rhs);
+		}
+		return true;
+	}
+	if (const auto* f = dynamic_cast<const fbm*>(v)) {
+		// the octaves are unrolled, each one scales the position of the previous one
+		const uint16_t octave_pos = _allocate(3);
+		const uint16_t octave_value = _allocate(1);
+		_emit(opcode::constant, dst).imm[0] = 0.;
+		uint16_t current_pos = pos;
+		double amp = 1.0;
+		for (uint32_t i = 0; i < f->get_octaves(); ++i) {
+			_compile(f->get_source(), current_pos, octave_value);
+			_emit(opcode::mul_add_imm, dst, dst, octave_value).imm[0] = amp;
+			if (i + 1 < f->get_octaves()) {
+				_emit(opcode::mul_pos_imm, octave_pos, current_pos).imm[0] = f->get_lacunarity();
+				current_pos = octave_pos;
+			}
+			amp *= f->get_gain();
+		}
+		_emit(opcode::mul_imm, dst, dst).imm[0] = f->get_scale();
+		return true;
+	}
+	if (const auto* a = dynamic_cast<const add_constant*>(v)) {
+		_compile(a->get_source(), pos, dst);
+		_emit(opcode::add_imm, dst, dst).imm[0] = 0.;
+		_emit(opcode::add_imm, dst, dst).imm[0] = a->get_constant();
+		return true;
+	}
+	if (const auto* m = dynamic_cast<const mul_constant*>(v)) {
+		_compile(m->get_source(), pos, dst);
+		_emit(opcode::mul_imm, dst, dst).imm[0] = m->get_constant();
+		return true;
+	}
+	if (const auto* s = dynamic_cast<const select*>(v)) {
+		const uint16_t alpha = _allocate(1);
+		const uint16_t second = _allocate(1);
+		_compile(s->get_controller(), pos, alpha);
+		if (const auto* greater = s->get_condition().target<greater_condition>()) {
+			_emit(opcode::ramp, alpha, alpha).imm = {greater->lower, greater->inv_interval, 0.};
+		}
+		else {
+			_emit(opcode::condition, alpha, alpha).condition = &s->get_condition();
+		}
+
+		// like get_value, each branch is only evaluated for the positions that need it
+		const size_t first_branch = _instructions.size();
+		_emit(opcode::first_branch, dst, alpha, pos);
+		_compile_branch(s->get_first(), pos, dst);
+		_instructions[first_branch].jump = static_cast<uint32_t>(_instructions.size());
+		const size_t second_branch = _instructions.size();
+		_emit(opcode::second_branch, second, alpha, pos);
+		_compile_branch(s->get_second(), pos, second);
+		_instructions[second_branch].jump = static_cast<uint32_t>(_instructions.size());
+		_emit(opcode::blend, dst, alpha, dst, second);
+		return true;
+	}
+	return false;
+}
+
+bool compiled_volume::_try_compile_transform(const volume* v, uint16_t pos, uint16_t dst) {
+	if (const auto* t = dynamic_cast<const inv_translate*>(v)) {
+		const auto translation = t->get_translation();
+		const uint16_t translated = _allocate(3);
+		const auto* x = as_constant(translation[0]);
+		const auto* y = as_constant(translation[1]);
+		const auto* z = as_constant(translation[2]);
+		if (x && y && z) {
+			_emit(opcode::translate_imm, translated, pos).imm = {x->get_constant(), y->get_constant(), z->get_constant()};
+		}
+		else {
+			const uint16_t offset = _allocate(3);
+			for (uint16_t axis = 0; axis < 3; ++axis) {
+				_compile(translation[axis], pos, offset + axis);
+			}
+			_emit(opcode::translate, translated, pos, offset);
+		}
+		_compile(t->get_source(), translated, dst);
+		return true;
+	}
+	if (const auto* t = dynamic_cast<const translate_constant*>(v)) {
+		const vec3& translation = t->get_translation();
+		const uint16_t translated = _allocate(3);
+		_emit(opcode::translate_imm, translated, pos).imm = {translation.x, translation.y, translation.z};
+		_compile(t->get_source(), translated, dst);
+		return true;
+	}
+	if (const auto* s = dynamic_cast<const scale_constant*>(v)) {
+		const uint16_t scaled = _allocate(3);
+		_emit(opcode::div_pos_imm, scaled, pos).imm[0] = s->get_scale();
+		_compile(s->get_source(), scaled, dst);
+		_emit(opcode::mul_imm, dst, dst).imm[0] = s->get_scale();
+		return true;
+	}
+	if (const auto* s = dynamic_cast<const inv_scale*>(v)) {
+		const uint16_t scaled = _allocate(3);
+		if (const auto* c = as_constant(s->get_scale())) {
+			_emit(opcode::div_pos_imm, scaled, pos).imm[0] = c->get_constant();
+			_compile(s->get_source(), scaled, dst);
+			_emit(opcode::mul_imm, dst, dst).imm[0] = c->get_constant();
+			return true;
+		}
+		const uint16_t scale = _allocate(1);
+		_compile(s->get_scale(), pos, scale);
+		_emit(opcode::div_pos, scaled, pos, scale);
+		_compile(s->get_source(), scaled, dst);
+		_emit(opcode::mul, dst, dst, scale);
+		return true;
+	}
+	return false;
+}
+
+compiled_volume::instruction& compiled_volume::_emit(opcode op, uint16_t dst, uint16_t a, uint16_t b, uint16_t c) {
+	if (op == opcode::translate || op == opcode::translate_imm || op == opcode::div_pos || op == opcode::div_pos_imm ||
+		op == opcode::mul_pos_imm) {
+		// the values kept for the old position in the registers are not for the new one
+		std::erase_if(_shared_values, [dst](const auto& shared) { return shared.first.second == dst; });
+	}
+	return _instructions.emplace_back(instruction{op, dst, a, b, c});
+}
+
+uint16_t compiled_volume::_allocate(uint16_t count) {
+	assertion(_top + count <= UINT16_MAX, "Too many registers in compiled volume");
+	const uint16_t first = _top;
+	_top += count;
+	_register_count = std::max(_register_count, _top);
+	return first;
+}
+
+template <size_t Lanes>
+void compiled_volume::_run(std::span<const vec3> positions, std::span<double> values, std::span<double> registers) const {
+	// a single position has its lane count known at compile time, which removes the loops
+	const size_t n = Lanes != 0 ? Lanes : positions.size();
+	for (size_t i = 0; i < n; ++i) {
+		registers[i] = positions[i].x;
+		registers[n + i] = positions[i].y;
+		registers[2 * n + i] = positions[i].z;
+	}
+	_execute<Lanes>(0, _instructions.size(), n, registers);
+	std::copy_n(registers.begin() + _result * n, n, values.begin());
+}
+
+size_t compiled_volume::_run_branch(const instruction& branch, size_t begin, size_t n, std::span<double> registers) const {
+	const double* alpha = &registers[branch.a * n];
+	const bool first = branch.op == opcode::first_branch;
+	std::array<uint32_t, BatchSize> needed;
+	size_t needed_count = 0;
+	for (size_t i = 0; i < n; ++i) {
+		if (first ? !(alpha[i] >= 1.) : !(alpha[i] <= 0.)) {
+			needed[needed_count++] = static_cast<uint32_t>(i);
+		}
+	}
+	if (needed_count == 0) {
+		return branch.jump;
+	}
+
+	// the branch only reads its position, so the needed lanes are gathered into registers of their own
+	const auto branch_registers = registers.subspan(_register_count * n);
+	if (needed_count == n || branch_registers.size() < _register_count * needed_count) {
+		return begin;
+	}
+	const size_t m = needed_count;
+	for (size_t axis = 0; axis < 3; ++axis) {
+		for (size_t j = 0; j < m; ++j) {
+			branch_registers[(branch.b + axis) * m + j] = registers[(branch.b + axis) * n + needed[j]];
+		}
+	}
+	_execute<0>(begin, branch.jump, m, branch_registers);
+	for (size_t j = 0; j < m; ++j) {
+		registers[branch.dst * n + needed[j]] = branch_registers[branch.dst * m + j];
+	}
+	return branch.jump;
+}
+
+template <size_t Lanes>
+void compiled_volume::_execute(size_t begin, size_t end, size_t lanes, std::span<double> registers) const {
+	const size_t n = Lanes != 0 ? Lanes : lanes;
+	const auto reg = [&registers, n](uint16_t r) {
+		return registers.data() + r * n;
+	};
+
+	size_t pc = begin;
+	while (pc < end) {
+		const instruction& in = _instructions[pc++];
+		double* dst = reg(in.dst);
+		const double* a = reg(in.a);
+		const double* b = reg(in.b);
+		const double* c = reg(in.c);
+		switch (in.op) {
+		case opcode::constant:
+			std::fill_n(dst, n, in.imm[0]);
+			break;
+		case opcode::sphere:
+			for (size_t i = 0; i < n; ++i) {
+				const double x = a[i];
+				const double y = a[n + i];
+				const double z = a[2 * n + i];
+				dst[i] = in.imm[0] - std::sqrt(x * x + y * y + z * z);
+			}
+			break;
+		case opcode::cube:
+			for (size_t i = 0; i < n; ++i) {
+				const double xa = std::abs(a[i]) - in.imm[0];
+				const double ya = std::abs(a[n + i]) - in.imm[1];
+				const double za = std::abs(a[2 * n + i]) - in.imm[2];
+				dst[i] = -max(xa, max(ya, za));
+			}
+			break;
+		case opcode::noise: {
+			const double frequency = in.imm[0];
+			if (n == 1) {
+				dst[0] = in.noise->get_value(frequency * a[0], frequency * a[1], frequency * a[2]);
+				break;
+			}
+			batch_positions noise_positions;
+			for (size_t i = 0; i < n; ++i) {
+				noise_positions.data[i] = {frequency * a[i], frequency * a[n + i], frequency * a[2 * n + i]};
+			}
+			in.noise->get_values(std::span(noise_positions.data, n), std::span(dst, n));
+			break;
+		}
+		case opcode::noise2d: {
+			const double frequency = in.imm[1];
+			if (n == 1) {
+				const vec3 surface_pos = vec3{a[0], a[1], a[2]}.rescale(in.imm[0]);
+				dst[0] = in.noise->get_value(frequency * surface_pos.x, frequency * surface_pos.y, frequency * surface_pos.z);
+				break;
+			}
+			batch_positions noise_positions;
+			for (size_t i = 0; i < n; ++i) {
+				const vec3 surface_pos = vec3{a[i], a[n + i], a[2 * n + i]}.rescale(in.imm[0]);
+				noise_positions.data[i] = {frequency * surface_pos.x, frequency * surface_pos.y, frequency * surface_pos.z};
+			}
+			in.noise->get_values(std::span(noise_positions.data, n), std::span(dst, n));
+			break;
+		}
+		case opcode::call: {
+			if (n == 1) {
+				dst[0] = in.source->get_value(a[0], a[1], a[2]);
+				break;
+			}
+			batch_positions call_positions;
+			for (size_t i = 0; i < n; ++i) {
+				call_positions.data[i] = {a[i], a[n + i], a[2 * n + i]};
+			}
+			in.source->get_values(std::span(call_positions.data, n), std::span(dst, n));
+			break;
+		}
+		case opcode::copy:
+			std::copy_n(a, n, dst);
+			break;
+		case opcode::negate:
+			for (size_t i = 0; i < n; ++i) {
+				dst[i] = -a[i];
+			}
+			break;
+		case opcode::add:
+			for (size_t i = 0; i < n; ++i) {
+				dst[i] = a[i] + b[i];
+			}
+			break;
+		case opcode::add_imm:
+			for (size_t i = 0; i < n; ++i) {
+				dst[i] = a[i] + in.imm[0];
+			}
+			break;
+		case opcode::mul:
+			for (size_t i = 0; i < n; ++i) {
+				dst[i] = a[i] * b[i];
+			}
+			break;
+		case opcode::mul_imm:
+			for (size_t i = 0; i < n; ++i) {
+				dst[i] = a[i] * in.imm[0];
+			}
+			break;
+		case opcode::mul_add_imm:
+			for (size_t i = 0; i < n; ++i) {
+				dst[i] = a[i] + in.imm[0] * b[i];
+			}
+			break;
+		case opcode::max:
+			for (size_t i = 0; i < n; ++i) {
+				dst[i] = std::max(a[i], b[i]);
+			}
+			break;
+		case opcode::max_imm:
+			for (size_t i = 0; i < n; ++i) {
+				dst[i] = std::max(in.imm[0], a[i]);
+			}
+			break;
+		case opcode::min_negated:
+			for (size_t i = 0; i < n; ++i) {
+				dst[i] = std::min(a[i], -b[i]);
+			}
+			break;
+		case opcode::to_range:
+			for (size_t i = 0; i < n; ++i) {
+				const auto v01 = .5 * (1. + a[i]);
+				assertion(v01 >= 0 && v01 <= 1, "to_range unexpected input");
+				dst[i] = in.imm[0] + v01 * in.imm[1];
+			}
+			break;
+		case opcode::ramp:
+			for (size_t i = 0; i < n; ++i) {
+				dst[i] = std::clamp(in.imm[1] * (a[i] - in.imm[0]), 0., 1.);
+			}
+			break;
+		case opcode::condition:
+			for (size_t i = 0; i < n; ++i) {
+				dst[i] = (*in.condition)(a[i]);
+			}
+			break;
+		case opcode::first_branch:
+		case opcode::second_branch:
+			pc = _run_branch(in, pc, n, registers);
+			break;
+		case opcode::blend:
+			for (size_t i = 0; i < n; ++i) {
+				const double alpha = a[i];
+				if (alpha <= 0.) {
+					dst[i] = b[i];
+				}
+				else if (alpha >= 1.) {
+					dst[i] = c[i];
+				}
+				else {
+					dst[i] = (1. - alpha) * b[i] + alpha * c[i];
+				}
+			}
+			break;
+		case opcode::translate:
+			for (size_t i = 0; i < 3 * n; ++i) {
+				dst[i] = a[i] - b[i];
+			}
+			break;
+		case opcode::translate_imm:
+			for (size_t axis = 0; axis < 3; ++axis) {
+				for (size_t i = axis * n; i < (axis + 1) * n; ++i) {
+					dst[i] = a[i] - in.imm[axis];
+				}
+			}
+			break;
+		case opcode::div_pos:
+			for (size_t axis = 0; axis < 3; ++axis) {
+				for (size_t i = 0; i < n; ++i) {
+					dst[axis * n + i] = a[axis * n + i] / b[i];
+				}
+			}
+			break;
+		case opcode::div_pos_imm:
+			for (size_t i = 0; i < 3 * n; ++i) {
+				dst[i] = a[i] / in.imm[0];
+			}
+			break;
+		case opcode::mul_pos_imm:
+			for (size_t i = 0; i < 3 * n; ++i) {
+				dst[i] = a[i] * in.imm[0];
+			}
+			break;
+		}
+	}
+}
+}
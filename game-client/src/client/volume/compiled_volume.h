@@ -0,0 +1,126 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+#include "afront/volume.h"
+
+namespace playchilla {
+class gradient_noise;
+}
+
+namespace playchilla::volumes {
+/**
+ * A volume tree lowered to a flat list of instructions over registers, evaluated by a loop over the instructions
+ * without virtual calls. Volumes that the compiler doesn't know are evaluated with a call instruction. The values
+ * are bit-identical to the source and the data comes from the source. A volume that is used by several volumes is
+ * evaluated once for each position, see volume_optimizer for sharing identical sub trees.
+ *
+ * Opt-in: the dispatch over one instruction per node costs more than the virtual calls it replaces, so on noise heavy
+ * trees like the planet it is slower than the tree, see the volume_codegen Performance test. The terrain uses the
+ * generated volume instead.
+ */
+class compiled_volume : public volume {
+public:
+	compiled_volume(const volume* source);
+
+	const volume* get_source() const;
+	size_t get_instruction_count() const;
+	size_t get_register_count() const;
+	size_t get_call_count() const; // Volumes evaluated through a virtual call
+
+	double get_value(double x, double y, double z) const override;
+	void get_values(std::span<const vec3> positions, std::span<double> values) const override;
+	double get_value_and_gradient(double x, double y, double z, vec3& gradient) const override; // From the source
+	interval get_interval(const aabb& box) const override; // From the source
+	double get_lipschitz(const aabb& box) const override; // From the source
+	const volume* approximate(double tolerance, volume_unique_ptrs& owned) const override; // Compiles the approximated source
+	void get_data(const vec3& pos, volume_data& data) const override;
+
+private:
+	enum class opcode : uint8_t {
+		constant,
+		sphere,
+		cube,
+		noise,
+		noise2d,
+		call,
+		copy,
+		negate,
+		add,
+		add_imm,
+		mul,
+		mul_imm,
+		mul_add_imm,
+		max,
+		max_imm,
+		min_negated,
+		to_range,
+		ramp,
+		condition,
+		first_branch,
+		second_branch,
+		blend,
+		translate,
+		translate_imm,
+		div_pos,
+		div_pos_imm,
+		mul_pos_imm,
+	};
+
+	// The register with the value of a volume for later uses at the same position
+	struct shared_value {
+		uint16_t reg;
+		size_t candidate;
+	};
+
+	// A position is three registers in a row, x, y and z. A branch is the instructions up to jump, evaluated for the
+	// positions where the select alpha in register a needs it, with the position in b and the value in dst.
+	struct instruction {
+		opcode op;
+		uint16_t dst = 0;
+		uint16_t a = 0;
+		uint16_t b = 0;
+		uint16_t c = 0;
+		uint32_t jump = 0;
+		std::array<double, 3> imm{};
+		const gradient_noise* noise = nullptr;
+		const volume* source = nullptr;
+		const std::function<double(double)>* condition = nullptr;
+	};
+
+	// Registers hold one value per position, laid out register by register
+	static constexpr size_t StackRegisterValues = 2048;
+
+	void _count_uses(const volume* v);
+	void _compile(const volume* v, uint16_t pos, uint16_t dst);
+	void _compile_branch(const volume* v, uint16_t pos, uint16_t dst);
+	bool _try_compile_leaf(const volume* v, uint16_t pos, uint16_t dst);
+	bool _try_compile_combiner(const volume* v, uint16_t pos, uint16_t dst);
+	bool _try_compile_transform(const volume* v, uint16_t pos, uint16_t dst);
+	instruction& _emit(opcode op, uint16_t dst, uint16_t a = 0, uint16_t b = 0, uint16_t c = 0);
+	uint16_t _allocate(uint16_t count);
+	template <size_t Lanes>
+	void _run(std::span<const vec3> positions, std::span<double> values, std::span<double> registers) const;
+	template <size_t Lanes>
+	void _execute(size_t begin, size_t end, size_t lanes, std::span<double> registers) const;
+	size_t _run_branch(const instruction& branch, size_t begin, size_t n, std::span<double> registers) const;
+
+	const volume* _source;
+	std::vector<instruction> _instructions;
+	uint16_t _top = 0;
+	uint16_t _pinned_top = 0; // Registers below hold the values of volumes used again in the same branch
+	std::unordered_map<const volume*, size_t> _uses;
+	std::map<std::pair<const volume*, uint16_t>, shared_value> _shared_values; // By volume and position
+	std::vector<bool> _reused; // If the value of a volume with several users was used again, by candidate
+	size_t _candidates = 0;
+	bool _keep_all = false; // Keeps the values of all volumes with several users to find the ones used again
+	uint16_t _register_count = 0;
+	uint16_t _result = 0;
+	size_t _call_count = 0;
+};
+}
@@ -3,10 +3,12 @@
 #include <algorithm>
 #include <utility>
 
+#include "compiled_volume.h"
 #include "difference.h"
 #include "fbm.h"
 #include "select.h"
 #include "union.h"
+#include "volume_optimizer.h"
 #include "volumes.h"
 
 namespace playchilla {
@@ -20,6 +22,11 @@ public:
 		return volume_ptr;
 	}
 
+	const volume* add(volume_unique_ptr volume) {
+		_volumes.push_back(std::move(volume));
+		return _volumes.back().get();
+	}
+
 private:
 	volume_unique_ptrs _volumes;
 };
@@ -152,11 +159,25 @@ public:
 		return create<volumes::select>(first, second, controller, std::move(condition));
 	}
 
+	// Evaluates source as a flat program, the values are the same. Opt-in, on noise heavy trees it is slower than the tree
+	csg_instance compile(const volume* source) {
+		return create<volumes::compiled_volume>(source);
+	}
+
+	// The same values from a graph where identical sub trees are shared and constants are folded, see volume_optimizer
+	csg_instance optimize(const volume* source) {
+		return {_vr.get(), volumes::volume_optimizer(*_vr).optimize(source)};
+	}
+
 	template <typename T, typename... Args>
 	csg_instance create(Args... args) {
 		return {_vr.get(), _vr->create<T>(std::forward<Args>(args)...)};
 	}
 
+	volume_registry& get_registry() {
+		return *_vr;
+	}
+
 	mx3::random& rnd() {
 		return _rnd;
 	}
@@ -173,8 +194,6 @@ private:
 inline auto select_greater(double value, double falloff) {
 	auto lower = value - falloff;
 	auto higher = value + falloff;
-	return [lower, inv_interval = 1. / (higher - lower)](double value) {
-		return std::clamp(inv_interval * (value - lower), 0., 1.);
-	};
+	return volumes::greater_condition{lower, 1. / (higher - lower)};
 }
 }
@@ -1,6 +1,9 @@
 #pragma once
 
+#include <array>
+
 #include "afront/volume.h"
+#include "afront/volume_data.h"
 
 namespace playchilla::volumes {
 class difference : public volume {
@@ -10,6 +13,14 @@ public:
 		_differences(std::move(rhs)) {
 	}
 
+	const volume* get_source() const {
+		return _source;
+	}
+
+	const std::vector<const volume*>& get_differences() const {
+		return _differences;
+	}
+
 	double get_value(double x, double y, double z) const override {
 		double v = _source->get_value(x, y, z);
 		for (const auto& d : _differences) {
@@ -18,17 +29,94 @@ public:
 		return v;
 	}
 
+	void get_values(std::span<const vec3> positions, std::span<double> values) const override {
+		for_each_batch(positions, values, [this](std::span<const vec3> batch, std::span<double> mins) {
+			std::array<double, BatchSize> rhs_values;
+			_source->get_values(batch, mins);
+			for (const auto& d : _differences) {
+				d->get_values(batch, std::span(rhs_values).first(batch.size()));
+				for (size_t i = 0; i < batch.size(); ++i) {
+					mins[i] = std::min(mins[i], -rhs_values[i]);
+				}
+			}
+		});
+	}
+
+	double get_value_and_gradient(double x, double y, double z, vec3& gradient) const override {
+		double v = _source->get_value_and_gradient(x, y, z, gradient);
+		for (const auto& d : _differences) {
+			vec3 d_gradient;
+			const double dv = -d->get_value_and_gradient(x, y, z, d_gradient);
+			if (dv < v) {
+				v = dv;
+				gradient = -d_gradient;
+			}
+		}
+		return v;
+	}
+
+	interval get_interval(const aabb& box) const override {
+		interval v = _source->get_interval(box);
+		for (const auto& d : _differences) {
+			v = min(v, -d->get_interval(box));
+		}
+		return v;
+	}
+
+	double get_lipschitz(const aabb& box) const override {
+		double lipschitz = _source->get_lipschitz(box);
+		for (const auto& d : _differences) {
+			lipschitz = std::max(lipschitz, d->get_lipschitz(box));
+		}
+		return lipschitz;
+	}
+
+	// Leaves out the differences that never cut into the source within the box
+	const volume* specialize(const aabb& box, volume_unique_ptrs& owned) const override {
+		const double upper = _source->get_interval(box).upper;
+		const volume* source = _source->specialize(box, owned);
+		std::vector<const volume*> differences;
+		bool changed = source != _source;
+		for (const auto& d : _differences) {
+			if (-d->get_interval(box).upper >= upper) {
+				changed = true;
+				continue;
+			}
+			differences.push_back(d->specialize(box, owned));
+			changed |= differences.back() != d;
+		}
+		if (differences.empty()) {
+			return source;
+		}
+		return changed ? _own<difference>(owned, source, std::move(differences)) : this;
+	}
+
+	// The min moves no further than the sources do
+	const volume* approximate(double tolerance, volume_unique_ptrs& owned) const override {
+		const volume* source = _source->approximate(tolerance, owned);
+		std::vector<const volume*> differences;
+		const bool changed = _approximate(_differences, tolerance, owned, differences);
+		return source != _source || changed ? _own<difference>(owned, source, std::move(differences)) : this;
+	}
+
 	void get_data(const vec3& pos, volume_data& data) const override {
-		const volume* module = _source;
-		double v = _source->get_value(pos);
+		get_value_and_data(pos, data);
+	}
+
+	// Like union_volume, each volume sets its data on a copy and the copy of the smallest value is kept
+	double get_value_and_data(const vec3& pos, volume_data& data) const override {
+		volume_data min_data = data;
+		double v = _source->get_value_and_data(pos, min_data);
 		for (const auto& d : _differences) {
-			const double dv = -d->get_value(pos);
+			volume_data d_data = data;
+			const double dv = -d->get_value_and_data(pos, d_data);
 			if (dv < v) {
-				module = d;
 				v = dv;
+				min_data = std::move(d_data);
 			}
 		}
-		module->get_data(pos, data);
+		data = std::move(min_data);
+		return v;
 	}
 
 private:
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <array>
+
 namespace playchilla::volumes {
 class fbm : public volume {
 public:
@@ -13,6 +15,30 @@ public:
 		_scale = 1.0 / ampFractal;
 	}
 
+	// The first octaves of a longer fbm, with its scale
+	fbm(const volume* source, uint32_t octaves, double scale) : _source(source), _scale(scale), _octaves(octaves) {
+	}
+
+	const volume* get_source() const {
+		return _source;
+	}
+
+	uint32_t get_octaves() const {
+		return _octaves;
+	}
+
+	double get_lacunarity() const {
+		return _lacunarity;
+	}
+
+	double get_gain() const {
+		return _gain;
+	}
+
+	double get_scale() const {
+		return _scale;
+	}
+
 
 	double get_value(double x, double y, double z) const override {
 		double sum = 0;
@@ -27,10 +53,137 @@ public:
 		return _scale * sum;
 	}
 
+	void get_values(std::span<const vec3> positions, std::span<double> values) const override {
+		for_each_batch(positions, values, [this](std::span<const vec3> batch, std::span<double> sums) {
+			batch_positions octave_positions;
+			std::array<double, BatchSize> octave_values;
+			const size_t count = batch.size();
+			std::copy(batch.begin(), batch.end(), octave_positions.data);
+			std::fill(sums.begin(), sums.end(), 0.);
+			double amp = 1.0;
+			for (uint32_t octave = 0; octave < _octaves; ++octave) {
+				_source->get_values(std::span(octave_positions.data).first(count), std::span(octave_values).first(count));
+				for (size_t i = 0; i < count; ++i) {
+					sums[i] += amp * octave_values[i];
+					octave_positions.data[i].x *= _lacunarity;
+					octave_positions.data[i].y *= _lacunarity;
+					octave_positions.data[i].z *= _lacunarity;
+				}
+				amp *= _gain;
+			}
+			for (double& sum : sums) {
+				sum *= _scale;
+			}
+		});
+	}
+
+	double get_value_and_gradient(double x, double y, double z, vec3& gradient) const override {
+		double sum = 0;
+		double amp = 1.0;
+		double frequency = 1.0;
+		gradient = {};
+		for (uint32_t i = 0; i < _octaves; ++i) {
+			vec3 octave_gradient;
+			sum += amp * _source->get_value_and_gradient(x, y, z, octave_gradient);
+			gradient += octave_gradient * (amp * frequency);
+			x *= _lacunarity;
+			y *= _lacunarity;
+			z *= _lacunarity;
+			amp *= _gain;
+			frequency *= _lacunarity;
+		}
+		gradient *= _scale;
+		return _scale * sum;
+	}
+
+	interval get_interval(const aabb& box) const override {
+		interval sum = 0.;
+		double amp = 1.0;
+		vec3 min = box.get_min();
+		vec3 max = box.get_max();
+		for (uint32_t i = 0; i < _octaves; ++i) {
+			sum += _source->get_interval(aabb::create_from_min_max(min, max)) * amp;
+			min = min * _lacunarity;
+			max = max * _lacunarity;
+			amp *= _gain;
+		}
+		return sum * _scale;
+	}
+
+	double get_lipschitz(const aabb& box) const override {
+		double lipschitz = 0;
+		double amp = 1.0;
+		double frequency = 1.0;
+		vec3 min = box.get_min();
+		vec3 max = box.get_max();
+		for (uint32_t i = 0; i < _octaves; ++i) {
+			lipschitz += _source->get_lipschitz(aabb::create_from_min_max(min, max)) * amp * frequency;
+			min = min * _lacunarity;
+			max = max * _lacunarity;
+			amp *= _gain;
+			frequency *= _lacunarity;
+		}
+		return lipschitz * std::abs(_scale);
+	}
+
+	// The source over all the octaves of the box
+	const volume* specialize(const aabb& box, volume_unique_ptrs& owned) const override {
+		const double last_frequency = std::pow(_lacunarity, _octaves - 1.);
+		const vec3 min = box.get_min();
+		const vec3 max = box.get_max();
+		const vec3 last_min = min * last_frequency;
+		const vec3 last_max = max * last_frequency;
+		const aabb octaves_box = aabb::create_from_min_max(
+			{std::min(min.x, last_min.x), std::min(min.y, last_min.y), std::min(min.z, last_min.z)},
+			{std::max(max.x, last_max.x), std::max(max.y, last_max.y), std::max(max.z, last_max.z)});
+		const volume* source = _source->specialize(octaves_box, owned);
+		return source == _source ? this : _own<fbm>(owned, source, _octaves, _scale);
+	}
+
+	// Leaves out the last octaves while they can't change the value by more than the tolerance together, the source of
+	// the octaves that are left gets the rest of it
+	const volume* approximate(double tolerance, volume_unique_ptrs& owned) const override {
+		const double magnitude = _source->get_magnitude();
+		const auto get_amp = [this](uint32_t octave) { return std::pow(_gain, static_cast<double>(octave)); };
+		uint32_t octaves = _octaves;
+		double left_out = 0;
+		while (octaves > 1 && left_out + _scale * get_amp(octaves - 1) * magnitude <= tolerance) {
+			left_out += _scale * get_amp(--octaves) * magnitude;
+		}
+		double amps = 0;
+		for (uint32_t i = 0; i < octaves; ++i) {
+			amps += get_amp(i);
+		}
+		const volume* source = _source->approximate((tolerance - left_out) / (_scale * amps), owned);
+		return octaves == _octaves && source == _source ? this : _own<fbm>(owned, source, octaves, _scale);
+	}
+
 	void get_data(const vec3& pos, volume_data& data) const override {
 		_source->get_data(pos, data);
 	}
 
+	// The data is the source's at the position, which is where the first octave is
+	double get_value_and_data(const vec3& pos, volume_data& data) const override {
+		if (_octaves == 0) {
+			return volume::get_value_and_data(pos, data);
+		}
+		double sum = 0;
+		double amp = 1.0;
+		sum += amp * _source->get_value_and_data(pos, data);
+		amp *= _gain;
+		double x = pos.x * _lacunarity;
+		double y = pos.y * _lacunarity;
+		double z = pos.z * _lacunarity;
+		for (uint32_t i = 1; i < _octaves; ++i) {
+			sum += amp * _source->get_value(x, y, z);
+			x *= _lacunarity;
+			y *= _lacunarity;
+			z *= _lacunarity;
+			amp *= _gain;
+		}
+		return _scale * sum;
+	}
+
 private:
 	const volume* _source;
 	double _scale;
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdexcept>
+
+#include "csg.h"
+#include "volume_codegen.h"
+
+namespace playchilla::volumes {
+// Base of the volumes written by volume_codegen, calls into the tree for what the generated code can't do itself
+class generated_volume : public volume {
+public:
+	generated_volume(const volume* source, uint64_t fingerprint) :
+		_source(source),
+		_externals(volume_codegen::get_externals(source)) {
+		// the generated code would silently compute another volume, so this fails in every build
+		if (volume_codegen(source).get_fingerprint() != fingerprint) {
+			throw std::invalid_argument("The volume was generated from another tree");
+		}
+	}
+
+	const volume* get_source() const {
+		return _source;
+	}
+
+	// The generated code has no gradients, the tree has the exact ones
+	double get_value_and_gradient(double x, double y, double z, vec3& gradient) const override {
+		return _source->get_value_and_gradient(x, y, z, gradient);
+	}
+
+	interval get_interval(const aabb& box) const override {
+		return _source->get_interval(box);
+	}
+
+	double get_lipschitz(const aabb& box) const override {
+		return _source->get_lipschitz(box);
+	}
+
+protected:
+	double _call(size_t external, double x, double y, double z) const {
+		return _externals[external]->get_value(x, y, z);
+	}
+
+	void _call_values(size_t external, std::span<const vec3> positions, std::span<double> values) const {
+		_externals[external]->get_values(positions, values);
+	}
+
+	void _call_data(size_t external, const vec3& pos, volume_data& data) const {
+		_externals[external]->get_data(pos, data);
+	}
+
+	void _set_data(size_t external, const vec3& pos, volume_data& data) const {
+		static_cast<const data_volume*>(_externals[external])->set_data(pos, data);
+	}
+
+	double _condition(size_t external, double control_value) const {
+		return static_cast<const select*>(_externals[external])->get_condition()(control_value);
+	}
+
+private:
+	const volume* _source;
+	std::vector<const volume*> _externals;
+};
+}
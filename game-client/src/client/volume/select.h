@@ -1,8 +1,20 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <functional>
 
 namespace playchilla::volumes {
+// Ramps from 0 to 1 over [lower, lower + 1 / inv_interval], a named type so that compiled_volume can recognize it
+struct greater_condition {
+	double lower;
+	double inv_interval;
+
+	double operator()(double value) const {
+		return std::clamp(inv_interval * (value - lower), 0., 1.);
+	}
+};
+
 class select : public volume {
 public:
 	using condition = std::function<double(double)>;
@@ -18,6 +30,22 @@ public:
 		_condition(std::move(condition)) {
 	}
 
+	const volume* get_first() const {
+		return _first;
+	}
+
+	const volume* get_second() const {
+		return _second;
+	}
+
+	const volume* get_controller() const {
+		return _controller;
+	}
+
+	const condition& get_condition() const {
+		return _condition;
+	}
+
 	double get_value(double x, double y, double z) const override {
 		const double control_value = _controller->get_value(x, y, z);
 		const double alpha = _condition(control_value);
@@ -30,6 +58,107 @@ public:
 		return (1. - alpha) * _first->get_value(x, y, z) + alpha * _second->get_value(x, y, z);
 	}
 
+	// Only evaluates the sources that are needed for each position, like get_value
+	void get_values(std::span<const vec3> positions, std::span<double> values) const override {
+		for_each_batch(positions, values, [this](std::span<const vec3> batch, std::span<double> batch_values) {
+			std::array<double, BatchSize> alphas;
+			std::array<double, BatchSize> second_values;
+			const size_t count = batch.size();
+			_controller->get_values(batch, std::span(alphas).first(count));
+			for (size_t i = 0; i < count; ++i) {
+				alphas[i] = _condition(alphas[i]);
+			}
+			_get_values_where(_first, batch, batch_values, [&alphas](size_t i) { return !(alphas[i] >= 1.); });
+			_get_values_where(_second, batch, std::span(second_values).first(count), [&alphas](size_t i) { return !(alphas[i] <= 0.); });
+			for (size_t i = 0; i < count; ++i) {
+				const double alpha = alphas[i];
+				if (alpha >= 1.) {
+					batch_values[i] = second_values[i];
+				}
+				else if (!(alpha <= 0.)) {
+					batch_values[i] = (1. - alpha) * batch_values[i] + alpha * second_values[i];
+				}
+			}
+		});
+	}
+
+	double get_value_and_gradient(double x, double y, double z, vec3& gradient) const override {
+		vec3 control_gradient;
+		const double control_value = _controller->get_value_and_gradient(x, y, z, control_gradient);
+		const double alpha = _condition(control_value);
+		if (alpha <= 0.) {
+			return _first->get_value_and_gradient(x, y, z, gradient);
+		}
+		if (alpha >= 1.) {
+			return _second->get_value_and_gradient(x, y, z, gradient);
+		}
+		vec3 first_gradient, second_gradient;
+		const double first = _first->get_value_and_gradient(x, y, z, first_gradient);
+		const double second = _second->get_value_and_gradient(x, y, z, second_gradient);
+		// the blend also moves with the controller
+		gradient = first_gradient * (1. - alpha) + second_gradient * alpha + control_gradient * ((second - first) * _get_condition_slope(control_value));
+		return (1. - alpha) * first + alpha * second;
+	}
+
+	// Leaves out the source that the controller can't select within the box
+	interval get_interval(const aabb& box) const override {
+		const interval alpha = _get_condition_interval(_controller->get_interval(box));
+		if (alpha.upper <= 0.) {
+			return _first->get_interval(box);
+		}
+		if (alpha.lower >= 1.) {
+			return _second->get_interval(box);
+		}
+		return lerp(_first->get_interval(box), _second->get_interval(box), alpha);
+	}
+
+	// A blend also changes with the weight, by the slope of the ramp times the controller bound times how far apart the
+	// sources can be. Conditions other than ramps have no known slope.
+	double get_lipschitz(const aabb& box) const override {
+		const interval alpha = _get_condition_interval(_controller->get_interval(box));
+		if (alpha.upper <= 0.) {
+			return _first->get_lipschitz(box);
+		}
+		if (alpha.lower >= 1.) {
+			return _second->get_lipschitz(box);
+		}
+		const auto* greater = _condition.target<greater_condition>();
+		if (!greater) {
+			return volume::get_lipschitz(box);
+		}
+		const interval apart = _second->get_interval(box) - _first->get_interval(box);
+		const double sources = std::max(_first->get_lipschitz(box), _second->get_lipschitz(box));
+		return sources + greater->inv_interval * _controller->get_lipschitz(box) * std::max(-apart.lower, apart.upper);
+	}
+
+	// The source that the controller selects everywhere within the box, if there is one
+	const volume* specialize(const aabb& box, volume_unique_ptrs& owned) const override {
+		const interval alpha = _get_condition_interval(_controller->get_interval(box));
+		if (alpha.upper <= 0.) {
+			return _first->specialize(box, owned);
+		}
+		if (alpha.lower >= 1.) {
+			return _second->specialize(box, owned);
+		}
+		const volume* first = _first->specialize(box, owned);
+		const volume* second = _second->specialize(box, owned);
+		const volume* controller = _controller->specialize(box, owned);
+		if (first == _first && second == _second && controller == _controller) {
+			return this;
+		}
+		return _own<select>(owned, first, second, controller, _condition);
+	}
+
+	// A blend is between the sources, the controller stays exact since the blend can change fast with it
+	const volume* approximate(double tolerance, volume_unique_ptrs& owned) const override {
+		const volume* first = _first->approximate(tolerance, owned);
+		const volume* second = _second->approximate(tolerance, owned);
+		if (first == _first && second == _second) {
+			return this;
+		}
+		return _own<select>(owned, first, second, _controller, _condition);
+	}
+
 	void get_data(const vec3& pos, volume_data& data) const override {
 		const double control_value = _controller->get_value(pos.x, pos.y, pos.z);
 		const double alpha = _condition(control_value);
@@ -39,7 +168,63 @@ public:
 		_first->get_data(pos, data);
 	}
 
+	// The second has the data as soon as it has any weight, as for get_data
+	double get_value_and_data(const vec3& pos, volume_data& data) const override {
+		const double control_value = _controller->get_value(pos.x, pos.y, pos.z);
+		const double alpha = _condition(control_value);
+		if (alpha <= 0.) {
+			return _first->get_value_and_data(pos, data);
+		}
+		if (alpha >= 1.) {
+			return _second->get_value_and_data(pos, data);
+		}
+		const double first = _first->get_value(pos.x, pos.y, pos.z);
+		return (1. - alpha) * first + alpha * _second->get_value_and_data(pos, data);
+	}
+
 private:
+	// Ramps increase with the control value, other conditions could be anything that get_value blends by
+	interval _get_condition_interval(const interval& control) const {
+		if (const auto* greater = _condition.target<greater_condition>()) {
+			return {(*greater)(control.lower), (*greater)(control.upper)};
+		}
+		return {0., 1.};
+	}
+
+	double _get_condition_slope(double control_value) const {
+		if (const auto* greater = _condition.target<greater_condition>()) {
+			const double t = greater->inv_interval * (control_value - greater->lower);
+			return t > 0. && t < 1. ? greater->inv_interval : 0.;
+		}
+		return (_condition(control_value + GradientStep) - _condition(control_value - GradientStep)) * (.5 / GradientStep);
+	}
+
+	// Evaluates source for the positions passing the filter, the other values are left as they are
+	template <typename FilterT>
+	static void _get_values_where(const volume* source, std::span<const vec3> batch, std::span<double> values, const FilterT& filter) {
+		batch_positions gathered;
+		std::array<double, BatchSize> gathered_values;
+		std::array<uint32_t, BatchSize> indices;
+		size_t gathered_count = 0;
+		for (size_t i = 0; i < batch.size(); ++i) {
+			if (filter(i)) {
+				indices[gathered_count] = static_cast<uint32_t>(i);
+				gathered.data[gathered_count++] = batch[i];
+			}
+		}
+		if (gathered_count == batch.size()) {
+			source->get_values(batch, values);
+			return;
+		}
+		if (gathered_count == 0) {
+			return;
+		}
+		source->get_values(std::span(gathered.data).first(gathered_count), std::span(gathered_values).first(gathered_count));
+		for (size_t g = 0; g < gathered_count; ++g) {
+			values[indices[g]] = gathered_values[g];
+		}
+	}
+
 	const volume* _first;
 	const volume* _second;
 	const volume* _controller;
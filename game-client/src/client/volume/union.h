@@ -1,6 +1,9 @@
 #pragma once
 
+#include <array>
+
 #include "afront/volume.h"
+#include "afront/volume_data.h"
 
 namespace playchilla::volumes {
 class union_volume : public volume {
@@ -14,6 +17,10 @@ public:
 		return _sources;
 	}
 
+	double get_min_value() const {
+		return _min_value;
+	}
+
 	double get_value(double x, double y, double z) const override {
 		double max = _min_value;
 		for (const auto& source : _sources) {
@@ -22,26 +29,102 @@ public:
 		return max;
 	}
 
-	void get_data(const vec3& pos, volume_data& data) const override {
-		if (const volume* m = _get_volume(pos)) {
-			m->get_data(pos, data);
+	void get_values(std::span<const vec3> positions, std::span<double> values) const override {
+		for_each_batch(positions, values, [this](std::span<const vec3> batch, std::span<double> maxes) {
+			std::array<double, BatchSize> source_values;
+			std::fill(maxes.begin(), maxes.end(), _min_value);
+			for (const auto& source : _sources) {
+				source->get_values(batch, std::span(source_values).first(batch.size()));
+				for (size_t i = 0; i < batch.size(); ++i) {
+					maxes[i] = std::max(maxes[i], source_values[i]);
+				}
+			}
+		});
+	}
+
+	double get_value_and_gradient(double x, double y, double z, vec3& gradient) const override {
+		double max = _min_value;
+		gradient = {};
+		for (const auto& source : _sources) {
+			vec3 source_gradient;
+			const double value = source->get_value_and_gradient(x, y, z, source_gradient);
+			if (max < value) {
+				max = value;
+				gradient = source_gradient;
+			}
 		}
+		return max;
 	}
 
-private:
-	const volume* _get_volume(const vec3& pos) const {
-		const volume* max_module = nullptr;
+	interval get_interval(const aabb& box) const override {
+		interval max = _min_value;
+		for (const auto& source : _sources) {
+			max = playchilla::max(max, source->get_interval(box));
+		}
+		return max;
+	}
+
+	double get_lipschitz(const aabb& box) const override {
+		double lipschitz = 0;
+		for (const auto& source : _sources) {
+			lipschitz = std::max(lipschitz, source->get_lipschitz(box));
+		}
+		return lipschitz;
+	}
+
+	// Leaves out the sources that are always below another source or the min value within the box
+	const volume* specialize(const aabb& box, volume_unique_ptrs& owned) const override {
+		std::vector<interval> intervals;
+		double lower = _min_value;
+		for (const auto& source : _sources) {
+			intervals.push_back(source->get_interval(box));
+			lower = std::max(lower, intervals.back().lower);
+		}
+		std::vector<const volume*> sources;
+		bool changed = false;
+		double kept_lower = MAX_VALUE;
+		for (size_t i = 0; i < _sources.size(); ++i) {
+			if (intervals[i].upper < lower) {
+				changed = true;
+				continue;
+			}
+			sources.push_back(_sources[i]->specialize(box, owned));
+			changed |= sources.back() != _sources[i];
+			kept_lower = intervals[i].lower;
+		}
+		if (sources.size() == 1 && kept_lower >= _min_value) {
+			return sources[0];
+		}
+		return changed ? _own<union_volume>(owned, std::move(sources), _min_value) : this;
+	}
+
+	// The max moves no further than the sources do
+	const volume* approximate(double tolerance, volume_unique_ptrs& owned) const override {
+		std::vector<const volume*> sources;
+		return _approximate(_sources, tolerance, owned, sources) ? _own<union_volume>(owned, std::move(sources), _min_value) : this;
+	}
+
+	void get_data(const vec3& pos, volume_data& data) const override {
+		get_value_and_data(pos, data);
+	}
+
+	// Each source sets its data on a copy and the copy of the first largest value is kept, so the sources are walked once
+	double get_value_and_data(const vec3& pos, volume_data& data) const override {
 		double max = _min_value;
+		volume_data max_data = data;
 		for (const auto* source : _sources) {
-			const double value = source->get_value(pos);
+			volume_data source_data = data;
+			const double value = source->get_value_and_data(pos, source_data);
 			if (value > max) {
 				max = value;
-				max_module = source;
+				max_data = std::move(source_data);
 			}
 		}
-		return max_module;
+		data = std::move(max_data);
+		return max;
 	}
 
+private:
 	std::vector<const volume*> _sources;
 	double _min_value;
 
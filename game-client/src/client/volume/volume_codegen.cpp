@@ -0,0 +1,832 @@
+#include "volume_codegen.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+
+#include "csg.h"
+#include "generated_volume.h"
+
+namespace playchilla::volumes {
+namespace {
+// Enough digits to read back the same double
+std::string to_literal(double v) {
+	assertion(!std::isnan(v), "Can't write nan as a literal");
+	if (std::isinf(v)) {
+		return v > 0 ? "std::numeric_limits<double>::infinity()" : "(-std::numeric_limits<double>::infinity())";
+	}
+	std::ostringstream out;
+	out << std::setprecision(std::numeric_limits<double>::max_digits10) << v;
+	std::string literal = out.str();
+	if (literal.find_first_of(".e") == std::string::npos) {
+		literal += '.';
+	}
+	return std::signbit(v) ? "(" + literal + ")" : literal;
+}
+
+uint64_t fnv1a(uint64_t hash, std::string_view text) {
+	for (const char c : text) {
+		hash = (hash ^ static_cast<uint8_t>(c)) * 1099511628211ull;
+	}
+	return hash;
+}
+}
+
+volume_codegen::volume_codegen(const volume* source) {
+	const auto externals = get_externals(source);
+	for (size_t i = 0; i < externals.size(); ++i) {
+		_externals.emplace(externals[i], i);
+	}
+
+	_out = &_value_code;
+	_indent = 2;
+	_result = _value(source, {"x", "y", "z"});
+	_out = &_values_code;
+	_indent = 3;
+	_values_result = _values(source, {"batch", "n"});
+	_out = &_data_code;
+	_indent = 2;
+	_data(source, "pos");
+
+	_fingerprint = fnv1a(14695981039346656037ull, _value_code);
+	_fingerprint = fnv1a(_fingerprint, _result);
+	_fingerprint = fnv1a(_fingerprint, _values_code);
+	_fingerprint = fnv1a(_fingerprint, _values_result);
+	_fingerprint = fnv1a(_fingerprint, _data_code);
+	for (const uint64_t seed : _noise_seeds) {
+		_fingerprint = fnv1a(_fingerprint, std::to_string(seed));
+	}
+	_fingerprint = fnv1a(_fingerprint, std::to_string(externals.size()));
+}
+
+std::vector<const volume*> volume_codegen::get_externals(const volume* source) {
+	std::vector<const volume*> externals;
+	std::vector<const volume*> visited;
+	_collect_externals(source, externals, visited);
+	return externals;
+}
+
+uint64_t volume_codegen::get_fingerprint() const {
+	return _fingerprint;
+}
+
+std::string volume_codegen::generate(std::string_view class_name) const {
+	std::ostringstream out;
+	out << "// Generated by volume-codegen, do not edit\n";
+	out << "#pragma once\n\n";
+	out << "#include \"client/volume/generated_volume.h\"\n\n";
+	out << "namespace playchilla::generated {\n";
+	out << "class " << class_name << " final : public volumes::generated_volume {\n";
+	out << "public:\n";
+	out << "\t" << class_name << "(const volume* source) : generated_volume(source, Fingerprint) {\n";
+	out << "\t}\n\n";
+	out << "\tdouble get_value(double x, double y, double z) const override {\n";
+	out << _value_code;
+	out << "\t\treturn " << _result << ";\n";
+	out << "\t}\n\n";
+	out << "\tvoid get_values(std::span<const vec3> positions, std::span<double> values) const override {\n";
+	out << "\t\tfor_each_batch(positions, values, [&](std::span<const vec3> batch, std::span<double> batch_values) {\n";
+	out << "\t\t\tconst size_t n = batch.size();\n";
+	out << _values_code;
+	out << "\t\t\tstd::copy_n(" << _values_result << ".begin(), n, batch_values.begin());\n";
+	out << "\t\t});\n";
+	out << "\t}\n\n";
+	out << "\tvoid get_data(const vec3& pos, volume_data& data) const override {\n";
+	out << _data_code;
+	out << "\t}\n\n";
+	out << "private:\n";
+	out << "\tstatic constexpr uint64_t Fingerprint = " << _fingerprint << "ull;\n";
+	for (size_t i = 0; i < _noise_seeds.size(); ++i) {
+		out << "\tconst gradient_noise _noise" << i << "{" << _noise_seeds[i] << "ull};\n";
+	}
+	out << "};\n";
+	out << "}\n";
+	return out.str();
+}
+
+std::optional<std::vector<const volume*>> volume_codegen::_get_children(const volume* v) {
+	if (const auto* c = dynamic_cast<const compiled_volume*>(v)) {
+		return std::vector{c->get_source()};
+	}
+	if (const auto* g = dynamic_cast<const generated_volume*>(v)) {
+		return std::vector{g->get_source()};
+	}
+	if (const auto* d = dynamic_cast<const data_volume*>(v)) {
+		return std::vector{d->get_source()};
+	}
+	if (dynamic_cast<const sphere*>(v) || dynamic_cast<const cube*>(v) || dynamic_cast<const constant*>(v) ||
+		dynamic_cast<const noise*>(v) || dynamic_cast<const noise2d*>(v)) {
+		return std::vector<const volume*>{};
+	}
+	if (const auto* n = dynamic_cast<const negate_value*>(v)) {
+		return std::vector{n->get_source()};
+	}
+	if (const auto* r = dynamic_cast<const to_range*>(v)) {
+		return std::vector{r->get_source()};
+	}
+	if (const auto* f = dynamic_cast<const fbm*>(v)) {
+		return std::vector{f->get_source()};
+	}
+	if (const auto* add = dynamic_cast<const add_value*>(v)) {
+		return add->get_sources();
+	}
+	if (const auto* mul = dynamic_cast<const mul_value*>(v)) {
+		return mul->get_sources();
+	}
+	if (const auto* u = dynamic_cast<const union_volume*>(v)) {
+		return u->get_sources();
+	}
+	if (const auto* d = dynamic_cast<const difference*>(v)) {
+		auto children = d->get_differences();
+		children.insert(children.begin(), d->get_source());
+		return children;
+	}
+	if (const auto* s = dynamic_cast<const select*>(v)) {
+		return std::vector{s->get_controller(), s->get_first(), s->get_second()};
+	}
+	if (const auto* t = dynamic_cast<const inv_translate*>(v)) {
+		const auto translation = t->get_translation();
+		return std::vector{translation[0], translation[1], translation[2], t->get_source()};
+	}
+	if (const auto* s = dynamic_cast<const inv_scale*>(v)) {
+		return std::vector{s->get_scale(), s->get_source()};
+	}
+	if (const auto* a = dynamic_cast<const add_constant*>(v)) {
+		return std::vector{a->get_source()};
+	}
+	if (const auto* m = dynamic_cast<const mul_constant*>(v)) {
+		return std::vector{m->get_source()};
+	}
+	if (const auto* t = dynamic_cast<const translate_constant*>(v)) {
+		return std::vector{t->get_source()};
+	}
+	if (const auto* s = dynamic_cast<const scale_constant*>(v)) {
+		return std::vector{s->get_source()};
+	}
+	return std::nullopt;
+}
+
+bool volume_codegen::_is_external(const volume* v) {
+	if (dynamic_cast<const data_volume*>(v)) {
+		return true;
+	}
+	if (const auto* s = dynamic_cast<const select*>(v)) {
+		return s->get_condition().target<greater_condition>() == nullptr;
+	}
+	return !_get_children(v);
+}
+
+void volume_codegen::_collect_externals(const volume* v, std::vector<const volume*>& externals, std::vector<const volume*>& visited) {
+	if (std::find(visited.begin(), visited.end(), v) != visited.end()) {
+		return;
+	}
+	visited.push_back(v);
+	if (_is_external(v)) {
+		externals.push_back(v);
+	}
+	if (const auto children = _get_children(v)) {
+		for (const volume* child : *children) {
+			_collect_externals(child, externals, visited);
+		}
+	}
+}
+
+std::string volume_codegen::_value(const volume* v, const position& pos) {
+	// the same operations in the same order as the volumes, so the values are bit-identical
+	const std::string xyz = pos.x + ", " + pos.y + ", " + pos.z;
+	if (const auto* c = dynamic_cast<const compiled_volume*>(v)) {
+		return _value(c->get_source(), pos);
+	}
+	if (const auto* g = dynamic_cast<const generated_volume*>(v)) {
+		return _value(g->get_source(), pos);
+	}
+	if (const auto* d = dynamic_cast<const data_volume*>(v)) {
+		return _value(d->get_source(), pos);
+	}
+	if (const auto* c = dynamic_cast<const constant*>(v)) {
+		return to_literal(c->get_constant());
+	}
+	if (const auto* s = dynamic_cast<const sphere*>(v)) {
+		const auto value = _variable("v");
+		_line("const double " + value + " = " + to_literal(s->get_radius()) + " - std::sqrt(" + pos.x + " * " + pos.x + " + " +
+			pos.y + " * " + pos.y + " + " + pos.z + " * " + pos.z + ");");
+		return value;
+	}
+	if (const auto* c = dynamic_cast<const cube*>(v)) {
+		const vec3& half_extents = c->get_half_extents();
+		const auto value = _variable("v");
+		_line("const double " + value + " = -max(std::abs(" + pos.x + ") - " + to_literal(half_extents.x) + ", max(std::abs(" +
+			pos.y + ") - " + to_literal(half_extents.y) + ", std::abs(" + pos.z + ") - " + to_literal(half_extents.z) + "));");
+		return value;
+	}
+	if (const auto* n = dynamic_cast<const noise*>(v)) {
+		const auto f = to_literal(n->get_frequency());
+		const auto value = _variable("v");
+		_line("const double " + value + " = " + _noise(n->get_noise()) + ".get_value(" + f + " * " + pos.x + ", " + f + " * " +
+			pos.y + ", " + f + " * " + pos.z + ");");
+		return value;
+	}
+	if (const auto* n = dynamic_cast<const noise2d*>(v)) {
+		const auto f = to_literal(n->get_frequency());
+		const auto surface_pos = _variable("s");
+		const auto value = _variable("v");
+		_line("const vec3 " + surface_pos + " = vec3{" + xyz + "}.rescale(" + to_literal(n->get_radius()) + ");");
+		_line("const double " + value + " = " + _noise(n->get_noise()) + ".get_value(" + f + " * " + surface_pos + ".x, " + f +
+			" * " + surface_pos + ".y, " + f + " * " + surface_pos + ".z);");
+		return value;
+	}
+	if (const auto* n = dynamic_cast<const negate_value*>(v)) {
+		const auto source = _value(n->get_source(), pos);
+		const auto value = _variable("v");
+		_line("const double " + value + " = -" + source + ";");
+		return value;
+	}
+	if (const auto* r = dynamic_cast<const to_range*>(v)) {
+		const auto source = _value(r->get_source(), pos);
+		const auto v01 = _variable("r");
+		const auto value = _variable("v");
+		_line("const double " + v01 + " = .5 * (1. + " + source + ");");
+		_line("assertion(" + v01 + " >= 0 && " + v01 + " <= 1, \"to_range unexpected input\");");
+		_line("const double " + value + " = " + to_literal(r->get_from()) + " + " + v01 + " * " +
+			to_literal(r->get_to() - r->get_from()) + ";");
+		return value;
+	}
+	if (const auto* add = dynamic_cast<const add_value*>(v)) {
+		std::string sum = "0.";
+		for (const volume* source : add->get_sources()) {
+			sum += " + " + _value(source, pos);
+		}
+		const auto value = _variable("v");
+		_line("const double " + value + " = " + sum + ";");
+		return value;
+	}
+	if (const auto* mul = dynamic_cast<const mul_value*>(v)) {
+		std::string product = "1.";
+		for (const volume* source : mul->get_sources()) {
+			product += " * " + _value(source, pos);
+		}
+		const auto value = _variable("v");
+		_line("const double " + value + " = " + product + ";");
+		return value;
+	}
+	if (const auto* f = dynamic_cast<const fbm*>(v)) {
+		const auto sum = _variable("f");
+		_line("double " + sum + " = 0.;");
+		position octave_pos = pos;
+		double amp = 1.0;
+		for (uint32_t i = 0; i < f->get_octaves(); ++i) {
+			_line(sum + " += " + to_literal(amp) + " * " + _value(f->get_source(), octave_pos) + ";");
+			if (i + 1 < f->get_octaves()) {
+				const auto lacunarity = to_literal(f->get_lacunarity());
+				position next_pos{_variable("x"), _variable("y"), _variable("z")};
+				_line("const double " + next_pos.x + " = " + octave_pos.x + " * " + lacunarity + ";");
+				_line("const double " + next_pos.y + " = " + octave_pos.y + " * " + lacunarity + ";");
+				_line("const double " + next_pos.z + " = " + octave_pos.z + " * " + lacunarity + ";");
+				octave_pos = std::move(next_pos);
+			}
+			amp *= f->get_gain();
+		}
+		const auto value = _variable("v");
+		_line("const double " + value + " = " + to_literal(f->get_scale()) + " * " + sum + ";");
+		return value;
+	}
+	if (const auto* u = dynamic_cast<const union_volume*>(v)) {
+		const auto max = _variable("m");
+		_line("double " + max + " = " + to_literal(u->get_min_value()) + ";");
+		for (const volume* source : u->get_sources()) {
+			const auto source_value = _value(source, pos);
+			_line(max + " = std::max(" + max + ", " + source_value + ");");
+		}
+		return max;
+	}
+	if (const auto* d = dynamic_cast<const difference*>(v)) {
+		const auto min = _variable("m");
+		_line("double " + min + " = " + _value(d->get_source(), pos) + ";");
+		for (const volume* rhs : d->get_differences()) {
+			const auto rhs_value = _value(rhs, pos);
+			_line(min + " = std::min(" + min + ", -" + rhs_value + ");");
+		}
+		return min;
+	}
+	if (const auto* s = dynamic_cast<const select*>(v)) {
+		// like select::get_values, each source is only evaluated when its weight isn't 0
+		const auto alpha = _variable("a");
+		_line("const double " + alpha + " = " + _condition(s, _value(s->get_controller(), pos)) + ";");
+		const auto first = _variable("v");
+		const auto second = _variable("v");
+		_line("double " + first + " = 0.;");
+		_line("double " + second + " = 0.;");
+		_open("if (!(" + alpha + " >= 1.)) {");
+		_line(first + " = " + _value(s->get_first(), pos) + ";");
+		_close();
+		_open("if (!(" + alpha + " <= 0.)) {");
+		_line(second + " = " + _value(s->get_second(), pos) + ";");
+		_close();
+		const auto value = _variable("v");
+		_line("const double " + value + " = " + alpha + " <= 0. ? " + first + " : " + alpha + " >= 1. ? " + second +
+			" : (1. - " + alpha + ") * " + first + " + " + alpha + " * " + second + ";");
+		return value;
+	}
+	if (const auto* t = dynamic_cast<const inv_translate*>(v)) {
+		const auto translation = t->get_translation();
+		const auto tx = _value(translation[0], pos);
+		const auto ty = _value(translation[1], pos);
+		const auto tz = _value(translation[2], pos);
+		const position translated{_variable("x"), _variable("y"), _variable("z")};
+		_line("const double " + translated.x + " = " + pos.x + " - " + tx + ";");
+		_line("const double " + translated.y + " = " + pos.y + " - " + ty + ";");
+		_line("const double " + translated.z + " = " + pos.z + " - " + tz + ";");
+		return _value(t->get_source(), translated);
+	}
+	if (const auto* s = dynamic_cast<const inv_scale*>(v)) {
+		const auto scale = _value(s->get_scale(), pos);
+		const position scaled{_variable("x"), _variable("y"), _variable("z")};
+		_line("const double " + scaled.x + " = " + pos.x + " / " + scale + ";");
+		_line("const double " + scaled.y + " = " + pos.y + " / " + scale + ";");
+		_line("const double " + scaled.z + " = " + pos.z + " / " + scale + ";");
+		const auto source = _value(s->get_source(), scaled);
+		const auto value = _variable("v");
+		_line("const double " + value + " = " + source + " * " + scale + ";");
+		return value;
+	}
+	if (const auto* a = dynamic_cast<const add_constant*>(v)) {
+		const auto source = _value(a->get_source(), pos);
+		const auto value = _variable("v");
+		_line("const double " + value + " = 0. + " + source + " + " + to_literal(a->get_constant()) + ";");
+		return value;
+	}
+	if (const auto* m = dynamic_cast<const mul_constant*>(v)) {
+		const auto source = _value(m->get_source(), pos);
+		const auto value = _variable("v");
+		_line("const double " + value + " = " + source + " * " + to_literal(m->get_constant()) + ";");
+		return value;
+	}
+	if (const auto* t = dynamic_cast<const translate_constant*>(v)) {
+		const vec3& translation = t->get_translation();
+		const position translated{_variable("x"), _variable("y"), _variable("z")};
+		_line("const double " + translated.x + " = " + pos.x + " - " + to_literal(translation.x) + ";");
+		_line("const double " + translated.y + " = " + pos.y + " - " + to_literal(translation.y) + ";");
+		_line("const double " + translated.z + " = " + pos.z + " - " + to_literal(translation.z) + ";");
+		return _value(t->get_source(), translated);
+	}
+	if (const auto* s = dynamic_cast<const scale_constant*>(v)) {
+		const auto scale = to_literal(s->get_scale());
+		const position scaled{_variable("x"), _variable("y"), _variable("z")};
+		_line("const double " + scaled.x + " = " + pos.x + " / " + scale + ";");
+		_line("const double " + scaled.y + " = " + pos.y + " / " + scale + ";");
+		_line("const double " + scaled.z + " = " + pos.z + " / " + scale + ";");
+		const auto source = _value(s->get_source(), scaled);
+		const auto value = _variable("v");
+		_line("const double " + value + " = " + source + " * " + scale + ";");
+		return value;
+	}
+
+	const auto value = _variable("v");
+	_line("const double " + value + " = _call(" + std::to_string(_externals.at(v)) + ", " + xyz + ");");
+	return value;
+}
+
+std::string volume_codegen::_values(const volume* v, const batch& b) {
+	// the same operations as _value for each position of the batch, the noise is evaluated over the whole batch
+	const std::string p = b.positions + "[i]";
+	const auto at = [](const std::string& array) { return array + "[i]"; };
+	if (const auto* c = dynamic_cast<const compiled_volume*>(v)) {
+		return _values(c->get_source(), b);
+	}
+	if (const auto* g = dynamic_cast<const generated_volume*>(v)) {
+		return _values(g->get_source(), b);
+	}
+	if (const auto* d = dynamic_cast<const data_volume*>(v)) {
+		return _values(d->get_source(), b);
+	}
+	if (const auto* c = dynamic_cast<const constant*>(v)) {
+		const auto value = _array("v");
+		_line(value + ".fill(" + to_literal(c->get_constant()) + ");");
+		return value;
+	}
+	if (const auto* s = dynamic_cast<const sphere*>(v)) {
+		const auto value = _array("v");
+		_for(b, at(value) + " = " + to_literal(s->get_radius()) + " - std::sqrt(" + p + ".x * " + p + ".x + " + p + ".y * " + p +
+			".y + " + p + ".z * " + p + ".z);");
+		return value;
+	}
+	if (const auto* c = dynamic_cast<const cube*>(v)) {
+		const vec3& half_extents = c->get_half_extents();
+		const auto value = _array("v");
+		_for(b, at(value) + " = -max(std::abs(" + p + ".x) - " + to_literal(half_extents.x) + ", max(std::abs(" + p + ".y) - " +
+			to_literal(half_extents.y) + ", std::abs(" + p + ".z) - " + to_literal(half_extents.z) + "));");
+		return value;
+	}
+	if (const auto* n = dynamic_cast<const noise*>(v)) {
+		const auto f = to_literal(n->get_frequency());
+		const auto noise_pos = _variable("q");
+		const auto value = _array("v");
+		_line("batch_positions " + noise_pos + ";");
+		_for(b, noise_pos + ".data[i] = {" + f + " * " + p + ".x, " + f + " * " + p + ".y, " + f + " * " + p + ".z};");
+		_line(_noise(n->get_noise()) + ".get_values(std::span(" + noise_pos + ".data).first(" + b.count + "), std::span(" + value +
+			").first(" + b.count + "));");
+		return value;
+	}
+	if (const auto* n = dynamic_cast<const noise2d*>(v)) {
+		const auto f = to_literal(n->get_frequency());
+		const auto noise_pos = _variable("q");
+		const auto value = _array("v");
+		_line("batch_positions " + noise_pos + ";");
+		_open("for (size_t i = 0; i < " + b.count + "; ++i) {");
+		_line("const vec3 s = " + p + ".rescale(" + to_literal(n->get_radius()) + ");");
+		_line(noise_pos + ".data[i] = {" + f + " * s.x, " + f + " * s.y, " + f + " * s.z};");
+		_close();
+		_line(_noise(n->get_noise()) + ".get_values(std::span(" + noise_pos + ".data).first(" + b.count + "), std::span(" + value +
+			").first(" + b.count + "));");
+		return value;
+	}
+	if (const auto* n = dynamic_cast<const negate_value*>(v)) {
+		const auto source = _values(n->get_source(), b);
+		const auto value = _array("v");
+		_for(b, at(value) + " = -" + at(source) + ";");
+		return value;
+	}
+	if (const auto* r = dynamic_cast<const to_range*>(v)) {
+		const auto source = _values(r->get_source(), b);
+		const auto value = _array("v");
+		_open("for (size_t i = 0; i < " + b.count + "; ++i) {");
+		_line("const double r = .5 * (1. + " + at(source) + ");");
+		_line("assertion(r >= 0 && r <= 1, \"to_range unexpected input\");");
+		_line(at(value) + " = " + to_literal(r->get_from()) + " + r * " + to_literal(r->get_to() - r->get_from()) + ";");
+		_close();
+		return value;
+	}
+	if (const auto* add = dynamic_cast<const add_value*>(v)) {
+		std::string sum = "0.";
+		for (const volume* source : add->get_sources()) {
+			sum += " + " + at(_values(source, b));
+		}
+		const auto value = _array("v");
+		_for(b, at(value) + " = " + sum + ";");
+		return value;
+	}
+	if (const auto* mul = dynamic_cast<const mul_value*>(v)) {
+		std::string product = "1.";
+		for (const volume* source : mul->get_sources()) {
+			product += " * " + at(_values(source, b));
+		}
+		const auto value = _array("v");
+		_for(b, at(value) + " = " + product + ";");
+		return value;
+	}
+	if (const auto* f = dynamic_cast<const fbm*>(v)) {
+		const auto sum = _array("f");
+		_line(sum + ".fill(0.);");
+		batch octave = b;
+		double amp = 1.0;
+		for (uint32_t i = 0; i < f->get_octaves(); ++i) {
+			_for(b, at(sum) + " += " + to_literal(amp) + " * " + at(_values(f->get_source(), octave)) + ";");
+			if (i + 1 < f->get_octaves()) {
+				const auto lacunarity = to_literal(f->get_lacunarity());
+				const auto next = _variable("p");
+				const auto q = octave.positions + "[i]";
+				_line("batch_positions " + next + ";");
+				_for(b, next + ".data[i] = {" + q + ".x * " + lacunarity + ", " + q + ".y * " + lacunarity + ", " + q + ".z * " +
+					lacunarity + "};");
+				octave.positions = next + ".data";
+			}
+			amp *= f->get_gain();
+		}
+		const auto value = _array("v");
+		_for(b, at(value) + " = " + to_literal(f->get_scale()) + " * " + at(sum) + ";");
+		return value;
+	}
+	if (const auto* u = dynamic_cast<const union_volume*>(v)) {
+		const auto max = _array("m");
+		_line(max + ".fill(" + to_literal(u->get_min_value()) + ");");
+		for (const volume* source : u->get_sources()) {
+			const auto source_values = _values(source, b);
+			_for(b, at(max) + " = std::max(" + at(max) + ", " + at(source_values) + ");");
+		}
+		return max;
+	}
+	if (const auto* d = dynamic_cast<const difference*>(v)) {
+		const auto source = _values(d->get_source(), b);
+		const auto min = _variable("m");
+		_line("std::array<double, BatchSize> " + min + " = " + source + ";");
+		for (const volume* rhs : d->get_differences()) {
+			const auto rhs_values = _values(rhs, b);
+			_for(b, at(min) + " = std::min(" + at(min) + ", -" + at(rhs_values) + ");");
+		}
+		return min;
+	}
+	if (const auto* s = dynamic_cast<const select*>(v)) {
+		// like select::get_values, each source is only evaluated for the positions where its weight isn't 0
+		const auto control = _values(s->get_controller(), b);
+		const auto alpha = _array("a");
+		_for(b, at(alpha) + " = " + _condition(s, at(control)) + ";");
+		const auto first = _variable("v");
+		const auto second = _variable("v");
+		_line("std::array<double, BatchSize> " + first + "{};");
+		_line("std::array<double, BatchSize> " + second + "{};");
+		_values_where(s->get_first(), b, "!(" + at(alpha) + " >= 1.)", first);
+		_values_where(s->get_second(), b, "!(" + at(alpha) + " <= 0.)", second);
+		const auto value = _array("v");
+		_for(b, at(value) + " = " + at(alpha) + " <= 0. ? " + at(first) + " : " + at(alpha) + " >= 1. ? " + at(second) + " : (1. - " +
+			at(alpha) + ") * " + at(first) + " + " + at(alpha) + " * " + at(second) + ";");
+		return value;
+	}
+	if (const auto* t = dynamic_cast<const inv_translate*>(v)) {
+		const auto translation = t->get_translation();
+		const auto tx = _values(translation[0], b);
+		const auto ty = _values(translation[1], b);
+		const auto tz = _values(translation[2], b);
+		const auto translated = _variable("p");
+		_line("batch_positions " + translated + ";");
+		_for(b, translated + ".data[i] = {" + p + ".x - " + at(tx) + ", " + p + ".y - " + at(ty) + ", " + p + ".z - " + at(tz) + "};");
+		return _values(t->get_source(), {translated + ".data", b.count});
+	}
+	if (const auto* s = dynamic_cast<const inv_scale*>(v)) {
+		const auto scale = _values(s->get_scale(), b);
+		const auto scaled = _variable("p");
+		_line("batch_positions " + scaled + ";");
+		_for(b, scaled + ".data[i] = {" + p + ".x / " + at(scale) + ", " + p + ".y / " + at(scale) + ", " + p + ".z / " + at(scale) + "};");
+		const auto source = _values(s->get_source(), {scaled + ".data", b.count});
+		const auto value = _array("v");
+		_for(b, at(value) + " = " + at(source) + " * " + at(scale) + ";");
+		return value;
+	}
+	if (const auto* a = dynamic_cast<const add_constant*>(v)) {
+		const auto source = _values(a->get_source(), b);
+		const auto value = _array("v");
+		_for(b, at(value) + " = 0. + " + at(source) + " + " + to_literal(a->get_constant()) + ";");
+		return value;
+	}
+	if (const auto* m = dynamic_cast<const mul_constant*>(v)) {
+		const auto source = _values(m->get_source(), b);
+		const auto value = _array("v");
+		_for(b, at(value) + " = " + at(source) + " * " + to_literal(m->get_constant()) + ";");
+		return value;
+	}
+	if (const auto* t = dynamic_cast<const translate_constant*>(v)) {
+		const vec3& translation = t->get_translation();
+		const auto translated = _variable("p");
+		_line("batch_positions " + translated + ";");
+		_for(b, translated + ".data[i] = {" + p + ".x - " + to_literal(translation.x) + ", " + p + ".y - " + to_literal(translation.y) +
+			", " + p + ".z - " + to_literal(translation.z) + "};");
+		return _values(t->get_source(), {translated + ".data", b.count});
+	}
+	if (const auto* s = dynamic_cast<const scale_constant*>(v)) {
+		const auto scale = to_literal(s->get_scale());
+		const auto scaled = _variable("p");
+		_line("batch_positions " + scaled + ";");
+		_for(b, scaled + ".data[i] = {" + p + ".x / " + scale + ", " + p + ".y / " + scale + ", " + p + ".z / " + scale + "};");
+		const auto source = _values(s->get_source(), {scaled + ".data", b.count});
+		const auto value = _array("v");
+		_for(b, at(value) + " = " + at(source) + " * " + scale + ";");
+		return value;
+	}
+
+	const auto value = _array("v");
+	_line("_call_values(" + std::to_string(_externals.at(v)) + ", std::span(" + b.positions + ").first(" + b.count + "), std::span(" +
+		value + ").first(" + b.count + "));");
+	return value;
+}
+
+void volume_codegen::_values_where(const volume* v, const batch& b, const std::string& filter, const std::string& values) {
+	// gathers the positions passing the filter, evaluates v for them and scatters the values back
+	const auto gathered = _variable("g");
+	const auto indices = _variable("k");
+	const batch gathered_batch{gathered + ".data", _variable("n")};
+	_line("batch_positions " + gathered + ";");
+	_line("std::array<uint32_t, BatchSize> " + indices + ";");
+	_line("size_t " + gathered_batch.count + " = 0;");
+	_open("for (size_t i = 0; i < " + b.count + "; ++i) {");
+	_open("if (" + filter + ") {");
+	_line(indices + "[" + gathered_batch.count + "] = static_cast<uint32_t>(i);");
+	_line(gathered + ".data[" + gathered_batch.count + "++] = " + b.positions + "[i];");
+	_close();
+	_close();
+	_open("if (" + gathered_batch.count + " > 0) {");
+	const auto source = _values(v, gathered_batch);
+	_for(gathered_batch, values + "[" + indices + "[i]] = " + source + "[i];");
+	_close();
+}
+
+bool volume_codegen::_has_data(const volume* v) {
+	// whether _data writes any code for v, the values that only choose between branches without data aren't needed
+	if (dynamic_cast<const data_volume*>(v)) {
+		return true;
+	}
+	if (const auto* s = dynamic_cast<const select*>(v)) {
+		return _has_data(s->get_first()) || _has_data(s->get_second());
+	}
+	if (const auto* t = dynamic_cast<const inv_translate*>(v)) {
+		return _has_data(t->get_source());
+	}
+	if (const auto* s = dynamic_cast<const inv_scale*>(v)) {
+		return _has_data(s->get_source());
+	}
+	const auto children = _get_children(v);
+	if (!children) {
+		return true;
+	}
+	return std::any_of(children->begin(), children->end(), _has_data);
+}
+
+void volume_codegen::_data(const volume* v, const std::string& pos) {
+	// walks the tree like the get_data of the volumes, only leafs and volumes without data are left out
+	if (!_has_data(v)) {
+		return;
+	}
+	const position components{pos + ".x", pos + ".y", pos + ".z"};
+	if (const auto* c = dynamic_cast<const compiled_volume*>(v)) {
+		return _data(c->get_source(), pos);
+	}
+	if (const auto* g = dynamic_cast<const generated_volume*>(v)) {
+		return _data(g->get_source(), pos);
+	}
+	if (const auto* d = dynamic_cast<const data_volume*>(v)) {
+		_line("_set_data(" + std::to_string(_externals.at(v)) + ", " + pos + ", data);");
+		return _data(d->get_source(), pos);
+	}
+	if (dynamic_cast<const sphere*>(v) || dynamic_cast<const cube*>(v) || dynamic_cast<const constant*>(v) ||
+		dynamic_cast<const noise*>(v) || dynamic_cast<const noise2d*>(v)) {
+		return;
+	}
+	if (const auto* n = dynamic_cast<const negate_value*>(v)) {
+		return _data(n->get_source(), pos);
+	}
+	if (const auto* r = dynamic_cast<const to_range*>(v)) {
+		return _data(r->get_source(), pos);
+	}
+	if (const auto* f = dynamic_cast<const fbm*>(v)) {
+		return _data(f->get_source(), pos);
+	}
+	if (const auto* add = dynamic_cast<const add_value*>(v)) {
+		for (const volume* source : add->get_sources()) {
+			_data(source, pos);
+		}
+		return;
+	}
+	if (const auto* mul = dynamic_cast<const mul_value*>(v)) {
+		for (const volume* source : mul->get_sources()) {
+			_data(source, pos);
+		}
+		return;
+	}
+	if (const auto* u = dynamic_cast<const union_volume*>(v)) {
+		const auto& sources = u->get_sources();
+		const auto max = _variable("m");
+		const auto chosen = _variable("c");
+		_line("double " + max + " = " + to_literal(u->get_min_value()) + ";");
+		_line("int " + chosen + " = -1;");
+		for (size_t i = 0; i < sources.size(); ++i) {
+			const auto source_value = _value(sources[i], components);
+			_open("if (" + source_value + " > " + max + ") {");
+			_line(max + " = " + source_value + ";");
+			_line(chosen + " = " + std::to_string(i) + ";");
+			_close();
+		}
+		for (size_t i = 0; i < sources.size(); ++i) {
+			if (_has_data(sources[i])) {
+				_open("if (" + chosen + " == " + std::to_string(i) + ") {");
+				_data(sources[i], pos);
+				_close();
+			}
+		}
+		return;
+	}
+	if (const auto* d = dynamic_cast<const difference*>(v)) {
+		const auto& differences = d->get_differences();
+		const auto min = _variable("m");
+		const auto chosen = _variable("c");
+		_line("double " + min + " = " + _value(d->get_source(), components) + ";");
+		_line("int " + chosen + " = 0;");
+		for (size_t i = 0; i < differences.size(); ++i) {
+			const auto rhs_value = _variable("d");
+			_line("const double " + rhs_value + " = -" + _value(differences[i], components) + ";");
+			_open("if (" + rhs_value + " < " + min + ") {");
+			_line(min + " = " + rhs_value + ";");
+			_line(chosen + " = " + std::to_string(i + 1) + ";");
+			_close();
+		}
+		if (_has_data(d->get_source())) {
+			_open("if (" + chosen + " == 0) {");
+			_data(d->get_source(), pos);
+			_close();
+		}
+		for (size_t i = 0; i < differences.size(); ++i) {
+			if (_has_data(differences[i])) {
+				_open("if (" + chosen + " == " + std::to_string(i + 1) + ") {");
+				_data(differences[i], pos);
+				_close();
+			}
+		}
+		return;
+	}
+	if (const auto* s = dynamic_cast<const select*>(v)) {
+		const auto alpha = _variable("a");
+		_line("const double " + alpha + " = " + _condition(s, _value(s->get_controller(), components)) + ";");
+		if (!_has_data(s->get_first())) {
+			_open("if (" + alpha + " > 0) {");
+			_data(s->get_second(), pos);
+			_close();
+			return;
+		}
+		if (!_has_data(s->get_second())) {
+			_open("if (!(" + alpha + " > 0)) {");
+			_data(s->get_first(), pos);
+			_close();
+			return;
+		}
+		_open("if (" + alpha + " > 0) {");
+		_data(s->get_second(), pos);
+		_close();
+		_open("else {");
+		_data(s->get_first(), pos);
+		_close();
+		return;
+	}
+	if (const auto* t = dynamic_cast<const inv_translate*>(v)) {
+		const auto translation = t->get_translation();
+		const auto tx = _value(translation[0], components);
+		const auto ty = _value(translation[1], components);
+		const auto tz = _value(translation[2], components);
+		const auto translated = _variable("p");
+		_line("const vec3 " + translated + " = " + pos + " - vec3(" + tx + ", " + ty + ", " + tz + ");");
+		return _data(t->get_source(), translated);
+	}
+	if (const auto* s = dynamic_cast<const inv_scale*>(v)) {
+		const auto scale = _value(s->get_scale(), components);
+		const auto scaled = _variable("p");
+		_line("const vec3 " + scaled + " = " + pos + " * (1. / " + scale + ");");
+		return _data(s->get_source(), scaled);
+	}
+	if (const auto* a = dynamic_cast<const add_constant*>(v)) {
+		return _data(a->get_source(), pos);
+	}
+	if (const auto* m = dynamic_cast<const mul_constant*>(v)) {
+		return _data(m->get_source(), pos);
+	}
+	if (const auto* t = dynamic_cast<const translate_constant*>(v)) {
+		const vec3& translation = t->get_translation();
+		const auto translated = _variable("p");
+		_line("const vec3 " + translated + " = " + pos + " - vec3(" + to_literal(translation.x) + ", " +
+			to_literal(translation.y) + ", " + to_literal(translation.z) + ");");
+		return _data(t->get_source(), translated);
+	}
+	if (const auto* s = dynamic_cast<const scale_constant*>(v)) {
+		const auto scaled = _variable("p");
+		_line("const vec3 " + scaled + " = " + pos + " * (1. / " + to_literal(s->get_scale()) + ");");
+		return _data(s->get_source(), scaled);
+	}
+
+	_line("_call_data(" + std::to_string(_externals.at(v)) + ", " + pos + ", data);");
+}
+
+std::string volume_codegen::_condition(const select* s, const std::string& control) {
+	if (const auto* greater = s->get_condition().target<greater_condition>()) {
+		return "std::clamp(" + to_literal(greater->inv_interval) + " * (" + control + " - " + to_literal(greater->lower) + "), 0., 1.)";
+	}
+	return "_condition(" + std::to_string(_externals.at(s)) + ", " + control + ")";
+}
+
+std::string volume_codegen::_noise(const gradient_noise& noise) {
+	const auto it = std::find(_noise_seeds.begin(), _noise_seeds.end(), noise.get_seed());
+	const size_t index = it - _noise_seeds.begin();
+	if (it == _noise_seeds.end()) {
+		_noise_seeds.push_back(noise.get_seed());
+	}
+	return "_noise" + std::to_string(index);
+}
+
+std::string volume_codegen::_variable(std::string_view prefix) {
+	return std::string(prefix) + std::to_string(_variable_count++);
+}
+
+std::string volume_codegen::_array(std::string_view prefix) {
+	const auto array = _variable(prefix);
+	_line("std::array<double, BatchSize> " + array + ";");
+	return array;
+}
+
+void volume_codegen::_for(const batch& b, const std::string& line) {
+	_open("for (size_t i = 0; i < " + b.count + "; ++i) {");
+	_line(line);
+	_close();
+}
+
+void volume_codegen::_line(const std::string& line) {
+	_out->append(_indent, '\t');
+	_out->append(line);
+	_out->push_back('\n');
+}
+
+void volume_codegen::_open(const std::string& line) {
+	_line(line);
+	++_indent;
+}
+
+void volume_codegen::_close() {
+	--_indent;
+	_line("}");
+}
+}
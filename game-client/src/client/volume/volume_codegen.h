@@ -0,0 +1,79 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "afront/volume.h"
+
+namespace playchilla {
+class gradient_noise;
+}
+
+namespace playchilla::volumes {
+class select;
+
+/**
+ * Writes the C++ source of a volume class that evaluates a volume tree in straight-line code without virtual calls,
+ * the ahead of time sibling of compiled_volume. The class gets the tree when it is created and calls into it for what
+ * can't be written as source: volumes the generator doesn't know, conditions other than greater_condition and the
+ * data set by data volumes. get_values evaluates each volume over a batch like the tree does, with the batched noise.
+ * The values and the data are bit-identical to the tree. See tools/volume-codegen.
+ */
+class volume_codegen {
+public:
+	volume_codegen(const volume* source);
+
+	// The volumes of the tree that the generated code calls, in the order the generated class refers to them
+	static std::vector<const volume*> get_externals(const volume* source);
+
+	// Changes with the generated code, a generated class uses it to check that it is created from the same tree
+	uint64_t get_fingerprint() const;
+	std::string generate(std::string_view class_name) const;
+
+private:
+	struct position {
+		std::string x;
+		std::string y;
+		std::string z;
+	};
+
+	// The positions of a batch and their count, positions[i] is a vec3
+	struct batch {
+		std::string positions;
+		std::string count;
+	};
+
+	static std::optional<std::vector<const volume*>> _get_children(const volume* v);
+	static bool _is_external(const volume* v);
+	static void _collect_externals(const volume* v, std::vector<const volume*>& externals, std::vector<const volume*>& visited);
+	static bool _has_data(const volume* v);
+
+	std::string _value(const volume* v, const position& pos);
+	std::string _values(const volume* v, const batch& b);
+	void _values_where(const volume* v, const batch& b, const std::string& filter, const std::string& values);
+	std::string _array(std::string_view prefix);
+	void _for(const batch& b, const std::string& line);
+	void _data(const volume* v, const std::string& pos);
+	std::string _condition(const select* s, const std::string& control);
+	std::string _noise(const gradient_noise& noise);
+	std::string _variable(std::string_view prefix);
+	void _line(const std::string& line);
+	void _open(const std::string& line);
+	void _close();
+
+	std::unordered_map<const volume*, size_t> _externals;
+	std::vector<uint64_t> _noise_seeds;
+	std::string _value_code;
+	std::string _values_code;
+	std::string _data_code;
+	std::string _result;
+	std::string _values_result;
+	std::string* _out = nullptr;
+	size_t _indent = 0;
+	size_t _variable_count = 0;
+	uint64_t _fingerprint = 0;
+};
+}
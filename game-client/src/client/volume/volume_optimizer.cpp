@@ -0,0 +1,468 @@
+#include "volume_optimizer.h"
+
+#include <algorithm>
+
+#include "core/util/conversion.h"
+#include "csg.h"
+
+namespace playchilla::volumes {
+namespace {
+// The kind of a volume in a sharing key, followed by its parameters and children
+enum class kind : uint64_t {
+	constant,
+	sphere,
+	cube,
+	noise,
+	noise2d,
+	negate,
+	to_range,
+	fbm,
+	add,
+	add_constant,
+	mul,
+	mul_constant,
+	union_volume,
+	difference,
+	select,
+	translate,
+	translate_constant,
+	scale,
+	scale_constant,
+};
+
+uint64_t bits(double v) {
+	return util::bits_to<uint64_t>(v);
+}
+
+uint64_t id(const volume* v) {
+	return reinterpret_cast<uintptr_t>(v);
+}
+
+std::vector<uint64_t> make_key(kind k, std::initializer_list<uint64_t> parameters, const std::vector<const volume*>& children = {}) {
+	std::vector<uint64_t> key{static_cast<uint64_t>(k)};
+	key.insert(key.end(), parameters);
+	for (const volume* child : children) {
+		key.push_back(id(child));
+	}
+	return key;
+}
+
+const constant* as_constant(const volume* v) {
+	return dynamic_cast<const constant*>(v);
+}
+}
+
+volume_optimizer::volume_optimizer(volume_registry& registry) : _registry(registry) {
+}
+
+const volume* volume_optimizer::optimize(const volume* source) {
+	return _optimize(source);
+}
+
+const volume_optimizer::stats& volume_optimizer::get_stats() const {
+	return _stats;
+}
+
+std::vector<const volume*> volume_optimizer::get_children(const volume* v) {
+	if (const auto* d = dynamic_cast<const data_volume*>(v)) {
+		return {d->get_source()};
+	}
+	if (const auto* n = dynamic_cast<const negate_value*>(v)) {
+		return {n->get_source()};
+	}
+	if (const auto* r = dynamic_cast<const to_range*>(v)) {
+		return {r->get_source()};
+	}
+	if (const auto* f = dynamic_cast<const fbm*>(v)) {
+		return {f->get_source()};
+	}
+	if (const auto* add = dynamic_cast<const add_value*>(v)) {
+		return add->get_sources();
+	}
+	if (const auto* add = dynamic_cast<const add_constant*>(v)) {
+		return {add->get_source()};
+	}
+	if (const auto* mul = dynamic_cast<const mul_value*>(v)) {
+		return mul->get_sources();
+	}
+	if (const auto* mul = dynamic_cast<const mul_constant*>(v)) {
+		return {mul->get_source()};
+	}
+	if (const auto* u = dynamic_cast<const union_volume*>(v)) {
+		return u->get_sources();
+	}
+	if (const auto* d = dynamic_cast<const difference*>(v)) {
+		auto children = d->get_differences();
+		children.insert(children.begin(), d->get_source());
+		return children;
+	}
+	if (const auto* s = dynamic_cast<const select*>(v)) {
+		return {s->get_controller(), s->get_first(), s->get_second()};
+	}
+	if (const auto* t = dynamic_cast<const inv_translate*>(v)) {
+		const auto translation = t->get_translation();
+		return {translation[0], translation[1], translation[2], t->get_source()};
+	}
+	if (const auto* t = dynamic_cast<const translate_constant*>(v)) {
+		return {t->get_source()};
+	}
+	if (const auto* s = dynamic_cast<const inv_scale*>(v)) {
+		return {s->get_scale(), s->get_source()};
+	}
+	if (const auto* s = dynamic_cast<const scale_constant*>(v)) {
+		return {s->get_source()};
+	}
+	return {};
+}
+
+size_t volume_optimizer::count_volumes(const volume* source) {
+	std::vector<const volume*> visited;
+	std::vector<const volume*> open{source};
+	while (!open.empty()) {
+		const volume* v = open.back();
+		open.pop_back();
+		if (std::find(visited.begin(), visited.end(), v) != visited.end()) {
+			continue;
+		}
+		visited.push_back(v);
+		for (const volume* child : get_children(v)) {
+			open.push_back(child);
+		}
+	}
+	return visited.size();
+}
+
+const volume* volume_optimizer::_optimize(const volume* v) {
+	if (const auto it = _optimized.find(v); it != _optimized.end()) {
+		return it->second;
+	}
+	const volume* optimized = _rewrite(v);
+	_optimized.emplace(v, optimized);
+	_optimized.emplace(optimized, optimized);
+	return optimized;
+}
+
+const volume* volume_optimizer::_rewrite(const volume* v) {
+	if (const auto* d = dynamic_cast<const data_volume*>(v)) {
+		// the data can't be compared, so data volumes aren't shared
+		const volume* source = _optimize(d->get_source());
+		if (source == d->get_source()) {
+			return v;
+		}
+		auto copy = d->with_source(source);
+		return copy ? _registry.add(std::move(copy)) : v;
+	}
+	if (const auto* c = as_constant(v)) {
+		return _share(make_key(kind::constant, {bits(c->get_constant())}), v);
+	}
+	if (const auto* s = dynamic_cast<const sphere*>(v)) {
+		return _share(make_key(kind::sphere, {bits(s->get_radius())}), v);
+	}
+	if (const auto* c = dynamic_cast<const cube*>(v)) {
+		const vec3& e = c->get_half_extents();
+		return _share(make_key(kind::cube, {bits(e.x), bits(e.y), bits(e.z)}), v);
+	}
+	if (const auto* n = dynamic_cast<const noise*>(v)) {
+		return _share(make_key(kind::noise, {n->get_noise().get_seed(), bits(n->get_frequency())}), v);
+	}
+	if (const auto* n = dynamic_cast<const noise2d*>(v)) {
+		return _share(make_key(kind::noise2d, {n->get_noise().get_seed(), bits(n->get_radius()), bits(n->get_frequency())}), v);
+	}
+	if (const auto* n = dynamic_cast<const negate_value*>(v)) {
+		const volume* source = _optimize(n->get_source());
+		if (const auto* inner = dynamic_cast<const negate_value*>(source)) {
+			++_stats.merged;
+			return inner->get_source();
+		}
+		return _share(make_key(kind::negate, {}, {source}), [&] {
+			return source == n->get_source() ? v : _create<negate_value>(source);
+		});
+	}
+	if (const auto* r = dynamic_cast<const to_range*>(v)) {
+		const volume* source = _optimize(r->get_source());
+		return _share(make_key(kind::to_range, {bits(r->get_from()), bits(r->get_to())}, {source}),
+			[&] { return source == r->get_source() ? v : _create<to_range>(source, r->get_from(), r->get_to()); });
+	}
+	if (const auto* f = dynamic_cast<const fbm*>(v)) {
+		const volume* source = _optimize(f->get_source());
+		return _share(make_key(kind::fbm, {f->get_octaves(), bits(f->get_scale())}, {source}), [&] {
+			return source == f->get_source() ? v : _create<fbm>(source, f->get_octaves(), f->get_scale());
+		});
+	}
+	if (const auto* add = dynamic_cast<const add_value*>(v)) {
+		std::vector<term> terms;
+		_expand_add(_optimize(add->get_sources()[0]), terms);
+		_append_terms(std::span(add->get_sources()).subspan(1), terms);
+		return _rewrite_add(terms);
+	}
+	if (const auto* add = dynamic_cast<const add_constant*>(v)) {
+		std::vector<term> terms;
+		_expand_add(_optimize(add->get_source()), terms);
+		terms.push_back({nullptr, add->get_constant()});
+		return _rewrite_add(terms);
+	}
+	if (const auto* mul = dynamic_cast<const mul_value*>(v)) {
+		if (mul->get_sources().empty()) {
+			return _share(make_key(kind::constant, {bits(1.)}), [&] { return _create<constant>(1.); });
+		}
+		std::vector<term> terms;
+		_expand_mul(_optimize(mul->get_sources()[0]), terms);
+		_append_terms(std::span(mul->get_sources()).subspan(1), terms);
+		return _rewrite_mul(terms);
+	}
+	if (const auto* mul = dynamic_cast<const mul_constant*>(v)) {
+		std::vector<term> terms;
+		_expand_mul(_optimize(mul->get_source()), terms);
+		terms.push_back({nullptr, mul->get_constant()});
+		return _rewrite_mul(terms);
+	}
+	if (const auto* u = dynamic_cast<const union_volume*>(v)) {
+		auto sources = _optimize_all(u->get_sources());
+		double min_value = u->get_min_value();
+		// max(min, max(inner min, a, b), c) is max(inner min, a, b, c) when the inner min is at least min
+		const auto* inner = sources.empty() ? nullptr : dynamic_cast<const union_volume*>(sources[0]);
+		if (inner && (min_value < inner->get_min_value() || bits(min_value) == bits(inner->get_min_value()))) {
+			sources.erase(sources.begin());
+			sources.insert(sources.begin(), inner->get_sources().begin(), inner->get_sources().end());
+			min_value = inner->get_min_value();
+			++_stats.merged;
+		}
+		return _share(make_key(kind::union_volume, {bits(min_value)}, sources), [&] {
+			return sources == u->get_sources() && min_value == u->get_min_value() ? v : _create<union_volume>(sources, min_value);
+		});
+	}
+	if (const auto* d = dynamic_cast<const difference*>(v)) {
+		const volume* source = _optimize(d->get_source());
+		auto differences = _optimize_all(d->get_differences());
+		if (const auto* inner = dynamic_cast<const difference*>(source)) {
+			differences.insert(differences.begin(), inner->get_differences().begin(), inner->get_differences().end());
+			source = inner->get_source();
+			++_stats.merged;
+		}
+		auto children = differences;
+		children.insert(children.begin(), source);
+		return _share(make_key(kind::difference, {}, children), [&] {
+			return source == d->get_source() && differences == d->get_differences() ? v : _create<difference>(source, differences);
+		});
+	}
+	if (const auto* s = dynamic_cast<const select*>(v)) {
+		const volume* first = _optimize(s->get_first());
+		const volume* second = _optimize(s->get_second());
+		const volume* controller = _optimize(s->get_controller());
+		const auto create = [&] {
+			const bool same = first == s->get_first() && second == s->get_second() && controller == s->get_controller();
+			return same ? v : _create<select>(first, second, controller, s->get_condition());
+		};
+		// other conditions can't be compared
+		if (const auto* greater = s->get_condition().target<greater_condition>()) {
+			return _share(make_key(kind::select, {bits(greater->lower), bits(greater->inv_interval)}, {first, second, controller}), create);
+		}
+		return create();
+	}
+	if (const auto* t = dynamic_cast<const inv_translate*>(v)) {
+		const volume* source = _optimize(t->get_source());
+		const auto translation = t->get_translation();
+		const auto offset = _optimize_all({translation[0], translation[1], translation[2]});
+		const auto* x = as_constant(offset[0]);
+		const auto* y = as_constant(offset[1]);
+		const auto* z = as_constant(offset[2]);
+		if (x && y && z) {
+			_stats.folded += 3;
+			const vec3 constant_offset(x->get_constant(), y->get_constant(), z->get_constant());
+			return _share(make_key(kind::translate_constant, {bits(constant_offset.x), bits(constant_offset.y), bits(constant_offset.z)}, {source}), [&] {
+				return _create<translate_constant>(source, constant_offset);
+			});
+		}
+		return _share(make_key(kind::translate, {}, {source, offset[0], offset[1], offset[2]}), [&] {
+			const bool same = source == t->get_source() && offset == std::vector(translation.begin(), translation.end());
+			return same ? v : _create<inv_translate>(source, offset[0], offset[1], offset[2]);
+		});
+	}
+	if (const auto* t = dynamic_cast<const translate_constant*>(v)) {
+		const volume* source = _optimize(t->get_source());
+		const vec3& offset = t->get_translation();
+		return _share(make_key(kind::translate_constant, {bits(offset.x), bits(offset.y), bits(offset.z)}, {source}),
+			[&] { return source == t->get_source() ? v : _create<translate_constant>(source, offset); });
+	}
+	if (const auto* s = dynamic_cast<const inv_scale*>(v)) {
+		const volume* source = _optimize(s->get_source());
+		const volume* scale = _optimize(s->get_scale());
+		if (const auto* c = as_constant(scale)) {
+			++_stats.folded;
+			return _share(make_key(kind::scale_constant, {bits(c->get_constant())}, {source}), [&] {
+				return _create<scale_constant>(source, c->get_constant());
+			});
+		}
+		return _share(make_key(kind::scale, {}, {source, scale}), [&] {
+			return source == s->get_source() && scale == s->get_scale() ? v : _create<inv_scale>(source, scale);
+		});
+	}
+	if (const auto* s = dynamic_cast<const scale_constant*>(v)) {
+		const volume* source = _optimize(s->get_source());
+		return _share(make_key(kind::scale_constant, {bits(s->get_scale())}, {source}),
+			[&] { return source == s->get_source() ? v : _create<scale_constant>(source, s->get_scale()); });
+	}
+	return v;
+}
+
+const volume* volume_optimizer::_rewrite_add(const std::vector<term>& terms) {
+	// the sum is 0 + t0 + t1 + ..., so the terms keep their order except that the first volume can swap places with
+	// the constants in front of it, 0 + c + x is x + c. A sum after its first term is never -0, which makes the
+	// rewrites exact.
+	std::vector<const volume*> run; // The volumes added since the last constant, the first may be the sum before it
+	double leading = 0;
+	bool has_leading = false;
+	const auto add_to_run = [this, &run](double c) {
+		const volume* sum = run.size() == 1 ? run[0] : _share(make_key(kind::add, {}, run), [&] { return _create<add_value>(run); });
+		++_stats.folded;
+		run = {_share(make_key(kind::add_constant, {bits(c)}, {sum}), [&] { return _create<add_constant>(sum, c); })};
+	};
+	for (const term& t : terms) {
+		if (!t.v && run.empty()) {
+			leading = has_leading ? leading + t.c : 0. + t.c;
+			has_leading = true;
+		}
+		else if (!t.v) {
+			add_to_run(t.c);
+		}
+		else {
+			run.push_back(t.v);
+			if (has_leading) {
+				add_to_run(leading);
+				has_leading = false;
+			}
+		}
+	}
+	if (run.empty()) {
+		return _share(make_key(kind::constant, {bits(leading)}), [&] { return _create<constant>(leading); });
+	}
+	if (run.size() == 1) {
+		// only a lone volume that is its own sum needs the 0 +
+		if (terms.size() > 1) {
+			return run[0];
+		}
+		add_to_run(0.);
+		return run[0];
+	}
+	return _share(make_key(kind::add, {}, run), [&] { return _create<add_value>(run); });
+}
+
+const volume* volume_optimizer::_rewrite_mul(const std::vector<term>& terms) {
+	// like the sum, the product is 1 * t0 * t1 * ... where 1 * x is always x
+	std::vector<const volume*> run;
+	double leading = 1;
+	bool has_leading = false;
+	const auto mul_run = [this, &run](double c) {
+		const volume* product = run.size() == 1 ? run[0] : _share(make_key(kind::mul, {}, run), [&] { return _create<mul_value>(run); });
+		++_stats.folded;
+		run = {_share(make_key(kind::mul_constant, {bits(c)}, {product}), [&] { return _create<mul_constant>(product, c); })};
+	};
+	for (const term& t : terms) {
+		if (!t.v && run.empty()) {
+			leading *= t.c;
+			has_leading = true;
+		}
+		else if (!t.v) {
+			mul_run(t.c);
+		}
+		else {
+			run.push_back(t.v);
+			if (has_leading) {
+				mul_run(leading);
+				has_leading = false;
+			}
+		}
+	}
+	if (run.empty()) {
+		return _share(make_key(kind::constant, {bits(leading)}), [&] { return _create<constant>(leading); });
+	}
+	if (run.size() == 1) {
+		return run[0];
+	}
+	return _share(make_key(kind::mul, {}, run), [&] { return _create<mul_value>(run); });
+}
+
+void volume_optimizer::_expand_add(const volume* v, std::vector<term>& terms) {
+	// a sum as the first term adds its terms in the same order
+	if (const auto* add = dynamic_cast<const add_value*>(v)) {
+		++_stats.merged;
+		const auto& sources = add->get_sources();
+		_expand_add(sources[0], terms);
+		for (size_t i = 1; i < sources.size(); ++i) {
+			terms.push_back({sources[i], 0});
+		}
+	}
+	else if (const auto* add = dynamic_cast<const add_constant*>(v)) {
+		_expand_add(add->get_source(), terms);
+		terms.push_back({nullptr, add->get_constant()});
+	}
+	else if (const auto* c = as_constant(v)) {
+		terms.push_back({nullptr, c->get_constant()});
+	}
+	else {
+		terms.push_back({v, 0});
+	}
+}
+
+void volume_optimizer::_expand_mul(const volume* v, std::vector<term>& terms) {
+	if (const auto* mul = dynamic_cast<const mul_value*>(v); mul && !mul->get_sources().empty()) {
+		++_stats.merged;
+		const auto& sources = mul->get_sources();
+		_expand_mul(sources[0], terms);
+		for (size_t i = 1; i < sources.size(); ++i) {
+			terms.push_back({sources[i], 0});
+		}
+	}
+	else if (const auto* mul = dynamic_cast<const mul_constant*>(v)) {
+		_expand_mul(mul->get_source(), terms);
+		terms.push_back({nullptr, mul->get_constant()});
+	}
+	else if (const auto* c = as_constant(v)) {
+		terms.push_back({nullptr, c->get_constant()});
+	}
+	else {
+		terms.push_back({v, 0});
+	}
+}
+
+void volume_optimizer::_append_terms(std::span<const volume* const> sources, std::vector<term>& terms) {
+	for (const volume* source : sources) {
+		const volume* optimized = _optimize(source);
+		if (const auto* c = as_constant(optimized)) {
+			terms.push_back({nullptr, c->get_constant()});
+		}
+		else {
+			terms.push_back({optimized, 0});
+		}
+	}
+}
+
+std::vector<const volume*> volume_optimizer::_optimize_all(const std::vector<const volume*>& sources) {
+	std::vector<const volume*> optimized;
+	optimized.reserve(sources.size());
+	for (const volume* source : sources) {
+		optimized.push_back(_optimize(source));
+	}
+	return optimized;
+}
+
+template <typename T, typename... Args>
+const volume* volume_optimizer::_create(Args&&... args) {
+	return _registry.create<T>(std::forward<Args>(args)...);
+}
+
+template <typename F>
+const volume* volume_optimizer::_share(std::vector<uint64_t> key, F&& create) {
+	if (const auto it = _shared.find(key); it != _shared.end()) {
+		++_stats.shared;
+		return it->second;
+	}
+	const volume* v = create();
+	_shared.emplace(std::move(key), v);
+	return v;
+}
+
+const volume* volume_optimizer::_share(std::vector<uint64_t> key, const volume* v) {
+	return _share(std::move(key), [v] { return v; });
+}
+}
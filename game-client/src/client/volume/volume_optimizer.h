@@ -0,0 +1,64 @@
+#pragma once
+
+#include <map>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+#include "afront/volume.h"
+
+namespace playchilla {
+class volume_registry;
+}
+
+namespace playchilla::volumes {
+/**
+ * Rewrites a volume tree to a smaller graph with bit-identical values: identical sub trees become one shared volume,
+ * constant children become parameters of the volumes that use them and adds, products, unions and differences
+ * nested as the first source are merged into their parent. Data volumes are kept with their data. The new volumes are
+ * created in the registry and the tree is left as it is, volumes the optimizer doesn't know are used as they are.
+ */
+class volume_optimizer {
+public:
+	struct stats {
+		size_t shared = 0; // Volumes replaced by an identical one
+		size_t folded = 0; // Constant children turned into parameters
+		size_t merged = 0; // Nested volumes merged into their parent
+	};
+
+	volume_optimizer(volume_registry& registry);
+
+	const volume* optimize(const volume* source);
+	const stats& get_stats() const;
+
+	// The volumes that a volume evaluates, empty for leafs and the volumes the optimizer doesn't know
+	static std::vector<const volume*> get_children(const volume* v);
+	static size_t count_volumes(const volume* source); // Distinct volumes in the graph
+
+private:
+	// A source of an add or a product, either a volume or a constant
+	struct term {
+		const volume* v = nullptr;
+		double c = 0;
+	};
+
+	const volume* _optimize(const volume* v);
+	const volume* _rewrite(const volume* v);
+	const volume* _rewrite_add(const std::vector<term>& terms);
+	const volume* _rewrite_mul(const std::vector<term>& terms);
+	void _expand_add(const volume* v, std::vector<term>& terms);
+	void _expand_mul(const volume* v, std::vector<term>& terms);
+	void _append_terms(std::span<const volume* const> sources, std::vector<term>& terms);
+	std::vector<const volume*> _optimize_all(const std::vector<const volume*>& sources);
+	template <typename T, typename... Args>
+	const volume* _create(Args&&... args);
+	template <typename F>
+	const volume* _share(std::vector<uint64_t> key, F&& create); // The volume with the key, made by create the first time
+	const volume* _share(std::vector<uint64_t> key, const volume* v);
+
+	volume_registry& _registry;
+	std::unordered_map<const volume*, const volume*> _optimized;
+	std::map<std::vector<uint64_t>, const volume*> _shared;
+	stats _stats;
+};
+}
@@ -1,7 +1,8 @@
 #pragma once
 
-#include <any>
+#include <array>
 #include <memory>
+#include <span>
 #include <vector>
 
 #include "game_volume_data.h"
@@ -17,15 +18,49 @@ class volume_data;
 // LEAFS
 ////////////////////////
 namespace volumes {
+// The distances from the origin to the points of the box
+inline interval get_distance_interval(const aabb& box) {
+	const vec3 min = box.get_min();
+	const vec3 max = box.get_max();
+	const vec3 nearest{std::clamp(0., min.x, max.x), std::clamp(0., min.y, max.y), std::clamp(0., min.z, max.z)};
+	const vec3 farthest{std::max(-min.x, max.x), std::max(-min.y, max.y), std::max(-min.z, max.z)};
+	return {nearest.length(), farthest.length()};
+}
+
 class sphere : public volume {
 public:
 	sphere(double radius) : _radius(radius) {
 	}
 
+	double get_radius() const {
+		return _radius;
+	}
+
 	double get_value(double x, double y, double z) const override {
 		return _radius - std::sqrt(x * x + y * y + z * z);
 	}
 
+	void get_values(std::span<const vec3> positions, std::span<double> values) const override {
+		for (size_t i = 0; i < positions.size(); ++i) {
+			const vec3& p = positions[i];
+			values[i] = _radius - std::sqrt(p.x * p.x + p.y * p.y + p.z * p.z);
+		}
+	}
+
+	double get_value_and_gradient(double x, double y, double z, vec3& gradient) const override {
+		const double length = std::sqrt(x * x + y * y + z * z);
+		gradient = length > 0 ? vec3{x, y, z} * (-1. / length) : vec3{};
+		return _radius - length;
+	}
+
+	interval get_interval(const aabb& box) const override {
+		return -get_distance_interval(box) + _radius;
+	}
+
+	double get_lipschitz(const aabb&) const override {
+		return 1;
+	}
+
 	void get_data(const vec3& pos, volume_data& data) const override {
 	}
 
@@ -38,6 +73,10 @@ public:
 	cube(const vec3& size) : _half_extents(size * .5) {
 	}
 
+	const vec3& get_half_extents() const {
+		return _half_extents;
+	}
+
 	double get_value(double x, double y, double z) const override {
 		const double xa = std::abs(x) - _half_extents.x;
 		const double ya = std::abs(y) - _half_extents.y;
@@ -45,6 +84,48 @@ public:
 		return -max(xa, max(ya, za));
 	}
 
+	void get_values(std::span<const vec3> positions, std::span<double> values) const override {
+		for (size_t i = 0; i < positions.size(); ++i) {
+			const vec3& p = positions[i];
+			const double xa = std::abs(p.x) - _half_extents.x;
+			const double ya = std::abs(p.y) - _half_extents.y;
+			const double za = std::abs(p.z) - _half_extents.z;
+			values[i] = -max(xa, max(ya, za));
+		}
+	}
+
+	double get_value_and_gradient(double x, double y, double z, vec3& gradient) const override {
+		// the gradient of the axis that max picks
+		const double xa = std::abs(x) - _half_extents.x;
+		const double ya = std::abs(y) - _half_extents.y;
+		const double za = std::abs(z) - _half_extents.z;
+		const double yza = max(ya, za);
+		gradient = {};
+		if (xa > yza) {
+			gradient.x = -std::copysign(1., x);
+		}
+		else if (ya > za) {
+			gradient.y = -std::copysign(1., y);
+		}
+		else {
+			gradient.z = -std::copysign(1., z);
+		}
+		return -max(xa, yza);
+	}
+
+	interval get_interval(const aabb& box) const override {
+		const vec3 min = box.get_min();
+		const vec3 max = box.get_max();
+		const interval xa = interval(min.x, max.x).abs() - _half_extents.x;
+		const interval ya = interval(min.y, max.y).abs() - _half_extents.y;
+		const interval za = interval(min.z, max.z).abs() - _half_extents.z;
+		return -playchilla::max(xa, playchilla::max(ya, za));
+	}
+
+	double get_lipschitz(const aabb&) const override {
+		return 1;
+	}
+
 	void get_data(const vec3& pos, volume_data& data) const override {
 	}
 
@@ -57,10 +138,31 @@ public:
 	constant(double value) : _value(value) {
 	}
 
+	double get_constant() const {
+		return _value;
+	}
+
 	double get_value(double x, double y, double z) const override {
 		return _value;
 	}
 
+	void get_values(std::span<const vec3>, std::span<double> values) const override {
+		std::fill(values.begin(), values.end(), _value);
+	}
+
+	double get_value_and_gradient(double, double, double, vec3& gradient) const override {
+		gradient = {};
+		return _value;
+	}
+
+	interval get_interval(const aabb&) const override {
+		return _value;
+	}
+
+	double get_lipschitz(const aabb&) const override {
+		return 0;
+	}
+
 	void get_data(const vec3&, volume_data& data) const override {
 	}
 
@@ -73,10 +175,50 @@ public:
 	noise(uint64_t seed, double period) : _noise(seed), _frequency(1. / period) {
 	}
 
+	const gradient_noise& get_noise() const {
+		return _noise;
+	}
+
+	double get_frequency() const {
+		return _frequency;
+	}
+
 	double get_value(double x, double y, double z) const override {
 		return _noise.get_value(_frequency * x, _frequency * y, _frequency * z);
 	}
 
+	void get_values(std::span<const vec3> positions, std::span<double> values) const override {
+		for_each_batch(positions, values, [this](std::span<const vec3> batch, std::span<double> batch_values) {
+			batch_positions noise_positions;
+			for (size_t i = 0; i < batch.size(); ++i) {
+				noise_positions.data[i] = {_frequency * batch[i].x, _frequency * batch[i].y, _frequency * batch[i].z};
+			}
+			_noise.get_values(std::span(noise_positions.data).first(batch.size()), batch_values);
+		});
+	}
+
+	double get_value_and_gradient(double x, double y, double z, vec3& gradient) const override {
+		const double value = _noise.get_value_and_gradient(_frequency * x, _frequency * y, _frequency * z, gradient);
+		gradient *= _frequency;
+		return value;
+	}
+
+	interval get_interval(const aabb& box) const override {
+		return _noise.get_interval(box.get_min() * _frequency, box.get_max() * _frequency);
+	}
+
+	double get_lipschitz(const aabb&) const override {
+		return _frequency * gradient_noise::get_lipschitz();
+	}
+
+	// All of the noise is within the tolerance of 0
+	const volume* approximate(double tolerance, volume_unique_ptrs& owned) const override {
+		if (tolerance >= gradient_noise::get_bounds().upper) {
+			return _own<constant>(owned, 0.);
+		}
+		return this;
+	}
+
 	void get_data(const vec3&, volume_data& data) const override {
 	}
 
@@ -91,11 +233,78 @@ public:
 		assertion(r > 0, "Sphere radius should be greater than 0");
 	}
 
+	const gradient_noise& get_noise() const {
+		return _noise;
+	}
+
+	double get_radius() const {
+		return _radius;
+	}
+
+	double get_frequency() const {
+		return _frequency;
+	}
+
 	double get_value(double x, double y, double z) const override {
 		const vec3 surface_pos = vec3{x, y, z}.rescale(_radius);
 		return _noise.get_value(_frequency * surface_pos.x, _frequency * surface_pos.y, _frequency * surface_pos.z);
 	}
 
+	void get_values(std::span<const vec3> positions, std::span<double> values) const override {
+		for_each_batch(positions, values, [this](std::span<const vec3> batch, std::span<double> batch_values) {
+			batch_positions noise_positions;
+			for (size_t i = 0; i < batch.size(); ++i) {
+				const vec3 surface_pos = batch[i].rescale(_radius);
+				noise_positions.data[i] = {_frequency * surface_pos.x, _frequency * surface_pos.y, _frequency * surface_pos.z};
+			}
+			_noise.get_values(std::span(noise_positions.data).first(batch.size()), batch_values);
+		});
+	}
+
+	double get_value_and_gradient(double x, double y, double z, vec3& gradient) const override {
+		const vec3 pos{x, y, z};
+		const double length = pos.length();
+		const vec3 surface_pos = pos.rescale(_radius);
+		vec3 noise_gradient;
+		const double value = _noise.get_value_and_gradient(_frequency * surface_pos.x, _frequency * surface_pos.y, _frequency * surface_pos.z, noise_gradient);
+		// the surface position only moves sideways, radius / length times the position
+		const vec3 dir = pos * (1. / length);
+		gradient = (noise_gradient - dir * dir.dot(noise_gradient)) * (_frequency * _radius / length);
+		return value;
+	}
+
+	interval get_interval(const aabb& box) const override {
+		// the surface positions are the positions scaled by radius / length, anything when the box holds the origin
+		const interval length = get_distance_interval(box);
+		if (!(length.lower > 0)) {
+			return gradient_noise::get_bounds();
+		}
+		const interval s{_frequency * _radius / length.upper, _frequency * _radius / length.lower};
+		const vec3 min = box.get_min();
+		const vec3 max = box.get_max();
+		const interval x = interval(min.x, max.x) * s;
+		const interval y = interval(min.y, max.y) * s;
+		const interval z = interval(min.z, max.z) * s;
+		return _noise.get_interval({x.lower, y.lower, z.lower}, {x.upper, y.upper, z.upper});
+	}
+
+	// The surface positions move sideways by radius / length of the position, without bound around the origin
+	double get_lipschitz(const aabb& box) const override {
+		const interval length = get_distance_interval(box);
+		if (!(length.lower > 0)) {
+			return volume::get_lipschitz(box);
+		}
+		return _frequency * _radius / length.lower * gradient_noise::get_lipschitz();
+	}
+
+	// All of the noise is within the tolerance of 0
+	const volume* approximate(double tolerance, volume_unique_ptrs& owned) const override {
+		if (tolerance >= gradient_noise::get_bounds().upper) {
+			return _own<constant>(owned, 0.);
+		}
+		return this;
+	}
+
 	void get_data(const vec3&, volume_data& data) const override {
 	}
 
@@ -113,14 +322,53 @@ public:
 	negate_value(const volume* source) : _source(source) {
 	}
 
+	const volume* get_source() const {
+		return _source;
+	}
+
 	double get_value(double x, double y, double z) const override {
 		return -_source->get_value(x, y, z);
 	}
 
+	void get_values(std::span<const vec3> positions, std::span<double> values) const override {
+		_source->get_values(positions, values);
+		for (double& v : values) {
+			v = -v;
+		}
+	}
+
+	double get_value_and_gradient(double x, double y, double z, vec3& gradient) const override {
+		const double value = -_source->get_value_and_gradient(x, y, z, gradient);
+		gradient = -gradient;
+		return value;
+	}
+
+	interval get_interval(const aabb& box) const override {
+		return -_source->get_interval(box);
+	}
+
+	double get_lipschitz(const aabb& box) const override {
+		return _source->get_lipschitz(box);
+	}
+
+	const volume* specialize(const aabb& box, volume_unique_ptrs& owned) const override {
+		const volume* source = _source->specialize(box, owned);
+		return source == _source ? this : _own<negate_value>(owned, source);
+	}
+
+	const volume* approximate(double tolerance, volume_unique_ptrs& owned) const override {
+		const volume* source = _source->approximate(tolerance, owned);
+		return source == _source ? this : _own<negate_value>(owned, source);
+	}
+
 	void get_data(const vec3& pos, volume_data& data) const override {
 		_source->get_data(pos, data);
 	}
 
+	double get_value_and_data(const vec3& pos, volume_data& data) const override {
+		return -_source->get_value_and_data(pos, data);
+	}
+
 private:
 	const volume* _source;
 };
@@ -131,6 +379,10 @@ public:
 		assertion(_sources.size() >= 2, "At least two sources are required for add_value");
 	}
 
+	const std::vector<const volume*>& get_sources() const {
+		return _sources;
+	}
+
 	double get_value(double x, double y, double z) const override {
 		double v = 0;
 		for (const auto& s : _sources) {
@@ -139,12 +391,72 @@ public:
 		return v;
 	}
 
+	void get_values(std::span<const vec3> positions, std::span<double> values) const override {
+		for_each_batch(positions, values, [this](std::span<const vec3> batch, std::span<double> sums) {
+			std::array<double, BatchSize> source_values;
+			std::fill(sums.begin(), sums.end(), 0.);
+			for (const auto& s : _sources) {
+				s->get_values(batch, std::span(source_values).first(batch.size()));
+				for (size_t i = 0; i < batch.size(); ++i) {
+					sums[i] += source_values[i];
+				}
+			}
+		});
+	}
+
+	double get_value_and_gradient(double x, double y, double z, vec3& gradient) const override {
+		double v = 0;
+		gradient = {};
+		for (const auto& s : _sources) {
+			vec3 source_gradient;
+			v += s->get_value_and_gradient(x, y, z, source_gradient);
+			gradient += source_gradient;
+		}
+		return v;
+	}
+
+	interval get_interval(const aabb& box) const override {
+		interval v = 0.;
+		for (const auto& s : _sources) {
+			v += s->get_interval(box);
+		}
+		return v;
+	}
+
+	double get_lipschitz(const aabb& box) const override {
+		double lipschitz = 0;
+		for (const auto& s : _sources) {
+			lipschitz += s->get_lipschitz(box);
+		}
+		return lipschitz;
+	}
+
+	const volume* specialize(const aabb& box, volume_unique_ptrs& owned) const override {
+		std::vector<const volume*> sources;
+		return _specialize(_sources, box, owned, sources) ? _own<add_value>(owned, std::move(sources)) : this;
+	}
+
+	// The errors of the sources add up, so each source that isn't a constant gets an even part of the tolerance
+	const volume* approximate(double tolerance, volume_unique_ptrs& owned) const override {
+		const auto volumes = std::count_if(_sources.begin(), _sources.end(), [](const volume* s) { return !dynamic_cast<const constant*>(s); });
+		std::vector<const volume*> sources;
+		return _approximate(_sources, tolerance / static_cast<double>(std::max<std::ptrdiff_t>(volumes, 1)), owned, sources) ? _own<add_value>(owned, std::move(sources)) : this;
+	}
+
 	void get_data(const vec3& pos, volume_data& data) const override {
 		for (const auto& s : _sources) {
 			s->get_data(pos, data);
 		}
 	}
 
+	double get_value_and_data(const vec3& pos, volume_data& data) const override {
+		double v = 0;
+		for (const auto& s : _sources) {
+			v += s->get_value_and_data(pos, data);
+		}
+		return v;
+	}
+
 private:
 	std::vector<const volume*> _sources;
 };
@@ -154,6 +466,10 @@ public:
 	mul_value(std::vector<const volume*> sources) : _sources(std::move(sources)) {
 	}
 
+	const std::vector<const volume*>& get_sources() const {
+		return _sources;
+	}
+
 	double get_value(double x, double y, double z) const override {
 		double v = 1;
 		for (const auto& s : _sources) {
@@ -162,31 +478,306 @@ public:
 		return v;
 	}
 
+	void get_values(std::span<const vec3> positions, std::span<double> values) const override {
+		for_each_batch(positions, values, [this](std::span<const vec3> batch, std::span<double> products) {
+			std::array<double, BatchSize> source_values;
+			std::fill(products.begin(), products.end(), 1.);
+			for (const auto& s : _sources) {
+				s->get_values(batch, std::span(source_values).first(batch.size()));
+				for (size_t i = 0; i < batch.size(); ++i) {
+					products[i] *= source_values[i];
+				}
+			}
+		});
+	}
+
+	double get_value_and_gradient(double x, double y, double z, vec3& gradient) const override {
+		double v = 1;
+		gradient = {};
+		for (const auto& s : _sources) {
+			vec3 source_gradient;
+			const double source_value = s->get_value_and_gradient(x, y, z, source_gradient);
+			gradient = gradient * source_value + source_gradient * v;
+			v *= source_value;
+		}
+		return v;
+	}
+
+	interval get_interval(const aabb& box) const override {
+		interval v = 1.;
+		for (const auto& s : _sources) {
+			v *= s->get_interval(box);
+		}
+		return v;
+	}
+
+	// By the product rule, each bound times the largest values of the other sources
+	double get_lipschitz(const aabb& box) const override {
+		double lipschitz = 0;
+		for (size_t i = 0; i < _sources.size(); ++i) {
+			const double source_lipschitz = _sources[i]->get_lipschitz(box);
+			if (source_lipschitz == 0) {
+				continue;
+			}
+			double term = source_lipschitz;
+			for (size_t j = 0; j < _sources.size(); ++j) {
+				if (j != i) {
+					const interval v = _sources[j]->get_interval(box);
+					term *= std::max(-v.lower, v.upper);
+				}
+			}
+			lipschitz += term;
+		}
+		return lipschitz;
+	}
+
+	const volume* specialize(const aabb& box, volume_unique_ptrs& owned) const override {
+		std::vector<const volume*> sources;
+		return _specialize(_sources, box, owned, sources) ? _own<mul_value>(owned, std::move(sources)) : this;
+	}
+
+	// Only a single volume scaled by constants, the error of a product of volumes depends on their values
+	const volume* approximate(double tolerance, volume_unique_ptrs& owned) const override {
+		double scale = 1;
+		size_t index = _sources.size();
+		for (size_t i = 0; i < _sources.size(); ++i) {
+			if (const auto* c = dynamic_cast<const constant*>(_sources[i])) {
+				scale *= std::abs(c->get_constant());
+			}
+			else if (index == _sources.size()) {
+				index = i;
+			}
+			else {
+				return this;
+			}
+		}
+		if (index == _sources.size() || !(scale > 0)) {
+			return this;
+		}
+		const volume* source = _sources[index]->approximate(tolerance / scale, owned);
+		if (source == _sources[index]) {
+			return this;
+		}
+		auto sources = _sources;
+		sources[index] = source;
+		return _own<mul_value>(owned, std::move(sources));
+	}
+
 	void get_data(const vec3& pos, volume_data& data) const override {
 		for (const auto& s : _sources) {
 			s->get_data(pos, data);
 		}
 	}
 
+	double get_value_and_data(const vec3& pos, volume_data& data) const override {
+		double v = 1;
+		for (const auto& s : _sources) {
+			v *= s->get_value_and_data(pos, data);
+		}
+		return v;
+	}
+
 private:
 	std::vector<const volume*> _sources;
 };
 
+// An add_value of the source and a constant, with the constant as a parameter instead of a volume
+class add_constant : public volume {
+public:
+	add_constant(const volume* source, double c) : _source(source), _c(c) {
+	}
+
+	const volume* get_source() const {
+		return _source;
+	}
+
+	double get_constant() const {
+		return _c;
+	}
+
+	// the sum starts from 0 like add_value, which turns -0 into 0
+	double get_value(double x, double y, double z) const override {
+		return 0. + _source->get_value(x, y, z) + _c;
+	}
+
+	void get_values(std::span<const vec3> positions, std::span<double> values) const override {
+		_source->get_values(positions, values);
+		for (double& v : values) {
+			v = 0. + v + _c;
+		}
+	}
+
+	double get_value_and_gradient(double x, double y, double z, vec3& gradient) const override {
+		return 0. + _source->get_value_and_gradient(x, y, z, gradient) + _c;
+	}
+
+	interval get_interval(const aabb& box) const override {
+		return _source->get_interval(box) + _c;
+	}
+
+	double get_lipschitz(const aabb& box) const override {
+		return _source->get_lipschitz(box);
+	}
+
+	const volume* specialize(const aabb& box, volume_unique_ptrs& owned) const override {
+		const volume* source = _source->specialize(box, owned);
+		return source == _source ? this : _own<add_constant>(owned, source, _c);
+	}
+
+	const volume* approximate(double tolerance, volume_unique_ptrs& owned) const override {
+		const volume* source = _source->approximate(tolerance, owned);
+		return source == _source ? this : _own<add_constant>(owned, source, _c);
+	}
+
+	void get_data(const vec3& pos, volume_data& data) const override {
+		_source->get_data(pos, data);
+	}
+
+	double get_value_and_data(const vec3& pos, volume_data& data) const override {
+		return 0. + _source->get_value_and_data(pos, data) + _c;
+	}
+
+private:
+	const volume* _source;
+	double _c;
+};
+
+// A mul_value of the source and a constant, with the constant as a parameter instead of a volume
+class mul_constant : public volume {
+public:
+	mul_constant(const volume* source, double c) : _source(source), _c(c) {
+	}
+
+	const volume* get_source() const {
+		return _source;
+	}
+
+	double get_constant() const {
+		return _c;
+	}
+
+	double get_value(double x, double y, double z) const override {
+		return _source->get_value(x, y, z) * _c;
+	}
+
+	void get_values(std::span<const vec3> positions, std::span<double> values) const override {
+		_source->get_values(positions, values);
+		for (double& v : values) {
+			v *= _c;
+		}
+	}
+
+	double get_value_and_gradient(double x, double y, double z, vec3& gradient) const override {
+		const double value = _source->get_value_and_gradient(x, y, z, gradient) * _c;
+		gradient *= _c;
+		return value;
+	}
+
+	interval get_interval(const aabb& box) const override {
+		return _source->get_interval(box) * _c;
+	}
+
+	double get_lipschitz(const aabb& box) const override {
+		return _c == 0 ? 0 : _source->get_lipschitz(box) * std::abs(_c);
+	}
+
+	const volume* specialize(const aabb& box, volume_unique_ptrs& owned) const override {
+		const volume* source = _source->specialize(box, owned);
+		return source == _source ? this : _own<mul_constant>(owned, source, _c);
+	}
+
+	const volume* approximate(double tolerance, volume_unique_ptrs& owned) const override {
+		if (!(_c != 0)) {
+			return this;
+		}
+		const volume* source = _source->approximate(tolerance / std::abs(_c), owned);
+		return source == _source ? this : _own<mul_constant>(owned, source, _c);
+	}
+
+	void get_data(const vec3& pos, volume_data& data) const override {
+		_source->get_data(pos, data);
+	}
+
+	double get_value_and_data(const vec3& pos, volume_data& data) const override {
+		return _source->get_value_and_data(pos, data) * _c;
+	}
+
+private:
+	const volume* _source;
+	double _c;
+};
+
 class to_range : public volume {
 public:
 	to_range(const volume* source, double from, double to) : _source(source), _from(from), _to(to) {
 	}
 
+	const volume* get_source() const {
+		return _source;
+	}
+
+	double get_from() const {
+		return _from;
+	}
+
+	double get_to() const {
+		return _to;
+	}
+
 	double get_value(double x, double y, double z) const override {
 		const auto v01 = .5 * (1. + _source->get_value(x, y, z));
 		assertion(v01 >=0 && v01<=1, "to_range unexpected input");
 		return _from + v01 * (_to - _from);
 	}
 
+	void get_values(std::span<const vec3> positions, std::span<double> values) const override {
+		_source->get_values(positions, values);
+		for (double& v : values) {
+			const auto v01 = .5 * (1. + v);
+			assertion(v01 >=0 && v01<=1, "to_range unexpected input");
+			v = _from + v01 * (_to - _from);
+		}
+	}
+
+	double get_value_and_gradient(double x, double y, double z, vec3& gradient) const override {
+		const auto v01 = .5 * (1. + _source->get_value_and_gradient(x, y, z, gradient));
+		assertion(v01 >=0 && v01<=1, "to_range unexpected input");
+		gradient *= .5 * (_to - _from);
+		return _from + v01 * (_to - _from);
+	}
+
+	interval get_interval(const aabb& box) const override {
+		return (_source->get_interval(box) + 1.) * (.5 * (_to - _from)) + _from;
+	}
+
+	double get_lipschitz(const aabb& box) const override {
+		return _source->get_lipschitz(box) * (.5 * std::abs(_to - _from));
+	}
+
+	const volume* specialize(const aabb& box, volume_unique_ptrs& owned) const override {
+		const volume* source = _source->specialize(box, owned);
+		return source == _source ? this : _own<to_range>(owned, source, _from, _to);
+	}
+
+	const volume* approximate(double tolerance, volume_unique_ptrs& owned) const override {
+		const double scale = .5 * std::abs(_to - _from);
+		if (!(scale > 0)) {
+			return this;
+		}
+		const volume* source = _source->approximate(tolerance / scale, owned);
+		return source == _source ? this : _own<to_range>(owned, source, _from, _to);
+	}
+
 	void get_data(const vec3& pos, volume_data& data) const override {
 		_source->get_data(pos, data);
 	}
 
+	double get_value_and_data(const vec3& pos, volume_data& data) const override {
+		const auto v01 = .5 * (1. + _source->get_value_and_data(pos, data));
+		assertion(v01 >=0 && v01<=1, "to_range unexpected input");
+		return _from + v01 * (_to - _from);
+	}
+
 private:
 	const volume* _source;
 	double _from;
@@ -206,6 +797,15 @@ public:
 		_z(z) {
 	}
 
+	const volume* get_source() const {
+		return _source;
+	}
+
+	// The translation of each axis
+	std::array<const volume*, 3> get_translation() const {
+		return {_x, _y, _z};
+	}
+
 	double get_value(double x, double y, double z) const override {
 		const double xx = _x->get_value(x, y, z);
 		const double yy = _y->get_value(x, y, z);
@@ -213,6 +813,58 @@ public:
 		return _source->get_value(x - xx, y - yy, z - zz);
 	}
 
+	void get_values(std::span<const vec3> positions, std::span<double> values) const override {
+		for_each_batch(positions, values, [this](std::span<const vec3> batch, std::span<double> batch_values) {
+			std::array<double, BatchSize> xx;
+			std::array<double, BatchSize> yy;
+			std::array<double, BatchSize> zz;
+			std::array<vec3, BatchSize> translated;
+			const size_t count = batch.size();
+			_x->get_values(batch, std::span(xx).first(count));
+			_y->get_values(batch, std::span(yy).first(count));
+			_z->get_values(batch, std::span(zz).first(count));
+			for (size_t i = 0; i < count; ++i) {
+				translated[i] = {batch[i].x - xx[i], batch[i].y - yy[i], batch[i].z - zz[i]};
+			}
+			_source->get_values(std::span(translated).first(count), batch_values);
+		});
+	}
+
+	double get_value_and_gradient(double x, double y, double z, vec3& gradient) const override {
+		vec3 gx, gy, gz, source_gradient;
+		const double xx = _x->get_value_and_gradient(x, y, z, gx);
+		const double yy = _y->get_value_and_gradient(x, y, z, gy);
+		const double zz = _z->get_value_and_gradient(x, y, z, gz);
+		const double value = _source->get_value_and_gradient(x - xx, y - yy, z - zz, source_gradient);
+		gradient = source_gradient - gx * source_gradient.x - gy * source_gradient.y - gz * source_gradient.z;
+		return value;
+	}
+
+	interval get_interval(const aabb& box) const override {
+		return _source->get_interval(_get_source_box(box));
+	}
+
+	// The source position moves by at most 1 plus the bounds of the offsets per unit
+	double get_lipschitz(const aabb& box) const override {
+		return _source->get_lipschitz(_get_source_box(box)) * (1. + _x->get_lipschitz(box) + _y->get_lipschitz(box) + _z->get_lipschitz(box));
+	}
+
+	const volume* specialize(const aabb& box, volume_unique_ptrs& owned) const override {
+		const volume* source = _source->specialize(_get_source_box(box), owned);
+		std::vector<const volume*> translation;
+		const bool translation_changed = _specialize(get_translation(), box, owned, translation);
+		if (source == _source && !translation_changed) {
+			return this;
+		}
+		return _own<inv_translate>(owned, source, translation[0], translation[1], translation[2]);
+	}
+
+	// The translation moves the positions, so it stays exact
+	const volume* approximate(double tolerance, volume_unique_ptrs& owned) const override {
+		const volume* source = _source->approximate(tolerance, owned);
+		return source == _source ? this : _own<inv_translate>(owned, source, _x, _y, _z);
+	}
+
 	void get_data(const vec3& pos, volume_data& data) const override {
 		const double xx = _x->get_value(pos);
 		const double yy = _y->get_value(pos);
@@ -220,7 +872,26 @@ public:
 		_source->get_data(pos - vec3(xx, yy, zz), data);
 	}
 
+	double get_value_and_data(const vec3& pos, volume_data& data) const override {
+		const double xx = _x->get_value(pos);
+		const double yy = _y->get_value(pos);
+		const double zz = _z->get_value(pos);
+		return _source->get_value_and_data(pos - vec3(xx, yy, zz), data);
+	}
+
 private:
+	// Where the source is evaluated for the positions in the box
+	aabb _get_source_box(const aabb& box) const {
+		const interval xx = _x->get_interval(box);
+		const interval yy = _y->get_interval(box);
+		const interval zz = _z->get_interval(box);
+		const vec3 min = box.get_min();
+		const vec3 max = box.get_max();
+		return aabb::create_from_min_max(
+			{min.x - xx.upper, min.y - yy.upper, min.z - zz.upper},
+			{max.x - xx.lower, max.y - yy.lower, max.z - zz.lower});
+	}
+
 	const volume* _source;
 	const volume* _x;
 	const volume* _y;
@@ -234,86 +905,387 @@ public:
 		_s(s) {
 	}
 
+	const volume* get_source() const {
+		return _source;
+	}
+
+	const volume* get_scale() const {
+		return _s;
+	}
+
 	double get_value(double x, double y, double z) const override {
 		const double s = _s->get_value(x, y, z);
 		return _source->get_value(x / s, y / s, z / s) * s;
 	}
 
+	void get_values(std::span<const vec3> positions, std::span<double> values) const override {
+		for_each_batch(positions, values, [this](std::span<const vec3> batch, std::span<double> batch_values) {
+			std::array<double, BatchSize> scales;
+			std::array<vec3, BatchSize> scaled;
+			const size_t count = batch.size();
+			_s->get_values(batch, std::span(scales).first(count));
+			for (size_t i = 0; i < count; ++i) {
+				const double s = scales[i];
+				scaled[i] = {batch[i].x / s, batch[i].y / s, batch[i].z / s};
+			}
+			_source->get_values(std::span(scaled).first(count), batch_values);
+			for (size_t i = 0; i < count; ++i) {
+				batch_values[i] *= scales[i];
+			}
+		});
+	}
+
+	double get_value_and_gradient(double x, double y, double z, vec3& gradient) const override {
+		vec3 scale_gradient, source_gradient;
+		const double s = _s->get_value_and_gradient(x, y, z, scale_gradient);
+		const double source_value = _source->get_value_and_gradient(x / s, y / s, z / s, source_gradient);
+		gradient = source_gradient + scale_gradient * (source_value - vec3{x, y, z}.dot(source_gradient) / s);
+		return source_value * s;
+	}
+
+	interval get_interval(const aabb& box) const override {
+		const interval s = _s->get_interval(box);
+		if (!(s.lower > 0)) {
+			return volume::get_interval(box);
+		}
+		return _source->get_interval(_get_source_box(box, s)) * s;
+	}
+
+	// From the gradient, source + scale * (source value - position . source gradient / s)
+	double get_lipschitz(const aabb& box) const override {
+		const interval s = _s->get_interval(box);
+		if (!(s.lower > 0)) {
+			return volume::get_lipschitz(box);
+		}
+		const aabb source_box = _get_source_box(box, s);
+		const double source_lipschitz = _source->get_lipschitz(source_box);
+		const double scale_lipschitz = _s->get_lipschitz(box);
+		if (scale_lipschitz == 0) {
+			return source_lipschitz;
+		}
+		const interval source_value = _source->get_interval(source_box);
+		const double magnitude = std::max(-source_value.lower, source_value.upper);
+		return source_lipschitz + scale_lipschitz * (magnitude + get_distance_interval(box).upper * source_lipschitz / s.lower);
+	}
+
+	const volume* specialize(const aabb& box, volume_unique_ptrs& owned) const override {
+		const interval s = _s->get_interval(box);
+		if (!(s.lower > 0)) {
+			return this;
+		}
+		const volume* source = _source->specialize(_get_source_box(box, s), owned);
+		const volume* scale = _s->specialize(box, owned);
+		return source == _source && scale == _s ? this : _own<inv_scale>(owned, source, scale);
+	}
+
+	// Only a constant scale, the values of the source are multiplied by it
+	const volume* approximate(double tolerance, volume_unique_ptrs& owned) const override {
+		const auto* c = dynamic_cast<const constant*>(_s);
+		if (!c || !(c->get_constant() != 0)) {
+			return this;
+		}
+		const volume* source = _source->approximate(tolerance / std::abs(c->get_constant()), owned);
+		return source == _source ? this : _own<inv_scale>(owned, source, _s);
+	}
+
 	void get_data(const vec3& pos, volume_data& data) const override {
 		const double s = _s->get_value(pos.x, pos.y, pos.z);
 		_source->get_data(pos * (1. / s), data);
 	}
 
 private:
+	// Where the source is evaluated for the positions in the box, for positive scales s
+	static aabb _get_source_box(const aabb& box, const interval& s) {
+		const interval inv_s{1. / s.upper, 1. / s.lower};
+		const vec3 min = box.get_min();
+		const vec3 max = box.get_max();
+		const interval x = interval(min.x, max.x) * inv_s;
+		const interval y = interval(min.y, max.y) * inv_s;
+		const interval z = interval(min.z, max.z) * inv_s;
+		return aabb::create_from_min_max({x.lower, y.lower, z.lower}, {x.upper, y.upper, z.upper});
+	}
+
 	const volume* _source;
 	const volume* _s;
 };
 
+// An inv_translate by constants, with the translation as a parameter instead of volumes
+class translate_constant : public volume {
+public:
+	translate_constant(const volume* source, const vec3& translation) : _source(source), _translation(translation) {
+	}
+
+	const volume* get_source() const {
+		return _source;
+	}
+
+	const vec3& get_translation() const {
+		return _translation;
+	}
+
+	double get_value(double x, double y, double z) const override {
+		return _source->get_value(x - _translation.x, y - _translation.y, z - _translation.z);
+	}
+
+	void get_values(std::span<const vec3> positions, std::span<double> values) const override {
+		for_each_batch(positions, values, [this](std::span<const vec3> batch, std::span<double> batch_values) {
+			std::array<vec3, BatchSize> translated;
+			for (size_t i = 0; i < batch.size(); ++i) {
+				translated[i] = {batch[i].x - _translation.x, batch[i].y - _translation.y, batch[i].z - _translation.z};
+			}
+			_source->get_values(std::span(translated).first(batch.size()), batch_values);
+		});
+	}
+
+	double get_value_and_gradient(double x, double y, double z, vec3& gradient) const override {
+		return _source->get_value_and_gradient(x - _translation.x, y - _translation.y, z - _translation.z, gradient);
+	}
+
+	interval get_interval(const aabb& box) const override {
+		return _source->get_interval(_get_source_box(box));
+	}
+
+	double get_lipschitz(const aabb& box) const override {
+		return _source->get_lipschitz(_get_source_box(box));
+	}
+
+	const volume* specialize(const aabb& box, volume_unique_ptrs& owned) const override {
+		const volume* source = _source->specialize(_get_source_box(box), owned);
+		return source == _source ? this : _own<translate_constant>(owned, source, _translation);
+	}
+
+	const volume* approximate(double tolerance, volume_unique_ptrs& owned) const override {
+		const volume* source = _source->approximate(tolerance, owned);
+		return source == _source ? this : _own<translate_constant>(owned, source, _translation);
+	}
+
+	void get_data(const vec3& pos, volume_data& data) const override {
+		_source->get_data(pos - _translation, data);
+	}
+
+	double get_value_and_data(const vec3& pos, volume_data& data) const override {
+		return _source->get_value_and_data(pos - _translation, data);
+	}
+
+private:
+	aabb _get_source_box(const aabb& box) const {
+		return aabb::create_from_min_max(box.get_min() - _translation, box.get_max() - _translation);
+	}
+
+	const volume* _source;
+	vec3 _translation;
+};
+
+// An inv_scale by a constant, with the scale as a parameter instead of a volume
+class scale_constant : public volume {
+public:
+	scale_constant(const volume* source, double s) : _source(source), _s(s) {
+	}
+
+	const volume* get_source() const {
+		return _source;
+	}
+
+	double get_scale() const {
+		return _s;
+	}
+
+	double get_value(double x, double y, double z) const override {
+		return _source->get_value(x / _s, y / _s, z / _s) * _s;
+	}
+
+	void get_values(std::span<const vec3> positions, std::span<double> values) const override {
+		for_each_batch(positions, values, [this](std::span<const vec3> batch, std::span<double> batch_values) {
+			std::array<vec3, BatchSize> scaled;
+			for (size_t i = 0; i < batch.size(); ++i) {
+				scaled[i] = {batch[i].x / _s, batch[i].y / _s, batch[i].z / _s};
+			}
+			_source->get_values(std::span(scaled).first(batch.size()), batch_values);
+			for (double& v : batch_values) {
+				v *= _s;
+			}
+		});
+	}
+
+	double get_value_and_gradient(double x, double y, double z, vec3& gradient) const override {
+		return _source->get_value_and_gradient(x / _s, y / _s, z / _s, gradient) * _s;
+	}
+
+	interval get_interval(const aabb& box) const override {
+		if (!(_s > 0)) {
+			return volume::get_interval(box);
+		}
+		return _source->get_interval(_get_source_box(box)) * _s;
+	}
+
+	// The scale of the positions and of the values cancel
+	double get_lipschitz(const aabb& box) const override {
+		if (!(_s > 0)) {
+			return volume::get_lipschitz(box);
+		}
+		return _source->get_lipschitz(_get_source_box(box));
+	}
+
+	const volume* specialize(const aabb& box, volume_unique_ptrs& owned) const override {
+		if (!(_s > 0)) {
+			return this;
+		}
+		const volume* source = _source->specialize(_get_source_box(box), owned);
+		return source == _source ? this : _own<scale_constant>(owned, source, _s);
+	}
+
+	const volume* approximate(double tolerance, volume_unique_ptrs& owned) const override {
+		if (!(_s != 0)) {
+			return this;
+		}
+		const volume* source = _source->approximate(tolerance / std::abs(_s), owned);
+		return source == _source ? this : _own<scale_constant>(owned, source, _s);
+	}
+
+	void get_data(const vec3& pos, volume_data& data) const override {
+		_source->get_data(pos * (1. / _s), data);
+	}
+
+private:
+	aabb _get_source_box(const aabb& box) const {
+		return aabb::create_from_min_max(box.get_min() * (1. / _s), box.get_max() * (1. / _s));
+	}
+
+	const volume* _source;
+	double _s;
+};
+
 ////////////////////////
 // DATA
 ////////////////////////
 
-template <typename T>
-class adaptive_edge_len_data : public volume {
+// Sets data on the way down, the values are the values of the source
+class data_volume : public volume {
 public:
-	adaptive_edge_len_data(const volume* source, const T& edge_len_calc) :
-		_source(source), _edge_len_calc(edge_len_calc) {
+	data_volume(const volume* source) : _source(source) {
+	}
+
+	const volume* get_source() const {
+		return _source;
 	}
 
 	double get_value(double x, double y, double z) const override {
 		return _source->get_value(x, y, z);
 	}
 
-	void get_data(const vec3& pos, volume_data& data) const override {
+	void get_values(std::span<const vec3> positions, std::span<double> values) const override {
+		_source->get_values(positions, values);
+	}
+
+	double get_value_and_gradient(double x, double y, double z, vec3& gradient) const override {
+		return _source->get_value_and_gradient(x, y, z, gradient);
+	}
+
+	interval get_interval(const aabb& box) const override {
+		return _source->get_interval(box);
+	}
+
+	double get_lipschitz(const aabb& box) const override {
+		return _source->get_lipschitz(box);
+	}
+
+	const volume* specialize(const aabb& box, volume_unique_ptrs& owned) const override {
+		return _with_owned_source(_source->specialize(box, owned), owned);
+	}
+
+	const volume* approximate(double tolerance, volume_unique_ptrs& owned) const override {
+		return _with_owned_source(_source->approximate(tolerance, owned), owned);
+	}
+
+	void get_data(const vec3& pos, volume_data& data) const final {
+		set_data(pos, data);
+		_source->get_data(pos, data);
+	}
+
+	double get_value_and_data(const vec3& pos, volume_data& data) const final {
+		set_data(pos, data);
+		return _source->get_value_and_data(pos, data);
+	}
+
+	// Sets the data of this volume only, before the source sets its data
+	virtual void set_data(const vec3& pos, volume_data& data) const = 0;
+
+	// The same data on another source, null for data volumes that can't be copied
+	virtual volume_unique_ptr with_source(const volume* source) const {
+		return nullptr;
+	}
+
+protected:
+	const volume* _source;
+
+private:
+	const volume* _with_owned_source(const volume* source, volume_unique_ptrs& owned) const {
+		if (source == _source) {
+			return this;
+		}
+		auto copy = with_source(source);
+		if (!copy) {
+			return this;
+		}
+		owned.push_back(std::move(copy));
+		return owned.back().get();
+	}
+};
+
+template <typename T>
+class adaptive_edge_len_data : public data_volume {
+public:
+	adaptive_edge_len_data(const volume* source, const T& edge_len_calc) :
+		data_volume(source), _edge_len_calc(edge_len_calc) {
+	}
+
+	void set_data(const vec3& pos, volume_data& data) const override {
 		data.edge_len = _edge_len_calc(pos);
-		return _source->get_data(pos, data);
+	}
+
+	volume_unique_ptr with_source(const volume* source) const override {
+		return std::make_unique<adaptive_edge_len_data>(source, _edge_len_calc);
 	}
 
 private:
-	const volume* _source;
 	T _edge_len_calc;
 };
 
 template <typename T>
-class set_default_data : public volume {
+class set_default_data : public data_volume {
 public:
 	set_default_data(const volume* source, T default_data) :
-		_source(source), _default_data(default_data) {
+		data_volume(source), _default_data(default_data) {
 	}
 
-	double get_value(double x, double y, double z) const override {
-		return _source->get_value(x, y, z);
+	void set_data(const vec3&, volume_data& data) const override {
+		data.set(_default_data);
 	}
 
-	void get_data(const vec3& pos, volume_data& data) const override {
-		data.custom_data = _default_data;
-		return _source->get_data(pos, data);
+	volume_unique_ptr with_source(const volume* source) const override {
+		return std::make_unique<set_default_data>(source, _default_data);
 	}
 
 private:
-	const volume* _source;
 	T _default_data;
 };
 
-class set_material_data : public volume {
+class set_material_data : public data_volume {
 public:
 	set_material_data(const volume* source, const material* material) :
-		_source(source),
+		data_volume(source),
 		_material(material) {
 	}
 
-	double get_value(double x, double y, double z) const override {
-		return _source->get_value(x, y, z);
+	void set_data(const vec3&, volume_data& data) const override {
+		data.get<game_volume_data>().mat = _material;
 	}
 
-	void get_data(const vec3& pos, volume_data& data) const override {
-		auto& game_data = std::any_cast<game_volume_data&>(data.custom_data);
-		game_data.mat = _material;
-		return _source->get_data(pos, data);
+	volume_unique_ptr with_source(const volume* source) const override {
+		return std::make_unique<set_material_data>(source, _material);
 	}
 
 private:
-	const volume* _source;
 	const material* _material;
 };
 }}
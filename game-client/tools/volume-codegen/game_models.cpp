@@ -0,0 +1,11 @@
+#include "volume_models.h"
+#include "client/example_models.h"
+
+namespace playchilla {
+const volume_models& get_volume_models() {
+	static const volume_models models{
+		{"planet", [](csg& csg) { return create_planet(csg, 100); }},
+	};
+	return models;
+}
+}
@@ -0,0 +1,37 @@
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "volume_models.h"
+#include "client/volume/volume_codegen.h"
+#include "core/util/file_util.h"
+
+// Writes a volume class for one of the models, see add_generated_volume in game-client/CMakeLists.txt
+// The seed must be the csg seed the model is created with at runtime, the generated volume checks it.
+int main(int argc, char** argv) {
+	using namespace playchilla;
+	if (argc != 5) {
+		std::cerr << "Usage: volume-codegen <model> <csg seed> <class name> <output header>\n";
+		return EXIT_FAILURE;
+	}
+	const std::string model = argv[1];
+	const auto it = get_volume_models().find(model);
+	if (it == get_volume_models().end()) {
+		std::cerr << "Unknown model: " << model << "\n";
+		return EXIT_FAILURE;
+	}
+	char* seed_end = nullptr;
+	const uint64_t seed = std::strtoull(argv[2], &seed_end, 10);
+	if (seed_end == argv[2] || *seed_end != '\0') {
+		std::cerr << "Invalid seed: " << argv[2] << "\n";
+		return EXIT_FAILURE;
+	}
+
+	csg csg(seed);
+	const volume* source = it->second(csg);
+	if (!file::write(argv[4], volumes::volume_codegen(source).generate(argv[3]))) {
+		std::cerr << "Failed to write: " << argv[4] << "\n";
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
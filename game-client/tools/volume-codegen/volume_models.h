@@ -0,0 +1,14 @@
+#pragma once
+
+#include <functional>
+#include <map>
+#include <string>
+
+#include "client/volume/csg.h"
+
+namespace playchilla {
+using volume_models = std::map<std::string, std::function<const volume*(csg&)>, std::less<>>;
+
+// The models a volume-codegen executable can generate, defined by the source it is built with
+const volume_models& get_volume_models();
+}
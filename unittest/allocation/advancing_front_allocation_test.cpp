@@ -0,0 +1,78 @@
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <new>
+
+#include "counting_allocator.h"
+#include "afront/advancing_front.h"
+#include "afront/test_models.h"
+#include "client/volume/csg.h"
+
+namespace playchilla {
+TEST(counting_allocator, CountsEveryForm) {
+	struct alignas(64) aligned {
+		double v;
+	};
+	const uint64_t before = test::get_allocation_count();
+	const int* one = new int(1);
+	const int* many = new int[3];
+	const int* no_throw = new (std::nothrow) int(2);
+	const aligned* one_aligned = new aligned{1};
+	const aligned* many_aligned = new aligned[2];
+	EXPECT_EQ(test::get_allocation_count() - before, 5);
+	// the pointers are used so that none of the allocations can be left out
+	for (const void* p : {static_cast<const void*>(one), static_cast<const void*>(many), static_cast<const void*>(no_throw)}) {
+		EXPECT_NE(p, nullptr);
+	}
+	EXPECT_EQ(reinterpret_cast<std::uintptr_t>(one_aligned) % alignof(aligned), 0);
+	EXPECT_EQ(reinterpret_cast<std::uintptr_t>(many_aligned) % alignof(aligned), 0);
+	delete one;
+	delete[] many;
+	delete no_throw;
+	delete one_aligned;
+	delete[] many_aligned;
+}
+
+/**
+ * Walks back and forth over the surface like an entity does, building within the creation radius and collapsing what is
+ * left behind. The first walk warms up the buffers and pools, returns the allocations and edges of the steps of the
+ * second walk.
+ */
+inline std::pair<uint64_t, uint64_t> count_walk_step_allocations(const volume* v, double edge_length, double creation_radius, const vec3& from, const vec3& to) {
+	advancing_front af(v, nullptr, edge_length, creation_radius);
+	auto& sm = af.get_surface_memory();
+	EXPECT_TRUE(af.try_find_surface(from));
+	constexpr int Stops = 20;
+	uint64_t allocations = 0;
+	uint64_t edges = 0;
+	for (int walk = 0; walk < 2; ++walk) {
+		for (int i = 0; i <= 2 * Stops; ++i) {
+			const double t = 1. - std::abs(static_cast<double>(i - Stops)) / Stops;
+			// along the arc between them
+			const vec3 pos = (from + (to - from) * t).normalize() * from.length();
+			const uint64_t before = test::get_allocation_count();
+			af.build_full_surface(pos);
+			if (walk == 1) {
+				allocations += test::get_allocation_count() - before;
+				edges += af.get_step_stats().edges;
+			}
+			sm.collapse_nodes_outside(pos, 1.2 * creation_radius);
+			sm.delete_removed();
+		}
+	}
+	sm.validate();
+	EXPECT_GT(edges, 1000);
+	return std::pair{allocations, edges};
+}
+
+TEST(advancing_front, NoStepAllocations) {
+	csg csg(12345);
+	const auto [sphere_allocations, sphere_edges] = count_walk_step_allocations(csg.sphere(10), .5, 5, {10, 0, 0}, {0, 10, 0});
+	EXPECT_EQ(sphere_allocations, 0);
+
+	// a few nodes of the rough surface get more than eight edges, and node cells can outgrow the room left in their slot
+	const auto [planet_allocations, planet_edges] = count_walk_step_allocations(test::create_noisy_planet(csg, 100), 1, 15, {50, 0, 0}, {0, 0, 50});
+	std::cout << "planet: " << planet_allocations << " allocations in " << planet_edges << " edges\n";
+	EXPECT_LT(1000 * planet_allocations, planet_edges);
+}
+}
@@ -0,0 +1,134 @@
+#include "counting_allocator.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// Replaces every form of operator new and delete to count the allocations. This is why the allocation tests have an
+// executable of their own, the other tests keep the allocator of the standard library.
+namespace {
+std::atomic<uint64_t> allocation_count = 0;
+
+void* allocate(std::size_t size) noexcept {
+	allocation_count.fetch_add(1, std::memory_order_relaxed);
+	return std::malloc(std::max<std::size_t>(size, 1));
+}
+
+void* allocate(std::size_t size, std::align_val_t alignment) noexcept {
+	allocation_count.fetch_add(1, std::memory_order_relaxed);
+	const auto align = static_cast<std::size_t>(alignment);
+	const std::size_t rounded = (std::max<std::size_t>(size, 1) + align - 1) / align * align;
+#ifdef _MSC_VER
+	return _aligned_malloc(rounded, align);
+#else
+	return std::aligned_alloc(align, rounded);
+#endif
+}
+
+void deallocate(void* p) noexcept {
+	std::free(p);
+}
+
+void deallocate(void* p, std::align_val_t) noexcept {
+#ifdef _MSC_VER
+	_aligned_free(p);
+#else
+	std::free(p);
+#endif
+}
+
+template <typename... Args>
+void* allocate_or_throw(Args... args) {
+	if (void* p = allocate(args...)) {
+		return p;
+	}
+	throw std::bad_alloc();
+}
+}
+
+namespace playchilla::test {
+uint64_t get_allocation_count() {
+	return allocation_count.load(std::memory_order_relaxed);
+}
+}
+
+void* operator new(std::size_t size) {
+	return allocate_or_throw(size);
+}
+
+void* operator new[](std::size_t size) {
+	return allocate_or_throw(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+	return allocate(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+	return allocate(size);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment) {
+	return allocate_or_throw(size, alignment);
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment) {
+	return allocate_or_throw(size, alignment);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+	return allocate(size, alignment);
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+	return allocate(size, alignment);
+}
+
+void operator delete(void* p) noexcept {
+	deallocate(p);
+}
+
+void operator delete[](void* p) noexcept {
+	deallocate(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+	deallocate(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept {
+	deallocate(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+	deallocate(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+	deallocate(p);
+}
+
+void operator delete(void* p, std::align_val_t alignment) noexcept {
+	deallocate(p, alignment);
+}
+
+void operator delete[](void* p, std::align_val_t alignment) noexcept {
+	deallocate(p, alignment);
+}
+
+void operator delete(void* p, std::size_t, std::align_val_t alignment) noexcept {
+	deallocate(p, alignment);
+}
+
+void operator delete[](void* p, std::size_t, std::align_val_t alignment) noexcept {
+	deallocate(p, alignment);
+}
+
+void operator delete(void* p, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+	deallocate(p, alignment);
+}
+
+void operator delete[](void* p, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+	deallocate(p, alignment);
+}
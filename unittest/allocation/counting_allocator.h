@@ -0,0 +1,8 @@
+#pragma once
+
+#include <cstdint>
+
+namespace playchilla::test {
+// The allocations made through any form of operator new since the executable started
+uint64_t get_allocation_count();
+}
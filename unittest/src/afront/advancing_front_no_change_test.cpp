@@ -1,10 +1,14 @@
 #include <gtest/gtest.h>
 
+#include <thread>
+
 #include "mesh_inspector.h"
 #include "afront/advancing_front.h"
 #include "afront/mesh_builder.h"
 #include "client/volume/csg.h"
 #include "core/util/timer.h"
+#include "generated/test_sphere.h"
+#include "generated/test_sphere_tunnel.h"
 #include "test_models.h"
 
 
@@ -163,6 +167,171 @@ TEST(advancing_front_no_change, Noise5) {
 	af.get_surface_memory().validate();
 }
 
+TEST(advancing_front_no_change, SphereWorkers) {
+	csg csg(12345);
+
+	debug_mesh_builder mb;
+	advancing_front af(csg.sphere(10), &mb, .5, 100);
+	af.use_workers(4);
+
+	EXPECT_TRUE(af.try_find_surface(vec3(1, 0, 0)));
+	af.build_full_surface(vec3d::zero);
+	EXPECT_EQ(mb.hash, 17961521605756299668ull);
+	EXPECT_EQ(mb.failed_follows, 0);
+	EXPECT_EQ(mb.triangles.size(), 8222);
+	af.get_surface_memory().delete_removed();
+	af.get_surface_memory().validate();
+}
+
+TEST(advancing_front_no_change, SphereStepWithin) {
+	csg csg(12345);
+
+	debug_mesh_builder mb;
+	advancing_front af(csg.sphere(10), &mb, .5, 100);
+	af.count_evaluations();
+
+	EXPECT_TRUE(af.try_find_surface(vec3(1, 0, 0)));
+	int triangles = 0;
+	uint64_t evaluations = 0;
+	while (true) {
+		const auto& stats = af.step_within(vec3d::zero, 0.5);
+		if (stats.edges == 0) {
+			break;
+		}
+		triangles += stats.triangles;
+		evaluations += stats.evaluations;
+	}
+	EXPECT_EQ(mb.hash, 17961521605756299668ull);
+	EXPECT_EQ(mb.failed_follows, 0);
+	EXPECT_EQ(mb.triangles.size(), 8222);
+	EXPECT_EQ(triangles, 8222);
+	EXPECT_GT(evaluations, 8222);
+	af.get_surface_memory().delete_removed();
+	af.get_surface_memory().validate();
+}
+
+TEST(advancing_front_no_change, CompositionWorkers) {
+	debug_mesh_builder mb;
+	csg csg(12345);
+	advancing_front af(test::create_sphere_tunnel(csg, 20), &mb, 3, 100);
+	af.use_workers(3);
+
+	EXPECT_TRUE(af.try_find_surface({0.1, -0.2, 0.3}));
+	af.build_full_surface(vec3d::zero);
+	EXPECT_EQ(mb.hash, 942349903305627741ull);
+	EXPECT_EQ(mb.failed_follows, 2);
+	EXPECT_EQ(mb.triangles.size(), 877);
+	af.get_surface_memory().delete_removed();
+	af.get_surface_memory().validate();
+}
+
+TEST(advancing_front_no_change, CompositionCompiled) {
+	debug_mesh_builder mb;
+	csg csg(12345);
+	advancing_front af(csg.compile(test::create_sphere_tunnel(csg, 20)), &mb, 3, 100);
+
+	EXPECT_TRUE(af.try_find_surface({0.1, -0.2, 0.3}));
+	af.build_full_surface(vec3d::zero);
+	EXPECT_EQ(mb.hash, 942349903305627741ull);
+	EXPECT_EQ(mb.failed_follows, 2);
+	EXPECT_EQ(mb.triangles.size(), 877);
+	af.get_surface_memory().delete_removed();
+	af.get_surface_memory().validate();
+}
+
+TEST(advancing_front_no_change, SphereGenerated) {
+	csg csg(12345);
+
+	debug_mesh_builder mb;
+	advancing_front af(csg.create<generated::test_sphere>(csg.sphere(10)), &mb, .5, 100);
+
+	EXPECT_TRUE(af.try_find_surface(vec3(1, 0, 0)));
+	while (af.step(vec3d::zero, 1)) {
+	}
+	EXPECT_EQ(mb.hash, 17961521605756299668ull);
+	EXPECT_EQ(mb.failed_follows, 0);
+	EXPECT_EQ(mb.triangles.size(), 8222);
+	af.get_surface_memory().delete_removed();
+	af.get_surface_memory().validate();
+}
+
+TEST(advancing_front_no_change, CompositionGenerated) {
+	debug_mesh_builder mb;
+	csg csg(12345);
+	advancing_front af(csg.create<generated::test_sphere_tunnel>(test::create_sphere_tunnel(csg, 20)), &mb, 3, 100);
+
+	EXPECT_TRUE(af.try_find_surface({0.1, -0.2, 0.3}));
+	while (af.step(vec3d::zero, 1)) {
+	}
+	EXPECT_EQ(mb.hash, 942349903305627741ull);
+	EXPECT_EQ(mb.failed_follows, 2);
+	EXPECT_EQ(mb.triangles.size(), 877);
+	af.get_surface_memory().delete_removed();
+	af.get_surface_memory().validate();
+}
+
+TEST(advancing_front_no_change, CompositionTiled) {
+	debug_mesh_builder mb;
+	csg csg(12345);
+	advancing_front af(test::create_sphere_tunnel(csg, 20), &mb, 3, 100);
+	af.use_tiles(8);
+
+	EXPECT_TRUE(af.try_find_surface({0.1, -0.2, 0.3}));
+	af.build_full_surface(vec3d::zero);
+	EXPECT_EQ(mb.hash, 942349903305627741ull);
+	EXPECT_EQ(mb.failed_follows, 2);
+	EXPECT_EQ(mb.triangles.size(), 877);
+	af.get_surface_memory().delete_removed();
+	af.get_surface_memory().validate();
+}
+
+TEST(advancing_front_no_change, CompositionOptimized) {
+	debug_mesh_builder mb;
+	csg csg(12345);
+	advancing_front af(csg.compile(csg.optimize(test::create_sphere_tunnel(csg, 20))), &mb, 3, 100);
+
+	EXPECT_TRUE(af.try_find_surface({0.1, -0.2, 0.3}));
+	af.build_full_surface(vec3d::zero);
+	EXPECT_EQ(mb.hash, 942349903305627741ull);
+	EXPECT_EQ(mb.failed_follows, 2);
+	EXPECT_EQ(mb.triangles.size(), 877);
+	af.get_surface_memory().delete_removed();
+	af.get_surface_memory().validate();
+}
+
+struct build_result {
+	uint64_t hash;
+	uint64_t failed_follows;
+	size_t triangles;
+};
+
+inline build_result build_with_workers(const volume* volume, double edge_len, double radius, size_t workers) {
+	debug_mesh_builder mb;
+	advancing_front af(volume, &mb, edge_len, radius);
+	af.use_workers(workers);
+	EXPECT_TRUE(af.try_find_surface(vec3(1, 0, 0)));
+	af.build_full_surface(vec3d::zero);
+	af.get_surface_memory().delete_removed();
+	af.get_surface_memory().validate();
+	return {mb.hash, mb.failed_follows, mb.triangles.size()};
+}
+
+TEST(advancing_front_no_change, WorkerCountIndependent) {
+	csg csg(12345);
+	const auto* noise = csg.noise(5).get();
+	const auto* planet = test::create_noisy_planet(csg, 100);
+
+	for (const auto& [v, edge_len, radius] : {std::tuple{noise, 3., 25.}, std::tuple{planet, 3., 40.}}) {
+		const auto expected = build_with_workers(v, edge_len, radius, 1);
+		for (size_t workers : {2, 3, 8}) {
+			const auto result = build_with_workers(v, edge_len, radius, workers);
+			EXPECT_EQ(result.hash, expected.hash);
+			EXPECT_EQ(result.failed_follows, expected.failed_follows);
+			EXPECT_EQ(result.triangles, expected.triangles);
+		}
+	}
+}
+
 inline long long time_scenario(const std::string& name, const volume* volume, double edgeLen, double radius) {
 	debug_mesh_builder mb;
 	advancing_front af(volume, &mb, edgeLen, radius);
@@ -171,9 +340,10 @@ inline long long time_scenario(const std::string& name, const volume* volume, do
 	while (af.step(vec3d::zero, 1)) {
 	}
 	const auto ms = t.millie_seconds();
-	std::cout << name << ": " << ms << " ms\n";
 	af.get_surface_memory().delete_removed();
 	af.get_surface_memory().validate();
+	const auto bytes_per_triangle = static_cast<double>(af.get_surface_memory().get_allocated_bytes()) / static_cast<double>(std::max<size_t>(1, mb.triangles.size()));
+	std::cout << name << ": " << ms << " ms, " << bytes_per_triangle << " bytes/triangle\n";
 	return ms;
 }
 
@@ -198,5 +368,26 @@ TEST(advancing_front_no_change, Performance) {
 	// release: 18092ms 2021-10-01
 	// release: 17685ms 2021-10-01  getValue(x,y,z) instead of getValue(const Vec3&)
 }
+
+inline long long time_workers(const volume* volume, double edge_len, double radius, size_t workers) {
+	debug_mesh_builder mb;
+	advancing_front af(volume, &mb, edge_len, radius);
+	af.use_workers(workers);
+	const timer t;
+	EXPECT_TRUE(af.try_find_surface(vec3(0.41, 0.01, -0.23)));
+	af.build_full_surface(vec3d::zero);
+	const auto ms = t.millie_seconds();
+	std::cout << workers << " workers: " << ms << " ms\n";
+	return ms;
+}
+
+TEST(advancing_front_no_change, WorkerSpeedup) {
+	csg csg(12345);
+	const auto* planet = test::create_noisy_planet(csg, 100);
+	const auto workers = std::max(1u, std::thread::hardware_concurrency());
+	const auto serial = time_workers(planet, 1., 150, 1);
+	const auto parallel = time_workers(planet, 1., 150, workers);
+	std::cout << "speedup: " << static_cast<double>(serial) / static_cast<double>(std::max(1ll, parallel)) << "x\n";
+}
 #endif
 }
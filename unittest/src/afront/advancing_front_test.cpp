@@ -1,8 +1,10 @@
 #include <gtest/gtest.h>
 
 #include "afront/advancing_front.h"
+#include "afront/counting_volume.h"
 #include "client/volume/csg.h"
-
+#include "core/util/timer.h"
+#include "test_models.h"
 
 namespace playchilla {
 TEST(advancing_front, SphereTest) {
@@ -52,4 +54,188 @@ TEST(advancing_front, SphereTest) {
 	EXPECT_EQ(nh.get_values(vec3d::zero, 9.9).size(), 0);
 	EXPECT_GT(nh.get_values(vec3d::zero, 10.1).size(), 1000);
 }
+
+TEST(advancing_front, ParkedEdgesWakeUp) {
+	csg csg(12345);
+	advancing_front af(csg.sphere(10), nullptr, 1, 12);
+	auto& sm = af.get_surface_memory();
+	EXPECT_TRUE(af.try_find_surface(vec3(1, 0, 0)));
+
+	af.build_full_surface({10, 0, 0});
+	const size_t half_nodes = sm.get_node_count();
+	EXPECT_GT(sm.get_front().get_dormant_count(), 0);
+	EXPECT_EQ(sm.pop_edge(), nullptr);
+
+	// every point on the sphere is within reach of one of the axes, visit them until nothing more is built
+	size_t node_count = 0;
+	while (node_count != sm.get_node_count()) {
+		node_count = sm.get_node_count();
+		for (const auto& pos : {vec3(-10, 0, 0), vec3(0, 10, 0), vec3(0, -10, 0), vec3(0, 0, 10), vec3(0, 0, -10), vec3(10, 0, 0)}) {
+			af.build_full_surface(pos);
+		}
+	}
+	EXPECT_GT(sm.get_node_count(), 2 * half_nodes);
+	EXPECT_EQ(sm.get_front().get_dormant_count(), 0);
+	EXPECT_FALSE(af.step(vec3d::zero, 1));
+	sm.validate();
+}
+
+TEST(advancing_front, PrioritizeNear) {
+	csg csg(12345);
+	advancing_front af(csg.sphere(10), nullptr, 1, 100);
+	af.prioritize_near();
+	auto& sm = af.get_surface_memory();
+	EXPECT_TRUE(af.try_find_surface(vec3(1, 0, 0)));
+	EXPECT_TRUE(sm.get_front().is_prioritized());
+
+	af.build_full_surface(vec3d::zero);
+	EXPECT_GT(sm.get_node_count(), 900);
+	EXPECT_FALSE(af.step(vec3d::zero, 1));
+	sm.validate();
+}
+
+TEST(advancing_front, StepWithin) {
+	csg csg(12345);
+	const volume* sphere = csg.sphere(10).get();
+	advancing_front af(sphere, nullptr, 1, 100);
+	af.count_evaluations();
+	EXPECT_TRUE(af.try_find_surface(vec3(1, 0, 0)));
+
+	// a budget too small for any edge still makes progress, one edge at a time
+	const auto& stats = af.step_within(vec3d::zero, 1e-9);
+	EXPECT_EQ(stats.edges, 1);
+	EXPECT_EQ(stats.triangles, 1);
+	EXPECT_GT(stats.evaluations, 0);
+	EXPECT_GT(stats.nano_seconds, 0);
+	EXPECT_EQ(&stats, &af.get_step_stats());
+
+	EXPECT_TRUE(af.step(vec3d::zero, 10));
+	EXPECT_EQ(af.get_step_stats().edges, 10);
+	EXPECT_EQ(af.get_volume(), sphere);
+
+	// parking is within the budget too
+	const vec3 far(1000, 0, 0);
+	EXPECT_EQ(af.step_within(far, 1e-9).parked_edges, 1);
+	EXPECT_EQ(af.get_step_stats().edges, 0);
+	EXPECT_GT(af.step_within(far, 1000).parked_edges, 1);
+}
+
+TEST(advancing_front, UseGradients) {
+	csg csg(12345);
+	const auto build = [](const volume* v, double edge_len, bool use_gradients) {
+		advancing_front af(v, nullptr, edge_len, 100);
+		af.count_evaluations();
+		if (use_gradients) {
+			af.use_gradients();
+		}
+		EXPECT_TRUE(af.try_find_surface({0.1, -0.2, 0.3}));
+		uint64_t evaluations = 0;
+		while (af.step(vec3d::zero, 100)) {
+			evaluations += af.get_step_stats().evaluations;
+		}
+		af.get_surface_memory().validate();
+		return std::pair{af.get_surface_memory().get_node_count(), evaluations};
+	};
+
+	for (const auto& [v, edge_len] : {std::pair{csg.sphere(10).get(), .5}, std::pair{test::create_sphere_tunnel(csg, 20), 3.}}) {
+		const auto [differences_nodes, differences_evaluations] = build(v, edge_len, false);
+		const auto [gradients_nodes, gradients_evaluations] = build(v, edge_len, true);
+		EXPECT_NEAR(static_cast<double>(gradients_nodes), static_cast<double>(differences_nodes), 0.1 * differences_nodes);
+		EXPECT_LT(3 * gradients_evaluations, differences_evaluations);
+	}
+}
+
+TEST(advancing_front, ValueTolerance) {
+	csg csg(12345);
+	const volume* planet = test::create_noisy_planet(csg, 100);
+	const auto build = [planet](double edge_fraction) {
+		advancing_front af(planet, nullptr, 3, 60);
+		af.use_value_tolerance(edge_fraction);
+		EXPECT_TRUE(af.try_find_surface({50, 0, 0}));
+		const timer t;
+		af.build_full_surface(vec3d::zero);
+		std::cout << "value tolerance " << edge_fraction << ": " << t.millie_seconds() << " ms\n";
+		af.get_surface_memory().validate();
+		double max_value = 0;
+		const auto nodes = af.get_surface_memory().get_nodes(vec3d::zero, 100);
+		for (const node* n : nodes) {
+			max_value = std::max(max_value, std::abs(planet->get_value(n->get_pos())));
+		}
+		return std::pair{static_cast<double>(nodes.size()), max_value};
+	};
+
+	// the surface is as far off as the tolerance lets the values be
+	const auto [exact_nodes, exact_max_value] = build(0);
+	const auto [nodes, max_value] = build(.3);
+	EXPECT_NEAR(nodes, exact_nodes, 0.1 * exact_nodes);
+	EXPECT_LE(max_value, exact_max_value + .3 * 3);
+}
+
+TEST(advancing_front, SurfaceProjection) {
+	csg csg(12345);
+	const volume* sphere = csg.sphere(10);
+	const auto build = [sphere](bool project) {
+		advancing_front af(sphere, nullptr, .5, 30);
+		af.count_evaluations();
+		if (project) {
+			af.use_surface_projection();
+		}
+		EXPECT_TRUE(af.try_find_surface({10, 0, 0}));
+		af.build_full_surface(vec3d::zero);
+		af.get_surface_memory().validate();
+		double max_value = 0;
+		const auto nodes = af.get_surface_memory().get_nodes(vec3d::zero, 20);
+		for (const node* n : nodes) {
+			max_value = std::max(max_value, std::abs(sphere->get_value(n->get_pos())));
+		}
+		std::cout << (project ? "projected: " : "stepped: ") << af.get_step_stats().evaluations << " evaluations\n";
+		return std::tuple{af.get_step_stats().triangles, af.get_step_stats().evaluations, max_value};
+	};
+
+	// about the same mesh with fewer evaluations, and the nodes closer to the surface than a step
+	const auto [stepped_triangles, stepped_evaluations, stepped_max_value] = build(false);
+	const auto [triangles, evaluations, max_value] = build(true);
+	EXPECT_NEAR(triangles, stepped_triangles, 0.05 * stepped_triangles);
+	EXPECT_LT(evaluations, stepped_evaluations);
+	EXPECT_LT(max_value, stepped_max_value);
+}
+
+TEST(advancing_front, DataOnlyForTriangles) {
+	csg csg(12345);
+	counting_volume sphere(csg.sphere(10).data_type(1).get());
+	advancing_front af(&sphere, nullptr, 1, 30);
+	af.ignore_resolution();
+	EXPECT_TRUE(af.try_find_surface({10, 0, 0}));
+	const uint64_t data_before = sphere.get_data_count();
+	af.build_full_surface(vec3d::zero);
+	af.get_surface_memory().validate();
+
+	// without resolution the data is only looked up for the triangles
+	EXPECT_GT(af.get_step_stats().triangles, 0);
+	EXPECT_EQ(sphere.get_data_count() - data_before, af.get_step_stats().triangles);
+}
+
+TEST(advancing_front, SeedSurfaces) {
+	csg csg(12345);
+	const volume* spheres = csg.unions({csg.sphere(5).translate({10, 0, 0}), csg.sphere(5).translate({-10, 0, 0})}).get();
+	advancing_front af(spheres, nullptr, 1, 30);
+	EXPECT_TRUE(af.need_seed());
+	EXPECT_EQ(af.seed_surfaces(vec3d::zero), 2);
+	af.build_full_surface(vec3d::zero);
+	af.get_surface_memory().validate();
+	EXPECT_EQ(af.seed_surfaces(vec3d::zero), 0);
+
+	// both spheres are covered, about as many nodes as one sphere built on its own twice
+	advancing_front single(csg.sphere(5), nullptr, 1, 30);
+	EXPECT_EQ(single.seed_surfaces(vec3d::zero), 1);
+	single.build_full_surface(vec3d::zero);
+	const auto single_nodes = static_cast<double>(single.get_surface_memory().get_node_count());
+	EXPECT_NEAR(static_cast<double>(af.get_surface_memory().get_node_count()), 2 * single_nodes, 0.1 * single_nodes);
+	EXPECT_FALSE(af.get_surface_memory().get_nodes({10, 0, 0}, 6).empty());
+	EXPECT_FALSE(af.get_surface_memory().get_nodes({-10, 0, 0}, 6).empty());
+
+	// nothing within the creation radius
+	advancing_front far(spheres, nullptr, 1, 3);
+	EXPECT_EQ(far.seed_surfaces({0, 20, 0}), 0);
+}
 }
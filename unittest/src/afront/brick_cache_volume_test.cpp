@@ -0,0 +1,155 @@
+#include "afront/brick_cache_volume.h"
+
+#include <gtest/gtest.h>
+
+#include <thread>
+
+#include "afront/advancing_front.h"
+#include "afront/counting_volume.h"
+#include "client/volume/csg.h"
+#include "core/util/conversion.h"
+#include "test_models.h"
+
+namespace playchilla {
+TEST(brick_cache_volume, InterpolatesWithinTolerance) {
+	csg csg(12345);
+	const volume* sphere = csg.sphere(10);
+	const brick_cache_volume cache(sphere, .25, 1e-2);
+	mx3::random r(123);
+	std::vector<vec3> positions;
+	for (int i = 0; i < 10000; ++i) {
+		positions.push_back(vec3d::create_random_dir(r) * r.between(9., 11.));
+	}
+	for (int pass = 0; pass < 2; ++pass) {
+		for (const auto& pos : positions) {
+			EXPECT_NEAR(cache.get_value(pos), sphere->get_value(pos), 1e-2) << pos;
+		}
+	}
+	const auto stats = cache.get_stats();
+	EXPECT_EQ(stats.bypasses, 0);
+	EXPECT_EQ(stats.fills, cache.get_brick_count());
+	EXPECT_GT(cache.get_hit_rate(), 0.8);
+
+	std::vector<double> values(positions.size());
+	cache.get_values(positions, values);
+	for (size_t i = 0; i < positions.size(); ++i) {
+		EXPECT_EQ(values[i], cache.get_value(positions[i]));
+	}
+}
+
+TEST(brick_cache_volume, BypassesOverTolerance) {
+	csg csg(12345);
+	const volume* noise = csg.noise(1);
+	const brick_cache_volume cache(noise, .5, 0);
+	mx3::random r(123);
+	for (int i = 0; i < 1000; ++i) {
+		const vec3 pos(r.between(-5., 5.), r.between(-5., 5.), r.between(-5., 5.));
+		EXPECT_EQ(util::bits_to<uint64_t>(cache.get_value(pos)), util::bits_to<uint64_t>(noise->get_value(pos))) << pos;
+	}
+	EXPECT_EQ(cache.get_stats().bypasses, 1000);
+	EXPECT_EQ(cache.get_hit_rate(), 0);
+}
+
+TEST(brick_cache_volume, SameFromThreads) {
+	csg csg(12345);
+	const volume* source = csg.add_values({csg.sphere(10), csg.noise(2).mul_value(0.1)});
+	const brick_cache_volume serial(source, .25, 1e-3);
+	const brick_cache_volume shared(source, .25, 1e-3, 64);
+	mx3::random r(123);
+	std::vector<vec3> positions;
+	std::vector<double> expected;
+	for (int i = 0; i < 2000; ++i) {
+		positions.push_back(vec3d::create_random_dir(r) * r.between(9., 11.));
+		expected.push_back(serial.get_value(positions.back()));
+	}
+
+	std::vector<std::thread> threads;
+	std::vector<size_t> mismatches(4);
+	for (size_t t = 0; t < mismatches.size(); ++t) {
+		threads.emplace_back([&, t] {
+			for (size_t i = 0; i < positions.size(); ++i) {
+				const size_t j = (i + t * 500) % positions.size();
+				mismatches[t] += shared.get_value(positions[j]) != expected[j];
+			}
+		});
+	}
+	for (auto& thread : threads) {
+		thread.join();
+	}
+	for (const size_t m : mismatches) {
+		EXPECT_EQ(m, 0);
+	}
+	EXPECT_LE(shared.get_brick_count(), 64);
+	EXPECT_GT(shared.get_stats().evictions, 0);
+}
+
+TEST(brick_cache_volume, EvictsLeastRecentlyUsed) {
+	csg csg(12345);
+	const brick_cache_volume cache(csg.sphere(10), 1, 1, 8);
+	const auto brick_pos = [](int i) {
+		return vec3(i * brick_cache_volume::BrickCells + .5, .5, .5);
+	};
+	for (int i = 0; i < 8; ++i) {
+		cache.get_value(brick_pos(i));
+	}
+	EXPECT_EQ(cache.get_brick_count(), 8);
+
+	// Touch the first so that the second is the oldest
+	cache.get_value(brick_pos(0));
+	cache.get_value(brick_pos(8));
+	EXPECT_EQ(cache.get_stats().evictions, 2);
+	EXPECT_EQ(cache.get_brick_count(), 7);
+
+	const auto fills = cache.get_stats().fills;
+	cache.get_value(brick_pos(0));
+	cache.get_value(brick_pos(3));
+	EXPECT_EQ(cache.get_stats().fills, fills);
+	cache.get_value(brick_pos(1));
+	EXPECT_EQ(cache.get_stats().fills, fills + 1);
+}
+
+TEST(brick_cache_volume, BoundsSurfaceDeviation) {
+	csg csg(12345);
+	const volume* planet = test::create_noisy_planet(csg, 100);
+	constexpr double edge_len = 1;
+	constexpr double tolerance = 0.05 * edge_len;
+	const counting_volume counting(planet);
+	const brick_cache_volume cache(&counting, 0.25 * edge_len, tolerance);
+
+	// The largest and mean distance from the surface of the planet to the nodes of a patch of it
+	struct patch {
+		size_t nodes = 0;
+		double max_deviation = 0;
+		double mean_deviation = 0;
+	};
+	const auto build = [planet](const volume* v) {
+		advancing_front af(v, nullptr, edge_len, 15);
+		const vec3 generate_pos(50, 0, 0);
+		EXPECT_TRUE(af.try_find_surface(generate_pos));
+		while (af.step(generate_pos, 100)) {
+		}
+		af.get_surface_memory().validate();
+		patch p;
+		const auto nodes = af.get_surface_memory().get_nodes(generate_pos, 100);
+		for (const node* n : nodes) {
+			const double deviation = std::abs(planet->get_value(n->pos));
+			p.max_deviation = std::max(p.max_deviation, deviation);
+			p.mean_deviation += deviation;
+		}
+		p.nodes = nodes.size();
+		p.mean_deviation /= static_cast<double>(p.nodes);
+		return p;
+	};
+
+	const auto uncached = build(planet);
+	const auto cached = build(&cache);
+	std::cout << "nodes: " << uncached.nodes << " cached: " << cached.nodes <<
+		", max deviation: " << uncached.max_deviation << " cached: " << cached.max_deviation <<
+		", mean deviation: " << uncached.mean_deviation << " cached: " << cached.mean_deviation <<
+		", hit rate: " << cache.get_hit_rate() << ", source evaluations: " << counting.get_value_count() << "\n";
+	EXPECT_NEAR(static_cast<double>(cached.nodes), static_cast<double>(uncached.nodes), 0.1 * uncached.nodes);
+	EXPECT_LE(cached.max_deviation, uncached.max_deviation + tolerance);
+	EXPECT_LE(cached.mean_deviation, uncached.mean_deviation + tolerance);
+	EXPECT_GT(cache.get_hit_rate(), 0.75);
+}
+}
@@ -0,0 +1,198 @@
+#include <gtest/gtest.h>
+
+#include "afront/edge_front.h"
+#include "afront/node.h"
+
+namespace playchilla {
+struct edge_front_fixture {
+	edge* add(const vec3& pos) {
+		nodes.push_back(std::make_unique<node>(pos, vec3d::Y));
+		nodes.push_back(std::make_unique<node>(pos + vec3(0.5, 0, 0), vec3d::Y));
+		return edges.create(nodes[nodes.size() - 2].get(), nodes.back().get());
+	}
+
+	std::vector<std::unique_ptr<node>> nodes;
+	object_pool<edge> edges;
+};
+
+TEST(edge_front, Empty) {
+	edge_front_fixture f;
+	edge_front front(f.edges, 10);
+	EXPECT_TRUE(front.empty());
+	EXPECT_EQ(front.size(), 0);
+	EXPECT_EQ(front.pop(), nullptr);
+}
+
+TEST(edge_front, FirstInFirstOut) {
+	edge_front_fixture f;
+	edge_front front(f.edges, 10);
+	edge* a = f.add({5, 0, 0});
+	edge* b = f.add({1, 0, 0});
+	front.push(a);
+	front.push(b);
+	EXPECT_EQ(front.size(), 2);
+	EXPECT_EQ(f.edges.get(front.front()), a);
+	EXPECT_EQ(front.pop(), a);
+	EXPECT_EQ(front.pop(), b);
+	EXPECT_EQ(front.pop(), nullptr);
+}
+
+TEST(edge_front, ParkAndWake) {
+	edge_front_fixture f;
+	edge_front front(f.edges, 10);
+	edge* near = f.add({5, 0, 0});
+	edge* far = f.add({100, 0, 0});
+	edge* farther = f.add({200, 0, 0});
+	front.park(near);
+	front.park(far);
+	front.park(farther);
+	EXPECT_FALSE(front.empty());
+	EXPECT_EQ(front.size(), 0);
+	EXPECT_EQ(front.get_dormant_count(), 3);
+	EXPECT_EQ(front.get_dormant_cell_count(), 3);
+
+	front.focus(vec3d::zero, 20);
+	EXPECT_EQ(front.get_dormant_count(), 2);
+	EXPECT_EQ(front.pop(), near);
+	EXPECT_EQ(front.pop(), nullptr);
+
+	// only the part of a cell that is within reach wakes up
+	edge* close_to_far = f.add({105, 0, 0});
+	front.park(close_to_far);
+	front.focus({95, 0, 0}, 8);
+	EXPECT_EQ(front.get_dormant_count(), 2);
+	EXPECT_EQ(front.pop(), far);
+	EXPECT_EQ(front.pop(), nullptr);
+
+	front.focus({195, 0, 0}, 1000);
+	EXPECT_EQ(front.get_dormant_count(), 0);
+	EXPECT_EQ(front.get_dormant_cell_count(), 0);
+	EXPECT_EQ(front.size(), 2);
+	EXPECT_TRUE(!front.empty());
+}
+
+TEST(edge_front, DropDeletedDormant) {
+	edge_front_fixture f;
+	edge_front front(f.edges, 10);
+	edge* a = f.add({100, 0, 0});
+	edge* b = f.add({200, 0, 0});
+	front.park(a);
+	front.park(b);
+	f.edges.destroy(a);
+	front.on_deleted(1);
+	EXPECT_EQ(front.get_dormant_count(), 1);
+	EXPECT_EQ(front.get_dormant_cell_count(), 1);
+
+	front.focus({200, 0, 0}, 5);
+	EXPECT_EQ(front.pop(), b);
+	EXPECT_TRUE(front.empty());
+}
+
+TEST(edge_front, PrioritizeNear) {
+	edge_front_fixture f;
+	edge_front front(f.edges, 10);
+	edge* a = f.add({30, 0, 0});
+	edge* b = f.add({10, 0, 0});
+	edge* c = f.add({20, 0, 0});
+	edge* d = f.add({10, 0, 0});
+	front.push(a);
+	front.prioritize_near(1);
+	front.push(b);
+	front.push(c);
+	front.push(d);
+	EXPECT_TRUE(front.is_prioritized());
+	EXPECT_EQ(front.size(), 4);
+
+	// equally close edges keep their order
+	EXPECT_EQ(f.edges.get(front.front()), b);
+	EXPECT_EQ(front.pop(), b);
+	EXPECT_EQ(front.pop(), d);
+
+	// moving the focus reorders what is left
+	front.focus({40, 0, 0}, 100);
+	EXPECT_EQ(front.pop(), a);
+	EXPECT_EQ(front.pop(), c);
+	EXPECT_EQ(front.pop(), nullptr);
+}
+
+TEST(edge_front, PopOrder) {
+	for (const bool prioritize : {false, true}) {
+		edge_front_fixture f;
+		edge_front front(f.edges, 10);
+		if (prioritize) {
+			front.prioritize_near(1);
+		}
+		for (int i = 0; i < 50; ++i) {
+			front.push(f.add({static_cast<double>(i * 37 % 20), 0, 0}));
+		}
+		std::vector<edge*> in_order;
+		front.for_each_in_pop_order([&f, &in_order](edge_handle handle) {
+			in_order.push_back(f.edges.get(handle));
+			return true;
+		});
+		std::vector<edge*> popped;
+		while (auto* e = front.pop()) {
+			popped.push_back(e);
+		}
+		EXPECT_EQ(in_order, popped);
+	}
+}
+
+TEST(edge_front, WakeFromManyCells) {
+	edge_front_fixture f;
+	edge_front front(f.edges, 1);
+	std::vector<edge*> parked;
+	for (int i = 0; i < 100; ++i) {
+		parked.push_back(f.add({i * 2., 0, 0}));
+		front.park(parked.back());
+	}
+	EXPECT_EQ(front.get_dormant_cell_count(), 100);
+
+	// fewer cells overlap the radius than there are dormant cells
+	front.focus({50, 0, 0}, 1.5);
+	EXPECT_EQ(front.get_dormant_count(), 99);
+	EXPECT_EQ(front.pop(), parked[25]);
+	EXPECT_EQ(front.pop(), nullptr);
+}
+
+TEST(edge_front, ReusesStorage) {
+	edge_front_fixture f;
+	edge_front front(f.edges, 10);
+	std::vector<edge*> edges;
+	for (int i = 0; i < 100; ++i) {
+		edges.push_back(f.add({i * 3., 0, 0}));
+	}
+
+	// popping and pushing keeps the order and the indexes from the front
+	front.push(edges[0]);
+	front.push(edges[1]);
+	EXPECT_EQ(front.pop(), edges[0]);
+	front.push(edges[2]);
+	EXPECT_EQ(front.size(), 2);
+	EXPECT_EQ(f.edges.get(front[0]), edges[1]);
+	EXPECT_EQ(f.edges.get(front[1]), edges[2]);
+	EXPECT_EQ(front.pop(), edges[1]);
+	EXPECT_EQ(front.pop(), edges[2]);
+
+	// parking, waking and popping the same number of edges again needs no more room
+	size_t bytes = 0;
+	for (int cycle = 0; cycle < 3; ++cycle) {
+		front.focus({-1000, 0, 0}, 1);
+		for (edge* e : edges) {
+			front.park(e);
+		}
+		EXPECT_EQ(front.get_dormant_cell_count(), 30);
+		front.focus({150, 0, 0}, 1000);
+		EXPECT_EQ(front.get_dormant_cell_count(), 0);
+		size_t popped = 0;
+		while (front.pop() != nullptr) {
+			++popped;
+		}
+		EXPECT_EQ(popped, edges.size());
+		if (cycle > 0) {
+			EXPECT_EQ(front.get_allocated_bytes(), bytes);
+		}
+		bytes = front.get_allocated_bytes();
+	}
+}
+}
@@ -35,7 +35,7 @@ TEST(surface_memory, Basic) {
     const edge* e = sm.push(a, b);
     EXPECT_EQ(e->get_other(a), b);
     EXPECT_EQ(e->get_other(b), a);
-    EXPECT_EQ(sm.get_front().front(), e);
+    EXPECT_EQ(sm.get_edge(sm.get_front().front()), e);
 }
 
 TEST(surface_memory, RemoveEdges) {
@@ -306,4 +306,109 @@ TEST(surface_memory, RemoveDragon) {
     EXPECT_EQ(sm.get_edge_count(), 2);
 }
 
-}
\ No newline at end of file
+TEST(surface_memory, DeleteRemovedKeepsLiveHandles) {
+    surface_memory sm(100);
+    node* a = sm.add_node(vec3d::zero, vec3d::Y);
+    node* b = sm.add_node(vec3(1, 0, 0), vec3d::Y);
+    node* c = sm.add_node(vec3(1, 0, 1), vec3d::Y);
+    node* d = sm.add_node(vec3(5, 0, 0), vec3d::Y);
+    node* e = sm.add_node(vec3(6, 0, 0), vec3d::Y);
+    sm.push(a, b);
+    sm.push(b, c);
+    edge* de = sm.push(d, e);
+    std::vector<edge_handle> front;
+    sm.get_front().for_each([&front](edge_handle handle) { front.push_back(handle); });
+
+    sm.collapse_node(b);
+    sm.delete_removed();
+    EXPECT_EQ(sm.get_node_count(), 2);
+    EXPECT_EQ(sm.get_edge_count(), 1);
+    EXPECT_EQ(sm.get_edge(front[0]), nullptr);
+    EXPECT_EQ(sm.get_edge(front[1]), nullptr);
+    EXPECT_EQ(sm.get_edge(front[2]), de);
+
+    // slots are recycled, handles to the deleted edges stay dead
+    node* f = sm.add_node(vec3(7, 0, 0), vec3d::Y);
+    edge* ef = sm.push(e, f);
+    EXPECT_EQ(sm.get_edge(front[0]), nullptr);
+    EXPECT_EQ(sm.get_edge(front[1]), nullptr);
+
+    EXPECT_EQ(sm.pop_edge(), de);
+    EXPECT_EQ(sm.pop_edge(), ef);
+    EXPECT_EQ(sm.pop_edge(), nullptr);
+    sm.validate();
+}
+
+TEST(surface_memory, AllocatedBytes) {
+    surface_memory sm(100);
+    const size_t empty = sm.get_allocated_bytes();
+    node* a = sm.add_node(vec3d::zero, vec3d::Y);
+    node* b = sm.add_node(vec3(1, 0, 0), vec3d::Y);
+    sm.push(a, b);
+    const size_t used = sm.get_allocated_bytes();
+    EXPECT_GT(used, empty);
+
+    // a node with many edges moves its adjacency to the heap
+    for (int i = 0; i < 8; ++i) {
+        sm.push(a, sm.add_node(vec3(i, 1, 0), vec3d::Y));
+    }
+    EXPECT_FALSE(a->edges.is_inline());
+    EXPECT_TRUE(b->edges.is_inline());
+    EXPECT_GE(sm.get_allocated_bytes(), used + a->edges.get_heap_bytes());
+}
+
+TEST(surface_memory, NodeCellSizes) {
+    surface_memory sm(100);
+    node* coarse = sm.add_node(vec3d::zero, vec3d::Y);
+    node* fine = sm.add_node(vec3(1, 0, 0), vec3d::Y, 1);
+    node* finer = sm.add_node(vec3(1.01, 0, 0), vec3d::Y, .1);
+    EXPECT_EQ(coarse->hash_level, 0);
+    EXPECT_EQ(fine->hash_level, -6);
+    EXPECT_EQ(finer->hash_level, -9);
+    EXPECT_EQ(sm.get_node_hash().get_level_count(), 3);
+    EXPECT_EQ(sm.get_nodes(vec3(1, 0, 0), .5).size(), 2);
+    EXPECT_EQ(sm.get_nodes(vec3d::zero, 2).size(), 3);
+
+    sm.collapse_node(fine);
+    EXPECT_EQ(sm.get_nodes(vec3(1, 0, 0), .5), std::vector<node*>{finer});
+    EXPECT_EQ(sm.get_node_hash().get_level_count(), 2);
+    sm.delete_removed();
+    testing::internal::CaptureStdout();
+    sm.validate();
+    EXPECT_EQ(testing::internal::GetCapturedStdout(), "");
+}
+
+TEST(surface_memory, CollapseFan) {
+    surface_memory sm(100);
+    node* hub = sm.add_node(vec3d::zero, vec3d::Y);
+    std::vector<node*> rim;
+    for (int i = 0; i < 12; ++i) {
+        const double a = i * 2 * 3.14159265 / 12;
+        rim.push_back(sm.add_node(vec3(std::cos(a), 0, std::sin(a)), vec3d::Y));
+        sm.push(hub, rim.back());
+    }
+    std::vector<edge*> rim_edges;
+    for (size_t i = 0; i < rim.size(); ++i) {
+        rim_edges.push_back(sm.push(rim[i], rim[(i + 1) % rim.size()]));
+    }
+    while (sm.pop_edge() != nullptr) {
+    }
+    for (auto* e : rim_edges) {
+        e->use();
+    }
+
+    // every rim edge closes a triangle with the hub and is back on the front once the hub is gone
+    sm.collapse_node(hub);
+    sm.delete_removed();
+    EXPECT_EQ(sm.get_node_count(), 12);
+    EXPECT_EQ(sm.get_edge_count(), 12);
+    for (auto* e : rim_edges) {
+        EXPECT_FALSE(e->is_used());
+    }
+    for (size_t i = 0; i < rim_edges.size(); ++i) {
+        EXPECT_NE(sm.pop_edge(), nullptr);
+    }
+    EXPECT_EQ(sm.pop_edge(), nullptr);
+    sm.validate();
+}
+}
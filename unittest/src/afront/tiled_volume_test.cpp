@@ -0,0 +1,102 @@
+#include "afront/tiled_volume.h"
+
+#include <gtest/gtest.h>
+
+#include "afront/advancing_front.h"
+#include "afront/counting_volume.h"
+#include "client/volume/csg.h"
+#include "core/util/conversion.h"
+#include "core/util/timer.h"
+#include "test_models.h"
+
+namespace playchilla {
+TEST(tiled_volume, SameValues) {
+	csg csg(12345);
+	const volume* planet = test::create_noisy_planet(csg, 100);
+	const tiled_volume tiled(planet, 4);
+	mx3::random r(123);
+	std::vector<vec3> positions;
+	for (int i = 0; i < 5000; ++i) {
+		positions.push_back(vec3d::create_random_dir(r) * r.between(45., 60.));
+	}
+	std::vector<double> values(positions.size());
+	tiled.get_values(positions, values);
+	for (size_t i = 0; i < positions.size(); ++i) {
+		EXPECT_EQ(util::bits_to<uint64_t>(values[i]), util::bits_to<uint64_t>(planet->get_value(positions[i]))) << positions[i];
+		EXPECT_EQ(util::bits_to<uint64_t>(tiled.get_value(positions[i])), util::bits_to<uint64_t>(values[i])) << positions[i];
+	}
+	EXPECT_EQ(tiled.get_tile_count(), tiled.get_specialize_count());
+	EXPECT_GT(tiled.get_specialize_count(), 100);
+}
+
+TEST(tiled_volume, KeepsRecentlyUsed) {
+	csg csg(12345);
+	const tiled_volume tiled(csg.sphere(10), 1, 4);
+	const auto tile_pos = [](int i) {
+		return vec3(i + .5, .5, .5);
+	};
+	for (int i = 0; i < 4; ++i) {
+		tiled.get_value(tile_pos(i));
+	}
+	EXPECT_EQ(tiled.get_tile_count(), 4);
+	EXPECT_EQ(tiled.get_specialize_count(), 4);
+
+	// Touch the first two so that the other two are dropped
+	tiled.get_value(tile_pos(0));
+	tiled.get_value(tile_pos(1));
+	tiled.get_value(tile_pos(4));
+	EXPECT_EQ(tiled.get_tile_count(), 3);
+	tiled.get_value(tile_pos(0));
+	tiled.get_value(tile_pos(1));
+	EXPECT_EQ(tiled.get_specialize_count(), 5);
+	tiled.get_value(tile_pos(2));
+	EXPECT_EQ(tiled.get_specialize_count(), 6);
+}
+
+TEST(tiled_volume, SameSurface) {
+	csg csg(12345);
+	const volume* planet = test::create_noisy_planet(csg, 100);
+	const auto build = [planet](bool tiled) {
+		advancing_front af(planet, nullptr, 1, 30);
+		if (tiled) {
+			af.use_tiles(8);
+		}
+		const vec3 generate_pos(50, 0, 0);
+		EXPECT_TRUE(af.try_find_surface(generate_pos));
+		const timer t;
+		af.build_full_surface(generate_pos);
+		const auto ms = t.millie_seconds();
+		af.get_surface_memory().validate();
+		std::cout << (tiled ? "tiled: " : "untiled: ") << ms << " ms\n";
+		return af.get_surface_memory().get_node_count();
+	};
+	EXPECT_EQ(build(true), build(false));
+}
+
+#ifndef DEVELOPMENT
+TEST(tiled_volume, Performance) {
+	// a row of overlapping noisy blobs, where each tile only needs the few blobs near it
+	csg csg(12345);
+	std::vector<const volume*> blobs;
+	for (int i = 0; i < 16; ++i) {
+		blobs.push_back(csg.add_values({csg.sphere(3).translate({4. * i, 0, 0}), csg.noise_seed(123 + i).mul_value(0.3)}));
+	}
+	const volume* row = csg.unions(blobs);
+	const auto build = [row](double tile_size) {
+		advancing_front af(row, nullptr, .4, 100);
+		if (tile_size > 0) {
+			af.use_tiles(tile_size);
+		}
+		EXPECT_TRUE(af.try_find_surface(vec3(0, 2, 0)));
+		const timer t;
+		af.build_full_surface(vec3(30, 0, 0));
+		const auto ms = t.millie_seconds();
+		std::cout << "tile size " << tile_size << ": " << ms << " ms\n";
+		return af.get_surface_memory().get_node_count();
+	};
+	const auto nodes = build(0);
+	EXPECT_EQ(build(4), nodes);
+	EXPECT_EQ(build(8), nodes);
+}
+#endif
+}
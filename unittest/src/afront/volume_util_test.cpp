@@ -2,8 +2,10 @@
 
 #include <gtest/gtest.h>
 
+#include "afront/counting_volume.h"
 #include "test_models.h"
 #include "core/util/timer.h"
+#include "core/util/worker_pool.h"
 
 namespace playchilla {
 struct surface_result {
@@ -173,6 +175,45 @@ TEST(volume_util, FindSurfaceTwoCubes) {
 	EXPECT_TRUE(sp->distance(-1, 0, 0) < 0.01);
 }
 
+// The evaluations per point of stepping as finely as the tolerance and of root finding from longer steps
+TEST(volume_util, FindSurfaceProjection) {
+	constexpr double tolerance = 0.01;
+	csg csg(12345);
+	const std::vector<std::tuple<std::string, const volume*, double>> shapes = {
+		{"cube", csg.cube({2, 2, 2}), 1},
+		{"two cubes", csg.unions({csg.cube({2, 2, 2}), csg.cube({2, 2, 2}).translate(vec3(-3, 0, 0))}), 1},
+		{"scaled sphere", csg.sphere(1).scale(2), 2},
+		{"noisy planet", test::create_noisy_planet(csg, 100), 50}};
+	for (const auto& [name, v, radius] : shapes) {
+		counting_volume counting(v);
+		mx3::random r(123);
+		uint64_t stepped_count = 0;
+		uint64_t projected_count = 0;
+		int points = 0;
+		for (int i = 0; i < 100; ++i) {
+			const vec3 pos = vec3d::create_random_dir(r) * r.between(.5 * radius, 1.5 * radius);
+			const auto before = counting.get_value_count();
+			const auto stepped = find_surface(&counting, pos, tolerance, radius);
+			const auto between = counting.get_value_count();
+			const auto projected = find_surface(&counting, pos, .25 * radius, radius, normal_method::central_difference, tolerance);
+			stepped_count += between - before;
+			projected_count += counting.get_value_count() - between;
+			if (stepped && projected) {
+				++points;
+				if (name != "noisy planet") {
+					// the same crossing, both past it by no more than the tolerance
+					EXPECT_LE(projected->distance(*stepped), tolerance * (1 + 1e-9)) << pos;
+					EXPECT_LE(std::abs(v->get_value(*projected)), tolerance) << pos;
+				}
+			}
+		}
+		ASSERT_GT(points, 0);
+		std::cout << name << ": " << static_cast<double>(stepped_count) / points << " evaluations per point stepping, "
+			<< static_cast<double>(projected_count) / points << " projecting\n";
+		EXPECT_LT(projected_count, stepped_count);
+	}
+}
+
 TEST(volume_util, FindSurfaceScaled) {
 	csg csg(12345);
 
@@ -214,4 +255,113 @@ TEST(volume_util, FindSurfaceScaled) {
 		//EXPECT_TRUE(Math.abs(vs) < Vec3.Epsilon);
 	}
 }
+
+TEST(volume_util, FindSurfaceComponents) {
+	csg csg(12345);
+	const volume* spheres = csg.unions({
+		csg.sphere(2).translate({10, 0, 0}),
+		csg.sphere(3).translate({-10, 5, 0}),
+		csg.sphere(1).translate({0, -10, 10}),
+		csg.sphere(2).translate({50, 0, 0})}).get();
+
+	const auto components = find_surface_components(spheres, aabb({0, 0, 0}, 20.), 1);
+	ASSERT_EQ(components.size(), 3);
+	for (const vec3& pos : components) {
+		EXPECT_NEAR(spheres->get_value(pos), 0, 1e-4) << pos;
+	}
+	// nearest first
+	EXPECT_NEAR(components[0].distance({10, 0, 0}), 2, 1e-4);
+	EXPECT_NEAR(components[1].distance({-10, 5, 0}), 3, 1e-4);
+
+	EXPECT_TRUE(find_surface_components(spheres, aabb({0, 30, 0}, 5.), 1).empty());
+	EXPECT_EQ(find_surface_components(test::create_sphere_tunnel(csg, 20), aabb({0, 0, 0}, 30.), 2).size(), 1);
+}
+
+TEST(volume_util, TraceSurface) {
+	constexpr double tolerance = 0.001;
+	csg csg(12345);
+	const volume* sphere = csg.sphere(2);
+	const volume* cubes = csg.unions({csg.cube({2, 2, 2}), csg.cube({.1, 2, 2}).translate(vec3(-3, 0, 0))});
+
+	auto hit = trace_surface(sphere, {{-5, 0, 0}, {1, 0, 0}, 10}, tolerance, 1);
+	ASSERT_TRUE(hit);
+	EXPECT_NEAR(hit->x, -2, tolerance);
+	EXPECT_GE(sphere->get_value(*hit), 0);
+
+	// the thin cube is found before the larger one
+	hit = trace_surface(cubes, {{-5, 0, 0}, {1, 0, 0}, 10}, tolerance, 1);
+	ASSERT_TRUE(hit);
+	EXPECT_NEAR(hit->x, -3.05, tolerance);
+
+	EXPECT_FALSE(trace_surface(sphere, {{-5, 3, 0}, {1, 0, 0}, 10}, tolerance, 1));
+	EXPECT_FALSE(trace_surface(sphere, {{-5, 0, 0}, {1, 0, 0}, 2.9}, tolerance, 1));
+	EXPECT_EQ(*trace_surface(sphere, {{1, 0, 0}, {1, 0, 0}, 10}, tolerance, 1), vec3(1, 0, 0));
+
+	EXPECT_TRUE(is_blocked(cubes, {-5, 0, 0}, {5, 0, 0}, .01));
+	EXPECT_FALSE(is_blocked(cubes, {-5, 3, 0}, {5, 3, 0}, .01));
+	EXPECT_FALSE(is_blocked(cubes, {-5, 0, 0}, {-3.1, 0, 0}, .01));
+}
+
+inline std::vector<ray> create_planet_rays(size_t count, double size) {
+	// from outside of the planet towards positions around its center, some of them miss it
+	mx3::random r(123);
+	std::vector<ray> rays;
+	for (size_t i = 0; i < count; ++i) {
+		const vec3 origin = vec3d::create_random_dir(r) * (2 * size);
+		const vec3 target = vec3d::create_random_dir(r) * r.between(0, 1.2 * size);
+		rays.push_back({origin, (target - origin).normalize(), origin.distance(target)});
+	}
+	return rays;
+}
+
+TEST(volume_util, TraceSurfacesBatched) {
+	constexpr double tolerance = 0.01;
+	csg csg(123);
+	const volume* planet = test::create_noisy_planet(csg, 100);
+	const auto rays = create_planet_rays(200, 100);
+	std::vector<std::optional<vec3>> hits(rays.size());
+	std::vector<std::optional<vec3>> worker_hits(rays.size());
+	worker_pool workers(2);
+	trace_surfaces(planet, rays, hits, tolerance, 1);
+	trace_surfaces(planet, rays, worker_hits, tolerance, 1, &workers);
+	int hit_count = 0;
+	for (size_t i = 0; i < rays.size(); ++i) {
+		const auto hit = trace_surface(planet, rays[i], tolerance, 1);
+		ASSERT_EQ(hits[i].has_value(), hit.has_value());
+		ASSERT_EQ(worker_hits[i].has_value(), hit.has_value());
+		if (hit) {
+			EXPECT_EQ(*hits[i], *hit);
+			EXPECT_EQ(*worker_hits[i], *hit);
+			EXPECT_GE(planet->get_value(*hit), 0);
+			++hit_count;
+		}
+	}
+	EXPECT_GT(hit_count, 0);
+	EXPECT_LT(hit_count, rays.size());
+}
+
+#ifndef DEVELOPMENT
+// Rays per second on the planet, traced by the Lipschitz bounds and marched at the tolerance as is_blocked used to
+TEST(volume_util, TraceSurfacesRate) {
+	constexpr double tolerance = 0.05;
+	csg csg(123);
+	const volume* planet = test::create_noisy_planet(csg, 100);
+	const auto rays = create_planet_rays(1000, 100);
+	std::vector<std::optional<vec3>> hits(rays.size());
+	const auto rate = [&rays](long long ms) { return static_cast<double>(rays.size()) * 1000. / static_cast<double>(std::max(ms, 1ll)); };
+
+	timer t;
+	trace_surfaces(planet, rays, hits, tolerance, 1);
+	const auto traced_ms = t.millie_seconds();
+	t.reset();
+	int same = 0;
+	for (size_t i = 0; i < rays.size(); ++i) {
+		const auto marched = find_surface(planet, rays[i].origin, rays[i].dir, true, tolerance, rays[i].length);
+		same += marched.has_value() == hits[i].has_value();
+	}
+	const auto marched_ms = t.millie_seconds();
+	std::cout << "traced: " << rate(traced_ms) << " rays/s, marched: " << rate(marched_ms) << " rays/s, " << same << " of " << rays.size() << " agree\n";
+	EXPECT_GT(same, .95 * static_cast<double>(rays.size()));
+}
+#endif
 }
@@ -0,0 +1,102 @@
+#include <gtest/gtest.h>
+
+#include "client/util/noise/noise.h"
+#include "core/util/conversion.h"
+#include "core/util/mx3.h"
+#include "core/util/timer.h"
+
+namespace playchilla {
+inline std::vector<vec3> random_noise_positions(size_t count, double extent) {
+	mx3::random r(123);
+	std::vector<vec3> positions;
+	for (size_t i = 0; i < count; ++i) {
+		positions.emplace_back(r.between(-extent, extent), r.between(-extent, extent), r.between(-extent, extent));
+	}
+	return positions;
+}
+
+inline void expect_same_noise(const gradient_noise& noise, const std::vector<vec3>& positions) {
+	std::vector<double> values(positions.size());
+	noise.get_values(positions, values);
+	for (size_t i = 0; i < positions.size(); ++i) {
+		const vec3& p = positions[i];
+		EXPECT_EQ(util::bits_to<uint64_t>(values[i]), util::bits_to<uint64_t>(noise.get_value(p.x, p.y, p.z))) << p;
+	}
+}
+
+TEST(noise, GetValuesSameAsGetValue) {
+	// a count that doesn't divide into groups of four, and cells far from the origin
+	for (const double extent : {1., 100., 1e6, 1e9}) {
+		expect_same_noise(gradient_noise(123), random_noise_positions(1001, extent));
+	}
+	expect_same_noise(gradient_noise(0), random_noise_positions(100, 10));
+	expect_same_noise(gradient_noise(~0ull), random_noise_positions(100, 10));
+}
+
+TEST(noise, GetValuesOutsideOfInt32Cells) {
+	expect_same_noise(gradient_noise(123), {{1e12, 0, 0}, {0, -1e12, 0}, {0, 0, 3e9}, {-0.5, 0.5, 0.25}, {2147483647.5, -2147483648.5, 1}});
+}
+
+TEST(noise, GetValuesIntegerCorners) {
+	expect_same_noise(gradient_noise(123), {{0, 0, 0}, {-1, -1, -1}, {1, 2, 3}, {-0., 0., -0.}, {-1e-300, 1e-300, 5}});
+}
+
+TEST(noise, GradientIsDerivative) {
+	const gradient_noise noise(123);
+	constexpr double h = 1e-6;
+	for (const auto& p : random_noise_positions(1000, 100)) {
+		vec3 gradient;
+		const double value = noise.get_value_and_gradient(p.x, p.y, p.z, gradient);
+		EXPECT_EQ(util::bits_to<uint64_t>(value), util::bits_to<uint64_t>(noise.get_value(p.x, p.y, p.z))) << p;
+		const vec3 expected = vec3(
+			noise.get_value(p.x + h, p.y, p.z) - noise.get_value(p.x - h, p.y, p.z),
+			noise.get_value(p.x, p.y + h, p.z) - noise.get_value(p.x, p.y - h, p.z),
+			noise.get_value(p.x, p.y, p.z + h) - noise.get_value(p.x, p.y, p.z - h)) * (.5 / h);
+		EXPECT_NEAR(gradient.x, expected.x, 1e-6) << p;
+		EXPECT_NEAR(gradient.y, expected.y, 1e-6) << p;
+		EXPECT_NEAR(gradient.z, expected.z, 1e-6) << p;
+	}
+}
+
+TEST(noise, IntervalContainsValues) {
+	const gradient_noise noise(123);
+	mx3::random r(123);
+	for (const double size : {0.01, 0.3, 1., 2.5, 10.}) {
+		for (const auto& center : random_noise_positions(50, 100)) {
+			const vec3 half(r.between(0., size), r.between(0., size), r.between(0., size));
+			const interval bounds = noise.get_interval(center - half, center + half);
+			EXPECT_LE(bounds.get_width(), gradient_noise::get_bounds().get_width());
+			for (int i = 0; i < 100; ++i) {
+				const vec3 p = center + vec3(r.between(-half.x, half.x), r.between(-half.y, half.y), r.between(-half.z, half.z));
+				EXPECT_TRUE(bounds.contains(noise.get_value(p.x, p.y, p.z))) << p << " " << bounds;
+			}
+		}
+	}
+	// small boxes are close to the value
+	EXPECT_LT(noise.get_interval({0.5, 0.5, 0.5}, {0.501, 0.501, 0.501}).get_width(), 0.01);
+}
+
+#ifndef DEVELOPMENT
+TEST(noise, Performance) {
+	const gradient_noise noise(123);
+	const auto positions = random_noise_positions(4'000'000, 100);
+	std::vector<double> values(positions.size());
+
+	const timer scalar_timer;
+	for (size_t i = 0; i < positions.size(); ++i) {
+		values[i] = noise.get_value(positions[i].x, positions[i].y, positions[i].z);
+	}
+	const auto scalar_ms = std::max<long long>(1, scalar_timer.millie_seconds());
+
+	const timer batch_timer;
+	noise.get_values(positions, values);
+	const auto batch_ms = std::max<long long>(1, batch_timer.millie_seconds());
+
+	const auto points_per_second = [&positions](long long ms) {
+		return static_cast<long long>(static_cast<double>(positions.size()) * 1000. / static_cast<double>(ms));
+	};
+	std::cout << "gradient noise get_value: " << points_per_second(scalar_ms) << " points/s, get_values" <<
+		(gradient_noise::has_simd() ? " (avx2): " : ": ") << points_per_second(batch_ms) << " points/s\n";
+}
+#endif
+}
@@ -0,0 +1,127 @@
+#include <gtest/gtest.h>
+
+#include "afront/counting_volume.h"
+#include "afront/test_models.h"
+#include "client/volume/csg.h"
+#include "core/util/timer.h"
+
+namespace playchilla {
+inline std::vector<vec3> compiled_test_positions(size_t count, double extent) {
+	mx3::random r(123);
+	std::vector<vec3> positions;
+	for (size_t i = 0; i < count; ++i) {
+		positions.emplace_back(r.between(-extent, extent), r.between(-extent, extent), r.between(-extent, extent));
+	}
+	return positions;
+}
+
+inline const volumes::compiled_volume* expect_same_compiled(csg& csg, const volume* source, double extent) {
+	const auto* compiled = dynamic_cast<const volumes::compiled_volume*>(csg.compile(source).get());
+	const auto positions = compiled_test_positions(1000, extent);
+	std::vector<double> values(positions.size());
+	compiled->get_values(positions, values);
+	std::vector<double> small_batches(positions.size());
+	for (size_t i = 0; i < positions.size(); i += 6) {
+		const size_t count = std::min<size_t>(6, positions.size() - i);
+		compiled->get_values(std::span(positions).subspan(i, count), std::span(small_batches).subspan(i, count));
+	}
+	for (size_t i = 0; i < positions.size(); ++i) {
+		const uint64_t expected = util::bits_to<uint64_t>(source->get_value(positions[i]));
+		EXPECT_EQ(util::bits_to<uint64_t>(static_cast<const volume*>(compiled)->get_value(positions[i])), expected) << positions[i];
+		EXPECT_EQ(util::bits_to<uint64_t>(values[i]), expected) << positions[i];
+		EXPECT_EQ(util::bits_to<uint64_t>(small_batches[i]), expected) << positions[i];
+	}
+	return compiled;
+}
+
+TEST(compiled_volume, Leafs) {
+	csg csg(12345);
+	EXPECT_EQ(expect_same_compiled(csg, csg.sphere(10), 20)->get_call_count(), 0);
+	EXPECT_EQ(expect_same_compiled(csg, csg.cube({3, 4, 5}), 5)->get_call_count(), 0);
+	EXPECT_EQ(expect_same_compiled(csg, csg.constant(3), 5)->get_call_count(), 0);
+	EXPECT_EQ(expect_same_compiled(csg, csg.noise(2.5), 10)->get_call_count(), 0);
+	EXPECT_EQ(expect_same_compiled(csg, csg.noise2d(10, 2), 20)->get_call_count(), 0);
+}
+
+TEST(compiled_volume, Modifiers) {
+	csg csg(12345);
+	const volume* sphere = csg.sphere(5);
+	const volume* noise = csg.noise(2);
+	expect_same_compiled(csg, csg.create<volumes::negate_value>(noise), 10);
+	expect_same_compiled(csg, csg.add_values({sphere, noise, csg.constant(0.5)}), 10);
+	expect_same_compiled(csg, csg(noise).mul_value(3), 10);
+	expect_same_compiled(csg, csg.create<volumes::mul_value>(std::vector{noise, sphere}), 10);
+	expect_same_compiled(csg, csg(noise).to_range(2, 4), 10);
+	expect_same_compiled(csg, csg(sphere).translate({1, 2, 3}), 10);
+	expect_same_compiled(csg, csg.create<volumes::inv_translate>(sphere, noise, csg.constant(1), noise), 10);
+	expect_same_compiled(csg, csg(sphere).scale(2.5), 10);
+	expect_same_compiled(csg, csg.create<volumes::inv_scale>(sphere, csg(noise).to_range(1, 2).get()), 10);
+	expect_same_compiled(csg, csg(noise).fbm(5), 10);
+	expect_same_compiled(csg, csg(noise).fbm(1), 10);
+	const auto* data = expect_same_compiled(csg, csg(sphere).data_type(3).adaptive_edge_len([](const vec3&) { return 1.; }), 10);
+	EXPECT_EQ(data->get_call_count(), 0);
+	EXPECT_EQ(data->get_instruction_count(), 1);
+}
+
+TEST(compiled_volume, Combiners) {
+	csg csg(12345);
+	const volume* sphere = csg.sphere(5);
+	const volume* cube = csg.cube({8, 2, 2});
+	const volume* noise = csg.noise(3);
+	expect_same_compiled(csg, csg.unions({sphere, cube, noise}), 10);
+	expect_same_compiled(csg, csg.differences(sphere, {cube, noise}), 10);
+	expect_same_compiled(csg, csg.select(sphere, cube, noise, select_greater(0, 0.3)), 10);
+	expect_same_compiled(csg, csg.select(sphere, cube, noise, [](double v) { return v < 0 ? 0. : 1.; }), 10);
+	EXPECT_EQ(expect_same_compiled(csg, test::create_noisy_planet(csg, 100), 60)->get_call_count(), 0);
+	EXPECT_EQ(expect_same_compiled(csg, test::create_sphere_tunnel(csg, 20), 25)->get_call_count(), 0);
+}
+
+TEST(compiled_volume, CallsUnknownVolumes) {
+	csg csg(12345);
+	counting_volume counting(csg.sphere(5));
+	const auto* compiled = expect_same_compiled(csg, csg.add_values({&counting, csg.noise(2)}), 10);
+	EXPECT_EQ(compiled->get_call_count(), 1);
+	EXPECT_GT(counting.get_value_count(), 0);
+}
+
+TEST(compiled_volume, ReusesRegisters) {
+	csg csg(12345);
+	const volume* sum = csg.sphere(5);
+	for (int i = 0; i < 100; ++i) {
+		sum = csg.add_values({sum, csg.noise(i + 1.)});
+	}
+	const auto* compiled = expect_same_compiled(csg, sum, 10);
+	EXPECT_LT(compiled->get_register_count(), 10);
+}
+
+TEST(compiled_volume, DataFromSource) {
+	csg csg(12345);
+	const volume* source = csg(csg.sphere(5)).adaptive_edge_len([](const vec3& pos) { return pos.x; });
+	volume_data data(0);
+	csg.compile(source).get()->get_data({2, 0, 0}, data);
+	EXPECT_EQ(data.edge_len, 2);
+}
+
+#ifndef DEVELOPMENT
+TEST(compiled_volume, Performance) {
+	csg csg(12345);
+	const volume* planet = test::create_noisy_planet(csg, 100);
+	const volume* compiled = csg.compile(planet);
+	const auto positions = compiled_test_positions(1'000'000, 60);
+	std::vector<double> values(positions.size());
+
+	for (const auto* v : {planet, compiled}) {
+		const timer scalar_timer;
+		for (size_t i = 0; i < positions.size(); ++i) {
+			values[i] = v->get_value(positions[i]);
+		}
+		const auto scalar_ms = scalar_timer.millie_seconds();
+
+		const timer batch_timer;
+		v->get_values(positions, values);
+		const auto batch_ms = batch_timer.millie_seconds();
+		std::cout << (v == planet ? "tree" : "compiled") << " noisy-planet get_value: " << scalar_ms << " ms, get_values: " << batch_ms << " ms\n";
+	}
+}
+#endif
+}
@@ -0,0 +1,126 @@
+#include <gtest/gtest.h>
+
+#include "afront/counting_volume.h"
+#include "afront/test_models.h"
+#include "client/volume/csg.h"
+#include "client/example_models.h"
+#include "core/util/timer.h"
+#include "generated/example_planet.h"
+#include "generated/test_noisy_planet.h"
+
+namespace playchilla {
+inline std::vector<vec3> codegen_test_positions(size_t count, double extent) {
+	mx3::random r(123);
+	std::vector<vec3> positions;
+	for (size_t i = 0; i < count; ++i) {
+		positions.emplace_back(r.between(-extent, extent), r.between(-extent, extent), r.between(-extent, extent));
+	}
+	return positions;
+}
+
+TEST(volume_codegen, GeneratedValuesSameAsTree) {
+	csg csg(12345);
+	const volume* planet = test::create_noisy_planet(csg, 100);
+	const volume* generated = csg.create<generated::test_noisy_planet>(planet);
+	const auto positions = codegen_test_positions(1000, 60);
+	std::vector<double> values(positions.size());
+	generated->get_values(positions, values);
+	for (size_t i = 0; i < positions.size(); ++i) {
+		const uint64_t expected = util::bits_to<uint64_t>(planet->get_value(positions[i]));
+		EXPECT_EQ(util::bits_to<uint64_t>(generated->get_value(positions[i])), expected) << positions[i];
+		EXPECT_EQ(util::bits_to<uint64_t>(values[i]), expected) << positions[i];
+	}
+}
+
+TEST(volume_codegen, GeneratedDataSameAsTree) {
+	// the same seed as the game, which the planet was generated with
+	csg csg(1234);
+	const volume* planet = create_planet(csg, 100);
+	const volume* generated = csg.create<generated::example_planet>(planet);
+	std::set<const material*> materials;
+	for (const auto& pos : codegen_test_positions(1000, 60)) {
+		volume_data expected(1);
+		volume_data data(1);
+		planet->get_data(pos, expected);
+		generated->get_data(pos, data);
+		const auto* expected_material = expected.get<game_volume_data>().mat;
+		EXPECT_EQ(data.get<game_volume_data>().mat, expected_material) << pos;
+		EXPECT_EQ(data.edge_len, expected.edge_len) << pos;
+		materials.insert(expected_material);
+	}
+	EXPECT_GT(materials.size(), 2);
+}
+
+TEST(volume_codegen, CallsUnknownVolumes) {
+	csg csg(12345);
+	counting_volume counting(csg.sphere(5));
+	const volume* source = csg.select(&counting, csg.noise(2), csg.noise(3), [](double v) { return v < 0 ? 0. : 1.; })
+		.adaptive_edge_len([](const vec3&) { return 2.; });
+	const auto externals = volumes::volume_codegen::get_externals(source);
+	ASSERT_EQ(externals.size(), 3);
+	EXPECT_EQ(externals[0], source);
+	EXPECT_EQ(externals[2], &counting);
+
+	const auto code = volumes::volume_codegen(source).generate("unknown");
+	EXPECT_NE(code.find("_set_data(0, pos, data);"), std::string::npos);
+	EXPECT_NE(code.find("_condition(1, "), std::string::npos);
+	EXPECT_NE(code.find("_call(2, x, y, z)"), std::string::npos);
+	EXPECT_NE(code.find("_call_values(2, std::span("), std::string::npos);
+	EXPECT_NE(code.find("_call_data(2, pos, data);"), std::string::npos);
+}
+
+TEST(volume_codegen, BatchesNoise) {
+	csg csg(12345);
+	const auto code = volumes::volume_codegen(test::create_noisy_planet(csg, 100)).generate("batched");
+	const auto values_begin = code.find("void get_values(");
+	const auto values_end = code.find("void get_data(");
+	ASSERT_NE(values_begin, std::string::npos);
+	const auto batch_noise = code.find(".get_values(std::span(", values_begin);
+	EXPECT_LT(batch_noise, values_end);
+	EXPECT_EQ(code.find(".get_value(", values_begin), code.find(".get_value(", values_end));
+}
+
+TEST(volume_codegen, NoDataCodeWithoutData) {
+	csg csg(12345);
+	const auto code = volumes::volume_codegen(test::create_sphere_tunnel(csg, 20)).generate("tunnel");
+	EXPECT_NE(code.find("void get_data(const vec3& pos, volume_data& data) const override {\n\t}"), std::string::npos);
+}
+
+TEST(volume_codegen, FingerprintFollowsTree) {
+	csg csg(12345);
+	const auto fingerprint = volumes::volume_codegen(test::create_noisy_planet(csg, 100)).get_fingerprint();
+	EXPECT_EQ(volumes::volume_codegen(test::create_noisy_planet(csg, 100)).get_fingerprint(), fingerprint);
+	EXPECT_NE(volumes::volume_codegen(test::create_noisy_planet(csg, 101)).get_fingerprint(), fingerprint);
+	EXPECT_NE(volumes::volume_codegen(csg.noise_seed(1)).get_fingerprint(), volumes::volume_codegen(csg.noise_seed(2)).get_fingerprint());
+}
+
+TEST(volume_codegen, RejectsOtherTree) {
+	csg csg(12345);
+	EXPECT_THROW(csg.create<generated::test_noisy_planet>(test::create_noisy_planet(csg, 101)), std::invalid_argument);
+}
+
+#ifndef DEVELOPMENT
+TEST(volume_codegen, Performance) {
+	csg csg(12345);
+	const volume* planet = test::create_noisy_planet(csg, 100);
+	const volume* compiled = csg.compile(planet);
+	const volume* generated = csg.create<generated::test_noisy_planet>(planet);
+	const auto positions = codegen_test_positions(1'000'000, 60);
+	std::vector<double> values(positions.size());
+
+	for (const auto& [name, v] : {std::pair{"tree", planet}, std::pair{"compiled", compiled}, std::pair{"generated", generated}}) {
+		const timer scalar_timer;
+		for (size_t i = 0; i < positions.size(); ++i) {
+			values[i] = v->get_value(positions[i]);
+		}
+		const auto scalar_ms = std::max<long long>(1, scalar_timer.millie_seconds());
+
+		const timer batch_timer;
+		v->get_values(positions, values);
+		const auto batch_ms = std::max<long long>(1, batch_timer.millie_seconds());
+		std::cout << name << " noisy-planet get_value: " << positions.size() * 1000 / scalar_ms << " points/s, get_values: " <<
+			positions.size() * 1000 / batch_ms << " points/s\n";
+	}
+}
+#endif
+}
@@ -0,0 +1,110 @@
+#include <gtest/gtest.h>
+
+#include "afront/counting_volume.h"
+#include "afront/test_models.h"
+#include "client/example_models.h"
+#include "client/volume/csg.h"
+
+namespace playchilla {
+inline std::vector<vec3> optimizer_test_positions(size_t count, double extent) {
+	mx3::random r(123);
+	std::vector<vec3> positions{{0, 0, 0}, {1, 0, 0}, {0, -2, 0}};
+	for (size_t i = 0; i < count; ++i) {
+		positions.emplace_back(r.between(-extent, extent), r.between(-extent, extent), r.between(-extent, extent));
+	}
+	return positions;
+}
+
+inline const volume* expect_same_optimized(csg& csg, const volume* source, double extent) {
+	const volume* optimized = csg.optimize(source);
+	const volume* compiled = csg.compile(optimized);
+	const auto positions = optimizer_test_positions(1000, extent);
+	std::vector<double> values(positions.size());
+	optimized->get_values(positions, values);
+	std::vector<double> compiled_values(positions.size());
+	compiled->get_values(positions, compiled_values);
+	for (size_t i = 0; i < positions.size(); ++i) {
+		const uint64_t expected = util::bits_to<uint64_t>(source->get_value(positions[i]));
+		EXPECT_EQ(util::bits_to<uint64_t>(optimized->get_value(positions[i])), expected) << positions[i];
+		EXPECT_EQ(util::bits_to<uint64_t>(values[i]), expected) << positions[i];
+		EXPECT_EQ(util::bits_to<uint64_t>(compiled_values[i]), expected) << positions[i];
+	}
+	EXPECT_LE(volumes::volume_optimizer::count_volumes(optimized), volumes::volume_optimizer::count_volumes(source));
+	return optimized;
+}
+
+TEST(volume_optimizer, SameValues) {
+	csg csg(12345);
+	const volume* sphere = csg.sphere(5);
+	const volume* noise = csg.noise(2);
+	expect_same_optimized(csg, csg.add_values({sphere, csg.constant(1), noise, csg.constant(-0.)}), 10);
+	expect_same_optimized(csg, csg.add_values({csg.constant(-0.), csg.add_values({noise, csg.constant(2)}), sphere}), 10);
+	expect_same_optimized(csg, csg.add_values({csg.constant(1), csg.constant(2)}), 10);
+	expect_same_optimized(csg, csg.create<volumes::mul_value>(std::vector<const volume*>{csg.constant(-1), noise, csg.constant(3), sphere}), 10);
+	expect_same_optimized(csg, csg(csg(noise).mul_value(2)).mul_value(0.5), 10);
+	expect_same_optimized(csg, csg.create<volumes::negate_value>(csg.create<volumes::negate_value>(noise).get()), 10);
+	expect_same_optimized(csg, csg.unions({csg.unions({sphere, noise}), csg.cube({8, 1, 1})}), 10);
+	expect_same_optimized(csg, csg.differences(csg.differences(sphere, {noise}), {csg.cube({8, 1, 1})}), 10);
+	expect_same_optimized(csg, csg(csg(sphere).translate({1, 2, 3})).scale(2.5), 10);
+	expect_same_optimized(csg, csg.create<volumes::inv_translate>(sphere, noise, csg.constant(1), noise), 10);
+	expect_same_optimized(csg, csg.create<volumes::inv_scale>(sphere, csg(noise).to_range(1, 2).get()), 10);
+	expect_same_optimized(csg, csg(csg(noise).fbm(4)).to_range(-1, 1), 10);
+	expect_same_optimized(csg, csg.select(sphere, csg.sphere(5), noise, select_greater(0, 0.3)), 10);
+	expect_same_optimized(csg, test::create_noisy_planet(csg, 100), 60);
+	expect_same_optimized(csg, test::create_sphere_tunnel(csg, 20), 25);
+	expect_same_optimized(csg, create_planet(csg, 100), 60);
+}
+
+TEST(volume_optimizer, SharesIdenticalTrees) {
+	csg csg(12345);
+	const auto create_blob = [&](double x) { return csg(csg.add_values({csg.sphere(3), csg.noise_seed(7, 2)})).translate({x, 0, 0}); };
+	const volume* source = csg.unions({create_blob(-2), create_blob(2)});
+	volumes::volume_optimizer optimizer(csg.get_registry());
+	const volume* optimized = optimizer.optimize(source);
+	EXPECT_GT(optimizer.get_stats().shared, 0);
+	EXPECT_EQ(volumes::volume_optimizer::count_volumes(source), 15);
+	EXPECT_EQ(volumes::volume_optimizer::count_volumes(optimized), 6);
+	EXPECT_EQ(optimizer.optimize(source), optimized);
+}
+
+TEST(volume_optimizer, FoldsAndMerges) {
+	csg csg(12345);
+	const volume* noise = csg.noise(2);
+	const volume* source = csg.add_values({csg.add_values({noise, csg.sphere(4)}), csg.cube({2, 2, 2}), csg.constant(2)});
+	volumes::volume_optimizer optimizer(csg.get_registry());
+	const volume* optimized = optimizer.optimize(source);
+	EXPECT_EQ(optimizer.get_stats().folded, 1);
+	EXPECT_EQ(optimizer.get_stats().merged, 1);
+	EXPECT_LT(volumes::volume_optimizer::count_volumes(optimized), volumes::volume_optimizer::count_volumes(source));
+}
+
+TEST(volume_optimizer, KeepsData) {
+	// the same seed as the game, which has materials in the data
+	csg csg(1234);
+	const volume* planet = create_planet(csg, 100);
+	const volume* optimized = csg.optimize(planet);
+	for (const auto& pos : optimizer_test_positions(1000, 60)) {
+		volume_data expected(1);
+		volume_data data(1);
+		planet->get_data(pos, expected);
+		optimized->get_data(pos, data);
+		EXPECT_EQ(data.get<game_volume_data>().mat, expected.get<game_volume_data>().mat) << pos;
+		EXPECT_EQ(data.edge_len, expected.edge_len) << pos;
+	}
+}
+
+TEST(volume_optimizer, CompiledEvaluatesSharedOnce) {
+	csg csg(12345);
+	counting_volume counting(csg.sphere(5));
+	const volume* source = csg.unions({csg.add_values({&counting, csg.noise(2)}), csg.add_values({&counting, csg.noise(3)})});
+	const auto positions = optimizer_test_positions(100, 10);
+	std::vector<double> values(positions.size());
+	const auto* compiled = dynamic_cast<const volumes::compiled_volume*>(csg.compile(source).get());
+	compiled->get_values(positions, values);
+	EXPECT_EQ(compiled->get_call_count(), 1);
+	EXPECT_EQ(counting.get_value_count(), positions.size());
+	for (size_t i = 0; i < positions.size(); ++i) {
+		EXPECT_EQ(util::bits_to<uint64_t>(values[i]), util::bits_to<uint64_t>(source->get_value(positions[i]))) << positions[i];
+	}
+}
+}
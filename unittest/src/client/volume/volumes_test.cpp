@@ -0,0 +1,421 @@
+#include <gtest/gtest.h>
+
+#include "afront/counting_volume.h"
+#include "afront/test_models.h"
+#include "client/volume/csg.h"
+#include "core/util/timer.h"
+
+namespace playchilla {
+inline std::vector<vec3> random_positions(size_t count, double extent) {
+	mx3::random r(123);
+	std::vector<vec3> positions;
+	for (size_t i = 0; i < count; ++i) {
+		positions.emplace_back(r.between(-extent, extent), r.between(-extent, extent), r.between(-extent, extent));
+	}
+	return positions;
+}
+
+inline aabb random_box(mx3::random& r, const vec3& center, double size) {
+	return {center, vec3(r.between(0., size), r.between(0., size), r.between(0., size))};
+}
+
+inline vec3 random_position(mx3::random& r, const aabb& box) {
+	return {r.between(box.x1(), box.x2()), r.between(box.y1(), box.y2()), r.between(box.z1(), box.z2())};
+}
+
+// A volume to check, with the extent of the positions around the origin to check it at
+struct volume_case {
+	const char* name;
+	const volume* v;
+	double extent;
+};
+
+inline std::vector<volume_case> get_leafs(csg& csg) {
+	return {
+		{"sphere", csg.sphere(10), 20},
+		{"cube", csg.cube({3, 4, 5}), 5},
+		{"constant", csg.constant(3), 5},
+		{"noise", csg.noise(2.5), 10},
+		{"noise2d", csg.noise2d(10, 2), 20},
+	};
+}
+
+inline std::vector<volume_case> get_modifiers(csg& csg) {
+	const volume* sphere = csg.sphere(5);
+	const volume* noise = csg.noise(2);
+	return {
+		{"negate", csg.create<volumes::negate_value>(noise), 10},
+		{"add", csg.add_values({sphere, noise, csg.constant(0.5)}), 10},
+		{"mul constant", csg(noise).mul_value(3), 10},
+		{"mul", csg.create<volumes::mul_value>(std::vector{noise, sphere}), 10},
+		{"to range", csg(noise).to_range(2, 4), 10},
+		{"translate", csg(sphere).translate({1, 2, 3}), 10},
+		{"inv translate", csg.create<volumes::inv_translate>(sphere, noise, csg.constant(1), noise), 10},
+		{"scale", csg(sphere).scale(2.5), 10},
+		{"inv scale", csg.create<volumes::inv_scale>(sphere, csg(noise).to_range(1, 2).get()), 10},
+		{"fbm", csg(noise).fbm(5), 10},
+		{"data", csg(sphere).data_type(3).adaptive_edge_len([](const vec3&) { return 1.; }), 10},
+	};
+}
+
+inline std::vector<volume_case> get_combiners(csg& csg) {
+	const volume* sphere = csg.sphere(5);
+	const volume* cube = csg.cube({8, 2, 2});
+	const volume* noise = csg.noise(3);
+	return {
+		{"union", csg.unions({sphere, cube, noise}), 10},
+		{"difference", csg.differences(sphere, {cube, noise}), 10},
+		{"select", csg.select(sphere, cube, noise, select_greater(0, 0.3)), 10},
+		{"select condition", csg.select(sphere, cube, noise, [](double v) { return std::clamp(v, 0., 1.); }), 10},
+		{"noisy planet", test::create_noisy_planet(csg, 100), 60},
+		{"sphere tunnel", test::create_sphere_tunnel(csg, 20), 25},
+		{"compiled noisy planet", csg.compile(test::create_noisy_planet(csg, 100)), 60},
+	};
+}
+
+// Checks each of the volumes with expect(v, extent), the failures name the volume
+template <typename ExpectT>
+void expect_each(const std::vector<volume_case>& cases, const ExpectT& expect) {
+	for (const auto& c : cases) {
+		SCOPED_TRACE(c.name);
+		expect(c.v, c.extent);
+	}
+}
+
+// The values of other are within the tolerance of the values of v and the edge lengths are the same. Without a tolerance
+// the values are bit-identical and so is the data, with one a branch of another source may win
+inline void expect_same_as(const volume* v, const volume* other, const vec3& p, double tolerance = 0) {
+	const double value = other->get_value(p);
+	if (tolerance > 0) {
+		EXPECT_LE(std::abs(value - v->get_value(p)), tolerance * (1 + 1e-9)) << p << " " << tolerance;
+	}
+	else {
+		EXPECT_EQ(util::bits_to<uint64_t>(value), util::bits_to<uint64_t>(v->get_value(p))) << p;
+	}
+	volume_data data(1), other_data(1);
+	v->get_data(p, data);
+	other->get_data(p, other_data);
+	EXPECT_EQ(other_data.edge_len, data.edge_len) << p;
+	if (tolerance > 0) {
+		return;
+	}
+	EXPECT_EQ(other_data.has_value(), data.has_value()) << p;
+	if (const int* type = data.get_if<int>()) {
+		EXPECT_EQ(other_data.get<int>(), *type) << p;
+	}
+}
+
+inline void expect_same_values(const volume* v, double extent) {
+	// more positions than fit in one batch, and a size that doesn't divide into batches
+	const auto positions = random_positions(1000, extent);
+	std::vector<double> values(positions.size());
+	v->get_values(positions, values);
+	for (size_t i = 0; i < positions.size(); ++i) {
+		EXPECT_EQ(util::bits_to<uint64_t>(values[i]), util::bits_to<uint64_t>(v->get_value(positions[i]))) << positions[i];
+	}
+}
+
+inline void expect_gradients(const volume* v, double extent) {
+	// central differences with a smaller step than the default, the positions rarely land on a kink
+	constexpr double h = 1e-6;
+	int mismatches = 0;
+	for (const auto& p : random_positions(200, extent)) {
+		vec3 gradient;
+		const double value = v->get_value_and_gradient(p, gradient);
+		EXPECT_EQ(value, v->get_value(p)) << p;
+		const vec3 expected = vec3(
+			v->get_value(p + vec3(h, 0, 0)) - v->get_value(p - vec3(h, 0, 0)),
+			v->get_value(p + vec3(0, h, 0)) - v->get_value(p - vec3(0, h, 0)),
+			v->get_value(p + vec3(0, 0, h)) - v->get_value(p - vec3(0, 0, h))) * (.5 / h);
+		if (gradient.distance(expected) > 1e-4 * std::max(1., expected.length())) {
+			++mismatches;
+		}
+	}
+	EXPECT_LE(mismatches, 2);
+}
+
+inline void expect_intervals(const volume* v, double extent) {
+	mx3::random r(321);
+	for (const double size : {0.1, 1., 10.}) {
+		for (const auto& center : random_positions(20, extent)) {
+			const aabb box = random_box(r, center, size);
+			const interval bounds = v->get_interval(box);
+			for (int i = 0; i < 50; ++i) {
+				const vec3 p = random_position(r, box);
+				EXPECT_TRUE(bounds.contains(v->get_value(p))) << p << " " << bounds;
+			}
+		}
+	}
+}
+
+// The values of pairs of positions in boxes are no further apart than the bound times their distance, returns the boxes
+// with a bound
+inline int expect_lipschitz(const volume* v, double extent) {
+	mx3::random r(321);
+	int bounded = 0;
+	for (const double size : {0.1, 1., 10.}) {
+		for (const auto& center : random_positions(20, extent)) {
+			const aabb box = random_box(r, center, size);
+			const double lipschitz = v->get_lipschitz(box);
+			if (std::isinf(lipschitz)) {
+				continue;
+			}
+			++bounded;
+			for (int i = 0; i < 50; ++i) {
+				const vec3 a = random_position(r, box);
+				const vec3 b = random_position(r, box);
+				EXPECT_LE(std::abs(v->get_value(a) - v->get_value(b)), lipschitz * a.distance(b) * (1 + 1e-9) + 1e-12) << a << " " << b;
+			}
+		}
+	}
+	return bounded;
+}
+
+inline void expect_value_and_data(const volume* v, double extent) {
+	for (const auto& p : random_positions(200, extent)) {
+		volume_data data(1);
+		const double value = v->get_value_and_data(p, data);
+		EXPECT_EQ(util::bits_to<uint64_t>(value), util::bits_to<uint64_t>(v->get_value(p))) << p;
+		volume_data expected(1);
+		v->get_data(p, expected);
+		EXPECT_EQ(data.edge_len, expected.edge_len) << p;
+		EXPECT_EQ(data.has_value(), expected.has_value()) << p;
+		if (const int* type = expected.get_if<int>()) {
+			EXPECT_EQ(data.get<int>(), *type) << p;
+		}
+	}
+}
+
+// Compares the specializations of the volume over random boxes to it, returns how many were pruned
+inline int expect_specialized(const volume* v, double extent, double size) {
+	mx3::random r(321);
+	int pruned = 0;
+	for (const auto& center : random_positions(50, extent)) {
+		const aabb box = random_box(r, center, size);
+		volume_unique_ptrs owned;
+		const volume* specialized = v->specialize(box, owned);
+		pruned += specialized != v;
+		for (int i = 0; i < 50; ++i) {
+			expect_same_as(v, specialized, random_position(r, box));
+		}
+	}
+	return pruned;
+}
+
+// Compares the approximations of the volume within a few tolerances to it, returns how many changed
+inline int expect_approximated(const volume* v, double extent) {
+	int approximated_count = 0;
+	const auto positions = random_positions(200, extent);
+	std::vector<double> values(positions.size());
+	for (const double tolerance : {0.001, 0.01, 0.1, 1., 10.}) {
+		volume_unique_ptrs owned;
+		const volume* approximated = v->approximate(tolerance, owned);
+		approximated_count += approximated != v;
+		approximated->get_values(positions, values);
+		for (size_t i = 0; i < positions.size(); ++i) {
+			EXPECT_EQ(values[i], approximated->get_value(positions[i])) << positions[i];
+			expect_same_as(v, approximated, positions[i], tolerance);
+		}
+	}
+	return approximated_count;
+}
+
+TEST(volumes, GetValues) {
+	csg csg(12345);
+	expect_each(get_leafs(csg), expect_same_values);
+	expect_each(get_modifiers(csg), expect_same_values);
+	expect_each(get_combiners(csg), expect_same_values);
+}
+
+TEST(volumes, Gradient) {
+	csg csg(12345);
+	expect_each(get_leafs(csg), expect_gradients);
+	expect_each(get_modifiers(csg), expect_gradients);
+	expect_each(get_combiners(csg), expect_gradients);
+}
+
+TEST(volumes, Interval) {
+	csg csg(12345);
+	expect_each(get_leafs(csg), expect_intervals);
+	expect_each(get_modifiers(csg), expect_intervals);
+	expect_each(get_combiners(csg), expect_intervals);
+
+	// the bounds are the values at the nearest and farthest points here
+	const interval sphere = csg.sphere(10).get()->get_interval(aabb::create_from_min_max({1, 2, 3}, {4, 5, 6}));
+	EXPECT_NEAR(sphere.lower, 10 - vec3(4, 5, 6).length(), 1e-12);
+	EXPECT_NEAR(sphere.upper, 10 - vec3(1, 2, 3).length(), 1e-12);
+	const interval cube = csg.cube({2, 2, 2}).get()->get_interval(aabb::create_from_min_max({-.5, -.5, -.5}, {2, .5, .5}));
+	EXPECT_NEAR(cube.lower, -1, 1e-12);
+	EXPECT_NEAR(cube.upper, 1, 1e-12);
+
+	// a select with its controller on one side within the box only bounds that source
+	const volume* sphere5 = csg.sphere(5);
+	const interval sphere_bounds = sphere5->get_interval(aabb({0, 0, 0}, 1.));
+	EXPECT_EQ(csg.select(sphere5, csg.noise(3), csg.constant(-1), select_greater(0, 0.3)).get()->get_interval(aabb({0, 0, 0}, 1.)).upper, sphere_bounds.upper);
+}
+
+TEST(volumes, Specialize) {
+	csg csg(12345);
+	const volume* sphere = csg.sphere(5).data_type(1).get();
+	const volume* cube = csg.cube({8, 2, 2}).data_type(2).get();
+	const volume* noise = csg.noise(3);
+	EXPECT_EQ(expect_specialized(sphere, 10, 2), 0);
+	EXPECT_GT(expect_specialized(csg.unions({sphere, cube}), 10, 2), 0);
+	EXPECT_GT(expect_specialized(csg.differences(sphere, {cube}), 10, 2), 0);
+	EXPECT_GT(expect_specialized(csg.select(sphere, cube, noise, select_greater(0, 0.3)), 10, 0.5), 0);
+	EXPECT_GT(expect_specialized(csg.unions({sphere, cube}).translate({1, 2, 3}).scale(2).fbm(2), 10, 1), 0);
+	EXPECT_GT(expect_specialized(test::create_noisy_planet(csg, 100), 60, 4), 0);
+	expect_specialized(test::create_sphere_tunnel(csg, 20), 25, 4);
+
+	// a select with its controller on one side within the box is its source there
+	const volume* one_sided = csg.select(sphere, noise, csg.constant(-1), select_greater(0, 0.3));
+	volume_unique_ptrs owned;
+	EXPECT_EQ(one_sided->specialize(aabb({0, 0, 0}, 1.), owned), sphere);
+	EXPECT_TRUE(owned.empty());
+}
+
+TEST(volumes, Approximate) {
+	csg csg(12345);
+	const volume* sphere = csg.sphere(5).data_type(1).get();
+	const volume* cube = csg.cube({8, 2, 2}).get();
+	const volume* noise = csg.noise(3);
+	const volume* octaves = csg(noise).fbm(8).get();
+	EXPECT_EQ(expect_approximated(sphere, 10), 0);
+	EXPECT_GT(expect_approximated(noise, 10), 0);
+	EXPECT_GT(expect_approximated(octaves, 10), 0);
+	EXPECT_GT(expect_approximated(csg.add_values({sphere, csg(octaves).mul_value(2)}), 10), 0);
+	EXPECT_GT(expect_approximated(csg.create<volumes::negate_value>(octaves).to_range(-2, 3), 10), 0);
+	EXPECT_GT(expect_approximated(csg.unions({sphere, cube, octaves}), 10), 0);
+	EXPECT_GT(expect_approximated(csg.differences(octaves, {sphere, cube}), 10), 0);
+	EXPECT_GT(expect_approximated(csg.select(sphere, octaves, noise, select_greater(0, 0.3)), 10), 0);
+	EXPECT_GT(expect_approximated(csg(octaves).translate({1, 2, 3}).scale(2).data_type(2), 10), 0);
+	EXPECT_GT(expect_approximated(csg.optimize(csg.add_values({csg(octaves).translate({1, 2, 3}).scale(2), csg.constant(1)})), 10), 0);
+	EXPECT_GT(expect_approximated(test::create_noisy_planet(csg, 100), 60), 0);
+	EXPECT_GT(expect_approximated(csg.compile(test::create_noisy_planet(csg, 100)), 60), 0);
+	expect_approximated(test::create_sphere_tunnel(csg, 20), 25);
+
+	// the octaves that can't change the value by more than the tolerance are left out, nothing is left out without one
+	volume_unique_ptrs owned;
+	EXPECT_EQ(octaves->approximate(0, owned), octaves);
+	const auto* fewer = dynamic_cast<const volumes::fbm*>(octaves->approximate(0.1, owned));
+	ASSERT_TRUE(fewer);
+	EXPECT_LT(fewer->get_octaves(), 8);
+	EXPECT_GT(fewer->get_octaves(), 1);
+	EXPECT_EQ(fewer->get_scale(), dynamic_cast<const volumes::fbm*>(octaves)->get_scale());
+}
+
+TEST(volumes, ValueAndData) {
+	csg csg(12345);
+	const volume* sphere = csg.sphere(5).data_type(1).get();
+	const volume* cube = csg.cube({8, 2, 2}).data_type(2).get();
+	const volume* noise = csg.noise(3);
+	expect_value_and_data(sphere, 10);
+	expect_value_and_data(csg.unions({sphere, cube}), 10);
+	expect_value_and_data(csg.differences(sphere, {cube}), 10);
+	expect_value_and_data(csg.select(sphere, cube, noise, select_greater(0, 0.3)), 10);
+	expect_value_and_data(csg.add_values({csg.unions({sphere, cube}).translate({1, 2, 3}).scale(2).fbm(2), noise}), 10);
+	expect_value_and_data(csg.optimize(csg.add_values({csg.unions({sphere, cube}).translate({1, 2, 3}), csg.constant(1)})), 10);
+	expect_each(get_modifiers(csg), expect_value_and_data);
+	expect_each(get_combiners(csg), expect_value_and_data);
+
+	// the data is the one of the largest source
+	volume_data data(1);
+	EXPECT_EQ(csg.unions({csg.sphere(1).data_type(3), cube}).get()->get_value_and_data({3, 0, 0}, data), 1);
+	EXPECT_EQ(data.get<int>(), 2);
+
+	// nested unions walk each source once for the data
+	counting_volume counting_sphere(sphere);
+	counting_volume counting_cube(cube);
+	csg.unions({csg.unions({&counting_sphere, &counting_cube}), csg.sphere(1)}).get()->get_data({1, 0, 0}, data);
+	EXPECT_EQ(counting_sphere.get_value_count(), 1);
+	EXPECT_EQ(counting_cube.get_value_count(), 1);
+	EXPECT_EQ(data.get<int>(), 1);
+}
+
+TEST(volumes, DataPayload) {
+	csg csg(12345);
+	volume_data data(1);
+	EXPECT_FALSE(data.has_value());
+	EXPECT_EQ(data.get_if<int>(), nullptr);
+	EXPECT_THROW(data.get<int>(), std::bad_cast);
+
+	const material m{};
+	csg.sphere(1).material(&m).data_type<game_volume_data>({}).get()->get_data({0, 0, 0}, data);
+	EXPECT_TRUE(data.has_value());
+	EXPECT_EQ(data.get_if<int>(), nullptr);
+	EXPECT_EQ(data.get<game_volume_data>().mat, &m);
+	EXPECT_THROW(data.get<int>(), std::bad_cast);
+
+	// copies keep the payload, a reset drops it
+	const volume_data copy = data;
+	EXPECT_EQ(copy.get_if<game_volume_data>()->mat, &m);
+	data = {2};
+	EXPECT_FALSE(data.has_value());
+	EXPECT_EQ(data.edge_len, 2);
+}
+
+TEST(volumes, Lipschitz) {
+	csg csg(12345);
+	const volume* sphere = csg.sphere(5);
+	const volume* cube = csg.cube({8, 2, 2});
+	const volume* noise = csg.noise(2);
+	EXPECT_EQ(expect_lipschitz(sphere, 10), 60);
+	EXPECT_EQ(expect_lipschitz(cube, 10), 60);
+	EXPECT_EQ(expect_lipschitz(noise, 10), 60);
+	EXPECT_GT(expect_lipschitz(csg.noise2d(10, 2), 20), 0);
+	EXPECT_EQ(expect_lipschitz(csg.create<volumes::negate_value>(noise), 10), 60);
+	EXPECT_EQ(expect_lipschitz(csg.add_values({sphere, noise, csg.constant(0.5)}), 10), 60);
+	EXPECT_EQ(expect_lipschitz(csg.create<volumes::mul_value>(std::vector{noise, sphere}), 10), 60);
+	EXPECT_EQ(expect_lipschitz(csg(noise).to_range(2, 4), 10), 60);
+	EXPECT_EQ(expect_lipschitz(csg(sphere).translate({1, 2, 3}).scale(2.5), 10), 60);
+	EXPECT_EQ(expect_lipschitz(csg.create<volumes::inv_translate>(sphere, noise, csg.constant(1), noise), 10), 60);
+	EXPECT_EQ(expect_lipschitz(csg.create<volumes::inv_scale>(sphere, csg(noise).to_range(1, 2).get()), 10), 60);
+	EXPECT_EQ(expect_lipschitz(csg(noise).fbm(5), 10), 60);
+	EXPECT_EQ(expect_lipschitz(csg.unions({sphere, cube, noise}), 10), 60);
+	EXPECT_EQ(expect_lipschitz(csg.differences(sphere, {cube, noise}), 10), 60);
+	EXPECT_EQ(expect_lipschitz(csg.select(sphere, cube, noise, select_greater(0, 0.3)), 10), 60);
+	EXPECT_EQ(expect_lipschitz(test::create_noisy_planet(csg, 100), 60), 60);
+	EXPECT_EQ(expect_lipschitz(csg.compile(test::create_noisy_planet(csg, 100)), 60), 60);
+	expect_lipschitz(test::create_sphere_tunnel(csg, 20), 25);
+
+	// selects with conditions other than ramps have no bound where they blend
+	EXPECT_EQ(expect_lipschitz(csg.select(sphere, cube, csg.constant(0.5), [](double v) { return v; }), 10), 0);
+}
+
+TEST(volumes, GetValuesEmpty) {
+	// an empty batch leaves the values around it as they are
+	const auto expect_untouched = [](const volume* v, double extent) {
+		const std::vector<vec3> positions(4, vec3(extent, 0, 0));
+		std::vector<double> values(4, -123.);
+		v->get_values(std::span(positions).first(0), std::span(values).first(0));
+		EXPECT_EQ(values, std::vector<double>(4, -123.));
+	};
+	csg csg(12345);
+	expect_each(get_leafs(csg), expect_untouched);
+	expect_each(get_modifiers(csg), expect_untouched);
+	expect_each(get_combiners(csg), expect_untouched);
+}
+
+#ifndef DEVELOPMENT
+TEST(volumes, GetValuesPerformance) {
+	csg csg(12345);
+	const volume* planet = test::create_noisy_planet(csg, 100);
+	const auto positions = random_positions(1'000'000, 60);
+	std::vector<double> values(positions.size());
+
+	const timer scalar_timer;
+	for (size_t i = 0; i < positions.size(); ++i) {
+		values[i] = planet->get_value(positions[i]);
+	}
+	const auto scalar_ms = scalar_timer.millie_seconds();
+
+	const timer batch_timer;
+	for (size_t i = 0; i < positions.size(); i += 6) {
+		const size_t count = std::min<size_t>(6, positions.size() - i);
+		planet->get_values(std::span(positions).subspan(i, count), std::span(values).subspan(i, count));
+	}
+	const auto batch_ms = batch_timer.millie_seconds();
+	std::cout << "noisy-planet get_value: " << scalar_ms << " ms, get_values in batches of 6: " << batch_ms << " ms\n";
+}
+#endif
+}
@@ -0,0 +1,37 @@
+#include <gtest/gtest.h>
+
+#include "core/math/interval.h"
+#include "core/util/mx3.h"
+
+namespace playchilla {
+TEST(interval, OperationsContainResults) {
+	mx3::random r(123);
+	for (int i = 0; i < 1000; ++i) {
+		const interval a(r.between(-5., 0.), r.between(0., 5.));
+		const interval b(r.between(-5., 5.), r.between(5., 10.));
+		const interval t(r.between(0., .5), r.between(.5, 1.));
+		const double x = r.between(a.lower, a.upper);
+		const double y = r.between(b.lower, b.upper);
+		const double s = r.between(t.lower, t.upper);
+		EXPECT_TRUE((a + b).contains(x + y));
+		EXPECT_TRUE((a - b).contains(x - y));
+		EXPECT_TRUE((a * b).contains(x * y));
+		EXPECT_TRUE((a * -2.).contains(x * -2.));
+		EXPECT_TRUE((-a).contains(-x));
+		EXPECT_TRUE(a.abs().contains(std::abs(x)));
+		EXPECT_TRUE(min(a, b).contains(std::min(x, y)));
+		EXPECT_TRUE(max(a, b).contains(std::max(x, y)));
+		EXPECT_TRUE(lerp(a, b, t).contains(x + s * (y - x)));
+	}
+}
+
+TEST(interval, Bounds) {
+	EXPECT_EQ((interval(-1, 2) * interval(-3, 4)).lower, -6);
+	EXPECT_EQ((interval(-1, 2) * interval(-3, 4)).upper, 8);
+	EXPECT_EQ(interval(-3, 2).abs().lower, 0);
+	EXPECT_EQ(interval(-3, 2).abs().upper, 3);
+	EXPECT_EQ(interval(-3, -2).abs().lower, 2);
+	EXPECT_TRUE(interval(1, 2).hull(interval(5)).contains(4));
+	EXPECT_FALSE(interval(1, 2).contains(0));
+}
+}
@@ -1,6 +1,9 @@
 #include <gtest/gtest.h>
 
 #include <algorithm>
+#include <atomic>
+#include <set>
+#include <thread>
 
 #include "core/math/aabb.h"
 #include "core/spatial/aabb_spatial_hash.h"
@@ -191,4 +194,107 @@ TEST(aabb_spatial_hash, RandomAabb) {
 
 	EXPECT_TRUE(verify());
 }
+
+TEST(aabb_spatial_hash, ConcurrentQueries) {
+	aabb_spatial_hash sh(5);
+	mx3::random r(123);
+	std::vector<std::unique_ptr<aabb_spatial_hash_value>> all;
+	for (int i = 0; i < 1000; ++i) {
+		all.emplace_back(std::make_unique<aabb_spatial_hash_value>(get_random_aabb(r)));
+		sh.add(all.back().get());
+	}
+	std::vector<aabb> queries;
+	std::vector<std::vector<aabb_spatial_hash_value*>> expected;
+	for (int i = 0; i < 200; ++i) {
+		queries.push_back(get_random_aabb(r));
+		expected.push_back(sh.get_values(queries.back()));
+	}
+
+	// the same results from threads that query at the same time
+	std::atomic<int> mismatches = 0;
+	std::vector<std::thread> threads;
+	for (int t = 0; t < 4; ++t) {
+		threads.emplace_back([&] {
+			for (int pass = 0; pass < 5; ++pass) {
+				for (size_t i = 0; i < queries.size(); ++i) {
+					mismatches += sh.get_values(queries[i]) != expected[i];
+				}
+			}
+		});
+	}
+	for (auto& t : threads) {
+		t.join();
+	}
+	EXPECT_EQ(mismatches, 0);
+}
+
+TEST(aabb_spatial_hash, ConcurrentReadersAndWriter) {
+	concurrent_aabb_spatial_hash sh(5);
+	mx3::random r(123);
+
+	// the fixed boxes never move so the readers know which to find, the writer moves, removes and adds the others
+	std::vector<std::unique_ptr<aabb_spatial_hash_value>> fixed;
+	std::vector<std::unique_ptr<aabb_spatial_hash_value>> moving;
+	for (int i = 0; i < 200; ++i) {
+		fixed.emplace_back(std::make_unique<aabb_spatial_hash_value>(get_random_aabb(r)));
+		moving.emplace_back(std::make_unique<aabb_spatial_hash_value>(get_random_aabb(r)));
+		sh.add(fixed.back().get());
+		sh.add(moving.back().get());
+	}
+	const std::set<const aabb_spatial_hash_value*> fixed_values = [&fixed] {
+		std::set<const aabb_spatial_hash_value*> values;
+		for (const auto& v : fixed) {
+			values.insert(v.get());
+		}
+		return values;
+	}();
+
+	std::atomic<bool> done = false;
+	std::atomic<int> errors = 0;
+	std::atomic<int> queries = 0;
+	std::vector<std::thread> readers;
+	for (int t = 0; t < 4; ++t) {
+		readers.emplace_back([&, t] {
+			mx3::random reader_random(t);
+			while (!done) {
+				const aabb bb = get_random_aabb(reader_random);
+				size_t expected_fixed = 0;
+				for (const auto& v : fixed) {
+					expected_fixed += v->overlaps(bb);
+				}
+				std::vector<const aabb_spatial_hash_value*> found;
+				sh.for_each_overlapping(bb, [&](const aabb_spatial_hash_value* v) {
+					errors += !v->overlaps(bb);
+					found.push_back(v);
+					return true;
+				});
+				std::ranges::sort(found);
+				errors += std::ranges::adjacent_find(found) != found.end();
+				errors += std::ranges::count_if(found, [&fixed_values](const aabb_spatial_hash_value* v) {
+					return fixed_values.contains(v);
+				}) != static_cast<std::ptrdiff_t>(expected_fixed);
+				++queries;
+			}
+		});
+	}
+
+	for (int i = 0; i < 2000; ++i) {
+		auto* v = moving[static_cast<size_t>(r.between(0, static_cast<double>(moving.size() - 1)))].get();
+		if (i % 10 == 0) {
+			sh.remove(v);
+			v->bb = get_random_aabb(r);
+			sh.add(v);
+		}
+		else {
+			sh.update(v, aabb(v->bb.get_center() + vec3d::create_random_dir(r).scale(5 * r.next_unit()), v->bb.get_size()));
+		}
+	}
+	done = true;
+	for (auto& t : readers) {
+		t.join();
+	}
+	EXPECT_EQ(errors, 0);
+	EXPECT_GT(queries, 0);
+	EXPECT_EQ(sh.get_values(aabb({400, 400, 400})).size(), fixed.size() + moving.size());
+}
 }
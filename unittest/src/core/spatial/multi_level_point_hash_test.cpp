@@ -0,0 +1,219 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+
+#include "core/spatial/multi_level_point_hash.h"
+#include "core/util/mx3.h"
+#include "core/util/timer.h"
+
+namespace playchilla {
+struct level_point {
+	vec3 pos;
+	int level = 0;
+};
+
+inline const vec3& get_pos(const level_point* p) {
+	return p->pos;
+}
+
+inline double get_spacing(const vec3& pos) {
+	return 0.01 * std::pow(100., (50 - pos.z) / 100);
+}
+
+/**
+ * Points on a sphere spaced from 0.01 near one pole to 1 near the other, with the level of cells 15 spacings wide.
+ */
+inline std::vector<level_point> create_graded_points(const multi_level_point_hash<level_point*>& hash, size_t count) {
+	constexpr double radius = 50;
+	mx3::random r(123);
+	std::vector<level_point> points(count);
+	for (auto& p : points) {
+		// dense where the points are fine, like a surface of edges of that length
+		const double theta = Pi * std::pow(r.next_unit(), 3);
+		const double phi = 2 * Pi * r.next_unit();
+		p.pos = vec3(std::cos(phi) * std::sin(theta), std::sin(phi) * std::sin(theta), std::cos(theta)) * radius;
+		p.level = hash.get_level(15 * get_spacing(p.pos));
+	}
+	return points;
+}
+
+TEST(multi_level_point_hash, Levels) {
+	const multi_level_point_hash<level_point*> hash(2);
+	EXPECT_EQ(hash.get_level(2), 0);
+	EXPECT_EQ(hash.get_level(1.9), 0);
+	EXPECT_EQ(hash.get_level(1), -1);
+	EXPECT_EQ(hash.get_level(0.9), -1);
+	EXPECT_EQ(hash.get_level(2.1), 1);
+	EXPECT_EQ(hash.get_level(16), 3);
+	EXPECT_EQ(hash.get_level(1e300), multi_level_point_hash<level_point*>::MaxLevel);
+	EXPECT_EQ(hash.get_level(0), multi_level_point_hash<level_point*>::MinLevel);
+}
+
+TEST(multi_level_point_hash, SameAsBruteForce) {
+	multi_level_point_hash<level_point*> hash(15);
+	auto points = create_graded_points(hash, 5000);
+	for (auto& p : points) {
+		hash.add(&p, p.level);
+	}
+	EXPECT_GT(hash.get_level_count(), 4);
+	EXPECT_EQ(hash.get_value_count(), points.size());
+
+	// remove every third
+	for (size_t i = 0; i < points.size(); i += 3) {
+		hash.remove(&points[i], points[i].level);
+	}
+	mx3::random r(321);
+	for (int i = 0; i < 200; ++i) {
+		const level_point& center = points[static_cast<size_t>(r.between(0, static_cast<double>(points.size() - 1)))];
+		const double radius = get_spacing(center.pos) * r.between(0.5, 5);
+		auto found = hash.get_values(center.pos, radius);
+		std::vector<level_point*> expected;
+		for (size_t j = 0; j < points.size(); ++j) {
+			if (j % 3 != 0 && points[j].pos.distance(center.pos) <= radius) {
+				expected.push_back(&points[j]);
+			}
+		}
+		std::ranges::sort(found);
+		EXPECT_EQ(found, expected);
+		EXPECT_EQ(hash.has_value(center.pos, radius), !expected.empty());
+	}
+
+	// a query larger than the whole set visits the cells in use
+	EXPECT_EQ(hash.get_values({0, 0, 0}, 1000).size(), hash.get_value_count());
+	for (size_t i = 0; i < points.size(); ++i) {
+		if (i % 3 != 0) {
+			hash.remove(&points[i], points[i].level);
+		}
+	}
+	EXPECT_EQ(hash.get_value_count(), 0);
+	EXPECT_EQ(hash.get_cell_count(), 0);
+	EXPECT_EQ(hash.get_level_count(), 0);
+}
+
+TEST(multi_level_point_hash, LargeQueries) {
+	multi_level_point_hash<level_point*> hash(15);
+	auto points = create_graded_points(hash, 5000);
+	for (auto& p : points) {
+		hash.add(&p, p.level);
+	}
+	// radii far larger than the coarse cells of the fine levels
+	mx3::random r(654);
+	for (int i = 0; i < 50; ++i) {
+		const vec3& center = points[static_cast<size_t>(r.between(0, static_cast<double>(points.size() - 1)))].pos;
+		const double radius = r.between(1, 40);
+		auto found = hash.get_values(center, radius);
+		std::vector<level_point*> expected;
+		for (auto& p : points) {
+			if (p.pos.distance(center) <= radius) {
+				expected.push_back(&p);
+			}
+		}
+		std::ranges::sort(found);
+		EXPECT_EQ(found, expected);
+	}
+}
+
+TEST(multi_level_point_hash, CoarseCellsOnDemand) {
+	multi_level_point_hash<level_point*> hash(15);
+	auto points = create_graded_points(hash, 2000);
+	const size_t half = points.size() / 2;
+	for (size_t i = 0; i < half; ++i) {
+		hash.add(&points[i], points[i].level);
+	}
+	const vec3 center = points[0].pos;
+	const size_t bytes = hash.get_allocated_bytes();
+	hash.get_values(center, 1e-3);
+	EXPECT_EQ(hash.get_allocated_bytes(), bytes);
+	hash.get_values(center, 40);
+	EXPECT_GT(hash.get_allocated_bytes(), bytes);
+
+	// the coarse cells follow the points added and removed after they are made
+	for (size_t i = half; i < points.size(); ++i) {
+		hash.add(&points[i], points[i].level);
+	}
+	for (size_t i = 0; i < points.size(); i += 2) {
+		hash.remove(&points[i], points[i].level);
+	}
+	auto found = hash.get_values(center, 40);
+	std::vector<level_point*> expected;
+	for (size_t i = 1; i < points.size(); i += 2) {
+		if (points[i].pos.distance(center) <= 40) {
+			expected.push_back(&points[i]);
+		}
+	}
+	std::ranges::sort(found);
+	EXPECT_EQ(found, expected);
+}
+
+TEST(multi_level_point_hash, NearestFirst) {
+	multi_level_point_hash<level_point*> levels(15);
+	point_spatial_hash3<level_point*> single(15);
+	auto points = create_graded_points(levels, 5000);
+	for (auto& p : points) {
+		levels.add(&p, p.level);
+		single.add(&p);
+	}
+	mx3::random r(456);
+	for (int i = 0; i < 100; ++i) {
+		const vec3& center = points[static_cast<size_t>(r.between(0, static_cast<double>(points.size() - 1)))].pos;
+		const double radius = get_spacing(center) * r.between(0.5, 5);
+		std::vector<double> expected;
+		for (const auto& p : points) {
+			if (p.pos.distance(center) <= radius) {
+				expected.push_back(p.pos.distance_sqr(center));
+			}
+		}
+		std::ranges::sort(expected);
+		const auto get_distances = [&center, radius](const auto& hash) {
+			std::vector<double> found;
+			EXPECT_TRUE(hash.for_each_nearest_within(center, radius, [&found, &center](const level_point* p) {
+				found.push_back(p->pos.distance_sqr(center));
+				return true;
+			}));
+			return found;
+		};
+		EXPECT_EQ(get_distances(levels), expected);
+		EXPECT_EQ(get_distances(single), expected);
+
+		// stops at the first that passes
+		const level_point* nearest = nullptr;
+		EXPECT_EQ(levels.for_each_nearest_within(center, radius, [&nearest](const level_point* p) {
+			nearest = p;
+			return false;
+		}), expected.empty());
+		EXPECT_EQ(nearest == nullptr, expected.empty());
+		if (nearest != nullptr) {
+			EXPECT_EQ(nearest->pos.distance_sqr(center), expected.front());
+		}
+	}
+}
+
+#ifndef DEVELOPMENT
+// Queries of the local spacing where it goes from 0.01 to 1, in one level of cells sized for the coarse part and by level
+TEST(multi_level_point_hash, GradedPerformance) {
+	multi_level_point_hash<level_point*> levels(15);
+	point_spatial_hash3<level_point*> single(15);
+	auto points = create_graded_points(levels, 200000);
+	for (auto& p : points) {
+		levels.add(&p, p.level);
+		single.add(&p);
+	}
+	const auto measure = [&points](const auto& hash, const char* name) {
+		const timer t;
+		size_t visited = 0;
+		size_t found = 0;
+		for (size_t i = 0; i < points.size(); i += 20) {
+			hash.for_each_value_within(points[i].pos, get_spacing(points[i].pos), [&found](const level_point*) {
+				++found;
+				return true;
+			});
+			++visited;
+		}
+		std::cout << name << ": " << t.millie_seconds() << " ms for " << visited << " queries\n";
+		return found;
+	};
+	const size_t found = measure(single, "single level");
+	EXPECT_EQ(measure(levels, "multi level"), found);
+}
+#endif
+}
@@ -1,10 +1,17 @@
 #include <algorithm>
+#include <map>
+#include <unordered_map>
 #include <gtest/gtest.h>
 
 #include "core/util/mx3.h"
-#include "core/spatial/spatial_hash.h"
+#include "core/util/timer.h"
+#include "core/spatial/point_spatial_hash.h"
 
 namespace playchilla {
+inline std::vector<int> get_values(const spatial_hash<int>& sh, const vec3& pos) {
+	const auto& values = sh.get_cell_values(pos);
+	return {values.begin(), values.end()};
+}
 
 TEST(spatial_hash, Empty) {
 	const spatial_hash<int> sh(10);
@@ -32,14 +39,14 @@ TEST(spatial_hash, Basic) {
 	EXPECT_EQ(sh.get_value_count(), 6);
 	EXPECT_EQ(sh.get_cell_count(), 4);
 
-	EXPECT_EQ(sh.get_cell_values(vec3(5,5,5)), (std::vector<int>{1, 2}));
-	EXPECT_EQ(sh.get_cell_values(vec3(-5,5,5)), (std::vector<int>{3, 4}));
+	EXPECT_EQ(get_values(sh, vec3(5,5,5)), (std::vector<int>{1, 2}));
+	EXPECT_EQ(get_values(sh, vec3(-5,5,5)), (std::vector<int>{3, 4}));
 
-	EXPECT_EQ(sh.get_cell_values(vec3(5,5,15)), (std::vector<int>{5}));
-	EXPECT_EQ(sh.get_cell_values(vec3(-15,5,5)), (std::vector<int>{6}));
+	EXPECT_EQ(get_values(sh, vec3(5,5,15)), (std::vector<int>{5}));
+	EXPECT_EQ(get_values(sh, vec3(-15,5,5)), (std::vector<int>{6}));
 
 	sh.remove_from_cell(1, vec3(3, 3, 3));
-	EXPECT_EQ(sh.get_cell_values(vec3(5,5,5)), (std::vector<int>{2}));
+	EXPECT_EQ(get_values(sh, vec3(5,5,5)), (std::vector<int>{2}));
 	EXPECT_EQ(sh.get_cell_count(), 4);
 
 	sh.remove_from_cell(5, vec3(3, 3, 13));
@@ -56,14 +63,14 @@ TEST_P(spatial_hash_edge_test, EdgeCase) {
 	sh.add_to_cell(-1, vec3(-s, 0, 0)); // goes into [-s,0)
 	sh.add_to_cell(0, vec3(0, 0, 0)); // goes into [0,s)
 	sh.add_to_cell(1, vec3(s, 0, 0)); // goes into [s,2s)
-	EXPECT_EQ(sh.get_cell_values({-s-Epsilon, 0, 0}), (std::vector<int>{}));
-	EXPECT_EQ(sh.get_cell_values({-s, 0, 0}), (std::vector<int>{-1}));
-	EXPECT_EQ(sh.get_cell_values({-Epsilon, 0, 0}), (std::vector<int>{-1}));
-	EXPECT_EQ(sh.get_cell_values({0, 0, 0}), (std::vector<int>{0}));
-	EXPECT_EQ(sh.get_cell_values({s-Epsilon, 0, 0}), (std::vector<int>{0}));
-	EXPECT_EQ(sh.get_cell_values({s, 0, 0}), (std::vector<int>{1}));
-	EXPECT_EQ(sh.get_cell_values({2*s-Epsilon, 0, 0}), (std::vector<int>{1}));
-	EXPECT_EQ(sh.get_cell_values({2*s, 0, 0}), (std::vector<int>{}));
+	EXPECT_EQ(get_values(sh, {-s-Epsilon, 0, 0}), (std::vector<int>{}));
+	EXPECT_EQ(get_values(sh, {-s, 0, 0}), (std::vector<int>{-1}));
+	EXPECT_EQ(get_values(sh, {-Epsilon, 0, 0}), (std::vector<int>{-1}));
+	EXPECT_EQ(get_values(sh, {0, 0, 0}), (std::vector<int>{0}));
+	EXPECT_EQ(get_values(sh, {s-Epsilon, 0, 0}), (std::vector<int>{0}));
+	EXPECT_EQ(get_values(sh, {s, 0, 0}), (std::vector<int>{1}));
+	EXPECT_EQ(get_values(sh, {2*s-Epsilon, 0, 0}), (std::vector<int>{1}));
+	EXPECT_EQ(get_values(sh, {2*s, 0, 0}), (std::vector<int>{}));
 }
 
 INSTANTIATE_TEST_SUITE_P(SpatialHashInstance, spatial_hash_edge_test, ::testing::Values(1, 2, 1e7));
@@ -87,4 +94,184 @@ TEST(spatial_hash, Stress) {
 	}
 }
 
+// Every cell in the same probe sequence, so removing cells has to move the ones after them back
+struct colliding_cell_hash {
+	static uint64_t hash(int64_t cx, int64_t, int64_t) {
+		return static_cast<uint64_t>(cx & 1);
+	}
+};
+
+template <typename HashT>
+void expect_same_as_map() {
+	spatial_hash<int, HashT, 2> sh(1);
+	std::map<std::tuple<int64_t, int64_t, int64_t>, std::vector<int>> expected;
+	mx3::random rnd(123);
+	for (int i = 0; i < 5000; ++i) {
+		const int64_t cx = static_cast<int64_t>(rnd() % 13) - 6;
+		const int64_t cy = static_cast<int64_t>(rnd() % 13) - 6;
+		const int64_t cz = static_cast<int64_t>(rnd() % 5) - 2;
+		auto& values = expected[{cx, cy, cz}];
+		if (!values.empty() && rnd.next_unit() < .45) {
+			const int v = values[rnd() % values.size()];
+			sh.remove_from_cell(v, cx, cy, cz);
+			std::erase(values, v);
+		}
+		else {
+			sh.add_to_cell(i, cx, cy, cz);
+			values.push_back(i);
+		}
+	}
+	std::erase_if(expected, [](const auto& e) { return e.second.empty(); });
+	EXPECT_EQ(sh.get_cell_count(), expected.size());
+	size_t value_count = 0;
+	for (const auto& [c, values] : expected) {
+		const auto& cell = sh.get_cell_values(std::get<0>(c), std::get<1>(c), std::get<2>(c));
+		EXPECT_EQ(std::vector<int>(cell.begin(), cell.end()), values);
+		value_count += values.size();
+	}
+	EXPECT_EQ(sh.get_value_count(), value_count);
+	size_t cells = 0;
+	sh.for_each_cell([&cells](const auto&) { ++cells; });
+	EXPECT_EQ(cells, expected.size());
+}
+
+TEST(spatial_hash, SameAsMap) {
+	expect_same_as_map<good_cell_hash>();
+	expect_same_as_map<fast_cell_hash>();
+	expect_same_as_map<colliding_cell_hash>();
+}
+
+struct churn_point {
+	vec3 pos;
+};
+
+inline const vec3& get_pos(const churn_point* p) {
+	return p->pos;
+}
+
+// The cells the hash used to keep, a vector per cell in a map keyed by the good hash
+class map_point_hash {
+public:
+	map_point_hash(double cell_size) : _inv_cell_size(1. / cell_size) {
+	}
+
+	void add(churn_point* p) {
+		_map[_hash(_to_cell(p->pos.x), _to_cell(p->pos.y), _to_cell(p->pos.z))].push_back(p);
+	}
+
+	void remove(churn_point* p) {
+		const auto it = _map.find(_hash(_to_cell(p->pos.x), _to_cell(p->pos.y), _to_cell(p->pos.z)));
+		it->second.erase(std::find(it->second.begin(), it->second.end(), p));
+		if (it->second.empty()) {
+			_map.erase(it);
+		}
+	}
+
+	template <typename CallbackT>
+	void for_each_value_within(const vec3& pos, double r, const CallbackT& callback) const {
+		for (int64_t cz = _to_cell(pos.z - r); cz <= _to_cell(pos.z + r); ++cz) {
+			for (int64_t cy = _to_cell(pos.y - r); cy <= _to_cell(pos.y + r); ++cy) {
+				for (int64_t cx = _to_cell(pos.x - r); cx <= _to_cell(pos.x + r); ++cx) {
+					const auto it = _map.find(_hash(cx, cy, cz));
+					if (it != _map.end()) {
+						for (const churn_point* p : it->second) {
+							if (pos.distance_sqr(p->pos) <= r * r && !callback(p)) {
+								return;
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+
+private:
+	int64_t _to_cell(double v) const {
+		return floor_to<int64_t>(v * _inv_cell_size);
+	}
+
+	static uint64_t _hash(int64_t cx, int64_t cy, int64_t cz) {
+		return hash_good(cx, cy, cz);
+	}
+
+	double _inv_cell_size;
+	std::unordered_map<uint64_t, std::vector<churn_point*>> _map;
+};
+
+/**
+ * The churn of the surface memory: points are added on a sphere around a center that moves along it, the neighbors of each
+ * new point are queried and the points that the center left behind are removed, the rest at the end. Returns the
+ * neighbors found.
+ */
+template <typename HashT>
+size_t run_churn(HashT& hash, std::vector<churn_point>& points) {
+	constexpr double radius = 100;
+	constexpr double keep_radius = 30;
+	constexpr double edge = 1;
+	mx3::random rnd(123);
+	std::vector<churn_point*> live;
+	size_t next = 0;
+	size_t found = 0;
+	for (int step = 0; step < 400; ++step) {
+		const double angle = step * .01;
+		const vec3 center(radius * std::cos(angle), radius * std::sin(angle), 0);
+		for (int i = 0; i < 100 && next < points.size(); ++i) {
+			const vec3 offset = vec3d::create_random_dir(rnd) * rnd.between(0, keep_radius);
+			churn_point* p = &points[next++];
+			p->pos = (center + offset).normalize() * radius;
+			hash.for_each_value_within(p->pos, 2 * edge, [&found](const churn_point*) {
+				++found;
+				return true;
+			});
+			hash.add(p);
+			live.push_back(p);
+		}
+		std::erase_if(live, [&hash, &center](churn_point* p) {
+			if (p->pos.distance_sqr(center) <= keep_radius * keep_radius) {
+				return false;
+			}
+			hash.remove(p);
+			return true;
+		});
+	}
+	for (churn_point* p : live) {
+		hash.remove(p);
+	}
+	return found;
+}
+
+TEST(spatial_hash, Churn) {
+	std::vector<churn_point> points(40000);
+	point_spatial_hash3<churn_point*, good_cell_hash> good(15);
+	point_spatial_hash3<churn_point*, fast_cell_hash> fast(15);
+	map_point_hash map(15);
+	const size_t found = run_churn(map, points);
+	EXPECT_GT(found, 0);
+	EXPECT_EQ(run_churn(good, points), found);
+	EXPECT_EQ(run_churn(fast, points), found);
+	EXPECT_EQ(good.get_value_count(), 0);
+	EXPECT_EQ(fast.get_cell_count(), 0);
+}
+
+#ifndef DEVELOPMENT
+// Inserts, removes and radius queries of the churn, the surface memory cells are 15 edges wide
+TEST(spatial_hash, ChurnPerformance) {
+	std::vector<churn_point> points(40000);
+	for (const double cell_size : {2., 15.}) {
+		const auto measure = [&](auto& hash, const char* name) {
+			const timer t;
+			for (int i = 0; i < 5; ++i) {
+				run_churn(hash, points);
+			}
+			std::cout << "cell size " << cell_size << ", " << name << ": " << t.millie_seconds() << " ms\n";
+		};
+		map_point_hash map(cell_size);
+		point_spatial_hash3<churn_point*, good_cell_hash> good(cell_size);
+		point_spatial_hash3<churn_point*, fast_cell_hash> fast(cell_size);
+		measure(map, "map of vectors");
+		measure(good, "flat, good hash");
+		measure(fast, "flat, fast hash");
+	}
+}
+#endif
 }
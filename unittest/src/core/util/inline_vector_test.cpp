@@ -0,0 +1,77 @@
+#include <gtest/gtest.h>
+
+#include "core/util/inline_vector.h"
+
+namespace playchilla {
+TEST(inline_vector, Empty) {
+	const inline_vector<int, 4> v;
+	EXPECT_TRUE(v.empty());
+	EXPECT_EQ(v.size(), 0);
+	EXPECT_TRUE(v.is_inline());
+	EXPECT_EQ(v.get_heap_bytes(), 0);
+	EXPECT_EQ(v.begin(), v.end());
+}
+
+TEST(inline_vector, Grow) {
+	inline_vector<int, 2> v;
+	v.push_back(1);
+	v.push_back(2);
+	EXPECT_TRUE(v.is_inline());
+	v.push_back(3);
+	EXPECT_FALSE(v.is_inline());
+	EXPECT_EQ(v.capacity(), 4);
+	EXPECT_EQ(v.get_heap_bytes(), 4 * sizeof(int));
+	EXPECT_EQ(v.size(), 3);
+	EXPECT_EQ(v[0], 1);
+	EXPECT_EQ(v[1], 2);
+	EXPECT_EQ(v[2], 3);
+	v.clear();
+	EXPECT_TRUE(v.empty());
+	EXPECT_EQ(v.capacity(), 4);
+}
+
+TEST(inline_vector, Erase) {
+	inline_vector<int, 4> v;
+	for (int i = 0; i < 4; ++i) {
+		v.push_back(i);
+	}
+	auto it = v.erase(v.begin() + 1);
+	EXPECT_EQ(*it, 2);
+	EXPECT_EQ(v.size(), 3);
+	EXPECT_EQ(v[0], 0);
+	EXPECT_EQ(v[1], 2);
+	EXPECT_EQ(v[2], 3);
+	it = v.erase(v.end() - 1);
+	EXPECT_EQ(it, v.end());
+	EXPECT_EQ(v.back(), 2);
+}
+
+TEST(inline_vector, CopyMove) {
+	inline_vector<int, 2> small;
+	small.push_back(1);
+	inline_vector<int, 2> large;
+	for (int i = 0; i < 5; ++i) {
+		large.push_back(i);
+	}
+
+	const auto small_copy = small;
+	const auto large_copy = large;
+	EXPECT_EQ(small_copy.size(), 1);
+	EXPECT_EQ(large_copy.size(), 5);
+	EXPECT_EQ(large_copy[4], 4);
+	EXPECT_NE(large_copy.data(), large.data());
+
+	const int* large_data = large.data();
+	const auto large_moved = std::move(large);
+	EXPECT_EQ(large_moved.data(), large_data);
+	EXPECT_EQ(large_moved.size(), 5);
+	EXPECT_TRUE(large.empty());
+	EXPECT_TRUE(large.is_inline());
+
+	small = large_moved;
+	EXPECT_EQ(small.size(), 5);
+	small = small_copy;
+	EXPECT_EQ(small.size(), 1);
+	EXPECT_EQ(small[0], 1);
+}
+}
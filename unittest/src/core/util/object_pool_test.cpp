@@ -0,0 +1,82 @@
+#include <gtest/gtest.h>
+
+#include "core/util/object_pool.h"
+
+namespace playchilla {
+struct pooled {
+	pooled(int value, int* destroyed) : value(value), destroyed(destroyed) {
+	}
+
+	~pooled() {
+		++*destroyed;
+	}
+
+	int value;
+	int* destroyed;
+};
+
+TEST(object_pool, Empty) {
+	const object_pool<pooled> pool;
+	EXPECT_EQ(pool.size(), 0);
+	EXPECT_EQ(pool.capacity(), 0);
+	EXPECT_EQ(pool.get({}), nullptr);
+	EXPECT_EQ(pool.get({10, 1}), nullptr);
+}
+
+TEST(object_pool, CreateDestroy) {
+	int destroyed = 0;
+	object_pool<pooled, 4> pool;
+	auto* a = pool.create(1, &destroyed);
+	auto* b = pool.create(2, &destroyed);
+	EXPECT_EQ(pool.size(), 2);
+	EXPECT_EQ(pool.capacity(), 4);
+	EXPECT_EQ(a->value, 1);
+	EXPECT_EQ(b->value, 2);
+
+	const auto ha = pool.get_handle(a);
+	const auto hb = pool.get_handle(b);
+	EXPECT_NE(ha, hb);
+	EXPECT_EQ(pool.get(ha), a);
+	EXPECT_EQ(pool.get(hb), b);
+
+	pool.destroy(a);
+	EXPECT_EQ(destroyed, 1);
+	EXPECT_EQ(pool.size(), 1);
+	EXPECT_FALSE(pool.is_alive(ha));
+	EXPECT_TRUE(pool.is_alive(hb));
+
+	// the slot is reused but the old handle stays dead
+	auto* c = pool.create(3, &destroyed);
+	EXPECT_EQ(c, a);
+	EXPECT_EQ(pool.get(ha), nullptr);
+	EXPECT_EQ(pool.get(pool.get_handle(c)), c);
+	EXPECT_EQ(pool.capacity(), 4);
+}
+
+TEST(object_pool, Grow) {
+	int destroyed = 0;
+	{
+		object_pool<pooled, 4> pool;
+		std::vector<pooled*> all;
+		for (int i = 0; i < 10; ++i) {
+			all.push_back(pool.create(i, &destroyed));
+		}
+		EXPECT_EQ(pool.size(), 10);
+		EXPECT_EQ(pool.capacity(), 12);
+		for (int i = 0; i < 10; ++i) {
+			EXPECT_EQ(all[i]->value, i);
+			EXPECT_EQ(pool.get(pool.get_handle(all[i])), all[i]);
+		}
+		for (int i = 0; i < 10; i += 2) {
+			pool.destroy(all[i]);
+		}
+		EXPECT_EQ(destroyed, 5);
+		for (int i = 0; i < 5; ++i) {
+			pool.create(i, &destroyed);
+		}
+		EXPECT_EQ(pool.capacity(), 12);
+	}
+	// the pool destroys what is left
+	EXPECT_EQ(destroyed, 15);
+}
+}
@@ -0,0 +1,13 @@
+#include "volume_models.h"
+#include "afront/test_models.h"
+
+namespace playchilla {
+const volume_models& get_volume_models() {
+	static const volume_models models{
+		{"test_sphere", [](csg& csg) { return csg.sphere(10).get(); }},
+		{"test_sphere_tunnel", [](csg& csg) { return test::create_sphere_tunnel(csg, 20); }},
+		{"test_noisy_planet", [](csg& csg) { return test::create_noisy_planet(csg, 100); }},
+	};
+	return models;
+}
+}